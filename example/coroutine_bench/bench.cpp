@@ -0,0 +1,85 @@
+﻿/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ucontext.h>
+
+#include "common/coroutine.h"
+#include "common/time_utility.h"
+
+// 对比协程切换开销:
+//   1. pebble协程库的resume/yield(编译时选择的上下文切换实现)
+//   2. 直接使用ucontext的swapcontext
+// 使用-DPEBBLE_USE_UCONTEXT编译pebble可以对比库本身在两种实现下的开销
+
+static const int32_t kSTACK_SIZE = 128 * 1024;
+
+static int64_t g_loop = 0;
+
+static void co_loop(struct pebble::schedule* S, void* ud) {
+    for (int64_t i = 0; i < g_loop; i++) {
+        pebble::coroutine_yield(S);
+    }
+}
+
+static ucontext_t g_main_ctx;
+static ucontext_t g_co_ctx;
+
+static void uc_loop() {
+    for (int64_t i = 0; i < g_loop; i++) {
+        swapcontext(&g_co_ctx, &g_main_ctx);
+    }
+}
+
+static void Report(const char* name, int64_t begin_us, int64_t end_us) {
+    // 每轮包含切入、切出两次切换
+    double cost_ns = (end_us - begin_us) * 1000.0 / (g_loop * 2);
+    printf("%-24s %ld switches, %.2f ns/switch\n", name, g_loop * 2, cost_ns);
+}
+
+int main(int argc, const char** argv) {
+    g_loop = (argc > 1) ? atol(argv[1]) : 10000000;
+
+    // pebble coroutine
+    struct pebble::schedule* S = pebble::coroutine_open(kSTACK_SIZE);
+    int64_t id = pebble::coroutine_new(S, co_loop, NULL);
+    int64_t begin = pebble::TimeUtility::GetCurrentUS();
+    while (pebble::coroutine_status(S, id) != COROUTINE_DEAD) {
+        pebble::coroutine_resume(S, id);
+    }
+    int64_t end = pebble::TimeUtility::GetCurrentUS();
+#ifdef PEBBLE_CO_ASM_CONTEXT
+    Report("pebble(asm context)", begin, end);
+#else
+    Report("pebble(ucontext)", begin, end);
+#endif
+    pebble::coroutine_close(S);
+
+    // raw ucontext
+    char* stack = new char[kSTACK_SIZE];
+    getcontext(&g_co_ctx);
+    g_co_ctx.uc_stack.ss_sp   = stack;
+    g_co_ctx.uc_stack.ss_size = kSTACK_SIZE;
+    g_co_ctx.uc_link          = &g_main_ctx;
+    makecontext(&g_co_ctx, uc_loop, 0);
+    begin = pebble::TimeUtility::GetCurrentUS();
+    for (int64_t i = 0; i <= g_loop; i++) {
+        swapcontext(&g_main_ctx, &g_co_ctx);
+    }
+    end = pebble::TimeUtility::GetCurrentUS();
+    Report("swapcontext", begin, end);
+    delete [] stack;
+
+    return 0;
+}
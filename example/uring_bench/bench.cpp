@@ -0,0 +1,192 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "common/time_utility.h"
+#include "framework/message.h"
+#include "framework/uring_driver.h"
+
+// 对比tcp://(libev)和uring://(io_uring)两种driver作为echo服务端的吞吐和CPU开销:
+//   服务端和客户端分别运行在独立的进程中，客户端固定使用tcp://，
+//   在每个连接上保持固定数量的在途消息，收到回包后立即发送下一个
+// 用法: ./bench [连接数] [每连接在途消息数] [消息长度] [测试秒数]
+
+static int32_t g_conn_num = 256;
+static int32_t g_depth = 16;
+static int32_t g_msg_len = 64;
+static int32_t g_seconds = 5;
+
+static volatile sig_atomic_t g_stop = 0;
+static int64_t g_msg_num = 0;
+static std::string g_msg;
+
+static void OnStop(int sig) {
+    g_stop = 1;
+}
+
+static int32_t OnEcho(const uint8_t* msg, uint32_t msg_len, pebble::MsgExternInfo* msg_info) {
+    g_msg_num++;
+    pebble::Message::Send(msg_info->_remote_handle, msg, msg_len);
+    return 0;
+}
+
+static int32_t OnReply(const uint8_t* msg, uint32_t msg_len, pebble::MsgExternInfo* msg_info) {
+    g_msg_num++;
+    pebble::Message::Send(msg_info->_self_handle,
+        reinterpret_cast<const uint8_t*>(g_msg.data()), g_msg.size());
+    return 0;
+}
+
+static void RaiseFdLimit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+static void RunServer(const std::string& url, int ready_fd) {
+    pebble::MessageCallbacks cbs;
+    cbs._on_message = OnEcho;
+    pebble::Message::Init(cbs);
+
+    int64_t handle = pebble::Message::Bind(url);
+    char result = handle >= 0 ? 1 : 0;
+    if (write(ready_fd, &result, 1) != 1) {
+        perror("write");
+    }
+    close(ready_fd);
+    if (handle < 0) {
+        fprintf(stderr, "bind %s failed %ld\n", url.c_str(), handle);
+        return;
+    }
+
+    const char* mode = "";
+    pebble::UringDriver* uring_driver =
+        dynamic_cast<pebble::UringDriver*>(pebble::Message::GetDriverByPrefix("uring").get());
+    if (url.compare(0, 5, "uring") == 0 && uring_driver != NULL) {
+        mode = uring_driver->IsUringEnabled() ? "(io_uring)" : "(fallback epoll)";
+    }
+
+    while (!g_stop) {
+        if (pebble::Message::Update() <= 0) {
+            usleep(100);
+        }
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double user_s = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0;
+    double sys_s  = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+    printf("  server %-6s%-17s msgs %ld, cpu user %.2fs sys %.2fs, %.3f us cpu/msg\n",
+        url.substr(0, url.find("://")).c_str(), mode, g_msg_num, user_s, sys_s,
+        g_msg_num > 0 ? (user_s + sys_s) * 1000000.0 / g_msg_num : 0.0);
+}
+
+static void RunClient(const std::string& url) {
+    pebble::MessageCallbacks cbs;
+    cbs._on_message = OnReply;
+    pebble::Message::Init(cbs);
+
+    for (int32_t i = 0; i < g_conn_num; i++) {
+        int64_t handle = pebble::Message::Connect(url);
+        if (handle < 0) {
+            fprintf(stderr, "connect %s failed %ld\n", url.c_str(), handle);
+            return;
+        }
+        for (int32_t j = 0; j < g_depth; j++) {
+            pebble::Message::Send(handle, reinterpret_cast<const uint8_t*>(g_msg.data()), g_msg.size());
+        }
+    }
+
+    // 预热1秒后开始统计
+    int64_t begin = pebble::TimeUtility::GetCurrentMS();
+    while (pebble::TimeUtility::GetCurrentMS() - begin < 1000) {
+        pebble::Message::Update();
+    }
+
+    g_msg_num = 0;
+    begin = pebble::TimeUtility::GetCurrentUS();
+    int64_t end = begin;
+    while (end - begin < g_seconds * 1000000LL) {
+        pebble::Message::Update();
+        end = pebble::TimeUtility::GetCurrentUS();
+    }
+    printf("  client tcp    %ld msgs in %.2fs, %.0f msgs/s\n",
+        g_msg_num, (end - begin) / 1000000.0, g_msg_num * 1000000.0 / (end - begin));
+}
+
+static void Bench(const char* prefix, uint16_t port) {
+    char url[64];
+    snprintf(url, sizeof(url), "%s://127.0.0.1:%u", prefix, port);
+    printf("%s\n", url);
+    fflush(stdout);
+
+    int ready[2];
+    if (pipe(ready) != 0) {
+        perror("pipe");
+        return;
+    }
+    pid_t server = fork();
+    if (0 == server) {
+        close(ready[0]);
+        signal(SIGTERM, OnStop);
+        RunServer(url, ready[1]);
+        fflush(stdout);
+        _exit(0);
+    }
+    close(ready[1]);
+    char result = 0;
+    if (read(ready[0], &result, 1) != 1) {
+        result = 0;
+    }
+    close(ready[0]);
+
+    if (result) {
+        snprintf(url, sizeof(url), "tcp://127.0.0.1:%u", port);
+        pid_t client = fork();
+        if (0 == client) {
+            RunClient(url);
+            fflush(stdout);
+            _exit(0);
+        }
+        waitpid(client, NULL, 0);
+    }
+
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+}
+
+int main(int argc, const char** argv) {
+    g_conn_num = (argc > 1) ? atoi(argv[1]) : g_conn_num;
+    g_depth    = (argc > 2) ? atoi(argv[2]) : g_depth;
+    g_msg_len  = (argc > 3) ? atoi(argv[3]) : g_msg_len;
+    g_seconds  = (argc > 4) ? atoi(argv[4]) : g_seconds;
+    g_msg.assign(g_msg_len, 'a');
+
+    RaiseFdLimit();
+    printf("%d connections, %d in-flight msgs/connection, %d bytes/msg, %d seconds\n",
+        g_conn_num, g_depth, g_msg_len, g_seconds);
+
+    Bench("tcp", 18901);
+    Bench("uring", 18902);
+
+    return 0;
+}
@@ -157,6 +157,8 @@ int32_t PebbleClient::Attach(Router* router, IProcessor* processor) {
 
     router->SetOnAddressChanged(cxx::bind(&PebbleClient::OnRouterAddressChanged, this,
         router, cxx::placeholders::_1, processor));
+    // 移除的handle在途请求完成、连接关闭后才detach，保证迟到的响应仍能交给processor
+    router->SetOnHandleClosed(cxx::bind(&PebbleClient::Detach, this, cxx::placeholders::_1));
     return 0;
 }
 
@@ -347,7 +349,7 @@ int32_t PebbleClient::InitStat() {
 
 int32_t PebbleClient::InitTimer() {
     if (!m_timer) {
-        m_timer = new SequenceTimer();
+        m_timer = new WheelTimer();
     }
 
     TimeoutCallback on_stat_timeout = cxx::bind(&PebbleClient::OnStatTimeout, this);
@@ -381,12 +383,16 @@ void PebbleClient::OnRouterAddressChanged(Router* router,
         return;
     }
 
-    // 采取简单策略，先把老的都detach，再attach新的
+    // 增量更新，只attach新增的handle；已删除的handle由router在其在途请求完成、连接关闭时
+    // 通过OnHandleClosed回调detach
+    cxx::unordered_map<int64_t, bool> old_handles;
     for (std::vector<int64_t>::iterator oit = it->second.begin(); oit != it->second.end(); ++oit) {
-        Detach(*oit);
+        old_handles[*oit] = true;
     }
     for (std::vector<int64_t>::const_iterator nit = handles.begin(); nit != handles.end(); ++nit) {
-        Attach(*nit, processor);
+        if (old_handles.find(*nit) == old_handles.end()) {
+            Attach(*nit, processor);
+        }
     }
     it->second = handles;
 }
@@ -31,8 +31,133 @@
 #include "common/log.h"
 #include "common/timer.h"
 
+#ifdef PEBBLE_CO_ASM_CONTEXT
+/*
+    co_context_swap(from, to): 保存当前callee-saved寄存器到当前栈，栈顶存入from->sp，
+        切换到to->sp并恢复寄存器，ret返回到to上次切出的位置
+    co_context_entry: 新协程首次切入时的入口，从寄存器取出入口函数及参数调用，入口函数不返回
+*/
+extern "C" {
+void co_context_swap(pebble::co_context* from, pebble::co_context* to);
+void co_context_entry();
+}
+
+#if defined(__x86_64__)
+// 栈布局(低->高): mxcsr/x87cw, r12, r13, r14, r15, rbx, rbp, ret
+__asm__(
+    ".text\n"
+    ".globl co_context_swap\n"
+    ".hidden co_context_swap\n"
+    ".type co_context_swap, @function\n"
+    "co_context_swap:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r15\n"
+    "    pushq %r14\n"
+    "    pushq %r13\n"
+    "    pushq %r12\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq (%rsi), %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r12\n"
+    "    popq %r13\n"
+    "    popq %r14\n"
+    "    popq %r15\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size co_context_swap, .-co_context_swap\n"
+    ".globl co_context_entry\n"
+    ".hidden co_context_entry\n"
+    ".type co_context_entry, @function\n"
+    "co_context_entry:\n"
+    "    movq %r12, %rdi\n"
+    "    callq *%r13\n"
+    "    ud2\n"
+    ".size co_context_entry, .-co_context_entry\n"
+);
+#elif defined(__aarch64__)
+// 栈布局(低->高): d8-d15, x19-x28, x29, x30
+__asm__(
+    ".text\n"
+    ".globl co_context_swap\n"
+    ".hidden co_context_swap\n"
+    ".type co_context_swap, %function\n"
+    "co_context_swap:\n"
+    "    sub sp, sp, #0xb0\n"
+    "    stp d8, d9, [sp, #0x00]\n"
+    "    stp d10, d11, [sp, #0x10]\n"
+    "    stp d12, d13, [sp, #0x20]\n"
+    "    stp d14, d15, [sp, #0x30]\n"
+    "    stp x19, x20, [sp, #0x40]\n"
+    "    stp x21, x22, [sp, #0x50]\n"
+    "    stp x23, x24, [sp, #0x60]\n"
+    "    stp x25, x26, [sp, #0x70]\n"
+    "    stp x27, x28, [sp, #0x80]\n"
+    "    stp x29, x30, [sp, #0x90]\n"
+    "    mov x9, sp\n"
+    "    str x9, [x0]\n"
+    "    ldr x9, [x1]\n"
+    "    mov sp, x9\n"
+    "    ldp d8, d9, [sp, #0x00]\n"
+    "    ldp d10, d11, [sp, #0x10]\n"
+    "    ldp d12, d13, [sp, #0x20]\n"
+    "    ldp d14, d15, [sp, #0x30]\n"
+    "    ldp x19, x20, [sp, #0x40]\n"
+    "    ldp x21, x22, [sp, #0x50]\n"
+    "    ldp x23, x24, [sp, #0x60]\n"
+    "    ldp x25, x26, [sp, #0x70]\n"
+    "    ldp x27, x28, [sp, #0x80]\n"
+    "    ldp x29, x30, [sp, #0x90]\n"
+    "    add sp, sp, #0xb0\n"
+    "    ret\n"
+    ".size co_context_swap, .-co_context_swap\n"
+    ".globl co_context_entry\n"
+    ".hidden co_context_entry\n"
+    ".type co_context_entry, %function\n"
+    "co_context_entry:\n"
+    "    mov x0, x19\n"
+    "    blr x20\n"
+    "    brk #0\n"
+    ".size co_context_entry, .-co_context_entry\n"
+);
+#endif
+#endif // PEBBLE_CO_ASM_CONTEXT
+
 namespace pebble {
 
+#ifdef PEBBLE_CO_ASM_CONTEXT
+/// @brief 在协程栈顶构造一个co_context_swap切出时的现场，首次切入时从co_context_entry开始执行func(arg)
+static void co_context_make(co_context* ctx, char* stack, uint32_t stack_size,
+    void (*func)(void*), void* arg) {
+    uintptr_t top = (reinterpret_cast<uintptr_t>(stack) + stack_size) & ~static_cast<uintptr_t>(15);
+#if defined(__x86_64__)
+    // ret进入co_context_entry后rsp需16字节对齐
+    uint64_t* sp = reinterpret_cast<uint64_t*>(top - 16);
+    *--sp = reinterpret_cast<uint64_t>(co_context_entry);   // ret
+    *--sp = 0;                                              // rbp
+    *--sp = 0;                                              // rbx
+    *--sp = 0;                                              // r15
+    *--sp = 0;                                              // r14
+    *--sp = reinterpret_cast<uint64_t>(func);               // r13
+    *--sp = reinterpret_cast<uint64_t>(arg);                // r12
+    *--sp = 0x037F00001F80ULL;                              // x87cw | mxcsr 默认值
+    ctx->sp = sp;
+#elif defined(__aarch64__)
+    uint64_t* sp = reinterpret_cast<uint64_t*>(top - 0xb0);
+    memset(sp, 0, 0xb0);
+    sp[8]  = reinterpret_cast<uint64_t>(arg);               // x19
+    sp[9]  = reinterpret_cast<uint64_t>(func);              // x20
+    sp[19] = reinterpret_cast<uint64_t>(co_context_entry);  // x30
+    ctx->sp = sp;
+#endif
+}
+#endif // PEBBLE_CO_ASM_CONTEXT
 
 struct coroutine *
 _co_new(struct schedule *S, cxx::function<void()>& std_func) {
@@ -157,9 +282,7 @@ int64_t coroutine_new(struct schedule *S, coroutine_func func, void *ud) {
     return id;
 }
 
-static void mainfunc(uint32_t low32, uint32_t hi32) {
-    uintptr_t ptr = (uintptr_t) low32 | ((uintptr_t) hi32 << 32);
-    struct schedule *S = (struct schedule *) ptr;
+static void mainfunc(struct schedule *S) {
     int64_t id = S->running;
     struct coroutine *C = S->co_hash_map[id];
     if (C->func != NULL) {
@@ -181,6 +304,30 @@ static void mainfunc(uint32_t low32, uint32_t hi32) {
     S->co_hash_map.erase(id);
     S->running = -1;
     PLOG_TRACE("coroutine %ld is deleted.", id);
+
+#ifdef PEBBLE_CO_ASM_CONTEXT
+    // 没有uc_link，直接切回主流程，不再返回
+    co_context_swap(&C->ctx, &S->main);
+#endif
+}
+
+#ifdef PEBBLE_CO_ASM_CONTEXT
+static void co_entry(void* arg) {
+    mainfunc(static_cast<struct schedule*>(arg));
+}
+#else
+static void co_entry(uint32_t low32, uint32_t hi32) {
+    uintptr_t ptr = (uintptr_t) low32 | ((uintptr_t) hi32 << 32);
+    mainfunc((struct schedule *) ptr);
+}
+#endif
+
+static inline void co_swap(coroutine_context_t* from, coroutine_context_t* to) {
+#ifdef PEBBLE_CO_ASM_CONTEXT
+    co_context_swap(from, to);
+#else
+    swapcontext(from, to);
+#endif
 }
 
 int32_t coroutine_resume(struct schedule * S, int64_t id, int32_t result) {
@@ -210,19 +357,23 @@ int32_t coroutine_resume(struct schedule * S, int64_t id, int32_t result) {
         case COROUTINE_READY: {
             PLOG_TRACE("coroutine %ld status is COROUTINE_READY, begin to execute...", id);
 
+            S->running = id;
+            C->status = COROUTINE_RUNNING;
+#ifdef PEBBLE_CO_ASM_CONTEXT
+            co_context_make(&C->ctx, C->stack, S->stack_size, co_entry, S);
+#else
             getcontext(&C->ctx);
             C->ctx.uc_stack.ss_sp = C->stack;
             C->ctx.uc_stack.ss_size = S->stack_size;
             C->ctx.uc_stack.ss_flags = 0;
             C->ctx.uc_link = &S->main;
-            S->running = id;
-            C->status = COROUTINE_RUNNING;
             uintptr_t ptr = (uintptr_t) S;
-            makecontext(&C->ctx, (void (*)(void)) mainfunc, 2,
+            makecontext(&C->ctx, (void (*)(void)) co_entry, 2,
             (uint32_t)ptr,  // NOLINT
             (uint32_t)(ptr>>32));  // NOLINT
+#endif
 
-            swapcontext(&S->main, &C->ctx);
+            co_swap(&S->main, &C->ctx);
 
             break;
         }
@@ -232,7 +383,7 @@ int32_t coroutine_resume(struct schedule * S, int64_t id, int32_t result) {
 
             S->running = id;
             C->status = COROUTINE_RUNNING;
-            swapcontext(&S->main, &C->ctx);
+            co_swap(&S->main, &C->ctx);
 
             break;
         }
@@ -268,7 +419,7 @@ int32_t coroutine_yield(struct schedule * S) {
     S->running = -1;
 
     PLOG_TRACE("coroutine %ld will be yield, swith to main loop...", id);
-    swapcontext(&C->ctx, &S->main);
+    co_swap(&C->ctx, &S->main);
 
     return C->result;
 }
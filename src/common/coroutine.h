@@ -65,11 +65,28 @@ public:
 
 typedef void (*coroutine_func)(struct schedule *, void *ud);
 
+/// @brief 协程上下文切换实现，编译时选择
+///     x86-64/aarch64默认使用汇编实现，只保存callee-saved寄存器和栈指针，
+///     避免swapcontext每次切换时的sigprocmask系统调用
+///     定义PEBBLE_USE_UCONTEXT(-DPEBBLE_USE_UCONTEXT)时强制使用ucontext
+#if !defined(PEBBLE_USE_UCONTEXT) && (defined(__x86_64__) || defined(__aarch64__))
+#define PEBBLE_CO_ASM_CONTEXT 1
+#endif
+
+#ifdef PEBBLE_CO_ASM_CONTEXT
+struct co_context {
+    void* sp;                   // 切出时的栈顶，寄存器保存在栈上
+};
+typedef co_context coroutine_context_t;
+#else
+typedef ucontext_t coroutine_context_t;
+#endif
+
 struct coroutine {
     coroutine_func func;
     cxx::function<void()> std_func;
     void *ud;
-    ucontext_t ctx;
+    coroutine_context_t ctx;
     struct schedule * sch;
     int status;
     bool enable_hook;
@@ -84,13 +101,13 @@ struct coroutine {
         enable_hook = false;
         stack = NULL;
         result = 0;
-        memset(&ctx, 0, sizeof(ucontext_t));
+        memset(&ctx, 0, sizeof(ctx));
     }
 };
 
 /// @brief struct schedule 协程调度器的数据结构
 struct schedule {
-    ucontext_t main;
+    coroutine_context_t main;
     int64_t nco;                // 下一个要创建的协程ID
     int64_t running;            // 当前正在运行的协程ID
     cxx::unordered_map<int64_t, coroutine*> co_hash_map;
@@ -259,7 +259,12 @@ NetIO::NetIO()
 
 NetIO::~NetIO()
 {
-    CloseAll();
+    if (NULL != m_sockets)
+    {
+        CloseAll();
+        delete [] m_sockets;
+        m_sockets = NULL;
+    }
 }
 
 int32_t NetIO::Init(Epoll* epoll)
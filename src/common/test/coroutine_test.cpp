@@ -0,0 +1,140 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <vector>
+
+#include "common/coroutine.h"
+#include "common/time_utility.h"
+#include "common/timer.h"
+#include "gtest/gtest.h"
+
+using namespace pebble;
+
+namespace {
+
+// 协程结束后任务对象由调度器释放，结果记录在任务外
+struct TaskResult {
+    TaskResult() : sum(0), ok(true), done(false), ret(0) {}
+    int64_t sum;
+    bool ok;
+    bool done;
+    int32_t ret;
+};
+
+// 每次挂起前后校验局部变量，覆盖切换时保存/恢复的寄存器(整数和浮点)
+class CountTask : public CoroutineTask {
+public:
+    CountTask() : m_rounds(0), m_result(NULL) {}
+
+    virtual void Run() {
+        int64_t a = 1;
+        int64_t b = 2;
+        double d = 0.5;
+        char stack_data[16 * 1024];
+        memset(stack_data, 'c', sizeof(stack_data));
+        for (int32_t i = 0; i < m_rounds; i++) {
+            int32_t result = Yield();
+            m_result->sum += result;
+            a += 1;
+            b += a;
+            d += 0.25;
+            if (a != i + 2 || d != 0.5 + 0.25 * (i + 1) || stack_data[i % sizeof(stack_data)] != 'c') {
+                m_result->ok = false;
+            }
+        }
+        m_result->ok = m_result->ok && (b == 2 + (m_rounds + 3) * m_rounds / 2);
+        m_result->done = true;
+    }
+
+    int32_t m_rounds;
+    TaskResult* m_result;
+};
+
+class SleepTask : public CoroutineTask {
+public:
+    SleepTask() : m_result(NULL) {}
+
+    virtual void Run() {
+        m_result->ret = Yield(20);
+        m_result->done = true;
+    }
+
+    TaskResult* m_result;
+};
+
+} // namespace
+
+TEST(CoroutineTest, InterleavedResumeKeepsState) {
+    CoroutineSchedule schedule;
+    ASSERT_EQ(0, schedule.Init());
+
+    const int32_t kTASK_NUM = 8;
+    const int32_t kROUNDS = 100;
+    std::vector<TaskResult> results(kTASK_NUM);
+    std::vector<int64_t> ids;
+    for (int32_t i = 0; i < kTASK_NUM; i++) {
+        CountTask* task = schedule.NewTask<CountTask>();
+        ASSERT_TRUE(task != NULL);
+        task->m_rounds = kROUNDS;
+        task->m_result = &results[i];
+        ids.push_back(task->Start());
+        ASSERT_EQ(COROUTINE_SUSPEND, schedule.Status(ids[i]));
+    }
+
+    // 协程交替恢复，Resume的参数作为Yield的返回值传入
+    for (int32_t r = 0; r < kROUNDS; r++) {
+        for (int32_t i = 0; i < kTASK_NUM; i++) {
+            ASSERT_EQ(0, schedule.Resume(ids[i], i + 1));
+        }
+    }
+
+    for (int32_t i = 0; i < kTASK_NUM; i++) {
+        EXPECT_TRUE(results[i].done);
+        EXPECT_TRUE(results[i].ok);
+        EXPECT_EQ(static_cast<int64_t>(i + 1) * kROUNDS, results[i].sum);
+        EXPECT_EQ(COROUTINE_DEAD, schedule.Status(ids[i]));
+    }
+    EXPECT_EQ(0, schedule.Size());
+    EXPECT_EQ(INVALID_CO_ID, schedule.CurrentTaskId());
+}
+
+TEST(CoroutineTest, ResumeErrors) {
+    CoroutineSchedule schedule;
+    ASSERT_EQ(0, schedule.Init());
+    EXPECT_EQ(kCO_COROUTINE_UNEXIST, schedule.Resume(12345));
+    EXPECT_EQ(kCO_NOT_IN_COROUTINE, schedule.Yield());
+}
+
+TEST(CoroutineTest, YieldTimeout) {
+    WheelTimer timer;
+    CoroutineSchedule schedule;
+    ASSERT_EQ(0, schedule.Init(&timer));
+
+    TaskResult result;
+    SleepTask* task = schedule.NewTask<SleepTask>();
+    ASSERT_TRUE(task != NULL);
+    task->m_result = &result;
+    task->Start();
+    EXPECT_FALSE(result.done);
+
+    int64_t end = TimeUtility::GetCurrentMS() + 200;
+    while (!result.done && TimeUtility::GetCurrentMS() < end) {
+        timer.Update();
+        usleep(1000);
+    }
+    EXPECT_TRUE(result.done);
+    EXPECT_EQ(kCO_TIMEOUT, result.ret);
+    EXPECT_EQ(0, timer.GetTimerNum());
+}
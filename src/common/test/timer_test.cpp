@@ -0,0 +1,163 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <vector>
+
+#include "common/time_utility.h"
+#include "common/timer.h"
+#include "gtest/gtest.h"
+
+using namespace pebble;
+
+namespace {
+
+struct Fired {
+    std::vector<uint64_t> datas;
+    std::vector<int64_t> delays;    // 相对启动时刻的实际超时时间(ms)
+    int32_t ret;
+};
+
+Fired g_fired;
+int64_t g_start_ms = 0;
+
+int32_t OnTimeout(void* context, uint64_t data) {
+    g_fired.datas.push_back(data);
+    g_fired.delays.push_back(TimeUtility::GetCurrentMS() - g_start_ms);
+    return g_fired.ret;
+}
+
+class WheelTimerTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        g_fired = Fired();
+        g_fired.ret = kTIMER_BE_REMOVED;
+        g_start_ms = TimeUtility::GetCurrentMS();
+    }
+
+    void UpdateFor(int64_t ms) {
+        int64_t end = TimeUtility::GetCurrentMS() + ms;
+        while (TimeUtility::GetCurrentMS() < end) {
+            m_timer.Update();
+            usleep(500);
+        }
+    }
+
+    WheelTimer m_timer;
+};
+
+} // namespace
+
+TEST_F(WheelTimerTest, InvalidParam) {
+    EXPECT_EQ(kTIMER_INVALID_PARAM, m_timer.StartTimer(0, OnTimeout, NULL, 0));
+    EXPECT_EQ(kTIMER_INVALID_PARAM, m_timer.StartTimer(10, NULL, NULL, 0));
+    EXPECT_EQ(kTIMER_INVALID_PARAM, m_timer.StartTimer(10, TimeoutCallback()));
+    EXPECT_EQ(kTIMER_UNEXISTED, m_timer.StopTimer(-1));
+    EXPECT_EQ(kTIMER_UNEXISTED, m_timer.ReStartTimer(12345));
+    EXPECT_EQ(-1, m_timer.GetNextExpireMS());
+}
+
+TEST_F(WheelTimerTest, CascadeFromUpperLevelsInOrder) {
+    // 10ms在第0层，300ms和700ms需要从第1层级联下放
+    ASSERT_GE(m_timer.StartTimer(700, OnTimeout, NULL, 700), 0);
+    ASSERT_GE(m_timer.StartTimer(10, OnTimeout, NULL, 10), 0);
+    ASSERT_GE(m_timer.StartTimer(300, OnTimeout, NULL, 300), 0);
+    EXPECT_EQ(3, m_timer.GetTimerNum());
+
+    UpdateFor(800);
+
+    ASSERT_EQ(3u, g_fired.datas.size());
+    for (size_t i = 0; i < g_fired.datas.size(); i++) {
+        // 不能提前超时，也不能因级联延迟太多
+        EXPECT_GE(g_fired.delays[i], static_cast<int64_t>(g_fired.datas[i]));
+        EXPECT_LT(g_fired.delays[i], static_cast<int64_t>(g_fired.datas[i]) + 50);
+    }
+    EXPECT_EQ(10u, g_fired.datas[0]);
+    EXPECT_EQ(300u, g_fired.datas[1]);
+    EXPECT_EQ(700u, g_fired.datas[2]);
+    EXPECT_EQ(0, m_timer.GetTimerNum());
+}
+
+TEST_F(WheelTimerTest, LongTimerDoesNotFireEarly) {
+    // 超出第1层范围的定时器放在更高层，级联时不能提前超时
+    int64_t id = m_timer.StartTimer(20000, OnTimeout, NULL, 1);
+    ASSERT_GE(id, 0);
+    UpdateFor(300);
+    EXPECT_TRUE(g_fired.datas.empty());
+
+    int64_t next = m_timer.GetNextExpireMS();
+    EXPECT_GE(next, 0);
+    EXPECT_LE(next, 256);
+
+    EXPECT_EQ(0, m_timer.StopTimer(id));
+    EXPECT_EQ(0, m_timer.GetTimerNum());
+}
+
+TEST_F(WheelTimerTest, StaleIdDoesNotHitReusedNode) {
+    int64_t old_id = m_timer.StartTimer(50, OnTimeout, NULL, 1);
+    ASSERT_GE(old_id, 0);
+    ASSERT_EQ(0, m_timer.StopTimer(old_id));
+
+    // 节点被复用，定时器ID的generation不同
+    int64_t new_id = m_timer.StartTimer(50, OnTimeout, NULL, 2);
+    ASSERT_GE(new_id, 0);
+    EXPECT_NE(old_id, new_id);
+    EXPECT_EQ(old_id & 0xFFFFFFFF, new_id & 0xFFFFFFFF);
+
+    EXPECT_EQ(kTIMER_UNEXISTED, m_timer.StopTimer(old_id));
+    EXPECT_EQ(kTIMER_UNEXISTED, m_timer.ReStartTimer(old_id));
+    EXPECT_EQ(1, m_timer.GetTimerNum());
+
+    UpdateFor(100);
+    ASSERT_EQ(1u, g_fired.datas.size());
+    EXPECT_EQ(2u, g_fired.datas[0]);
+}
+
+TEST_F(WheelTimerTest, CallbackReturnControlsRearm) {
+    // 返回>0时按返回值重新计时
+    g_fired.ret = 20;
+    int64_t id = m_timer.StartTimer(10, OnTimeout, NULL, 1);
+    ASSERT_GE(id, 0);
+    UpdateFor(100);
+    EXPECT_GE(g_fired.datas.size(), 3u);
+    EXPECT_LE(g_fired.datas.size(), 6u);
+    EXPECT_EQ(1, m_timer.GetTimerNum());
+
+    g_fired.ret = kTIMER_BE_REMOVED;
+    UpdateFor(50);
+    EXPECT_EQ(0, m_timer.GetTimerNum());
+    EXPECT_EQ(kTIMER_UNEXISTED, m_timer.StopTimer(id));
+}
+
+namespace {
+
+WheelTimer* g_self_timer = NULL;
+int64_t g_self_id = -1;
+
+int32_t StopSelf(int64_t timer_id) {
+    g_fired.datas.push_back(timer_id);
+    g_self_timer->StopTimer(g_self_id);
+    return kTIMER_BE_CONTINUED;
+}
+
+} // namespace
+
+TEST_F(WheelTimerTest, StopSelfInCallback) {
+    g_self_timer = &m_timer;
+    g_self_id = m_timer.StartTimer(10, StopSelf);
+    ASSERT_GE(g_self_id, 0);
+    UpdateFor(100);
+    ASSERT_EQ(1u, g_fired.datas.size());
+    EXPECT_EQ(0, m_timer.GetTimerNum());
+}
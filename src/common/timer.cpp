@@ -313,5 +313,288 @@ int32_t SequenceTimer::Update() {
     return num;
 }
 
+WheelTimer::WheelTimer() {
+    m_cur_ms          = TimeUtility::GetCurrentMS();
+    m_timer_num       = 0;
+    m_running         = NULL;
+    m_running_stopped = false;
+    m_last_error[0]   = 0;
+
+    for (int32_t i = 0; i < kROOT_SIZE; ++i) {
+        db_list_init(&m_root[i]);
+    }
+    for (int32_t l = 0; l < kLEVEL_NUM; ++l) {
+        for (int32_t i = 0; i < kLEVEL_SIZE; ++i) {
+            db_list_init(&m_levels[l][i]);
+        }
+    }
+}
+
+WheelTimer::~WheelTimer() {
+    for (std::vector<TimerNode*>::iterator it = m_node_blocks.begin(); it != m_node_blocks.end(); ++it) {
+        delete [] *it;
+    }
+}
+
+int64_t WheelTimer::StartTimer(uint32_t timeout_ms, const TimeoutCallback& cb) {
+    if (!cb || 0 == timeout_ms) {
+        _LOG_LAST_ERROR("param is invalid: timeout_ms = %u, cb = %d", timeout_ms, (cb ? true : false));
+        return kTIMER_INVALID_PARAM;
+    }
+
+    TimerNode* node  = AllocNode();
+    node->timeout_ms = timeout_ms;
+    node->expire     = TimeUtility::GetCurrentMS() + timeout_ms;
+    node->cb         = cb;
+    AddNode(node);
+
+    return node->id;
+}
+
+int64_t WheelTimer::StartTimer(uint32_t timeout_ms, TimeoutHandler handler, void* context, uint64_t data) {
+    if (NULL == handler || 0 == timeout_ms) {
+        _LOG_LAST_ERROR("param is invalid: timeout_ms = %u, handler = %p", timeout_ms, handler);
+        return kTIMER_INVALID_PARAM;
+    }
+
+    TimerNode* node  = AllocNode();
+    node->timeout_ms = timeout_ms;
+    node->expire     = TimeUtility::GetCurrentMS() + timeout_ms;
+    node->handler    = handler;
+    node->context    = context;
+    node->data       = data;
+    AddNode(node);
+
+    return node->id;
+}
+
+int32_t WheelTimer::StopTimer(int64_t timer_id) {
+    TimerNode* node = GetNode(timer_id);
+    if (NULL == node) {
+        _LOG_LAST_ERROR("timer id %ld not exist", timer_id);
+        return kTIMER_UNEXISTED;
+    }
+
+    // 回调中stop自身，回调返回后再删除
+    if (node == m_running) {
+        m_running_stopped = true;
+        return 0;
+    }
+
+    db_list_del(&node->list_item);
+    FreeNode(node);
+
+    return 0;
+}
+
+int32_t WheelTimer::ReStartTimer(int64_t timer_id) {
+    TimerNode* node = GetNode(timer_id);
+    if (NULL == node) {
+        _LOG_LAST_ERROR("timer id %ld not exist", timer_id);
+        return kTIMER_UNEXISTED;
+    }
+
+    // 回调中restart自身，以回调返回值为准
+    if (node == m_running) {
+        return 0;
+    }
+
+    db_list_del(&node->list_item);
+    node->expire = TimeUtility::GetCurrentMS() + node->timeout_ms;
+    AddNode(node);
+
+    return 0;
+}
+
+int32_t WheelTimer::Update() {
+    int32_t num = 0;
+    int64_t now = TimeUtility::GetCurrentMS();
+    int32_t ret = 0;
+
+    while (m_cur_ms <= now) {
+        // 没有定时器时直接跳到当前时刻
+        if (0 == m_timer_num) {
+            m_cur_ms = now + 1;
+            break;
+        }
+
+        int32_t index = m_cur_ms & kROOT_MASK;
+        if (0 == index) {
+            Cascade();
+        }
+
+        // 先把到期的槽摘下来，回调中新加的定时器不会进入本轮
+        DbListItem expired;
+        db_list_init(&expired);
+        DbListItem* head = &m_root[index];
+        if (head->_next != head) {
+            expired._next = head->_next;
+            expired._prev = head->_prev;
+            expired._next->_prev = &expired;
+            expired._prev->_next = &expired;
+            db_list_init(head);
+        }
+        ++m_cur_ms;
+
+        while (expired._next != &expired) {
+            DbListItem* item = expired._next;
+            db_list_del(item);
+            TimerNode* node = container(TimerNode, list_item, item);
+            assert(node);
+
+            m_running         = node;
+            m_running_stopped = false;
+            ret = node->handler ? node->handler(node->context, node->data) : node->cb(node->id);
+            m_running         = NULL;
+            num++;
+
+            // 返回 <0 删除定时器，=0 继续，>0按新的超时时间重启定时器
+            if (ret < 0 || m_running_stopped) {
+                FreeNode(node);
+            } else {
+                if (ret > 0) {
+                    node->timeout_ms = ret;
+                }
+                node->expire = now + node->timeout_ms;
+                AddNode(node);
+            }
+        }
+    }
+
+    return num;
+}
+
+int64_t WheelTimer::GetNextExpireMS() {
+    if (0 == m_timer_num) {
+        return -1;
+    }
+
+    bool levels_empty = true;
+    for (int32_t l = 0; l < kLEVEL_NUM && levels_empty; ++l) {
+        for (int32_t i = 0; i < kLEVEL_SIZE; ++i) {
+            if (m_levels[l][i]._next != &m_levels[l][i]) {
+                levels_empty = false;
+                break;
+            }
+        }
+    }
+
+    // 第0层覆盖[m_cur_ms, m_cur_ms + 256)，上层的定时器最早在下一个级联时刻下放到第0层
+    int64_t next = m_cur_ms + kROOT_SIZE;
+    for (int32_t i = 0; i < kROOT_SIZE; ++i) {
+        int64_t ms = m_cur_ms + i;
+        DbListItem* head = &m_root[ms & kROOT_MASK];
+        if (head->_next != head || (!levels_empty && 0 == (ms & kROOT_MASK))) {
+            next = ms;
+            break;
+        }
+    }
+
+    int64_t now = TimeUtility::GetCurrentMS();
+    return next > now ? next - now : 0;
+}
+
+WheelTimer::TimerNode* WheelTimer::GetNode(int64_t timer_id) {
+    if (timer_id < 0) {
+        return NULL;
+    }
+
+    uint32_t index = static_cast<uint32_t>(timer_id & 0xFFFFFFFF);
+    if (index >= m_nodes.size()) {
+        return NULL;
+    }
+
+    TimerNode* node = m_nodes[index];
+    return node->id == timer_id ? node : NULL;
+}
+
+WheelTimer::TimerNode* WheelTimer::AllocNode() {
+    if (m_free_nodes.empty()) {
+        TimerNode* block = new TimerNode[kNODE_BLOCK_SIZE];
+        m_node_blocks.push_back(block);
+        for (int32_t i = 0; i < kNODE_BLOCK_SIZE; ++i) {
+            block[i].index = m_nodes.size();
+            m_nodes.push_back(&block[i]);
+        }
+        for (int32_t i = kNODE_BLOCK_SIZE - 1; i >= 0; --i) {
+            m_free_nodes.push_back(block[i].index);
+        }
+    }
+
+    TimerNode* node = m_nodes[m_free_nodes.back()];
+    m_free_nodes.pop_back();
+    node->id = (static_cast<int64_t>(node->generation) << 32) | node->index;
+    ++m_timer_num;
+
+    return node;
+}
+
+void WheelTimer::FreeNode(TimerNode* node) {
+    node->id = -1;
+    node->cb = TimeoutCallback();
+    node->handler = NULL;
+    node->context = NULL;
+    // 复用节点时ID变化，避免旧的定时器ID误操作新定时器
+    node->generation = (node->generation + 1) & 0x7FFFFFFF;
+    m_free_nodes.push_back(node->index);
+    --m_timer_num;
+}
+
+void WheelTimer::AddNode(TimerNode* node) {
+    // 最后一层不能回绕到当前槽，超时时间上限约48.5天
+    static const int64_t kMAX_DELTA = (1LL << 32) - (1LL << 26) - 1;
+
+    int64_t delta = node->expire - m_cur_ms;
+    if (delta > kMAX_DELTA) {
+        delta = kMAX_DELTA;
+        node->expire = m_cur_ms + delta;
+    }
+
+    DbListItem* head = NULL;
+    if (delta < 0) {
+        head = &m_root[m_cur_ms & kROOT_MASK];
+    } else if (delta < kROOT_SIZE) {
+        head = &m_root[node->expire & kROOT_MASK];
+    } else {
+        int32_t l = 0;
+        for (; l < kLEVEL_NUM - 1; ++l) {
+            if (delta < (1LL << (kROOT_BITS + (l + 1) * kLEVEL_BITS))) {
+                break;
+            }
+        }
+        head = &m_levels[l][(node->expire >> (kROOT_BITS + l * kLEVEL_BITS)) & kLEVEL_MASK];
+    }
+
+    db_list_add_tail(head, &node->list_item);
+}
+
+void WheelTimer::Cascade() {
+    // 第0层转完一圈，把上层当前槽的定时器重新放置到下层
+    for (int32_t l = 0; l < kLEVEL_NUM; ++l) {
+        int32_t index = (m_cur_ms >> (kROOT_BITS + l * kLEVEL_BITS)) & kLEVEL_MASK;
+
+        DbListItem list;
+        db_list_init(&list);
+        DbListItem* head = &m_levels[l][index];
+        if (head->_next != head) {
+            list._next = head->_next;
+            list._prev = head->_prev;
+            list._next->_prev = &list;
+            list._prev->_next = &list;
+            db_list_init(head);
+        }
+
+        while (list._next != &list) {
+            DbListItem* item = list._next;
+            db_list_del(item);
+            AddNode(container(TimerNode, list_item, item));
+        }
+
+        if (index != 0) {
+            break;
+        }
+    }
+}
+
 }  // namespace pebble
 
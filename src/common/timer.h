@@ -14,6 +14,8 @@
 #ifndef _PEBBLE_COMMON_TIMER_H_
 #define _PEBBLE_COMMON_TIMER_H_
 
+#include <vector>
+
 #include "common/db_list.h"
 #include "common/error.h"
 #include "common/platform.h"
@@ -90,6 +92,11 @@ public:
 
     /// @brief 获取定时器数目
     virtual int64_t GetTimerNum() { return 0; }
+
+    /// @brief 获取距离最近一个定时器超时的时间
+    /// @return >=0 最近超时时间(ms)，可能早于实际超时时间，但不会晚于
+    /// @return -1 没有定时器或不支持查询
+    virtual int64_t GetNextExpireMS() { return -1; }
 };
 
 #if 0
@@ -204,6 +211,117 @@ private:
     char m_last_error[256];
 };
 
+/// @brief 分层时间轮定时器，精度1ms，第0层256个槽，第1~4层各64个槽，覆盖uint32_t的超时范围
+///     定时器节点池化分配，定时器ID直接索引节点，适合大量并发的RPC会话、协程超时等
+///     复杂度:start O(1)，stop O(1)，restart O(1)，timeout O(1)
+/// @note 超时回调中可以stop/restart其他定时器，对自身的stop会在回调返回后删除，对自身的restart以回调返回值为准
+class WheelTimer : public Timer {
+public:
+    /// @brief 轻量定时器回调，函数指针加上下文，构造时无内存分配
+    /// @param context 启动定时器时传入的上下文
+    /// @param data 启动定时器时传入的用户数据
+    /// @return 同TimeoutCallback
+    typedef int32_t (*TimeoutHandler)(void* context, uint64_t data);
+
+    WheelTimer();
+    virtual ~WheelTimer();
+
+    /// @see Timer::StartTimer
+    virtual int64_t StartTimer(uint32_t timeout_ms, const TimeoutCallback& cb);
+
+    /// @brief 启动定时器，供RPC会话等高频场景使用，避免每次构造TimeoutCallback的开销
+    /// @param timeout_ms 超时时间(ms)
+    /// @param handler 超时回调函数
+    /// @param context 回调时原样传回
+    /// @param data 回调时原样传回
+    /// @return 定时器ID，<0失败
+    int64_t StartTimer(uint32_t timeout_ms, TimeoutHandler handler, void* context, uint64_t data);
+
+    /// @see Timer::StopTimer
+    virtual int32_t StopTimer(int64_t timer_id);
+
+    /// @see Timer::ReStartTimer
+    virtual int32_t ReStartTimer(int64_t timer_id);
+
+    /// @see Timer::Update
+    virtual int32_t Update();
+
+    /// @see Timer::LastErrorStr
+    virtual const char* GetLastError() const {
+        return m_last_error;
+    }
+
+    /// @see Timer::GetTimerNum
+    virtual int64_t GetTimerNum() {
+        return m_timer_num;
+    }
+
+    /// @see Timer::GetNextExpireMS
+    virtual int64_t GetNextExpireMS();
+
+private:
+    static const int32_t kROOT_BITS   = 8;
+    static const int32_t kROOT_SIZE   = 1 << kROOT_BITS;
+    static const int32_t kROOT_MASK   = kROOT_SIZE - 1;
+    static const int32_t kLEVEL_BITS  = 6;
+    static const int32_t kLEVEL_SIZE  = 1 << kLEVEL_BITS;
+    static const int32_t kLEVEL_MASK  = kLEVEL_SIZE - 1;
+    static const int32_t kLEVEL_NUM   = 4;
+    static const int32_t kNODE_BLOCK_SIZE = 1024;
+
+    struct TimerNode {
+        TimerNode() {
+            id         = -1;
+            timeout_ms = 0;
+            expire     = 0;
+            index      = 0;
+            generation = 0;
+            handler    = NULL;
+            context    = NULL;
+            data       = 0;
+        }
+
+        DbListItem list_item;
+
+        int64_t  id;
+        uint32_t timeout_ms;
+        int64_t  expire;        // 超时时刻(ms)
+        uint32_t index;         // 在节点池中的下标
+        uint32_t generation;    // 节点复用次数，与index组成定时器ID
+        TimeoutCallback cb;
+        TimeoutHandler  handler;    // 非空时优先于cb
+        void*           context;
+        uint64_t        data;
+    };
+
+    TimerNode* GetNode(int64_t timer_id);
+
+    TimerNode* AllocNode();
+
+    void FreeNode(TimerNode* node);
+
+    void AddNode(TimerNode* node);
+
+    void Cascade();
+
+private:
+    int64_t m_cur_ms;           // 下一个待处理的时刻(ms)
+    int64_t m_timer_num;
+
+    DbListItem m_root[kROOT_SIZE];
+    DbListItem m_levels[kLEVEL_NUM][kLEVEL_SIZE];
+
+    // 回调中的节点，用于处理回调中对自身的stop
+    TimerNode* m_running;
+    bool m_running_stopped;
+
+    std::vector<TimerNode*> m_nodes;
+    std::vector<TimerNode*> m_node_blocks;
+    std::vector<uint32_t> m_free_nodes;
+
+    char m_last_error[256];
+};
+
 }  // namespace pebble
 
 #endif  // _PEBBLE_COMMON_TIMER_H_
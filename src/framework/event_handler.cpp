@@ -12,6 +12,7 @@
  */
 
 #include "framework/event_handler.inh"
+#include "framework/monitor.h"
 #include "framework/rpc.h"
 #include "framework/stat.h"
 #include "framework/stat_manager.h"
@@ -29,6 +30,12 @@ void RpcEventHandler::RequestProcComplete(const std::string& name,
         m_stat_manager->GetStat()->AddMessageItem(name, result, time_cost_ms);
         m_stat_manager->Report2Gdata(name, result, time_cost_ms);
     }
+
+    // 因过载被拒绝或丢弃的请求未经处理，其时延不反映服务能力
+    bool is_overload = result <= kRPC_SYSTEM_OVERLOAD_BASE && result > kRPC_SYSTEM_OVERLOAD_BASE - 100;
+    if (m_concurrency_limit_monitor && !is_overload) {
+        m_concurrency_limit_monitor->OnRequestComplete(time_cost_ms);
+    }
 }
 
 void RpcEventHandler::ResponseProcComplete(const std::string& name,
@@ -11,18 +11,24 @@
  *
  */
 
+#include <stdlib.h>
+
 #include "common/log.h"
 #include "framework/message.h"
+#include "framework/shm_driver.h"
 #include "framework/tcp_driver.h"
+#include "framework/udp_driver.h"
+#include "framework/unix_driver.h"
+#include "framework/uring_driver.h"
 
 namespace pebble {
 
 #define HANDLE_SEQ_MASK 0x7000000000000000LL
 #define HANDLE_SEQ_MASK_OFFSET 60
 /*
-	handle MASK:
+	handle MASK: 按驱动注册的顺序分配
 		tcp	 : 0 << 60
-		http : 1 << 60
+		其他驱动(udp、unix、unixpacket、shm、uring、用户驱动)按第一次使用或AddDriver的顺序
 		...
 */
 
@@ -48,6 +54,21 @@ int64_t MessageDriver::GenHandle() {
 	return m_handle_mask | m_handle_seq++;
 }
 
+int32_t UrlToIpPort(const std::string& url, std::string* ip, uint16_t* port) {
+    if (NULL == ip || NULL == port) {
+        return -1;
+    }
+
+    size_t pos = url.find_last_of(':');
+    if (std::string::npos == pos || url.size() == pos) {
+        return -1;
+    }
+
+    ip->assign(url.substr(0, pos));
+    *port = static_cast<uint16_t>(atoi(url.substr(pos + 1).c_str()));
+    return 0;
+}
+
 int32_t Message::Init(const MessageCallbacks& cb) {
 	int a = 1;
 	(*(char *)&a == 1) ? endian_pos = 7 : endian_pos = 0;
@@ -59,6 +80,7 @@ int32_t Message::Init(const MessageCallbacks& cb) {
 	if (ret != 0) {
 		return ret;
 	}
+
 	// add other driver...
 
     return 0;
@@ -70,14 +92,13 @@ int64_t Message::Bind(const std::string &url) {
 		PLOG_ERROR("");
 		return kMESSAGE_UNINSTALL_DRIVER;
 	}
-	std::map<std::string, cxx::shared_ptr<MessageDriver> >::iterator it =
-		m_prefix_to_driver.find(url.substr(0, pos));
-	if (it == m_prefix_to_driver.end()) {
+	cxx::shared_ptr<MessageDriver> driver = LoadDriver(url.substr(0, pos));
+	if (!driver) {
 		PLOG_ERROR("can't find %s's driver", url.c_str());
 		return kMESSAGE_UNINSTALL_DRIVER;
 	}
 
-    return it->second->Bind(url.substr(pos + 3));
+    return driver->Bind(url.substr(pos + 3));
 }
 
 int64_t Message::Connect(const std::string &url) {
@@ -86,14 +107,13 @@ int64_t Message::Connect(const std::string &url) {
 		PLOG_ERROR("");
 		return kMESSAGE_UNINSTALL_DRIVER;
 	}
-	std::map<std::string, cxx::shared_ptr<MessageDriver> >::iterator it =
-		m_prefix_to_driver.find(url.substr(0, pos));
-	if (it == m_prefix_to_driver.end()) {
+	cxx::shared_ptr<MessageDriver> driver = LoadDriver(url.substr(0, pos));
+	if (!driver) {
 		PLOG_ERROR("can't find %s's driver", url.c_str());
 		return kMESSAGE_UNINSTALL_DRIVER;
 	}
 
-	return it->second->Connect(url.substr(pos + 3));
+	return driver->Connect(url.substr(pos + 3));
 }
 
 int32_t Message::Send(int64_t handle, const uint8_t* msg, uint32_t msg_len, int32_t flag) {
@@ -157,6 +177,10 @@ int32_t Message::AddDriver(const cxx::shared_ptr<MessageDriver>& driver) {
 	
 	m_drivers[m_driver_num++] = driver;
 	m_prefix_to_driver[prefix] = driver;
+
+	if (m_cbs._on_driver_added) {
+		m_cbs._on_driver_added(prefix);
+	}
     return 0;
 }
 
@@ -172,4 +196,43 @@ cxx::shared_ptr<MessageDriver> Message::GetDriver(int64_t handle) {
 	return m_drivers[idx];
 }
 
+cxx::shared_ptr<MessageDriver> Message::GetDriverByPrefix(const std::string& prefix) {
+	std::map<std::string, cxx::shared_ptr<MessageDriver> >::iterator it = m_prefix_to_driver.find(prefix);
+	if (m_prefix_to_driver.end() == it) {
+		cxx::shared_ptr<MessageDriver> null_ptr;
+		return null_ptr;
+	}
+	return it->second;
+}
+
+// 内置的可选驱动，未使用时不创建，不占用handle前缀，也不分配socket、事件循环等资源
+static cxx::shared_ptr<MessageDriver> NewBuiltinDriver(const std::string& prefix) {
+	cxx::shared_ptr<MessageDriver> driver;
+	if ("udp" == prefix) {
+		driver.reset(new UdpDriver());
+	} else if ("unix" == prefix) {
+		driver.reset(new UnixDriver(false));
+	} else if ("unixpacket" == prefix) {
+		driver.reset(new UnixDriver(true));
+	} else if ("shm" == prefix) {
+		driver.reset(new ShmDriver());
+	} else if ("uring" == prefix) {
+		driver.reset(new UringDriver());
+	}
+	return driver;
+}
+
+cxx::shared_ptr<MessageDriver> Message::LoadDriver(const std::string& prefix) {
+	cxx::shared_ptr<MessageDriver> driver = GetDriverByPrefix(prefix);
+	if (driver) {
+		return driver;
+	}
+
+	driver = NewBuiltinDriver(prefix);
+	if (driver && AddDriver(driver) != 0) {
+		driver.reset();
+	}
+	return driver;
+}
+
 } // namespace pebble
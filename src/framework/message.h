@@ -105,12 +105,15 @@ struct MessageCallbacks {
 	cxx::function<int(int64_t local_handle, int64_t peer_hanlde)> _on_peer_connected;
 	cxx::function<int(int64_t local_handle, int64_t peer_hanlde)> _on_peer_closed;
 	cxx::function<int(int64_t handle)> _on_closed;
+	// 驱动注册后回调，内置的可选驱动在第一次使用时才注册，可在此时对驱动做配置
+	cxx::function<void(const char* prefix)> _on_driver_added;
 
 	MessageCallbacks& operator = (const MessageCallbacks& rhs) {
 		_on_message 		= rhs._on_message;
 		_on_peer_connected 	= rhs._on_peer_connected;
 		_on_peer_closed 	= rhs._on_peer_closed;
 		_on_closed			= rhs._on_closed;
+		_on_driver_added	= rhs._on_driver_added;
 		return *this;
 	}
 };
@@ -146,6 +149,8 @@ public:
 	// framework call
 	void SetHandleMask(int64_t handle_mask) { m_handle_mask = handle_mask; }
 
+	int64_t GetHandleMask() const { return m_handle_mask; }
+
 protected:
 	int64_t GenHandle();
 
@@ -156,6 +161,11 @@ private:
 	int64_t m_handle_mask;
 };
 
+/// @brief 解析"ip:port"形式的地址，供各网络驱动使用
+/// @return 0 成功
+/// @return -1 地址格式错误
+int32_t UrlToIpPort(const std::string& url, std::string* ip, uint16_t* port);
+
 /// @brief 基于消息的通讯接口类
 class Message {
 public:
@@ -229,7 +239,14 @@ public:
 
 	static cxx::shared_ptr<MessageDriver> GetDriver(int64_t handle);
 
+	/// @brief 按前缀查找通信驱动，如"tcp"
+	/// @note 只查找已注册的驱动，内置的可选驱动(udp、unix等)在第一次Bind/Connect时才注册
+	static cxx::shared_ptr<MessageDriver> GetDriverByPrefix(const std::string& prefix);
+
 private:
+	// 按前缀查找通信驱动，内置的可选驱动未注册时创建并注册
+	static cxx::shared_ptr<MessageDriver> LoadDriver(const std::string& prefix);
+
 	static MessageCallbacks m_cbs;
 	static int m_driver_num;
     static cxx::shared_ptr<MessageDriver> m_drivers[MAX_DRIVER_NUM];
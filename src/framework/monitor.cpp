@@ -0,0 +1,172 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <math.h>
+
+#include "framework/monitor.h"
+
+
+namespace pebble {
+
+// 统计窗口的最短时长和最少样本数，样本太少时窗口延续
+static const int64_t  kWINDOW_MS          = 100;
+static const uint32_t kWINDOW_MIN_SAMPLES = 10;
+// 长期时延EWMA的新样本权重(按窗口)
+static const double   kLONG_RTT_WEIGHT    = 0.05;
+// 短期时延超过长期时延的倍数容忍度，毫秒精度的时延抖动较大，取2倍
+static const double   kRTT_TOLERANCE      = 2.0;
+// 新限制的平滑系数
+static const double   kLIMIT_SMOOTHING    = 0.2;
+
+ConcurrencyLimitMonitor::ConcurrencyLimitMonitor()
+    :   m_enable(false), m_task_num(0), m_max_task_num(0), m_min_limit(1), m_max_limit(UINT32_MAX),
+        m_limit(UINT32_MAX), m_long_rtt_ms(-1.0), m_window_start_ms(0), m_window_rtt_sum(0),
+        m_window_samples(0) {
+}
+
+void ConcurrencyLimitMonitor::SetLimitRange(uint32_t min_limit, uint32_t max_limit) {
+    m_min_limit = min_limit > 0 ? min_limit : 1;
+    m_max_limit = max_limit > m_min_limit ? max_limit : m_min_limit;
+    if (m_limit > m_max_limit) {
+        m_limit = m_max_limit;
+    }
+    if (m_limit < m_min_limit) {
+        m_limit = m_min_limit;
+    }
+}
+
+void ConcurrencyLimitMonitor::OnRequestComplete(int64_t time_cost_ms) {
+    if (!m_enable) {
+        return;
+    }
+
+    int64_t now = TimeUtility::GetCurrentMS();
+    if (0 == m_window_samples) {
+        m_window_start_ms = now;
+    }
+    m_window_rtt_sum += time_cost_ms > 0 ? time_cost_ms : 0;
+    ++m_window_samples;
+
+    if (m_window_samples >= kWINDOW_MIN_SAMPLES && now - m_window_start_ms >= kWINDOW_MS) {
+        UpdateLimit();
+    }
+}
+
+void ConcurrencyLimitMonitor::UpdateLimit() {
+    // 时延以1ms为最小单位，避免亚毫秒级请求的比值失真
+    double short_rtt = static_cast<double>(m_window_rtt_sum) / m_window_samples;
+    if (short_rtt < 1.0) {
+        short_rtt = 1.0;
+    }
+    uint32_t max_task_num = m_max_task_num;
+
+    m_window_rtt_sum = 0;
+    m_window_samples = 0;
+    m_max_task_num   = m_task_num;
+
+    if (m_long_rtt_ms < 0) {
+        m_long_rtt_ms = short_rtt;
+        return;
+    }
+    m_long_rtt_ms += kLONG_RTT_WEIGHT * (short_rtt - m_long_rtt_ms);
+
+    // 长期均值远高于当前时延时，说明长期均值受之前排队的影响，加速回落
+    if (m_long_rtt_ms > 2 * short_rtt) {
+        m_long_rtt_ms *= 0.9;
+    }
+
+    // 短期时延超过容忍范围时按比例下调限制，每次最多减半；sqrt(limit)为允许的排队余量
+    double gradient = kRTT_TOLERANCE * m_long_rtt_ms / short_rtt;
+    gradient = gradient < 0.5 ? 0.5 : (gradient > 1.0 ? 1.0 : gradient);
+    double new_limit = m_limit * gradient + sqrt(m_limit);
+
+    // 并发任务数远未达到限制时，时延不能反映限制是否合适，只允许下调
+    if (max_task_num < m_limit / 2 && new_limit > m_limit) {
+        return;
+    }
+
+    m_limit = m_limit * (1 - kLIMIT_SMOOTHING) + new_limit * kLIMIT_SMOOTHING;
+    if (m_limit < m_min_limit) {
+        m_limit = m_min_limit;
+    } else if (m_limit > m_max_limit) {
+        m_limit = m_max_limit;
+    }
+}
+
+CoDelMonitor::CoDelMonitor()
+    :   m_enable(false), m_target_ms(5), m_interval_ms(100), m_first_above_ms(0), m_dropping(false),
+        m_drop_next_ms(0), m_drop_count(0), m_drop_current(false) {
+}
+
+void CoDelMonitor::SetEnable(bool enable) {
+    m_enable = enable;
+    if (!m_enable) {
+        m_first_above_ms = 0;
+        m_dropping       = false;
+        m_drop_current   = false;
+    }
+}
+
+void CoDelMonitor::SetTarget(uint32_t target_ms, uint32_t interval_ms) {
+    m_target_ms   = target_ms;
+    m_interval_ms = interval_ms > 0 ? interval_ms : 1;
+}
+
+int64_t CoDelMonitor::ControlLaw(int64_t t) const {
+    return t + static_cast<int64_t>(m_interval_ms / sqrt(static_cast<double>(m_drop_count)));
+}
+
+void CoDelMonitor::OnMessage(int64_t arrived_ms) {
+    m_drop_current = false;
+    if (!m_enable || arrived_ms <= 0) {
+        return;
+    }
+
+    int64_t now = TimeUtility::GetCurrentMS();
+    int64_t sojourn_ms = now - arrived_ms;
+
+    // 排队时间在整个观察周期内都高于目标，即周期内的最小排队时间高于目标
+    bool ok_to_drop = false;
+    if (sojourn_ms < m_target_ms) {
+        m_first_above_ms = 0;
+    } else if (0 == m_first_above_ms) {
+        m_first_above_ms = now + m_interval_ms;
+    } else if (now >= m_first_above_ms) {
+        ok_to_drop = true;
+    }
+
+    if (m_dropping) {
+        if (!ok_to_drop) {
+            m_dropping = false;
+        } else if (now >= m_drop_next_ms) {
+            m_drop_current = true;
+            ++m_drop_count;
+            m_drop_next_ms = ControlLaw(m_drop_next_ms);
+        }
+        return;
+    }
+
+    if (ok_to_drop) {
+        m_drop_current = true;
+        m_dropping     = true;
+        // 刚退出丢弃状态不久又进入时，沿用之前的丢弃频率
+        if (m_drop_count > 2 && now - m_drop_next_ms < 8 * static_cast<int64_t>(m_interval_ms)) {
+            m_drop_count -= 2;
+        } else {
+            m_drop_count = 1;
+        }
+        m_drop_next_ms = ControlLaw(now);
+    }
+}
+
+} // namespace pebble
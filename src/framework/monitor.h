@@ -26,6 +26,8 @@ enum OverLoadType {
     kNO_OVERLOAD     = 0,   // 未过载
     kMESSAGE_EXPIRED = 0x1, // 消息过期
     kTASK_OVERLOAD   = 0x2, // 并发任务数过载(超出限制)
+    kCONCURRENCY_OVERLOAD = 0x4, // 并发任务数超出根据时延自适应的限制
+    kQUEUE_DELAY_OVERLOAD = 0x8, // 消息排队时间持续超出目标(CoDel)
 };
 
 /// @brief 系统过载监控接口定义
@@ -87,6 +89,106 @@ private:
     uint32_t m_expire_threshold_ms;
 };
 
+/// @brief 自适应并发限制监控，根据请求时延的变化动态调整并发任务数的限制(gradient算法)
+/// @note 以长期时延均值为基准，短期时延明显升高说明请求开始排队，按比例降低限制；
+///   时延平稳时限制以sqrt(limit)的步长缓慢增长，探测更高的并发能力
+class ConcurrencyLimitMonitor : public IMonitor {
+public:
+    ConcurrencyLimitMonitor();
+    virtual ~ConcurrencyLimitMonitor() {}
+
+    /// @brief 打开或关闭自适应并发限制，关闭时不限制也不统计
+    void SetEnable(bool enable) {
+        m_enable = enable;
+    }
+
+    /// @brief 设置并发限制的调整范围，初始限制为上限，随时延升高向下调整
+    void SetLimitRange(uint32_t min_limit, uint32_t max_limit);
+
+    /// @brief 设置当前并发任务数
+    void SetTaskNum(uint32_t task_num) {
+        m_task_num = task_num;
+        if (task_num > m_max_task_num) {
+            m_max_task_num = task_num;
+        }
+    }
+
+    /// @brief 请求处理完成时调用
+    /// @param time_cost_ms 请求从到达至处理完成的时间，包含排队时间
+    void OnRequestComplete(int64_t time_cost_ms);
+
+    /// @brief 获取当前的并发限制
+    uint32_t GetLimit() const {
+        return static_cast<uint32_t>(m_limit);
+    }
+
+    virtual uint32_t IsOverLoad() {
+        return (m_enable && m_task_num >= static_cast<uint32_t>(m_limit))
+            ? kCONCURRENCY_OVERLOAD : kNO_OVERLOAD;
+    }
+
+private:
+    // 一个统计窗口结束时根据窗口内的时延调整限制
+    void UpdateLimit();
+
+private:
+    bool     m_enable;
+    uint32_t m_task_num;
+    uint32_t m_max_task_num;    // 统计窗口内的最大并发任务数
+    uint32_t m_min_limit;
+    uint32_t m_max_limit;
+    double   m_limit;
+    double   m_long_rtt_ms;     // 长期时延的EWMA，作为无排队时的基准
+    int64_t  m_window_start_ms;
+    int64_t  m_window_rtt_sum;
+    uint32_t m_window_samples;
+};
+
+/// @brief 排队时延监控(CoDel)，消息排队时间在一个周期内始终高于目标值时认为出现了持续排队，
+///   开始丢弃消息，持续排队期间丢弃间隔按interval/sqrt(丢弃次数)逐步缩短，直到排队时间回落到目标以下
+/// @note 和MessageExpireMonitor的固定过期时间相比，短暂的突发不会触发丢弃，持续排队则尽早丢弃，
+///   避免所有请求都排队到接近过期时间才被缓慢处理
+class CoDelMonitor : public IMonitor {
+public:
+    CoDelMonitor();
+    virtual ~CoDelMonitor() {}
+
+    /// @brief 打开或关闭CoDel监控，关闭时不丢弃也不统计
+    void SetEnable(bool enable);
+
+    /// @brief 设置排队时间目标值和观察周期
+    /// @param target_ms 可以接受的排队时间，默认5ms
+    /// @param interval_ms 观察周期，排队时间在一个周期内始终高于目标时开始丢弃，默认100ms
+    void SetTarget(uint32_t target_ms, uint32_t interval_ms);
+
+    /// @brief 消息出队(开始处理)时调用，根据消息的排队时间决定是否丢弃此消息
+    /// @param arrived_ms 消息的到达时间
+    void OnMessage(int64_t arrived_ms);
+
+    /// @brief 是否处于丢弃状态，即出现了持续排队
+    bool IsDropping() const {
+        return m_dropping;
+    }
+
+    virtual uint32_t IsOverLoad() {
+        return m_drop_current ? kQUEUE_DELAY_OVERLOAD : kNO_OVERLOAD;
+    }
+
+private:
+    // 丢弃次数为count时下一次丢弃的时间
+    int64_t ControlLaw(int64_t t) const;
+
+private:
+    bool     m_enable;
+    uint32_t m_target_ms;
+    uint32_t m_interval_ms;
+    int64_t  m_first_above_ms;  // 排队时间高于目标后，在此时刻仍高于目标则进入丢弃状态，0表示低于目标
+    bool     m_dropping;
+    int64_t  m_drop_next_ms;
+    uint32_t m_drop_count;
+    bool     m_drop_current;    // 当前消息是否丢弃
+};
+
 /// @brief 监控中心，根据系统负载情况和流控策略配置提供流控决策支持
 class MonitorCenter {
 public:
@@ -48,8 +48,15 @@ Options::Options() {
     // flow control
     _enable_flow_control    = DEFAULT_ENABLE_FLOW_CONTROL;
     _max_msg_num_per_loop   = DEFAULT_MAX_MSG_NUM_PER_LOOP;
+    _max_msg_num_per_conn   = DEFAULT_MAX_MSG_NUM_PER_CONN;
     _task_threshold         = DEFAULT_TASK_THRESHOLD;
     _message_expire_ms      = DEFAULT_MESSAGE_EXPIRE_MS;
+    _enable_concurrency_limit = DEFAULT_ENABLE_CONCURRENCY_LIMIT;
+    _concurrency_limit_min  = DEFAULT_CONCURRENCY_LIMIT_MIN;
+    _concurrency_limit_max  = DEFAULT_CONCURRENCY_LIMIT_MAX;
+    _enable_codel           = DEFAULT_ENABLE_CODEL;
+    _codel_target_ms        = DEFAULT_CODEL_TARGET_MS;
+    _codel_interval_ms      = DEFAULT_CODEL_INTERVAL_MS;
     _idle_us                = DEFAULT_IDLE_US;
 
     // broadcast
@@ -57,6 +64,15 @@ Options::Options() {
 
     // rpc
     _proc_req_timeout_ms    = DEFAULT_PROC_REQ_TIMEOUT_MS;
+    _circuit_breaker_failures = DEFAULT_CIRCUIT_BREAKER_FAILURES;
+    _circuit_breaker_open_ms  = DEFAULT_CIRCUIT_BREAKER_OPEN_MS;
+    _rpc_cache_max_mb       = DEFAULT_RPC_CACHE_MAX_MB;
+    _batch_max_num          = DEFAULT_BATCH_MAX_NUM;
+    _batch_max_bytes        = DEFAULT_BATCH_MAX_BYTES;
+    _batch_max_delay_ms     = DEFAULT_BATCH_MAX_DELAY_MS;
+
+    // message
+    _tcp_io_thread_num      = DEFAULT_TCP_IO_THREAD_NUM;
 }
 
 std::string Options::ToString() {
@@ -86,8 +102,15 @@ std::string Options::ToString() {
         << "[" << kSectionFlowControl << "]\n"
             << kEnableFlowControl   << " = " << _enable_flow_control  << "\n"
             << kMaxMsgNumPerLoop    << " = " << _max_msg_num_per_loop << "\n"
+            << kMaxMsgNumPerConn    << " = " << _max_msg_num_per_conn << "\n"
             << kTaskThreshold       << " = " << _task_threshold       << "\n"
             << kMessageExpireMs     << " = " << _message_expire_ms    << "\n"
+            << kEnableConcurrencyLimit << " = " << _enable_concurrency_limit << "\n"
+            << kConcurrencyLimitMin << " = " << _concurrency_limit_min << "\n"
+            << kConcurrencyLimitMax << " = " << _concurrency_limit_max << "\n"
+            << kEnableCoDel         << " = " << _enable_codel         << "\n"
+            << kCoDelTargetMs       << " = " << _codel_target_ms      << "\n"
+            << kCoDelIntervalMs     << " = " << _codel_interval_ms    << "\n"
             << kIdleUs              << " = " << _idle_us              << "\n"
         << "[" << kSectionBroadcast << "]\n"
             << kBcRelayAddress      << " = " << _bc_relay_address     << "\n"
@@ -95,7 +118,25 @@ std::string Options::ToString() {
             << kBcZkTimeoutMs       << " = " << _bc_zk_timeout_ms     << "\n"
         << "[" << kSectionRpc << "]\n"
             << kProcReqTimeoutMs    << " = " << _proc_req_timeout_ms  << "\n"
+            << kCircuitBreakerFailures << " = " << _circuit_breaker_failures << "\n"
+            << kCircuitBreakerOpenMs << " = " << _circuit_breaker_open_ms << "\n"
+            << kRpcCacheMaxMB       << " = " << _rpc_cache_max_mb     << "\n"
+            << kBatchMaxNum         << " = " << _batch_max_num        << "\n"
+            << kBatchMaxBytes       << " = " << _batch_max_bytes      << "\n"
+            << kBatchMaxDelayMs     << " = " << _batch_max_delay_ms   << "\n"
+        << "[" << kSectionMessage << "]\n"
+            << kTcpIoThreadNum      << " = " << _tcp_io_thread_num    << "\n"
+        << "[" << kSectionRpcPriority << "]\n"
         ;
+    for (std::map<std::string, uint32_t>::iterator it = _rpc_priority.begin();
+        it != _rpc_priority.end(); ++it) {
+        oss << it->first << " = " << it->second << "\n";
+    }
+    oss << "[" << kSectionRpcCache << "]\n";
+    for (std::map<std::string, uint32_t>::iterator it = _rpc_cache.begin();
+        it != _rpc_cache.end(); ++it) {
+        oss << it->first << " = " << it->second << "\n";
+    }
 
     return oss.str();
 }
@@ -108,6 +149,9 @@ const char* kSectionStat        = "stat";
 const char* kSectionFlowControl = "flow_control";
 const char* kSectionBroadcast   = "broadcast";
 const char* kSectionRpc         = "rpc";
+const char* kSectionMessage     = "message";
+const char* kSectionRpcPriority = "rpc_priority";
+const char* kSectionRpcCache    = "rpc_cache";
 
 
 // config name
@@ -139,8 +183,15 @@ const char* kGdataLogPath       = "gdata_log_path";
 // [flow_control]
 const char* kEnableFlowControl  = "enable";
 const char* kMaxMsgNumPerLoop   = "msg_num_per_loop";
+const char* kMaxMsgNumPerConn   = "msg_num_per_conn";
 const char* kTaskThreshold      = "task_threshold";
 const char* kMessageExpireMs    = "message_expire_ms";
+const char* kEnableConcurrencyLimit = "concurrency_limit_enable";
+const char* kConcurrencyLimitMin    = "concurrency_limit_min";
+const char* kConcurrencyLimitMax    = "concurrency_limit_max";
+const char* kEnableCoDel        = "codel_enable";
+const char* kCoDelTargetMs      = "codel_target_ms";
+const char* kCoDelIntervalMs    = "codel_interval_ms";
 const char* kIdleUs             = "idle_us";
 
 // [broadcast]
@@ -150,6 +201,15 @@ const char* kBcZkTimeoutMs      = "zk_connect_timeout_ms";
 
 // [rpc]
 const char* kProcReqTimeoutMs   = "proc_request_timeout_ms";
+const char* kCircuitBreakerFailures = "circuit_breaker_failures";
+const char* kCircuitBreakerOpenMs   = "circuit_breaker_open_ms";
+const char* kRpcCacheMaxMB      = "cache_max_mb";
+const char* kBatchMaxNum        = "batch_max_num";
+const char* kBatchMaxBytes      = "batch_max_bytes";
+const char* kBatchMaxDelayMs    = "batch_max_delay_ms";
+
+// [message]
+const char* kTcpIoThreadNum     = "tcp_io_thread_num";
 
 }  // namespace pebble
 
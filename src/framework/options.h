@@ -15,6 +15,7 @@
 #ifndef  _PEBBLE_EXTENSION_OPTIONS_H_
 #define  _PEBBLE_EXTENSION_OPTIONS_H_
 
+#include <map>
 #include <string>
 
 #include "common/platform.h"
@@ -54,8 +55,15 @@ struct Options {
     // flow control
     bool     _enable_flow_control;  // 是否打开流控，0 - 关闭，1 - 打开，默认为1
     uint32_t _max_msg_num_per_loop; // 每个tick最大消息处理数量，默认为100
+    uint32_t _max_msg_num_per_conn; // 每个tick单个连接每轮最大消息处理数量，多个连接间轮转处理，默认为10
     uint32_t _task_threshold;       // 系统并发任务门限，默认为1w
     uint32_t _message_expire_ms;    // 消息过期时间（单位ms），默认为10*1000(10s)
+    bool     _enable_concurrency_limit; // 是否根据请求时延自适应限制并发任务数，默认为0
+    uint32_t _concurrency_limit_min;    // 自适应并发限制的下限，默认为10
+    uint32_t _concurrency_limit_max;    // 自适应并发限制的上限，也是初始值，默认为1w
+    bool     _enable_codel;         // 是否根据排队时间丢弃消息(CoDel)，丢弃期间后到的消息先处理，默认为0
+    uint32_t _codel_target_ms;      // 可以接受的排队时间（单位ms），默认为5
+    uint32_t _codel_interval_ms;    // 排队时间持续高于目标多久开始丢弃（单位ms），默认为100
     uint32_t _idle_us;              // idle time by us
 
     // broadcast
@@ -65,6 +73,21 @@ struct Options {
 
     // rpc
     uint32_t _proc_req_timeout_ms; // 请求处理超时时间，超时未回响应就释放session
+    uint32_t _circuit_breaker_failures; // 连续传输失败多少次后熔断目标handle，0表示关闭熔断，默认为5
+    uint32_t _circuit_breaker_open_ms;  // 熔断时长，也是探测请求的最小间隔（单位ms），默认为1000
+    uint32_t _rpc_cache_max_mb;     // 客户端响应缓存占用的内存上限（单位MB），默认为16
+    uint32_t _batch_max_num;        // 同一连接上的请求合并发送时每批最多的请求数，<=1表示关闭，默认为0
+    uint32_t _batch_max_bytes;      // 每批最大的字节数，默认为64k
+    uint32_t _batch_max_delay_ms;   // 请求等待合并的最长时间（单位ms），0表示只合并同一轮循环内的请求，默认为0
+
+    // message
+    uint32_t _tcp_io_thread_num;    // tcp收发I/O线程数，0表示在主线程收发，默认为0，非reload生效
+
+    // rpc priority
+    std::map<std::string, uint32_t> _rpc_priority; // 方法名 -> 优先级 @see RpcPriority，默认为空
+
+    // rpc cache
+    std::map<std::string, uint32_t> _rpc_cache; // 方法名 -> 响应缓存有效期（单位ms），默认为空
 
     Options();
     std::string ToString();
@@ -79,6 +102,9 @@ extern const char* kSectionStat;        // [stat]
 extern const char* kSectionFlowControl; // [flowcontrol]
 extern const char* kSectionBroadcast;   // [broadcast]
 extern const char* kSectionRpc;         // [rpc]
+extern const char* kSectionMessage;     // [message]
+extern const char* kSectionRpcPriority; // [rpc_priority]，字段名为"服务名:方法名"，值为优先级
+extern const char* kSectionRpcCache;    // [rpc_cache]，字段名为"服务名:方法名"，值为缓存有效期(ms)
 
 
 // config name
@@ -111,8 +137,15 @@ extern const char* kGdataLogPath;
 // [flow_control]
 extern const char* kEnableFlowControl;
 extern const char* kMaxMsgNumPerLoop;
+extern const char* kMaxMsgNumPerConn;
 extern const char* kTaskThreshold;
 extern const char* kMessageExpireMs;
+extern const char* kEnableConcurrencyLimit;
+extern const char* kConcurrencyLimitMin;
+extern const char* kConcurrencyLimitMax;
+extern const char* kEnableCoDel;
+extern const char* kCoDelTargetMs;
+extern const char* kCoDelIntervalMs;
 extern const char* kIdleUs;
 
 // [broadcast]
@@ -122,6 +155,15 @@ extern const char* kBcZkTimeoutMs;
 
 // [rpc]
 extern const char* kProcReqTimeoutMs;
+extern const char* kCircuitBreakerFailures;
+extern const char* kCircuitBreakerOpenMs;
+extern const char* kRpcCacheMaxMB;
+extern const char* kBatchMaxNum;
+extern const char* kBatchMaxBytes;
+extern const char* kBatchMaxDelayMs;
+
+// [message]
+extern const char* kTcpIoThreadNum;
 
 // default values
 // [app]
@@ -153,8 +195,15 @@ extern const char* kProcReqTimeoutMs;
 // [flow_control]
 #define DEFAULT_ENABLE_FLOW_CONTROL true
 #define DEFAULT_MAX_MSG_NUM_PER_LOOP    100
+#define DEFAULT_MAX_MSG_NUM_PER_CONN    10
 #define DEFAULT_TASK_THRESHOLD      (10000)
 #define DEFAULT_MESSAGE_EXPIRE_MS   (10 * 1000)
+#define DEFAULT_ENABLE_CONCURRENCY_LIMIT false
+#define DEFAULT_CONCURRENCY_LIMIT_MIN   10
+#define DEFAULT_CONCURRENCY_LIMIT_MAX   (10000)
+#define DEFAULT_ENABLE_CODEL        false
+#define DEFAULT_CODEL_TARGET_MS     5
+#define DEFAULT_CODEL_INTERVAL_MS   100
 #define DEFAULT_IDLE_US         (1000)
 
 // [broadcast]
@@ -162,6 +211,15 @@ extern const char* kProcReqTimeoutMs;
 
 // [rpc]
 #define DEFAULT_PROC_REQ_TIMEOUT_MS 20000
+#define DEFAULT_CIRCUIT_BREAKER_FAILURES 5
+#define DEFAULT_CIRCUIT_BREAKER_OPEN_MS  1000
+#define DEFAULT_RPC_CACHE_MAX_MB    16
+#define DEFAULT_BATCH_MAX_NUM       0
+#define DEFAULT_BATCH_MAX_BYTES     (64 * 1024)
+#define DEFAULT_BATCH_MAX_DELAY_MS  0
+
+// [message]
+#define DEFAULT_TCP_IO_THREAD_NUM   0
 
 }  // namespace pebble
 #endif   //  _PEBBLE_EXTENSION_OPTIONS_H_
@@ -11,6 +11,7 @@
  *
  */
 
+#include "common/coroutine.h"
 #include "common/log.h"
 #include "framework/pebble_rpc.h"
 #include "framework/rpc_plugin.inh"
@@ -136,6 +137,18 @@ int32_t PebbleRpc::SendRequestSync(int64_t handle,
     return m_rpc_util->SendRequestSync(handle, rpc_head, buff, buff_len, on_rsp, timeout_ms);
 }
 
+CoroutineSchedule* PebbleRpc::GetCoroutineSchedule() {
+    return m_rpc_util->GetCoroutineSchedule();
+}
+
+void PebbleRpc::SetHedgePolicy(const std::string& name, const HedgePolicy& policy) {
+    m_rpc_util->SetHedgePolicy(name, policy);
+}
+
+void PebbleRpc::SetCoalesce(const std::string& name, bool enable) {
+    m_rpc_util->SetCoalesce(name, enable);
+}
+
 void PebbleRpc::SendRequestParallel(int64_t handle,
                                     const RpcHead& rpc_head,
                                     const uint8_t* buff,
@@ -264,6 +277,10 @@ int32_t PebbleRpc::ProcessRequest(int64_t handle, const RpcHead& rpc_head,
     return m_rpc_util->ProcessRequest(handle, rpc_head, buff, buff_len);
 }
 
+int32_t PebbleRpc::OnStreamBlocked(uint64_t session_id) {
+    return m_rpc_util->WaitStreamCredit(session_id);
+}
+
 int32_t PebbleRpc::AddService(cxx::shared_ptr<IPebbleRpcService> service) {
     std::string service_name(service->Name());
     if (service_name.empty()) {
@@ -285,5 +302,100 @@ int32_t PebbleRpc::AddService(cxx::shared_ptr<IPebbleRpcService> service) {
     return kRPC_SUCCESS;
 }
 
-} // namespace pebble
 
+RpcStream::RpcStream() {
+    m_rpc        = NULL;
+    m_session_id = 0;
+    m_window     = 0;
+    m_done       = true;
+    m_result     = kRPC_INVALID_PARAM;
+    m_co_id      = INVALID_CO_ID;
+}
+
+RpcStream::~RpcStream() {
+    Abort(kRPC_STREAM_CANCELLED);
+}
+
+int32_t RpcStream::Open(PebbleRpc* rpc, int64_t handle, const RpcHead& rpc_head,
+    const uint8_t* buff, uint32_t buff_len, int32_t timeout_ms) {
+    if (NULL == rpc || !m_done) {
+        return kRPC_INVALID_PARAM;
+    }
+
+    OnRpcStream on_frame = cxx::bind(&RpcStream::OnFrame, this,
+        cxx::placeholders::_1, cxx::placeholders::_2);
+    OnRpcResponse on_rsp = cxx::bind(&RpcStream::OnEnd, this,
+        cxx::placeholders::_1, cxx::placeholders::_2, cxx::placeholders::_3);
+    int32_t ret = rpc->SendStreamRequest(handle, rpc_head, buff, buff_len,
+        on_frame, on_rsp, timeout_ms, m_window);
+    if (ret != kRPC_SUCCESS) {
+        m_result = ret;
+        return ret;
+    }
+
+    m_rpc        = rpc;
+    m_session_id = rpc_head.m_session_id;
+    m_done       = false;
+    m_result     = kRPC_SUCCESS;
+    m_frames.clear();
+    return kRPC_SUCCESS;
+}
+
+bool RpcStream::Next(std::string* frame) {
+    while (m_frames.empty()) {
+        if (m_done) {
+            return false;
+        }
+
+        CoroutineSchedule* schedule = m_rpc->GetCoroutineSchedule();
+        if (NULL == schedule || schedule->CurrentTaskId() == INVALID_CO_ID) {
+            PLOG_ERROR("not in coroutine");
+            Abort(kRPC_UTIL_NOT_IN_COROUTINE);
+            return false;
+        }
+        m_co_id = schedule->CurrentTaskId();
+        schedule->Yield();
+        m_co_id = INVALID_CO_ID;
+    }
+
+    frame->swap(m_frames.front());
+    m_frames.pop_front();
+
+    if (!m_done) {
+        m_rpc->AckStream(m_session_id, 1);
+    }
+    return true;
+}
+
+void RpcStream::Abort(int32_t result) {
+    if (m_done) {
+        return;
+    }
+
+    m_rpc->CancelRequest(m_session_id);
+    m_done   = true;
+    m_result = result;
+    m_frames.clear();
+    Wakeup();
+}
+
+int32_t RpcStream::OnFrame(const uint8_t* buff, uint32_t buff_len) {
+    m_frames.push_back(std::string(reinterpret_cast<const char*>(buff), buff_len));
+    Wakeup();
+    return kRPC_SUCCESS;
+}
+
+int32_t RpcStream::OnEnd(int32_t ret, const uint8_t* buff, uint32_t buff_len) {
+    m_done   = true;
+    m_result = ret;
+    Wakeup();
+    return ret;
+}
+
+void RpcStream::Wakeup() {
+    if (m_co_id != INVALID_CO_ID) {
+        m_rpc->GetCoroutineSchedule()->Resume(m_co_id);
+    }
+}
+
+} // namespace pebble
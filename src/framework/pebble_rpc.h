@@ -14,6 +14,7 @@
 #ifndef _PEBBLE_FRAMEWORK_PEBBLE_RPC_H_
 #define _PEBBLE_FRAMEWORK_PEBBLE_RPC_H_
 
+#include <deque>
 #include "framework/rpc.h"
 
 namespace pebble {
@@ -85,6 +86,20 @@ public:
     template<typename Class>
     int32_t AddService(Class* service);
 
+    /// @brief 设置方法的对冲请求策略，只能用于幂等方法，只对同步调用生效
+    /// @param name 方法名，格式为"服务名:方法名"
+    /// @param policy 对冲策略 @see HedgePolicy
+    /// @note 主请求的handle需由Router获得，对冲请求发往同一Router下的另一个handle
+    void SetHedgePolicy(const std::string& name, const HedgePolicy& policy);
+
+    /// @brief 设置方法是否合并相同的在途请求，只能用于只读方法，只对同步调用生效
+    /// @param name 方法名，格式为"服务名:方法名"
+    /// @param enable true时发往同一handle且方法名和请求参数都相同的请求在途期间，后来的调用不再发送，
+    ///     而是等待并共享在途请求的响应，如大量玩家同时登录时查询同一个公会信息
+    /// @note 合并的调用不使用对冲策略；每个调用仍按自己的超时时间返回，
+    ///     在途请求先于某个调用的超时时间超时，该调用在剩余时间内重新发起请求
+    void SetCoalesce(const std::string& name, bool enable);
+
 public:
     /// @brief 编解码内存策略
     /// @note 内部使用，用户无需关注
@@ -102,6 +117,12 @@ public:
     /// @note 内部使用，用户无需关注
     uint8_t* GetBuffer(int32_t size);
 
+    /// @brief 获取消息编码类型
+    /// @note 内部使用，用户无需关注
+    CodeType GetCodeType() const {
+        return m_code_type;
+    }
+
     /// @brief stub同步发送接口
     /// @note 内部使用，用户无需关注
     int32_t SendRequestSync(int64_t handle,
@@ -111,6 +132,10 @@ public:
                     const OnRpcResponse& on_rsp,
                     int32_t timeout_ms);
 
+    /// @brief 获取协程调度器，未设置时返回NULL
+    /// @note 内部使用，用户无需关注
+    CoroutineSchedule* GetCoroutineSchedule();
+
     /// @brief stub并行发送接口
     /// @note 内部使用，用户无需关注
     void SendRequestParallel(int64_t handle,
@@ -137,6 +162,8 @@ private:
     virtual int32_t ProcessRequest(int64_t handle, const RpcHead& rpc_head,
         const uint8_t* buff, uint32_t buff_len);
 
+    virtual int32_t OnStreamBlocked(uint64_t session_id);
+
     int32_t AddService(cxx::shared_ptr<IPebbleRpcService> service);
 
 protected:
@@ -160,6 +187,101 @@ int32_t PebbleRpc::AddService(Class* service) {
 }
 
 
+/// @brief 流式调用的客户端迭代器，在协程中逐帧读取服务端的流式响应
+/// @note 每读取一帧向服务端确认一次，服务端最多领先窗口大小的帧数，避免慢消费方被压垮；
+///   对象析构时未结束的流式调用被取消
+class RpcStream {
+public:
+    RpcStream();
+    virtual ~RpcStream();
+
+    /// @brief 设置窗口，即客户端最多缓存的未读帧数，需在发起调用前设置，默认为16
+    void SetWindow(uint32_t window) {
+        m_window = window;
+    }
+
+    /// @brief 读取下一帧，没有数据时挂起当前协程等待
+    /// @param frame 输出参数，帧数据
+    /// @return true 读到一帧
+    /// @return false 流式调用已结束，通过GetResult获取结果
+    bool Next(std::string* frame);
+
+    /// @brief 获取流式调用的结果，Next返回false后有效
+    /// @return 0 服务端正常结束
+    /// @return 非0 失败 @see RpcErrorCode
+    int32_t GetResult() const {
+        return m_result;
+    }
+
+    /// @brief 取消流式调用，服务端停止发送，之后Next返回false
+    void Cancel() {
+        Abort(kRPC_STREAM_CANCELLED);
+    }
+
+    /// @brief 发送流式请求
+    /// @note 内部使用，用户无需关注
+    int32_t Open(PebbleRpc* rpc, int64_t handle, const RpcHead& rpc_head,
+        const uint8_t* buff, uint32_t buff_len, int32_t timeout_ms);
+
+protected:
+    // 以指定结果结束流式调用
+    void Abort(int32_t result);
+
+private:
+    RpcStream(const RpcStream&);
+    RpcStream& operator=(const RpcStream&);
+
+    int32_t OnFrame(const uint8_t* buff, uint32_t buff_len);
+
+    int32_t OnEnd(int32_t ret, const uint8_t* buff, uint32_t buff_len);
+
+    // 唤醒在Next中等待的协程
+    void Wakeup();
+
+private:
+    PebbleRpc* m_rpc;
+    uint64_t   m_session_id;
+    uint32_t   m_window;
+    bool       m_done;
+    int32_t    m_result;
+    int64_t    m_co_id;
+    std::deque<std::string> m_frames;
+};
+
+/// @brief 带解码的流式调用客户端迭代器，由IDL生成代码创建解码函数
+template<typename T>
+class RpcStreamReader : public RpcStream {
+public:
+    typedef cxx::function<int32_t(const uint8_t* buff, uint32_t buff_len, T* item)> Decoder;
+
+    using RpcStream::Next;
+
+    /// @brief 读取并解码下一帧，没有数据时挂起当前协程等待
+    /// @return true 读到一帧
+    /// @return false 流式调用已结束或解码失败，通过GetResult获取结果
+    bool Next(T* item) {
+        if (!Next(&m_frame)) {
+            return false;
+        }
+        int32_t ret = m_decoder(reinterpret_cast<const uint8_t*>(m_frame.data()), m_frame.size(), item);
+        if (ret != kRPC_SUCCESS) {
+            Abort(ret);
+            return false;
+        }
+        return true;
+    }
+
+    /// @note 内部使用，用户无需关注
+    void SetDecoder(const Decoder& decoder) {
+        m_decoder = decoder;
+    }
+
+private:
+    Decoder     m_decoder;
+    std::string m_frame;
+};
+
+
 /// @brief PebbleRpc IDL生成代码服务端骨架代码接口
 /// @note 内部使用，用户无需关注
 class IPebbleRpcService {
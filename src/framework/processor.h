@@ -133,7 +133,8 @@ public:
     ///     涵盖了具体的过载类型，具体可参考 @see OverLoadType
     /// @return 0 成功
     /// @return 非0 失败
-    // TODO: 每个Processor建议维护一个消息白名单或优先级列表，允许某些消息即使在过载情况下仍然要处理
+    /// @note 每个Processor可以维护消息的优先级，允许某些消息即使在过载情况下仍然要处理，
+    ///   如RPC的方法优先级 @see IRpc::SetFunctionPriority
     virtual int32_t OnMessage(int64_t handle, const uint8_t* msg, uint32_t msg_len, const MsgExternInfo* msg_info, uint32_t is_overload) = 0;
 
     /// @brief 事件驱动
@@ -0,0 +1,95 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include "common/time_utility.h"
+#include "framework/response_cache.h"
+
+
+namespace pebble {
+
+ResponseCache::ResponseCache() {
+    m_max_bytes = 0;
+    m_bytes     = 0;
+    m_hits      = 0;
+    m_misses    = 0;
+    m_evictions = 0;
+}
+
+ResponseCache::~ResponseCache() {
+}
+
+void ResponseCache::SetMaxBytes(uint64_t max_bytes) {
+    m_max_bytes = max_bytes;
+    while (m_bytes > m_max_bytes && !m_lru.empty()) {
+        Erase(m_entries.find(*m_lru.back()));
+        ++m_evictions;
+    }
+}
+
+ResponseCache::Data ResponseCache::Get(const std::string& key) {
+    EntryMap::iterator it = m_entries.find(key);
+    if (it == m_entries.end()) {
+        ++m_misses;
+        return Data();
+    }
+
+    if (it->second._expire_ms <= TimeUtility::GetCurrentMS()) {
+        Erase(it);
+        ++m_misses;
+        return Data();
+    }
+
+    m_lru.splice(m_lru.begin(), m_lru, it->second._lru);
+    ++m_hits;
+    return it->second._data;
+}
+
+void ResponseCache::Put(const std::string& key, const uint8_t* buff, uint32_t buff_len,
+    uint32_t ttl_ms) {
+    EntryMap::iterator it = m_entries.find(key);
+    if (it != m_entries.end()) {
+        Erase(it);
+    }
+
+    // 单条数据超过上限时不缓存，避免清空整个缓存
+    if (key.size() + buff_len > m_max_bytes) {
+        return;
+    }
+
+    while (m_bytes + key.size() + buff_len > m_max_bytes && !m_lru.empty()) {
+        Erase(m_entries.find(*m_lru.back()));
+        ++m_evictions;
+    }
+
+    // 已发出的缓存数据可能仍被回调方持有，每次写入使用新的数据对象
+    std::pair<EntryMap::iterator, bool> result = m_entries.insert(std::make_pair(key, Entry()));
+    Entry& entry     = result.first->second;
+    entry._data.reset(new std::string(reinterpret_cast<const char*>(buff), buff_len));
+    entry._expire_ms = TimeUtility::GetCurrentMS() + ttl_ms;
+    entry._lru       = m_lru.insert(m_lru.begin(), &result.first->first);
+    m_bytes += EntryBytes(key, *entry._data);
+}
+
+void ResponseCache::Clear() {
+    m_entries.clear();
+    m_lru.clear();
+    m_bytes = 0;
+}
+
+void ResponseCache::Erase(EntryMap::iterator it) {
+    m_bytes -= EntryBytes(it->first, *it->second._data);
+    m_lru.erase(it->second._lru);
+    m_entries.erase(it);
+}
+
+} // namespace pebble
@@ -0,0 +1,84 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#ifndef _PEBBLE_FRAMEWORK_RESPONSE_CACHE_H_
+#define _PEBBLE_FRAMEWORK_RESPONSE_CACHE_H_
+
+#include <list>
+#include <string>
+
+#include "common/platform.h"
+
+
+namespace pebble {
+
+/// @brief RPC客户端响应缓存，以"方法名+请求数据"为key缓存成功的响应数据
+/// @note 数据按TTL过期，总字节数超出上限时淘汰最久未访问的数据(LRU)
+class ResponseCache {
+public:
+    typedef cxx::shared_ptr<std::string> Data;
+
+    ResponseCache();
+    ~ResponseCache();
+
+    /// @brief 设置缓存占用的字节数上限(key和数据)，缩小上限时立即淘汰
+    void SetMaxBytes(uint64_t max_bytes);
+
+    /// @brief 查找缓存，命中时刷新LRU顺序
+    /// @return 命中返回响应数据，未命中或已过期返回空指针
+    Data Get(const std::string& key);
+
+    /// @brief 写入缓存，key已存在时覆盖
+    /// @param ttl_ms 数据有效期，单位ms
+    void Put(const std::string& key, const uint8_t* buff, uint32_t buff_len, uint32_t ttl_ms);
+
+    /// @brief 清空缓存，统计计数保留
+    void Clear();
+
+    uint64_t GetHits() const { return m_hits; }
+    uint64_t GetMisses() const { return m_misses; }
+    uint64_t GetEvictions() const { return m_evictions; }
+    uint64_t GetBytes() const { return m_bytes; }
+    uint32_t GetSize() const { return m_entries.size(); }
+
+private:
+    struct Entry;
+    typedef cxx::unordered_map<std::string, Entry> EntryMap;
+    // LRU链表，头部为最近访问的数据，元素指向m_entries中的key
+    typedef std::list<const std::string*> LruList;
+
+    struct Entry {
+        Data    _data;
+        int64_t _expire_ms;
+        LruList::iterator _lru;
+    };
+
+    void Erase(EntryMap::iterator it);
+
+    static uint64_t EntryBytes(const std::string& key, const std::string& data) {
+        return key.size() + data.size();
+    }
+
+private:
+    EntryMap m_entries;
+    LruList  m_lru;
+    uint64_t m_max_bytes;
+    uint64_t m_bytes;
+    uint64_t m_hits;
+    uint64_t m_misses;
+    uint64_t m_evictions;
+};
+
+} // namespace pebble
+
+#endif // _PEBBLE_FRAMEWORK_RESPONSE_CACHE_H_
@@ -11,10 +11,387 @@
  *
  */
 
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common/time_utility.h"
 #include "framework/router.h"
+#include "framework/rpc.h"
 
 namespace pebble {
 
+// 64位整数混淆，使连续的key(如玩家id)在哈希环上均匀分布
+static uint64_t HashMix64(uint64_t value) {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ULL;
+    value ^= value >> 33;
+    return value;
+}
+
+// FNV-1a
+static uint64_t HashString64(const char* str, uint32_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (uint32_t idx = 0 ; idx < len ; ++idx) {
+        hash ^= static_cast<uint8_t>(str[idx]);
+        hash *= 0x100000001b3ULL;
+    }
+    return HashMix64(hash);
+}
+
+ConsistentHashRoutePolicy::ConsistentHashRoutePolicy(uint32_t virtual_node_num)
+    :   m_virtual_node_num(virtual_node_num > 0 ? virtual_node_num : 1)
+{
+}
+
+int64_t ConsistentHashRoutePolicy::GetRoute(uint64_t key, const std::vector<int64_t>& handles)
+{
+    if (0 == handles.size()) {
+        return kROUTER_NONE_VALID_HANDLE;
+    }
+    // 未收到地址变化通知(如用户直接使用本策略)时退化为取模
+    if (m_ring.empty()) {
+        return handles[key % handles.size()];
+    }
+
+    std::pair<uint64_t, int64_t> point(HashMix64(key), INT64_MIN);
+    std::vector< std::pair<uint64_t, int64_t> >::const_iterator it =
+        std::lower_bound(m_ring.begin(), m_ring.end(), point);
+
+    // handles可能是过滤(熔断、排除)后的子集，沿哈希环顺时针找到第一个可用的虚拟节点，
+    // 这样只有被过滤handle上的key会迁移，其他key的路由保持不变
+    m_sorted_handles.assign(handles.begin(), handles.end());
+    std::sort(m_sorted_handles.begin(), m_sorted_handles.end());
+    for (uint32_t step = 0 ; step < m_ring.size() ; ++step, ++it) {
+        if (m_ring.end() == it) {
+            it = m_ring.begin();
+        }
+        if (std::binary_search(m_sorted_handles.begin(), m_sorted_handles.end(), it->second)) {
+            return it->second;
+        }
+    }
+    // 环上的handle都不可用(如环尚未更新)，在可用handle中取模
+    return handles[key % handles.size()];
+}
+
+void ConsistentHashRoutePolicy::OnRouteChanged(const std::vector<int64_t>& handles,
+    const std::vector<std::string>& urls)
+{
+    m_ring.clear();
+    if (handles.size() != urls.size()) {
+        return;
+    }
+
+    m_ring.reserve(handles.size() * m_virtual_node_num);
+    char node_name[1024];
+    for (uint32_t idx = 0 ; idx < handles.size() ; ++idx) {
+        for (uint32_t vnode = 0 ; vnode < m_virtual_node_num ; ++vnode) {
+            int len = snprintf(node_name, sizeof(node_name), "%s#%u", urls[idx].c_str(), vnode);
+            if (len < 0) {
+                continue;
+            }
+            if (len >= static_cast<int>(sizeof(node_name))) {
+                len = sizeof(node_name) - 1;
+            }
+            m_ring.push_back(std::make_pair(HashString64(node_name, len), handles[idx]));
+        }
+    }
+    std::sort(m_ring.begin(), m_ring.end());
+}
+
+struct HandleQuality {
+    HandleQuality() : _inflight(0), _samples(0), _latency_ms(0.0), _error_rate(0.0),
+        _circuit(kCIRCUIT_CLOSED), _failures(0), _probe_ms(0) {}
+    int64_t _inflight;
+    int64_t _samples;
+    double  _latency_ms;
+    double  _error_rate;
+
+    CircuitState _circuit;
+    uint32_t     _failures; // 连续传输失败次数
+    int64_t      _probe_ms; // 熔断时为允许探测的时间，半开时为探测发出的时间
+};
+
+typedef cxx::unordered_map<int64_t, HandleQuality> HandleQualityMap;
+
+// EWMA的新样本权重
+static const double kQUALITY_EWMA_WEIGHT = 0.1;
+// 错误率上限，避免全部失败时评分无穷大，失败节点仍有机会被探测
+static const double kQUALITY_MAX_ERROR_RATE = 0.99;
+
+static HandleQualityMap& GetHandleQualityMap() {
+    static HandleQualityMap handle_quality_map;
+    return handle_quality_map;
+}
+
+typedef cxx::unordered_map<int64_t, OnHandleClosed> DrainingHandleMap;
+
+// 等待在途请求完成后关闭的handle及其关闭回调
+static DrainingHandleMap& GetDrainingHandles() {
+    static DrainingHandleMap draining_handles;
+    return draining_handles;
+}
+
+static void CloseIfDrained(int64_t handle, int64_t inflight) {
+    if (inflight > 0) {
+        return;
+    }
+    DrainingHandleMap& draining = GetDrainingHandles();
+    DrainingHandleMap::iterator it = draining.find(handle);
+    if (draining.end() == it) {
+        return;
+    }
+    OnHandleClosed on_closed = it->second;
+    draining.erase(it);
+    Message::Close(handle);
+    RouteQuality::Remove(handle);
+    if (on_closed) {
+        on_closed(handle);
+    }
+}
+
+static uint32_t g_circuit_failure_threshold = 5;
+static uint32_t g_circuit_open_ms           = 1000;
+// 非正常状态的handle数
+static uint32_t g_circuit_open_num          = 0;
+
+static void OpenCircuit(HandleQuality* quality, int64_t now) {
+    if (kCIRCUIT_CLOSED == quality->_circuit) {
+        ++g_circuit_open_num;
+    }
+    quality->_circuit  = kCIRCUIT_OPEN;
+    quality->_probe_ms = now + g_circuit_open_ms;
+}
+
+static void CloseCircuit(HandleQuality* quality) {
+    if (kCIRCUIT_CLOSED != quality->_circuit && g_circuit_open_num > 0) {
+        --g_circuit_open_num;
+    }
+    quality->_circuit  = kCIRCUIT_CLOSED;
+    quality->_failures = 0;
+}
+
+bool RouteQuality::IsTransportFailed(int32_t ret_code)
+{
+    if (kRPC_REQUEST_TIMEOUT == ret_code || kRPC_SEND_FAILED == ret_code
+        || kRPC_SYSTEM_ERROR == ret_code || kRPC_PROCESS_TIMEOUT == ret_code
+        || kRPC_CIRCUIT_OPEN == ret_code) {
+        return true;
+    }
+    // 服务端过载
+    return ret_code <= kRPC_SYSTEM_OVERLOAD_BASE && ret_code > kRPC_SYSTEM_OVERLOAD_BASE - 100;
+}
+
+void RouteQuality::OnRequestSent(int64_t handle)
+{
+    HandleQuality& quality = GetHandleQualityMap()[handle];
+    ++quality._inflight;
+
+    // 熔断期满后发出的第一个请求作为探测请求
+    if (kCIRCUIT_OPEN == quality._circuit) {
+        int64_t now = TimeUtility::GetCurrentMS();
+        if (now >= quality._probe_ms) {
+            quality._circuit  = kCIRCUIT_HALF_OPEN;
+            quality._probe_ms = now;
+        }
+    }
+}
+
+void RouteQuality::OnRequestDone(int64_t handle, int32_t ret_code, int64_t time_cost_ms)
+{
+    HandleQualityMap& quality_map = GetHandleQualityMap();
+    HandleQualityMap::iterator it = quality_map.find(handle);
+    if (quality_map.end() == it) {
+        return;
+    }
+
+    HandleQuality& quality = it->second;
+    if (quality._inflight > 0) {
+        --quality._inflight;
+    }
+
+    bool failed = IsTransportFailed(ret_code);
+    switch (quality._circuit) {
+        case kCIRCUIT_CLOSED:
+            if (!failed) {
+                quality._failures = 0;
+            } else if (g_circuit_failure_threshold > 0
+                && ++quality._failures >= g_circuit_failure_threshold) {
+                OpenCircuit(&quality, TimeUtility::GetCurrentMS());
+            }
+            break;
+        case kCIRCUIT_HALF_OPEN:
+            if (failed) {
+                OpenCircuit(&quality, TimeUtility::GetCurrentMS());
+            } else {
+                CloseCircuit(&quality);
+            }
+            break;
+        default:
+            // 熔断前发出的请求的迟到结果不改变熔断状态
+            break;
+    }
+
+    double latency = time_cost_ms > 0 ? static_cast<double>(time_cost_ms) : 0.0;
+    double error   = failed ? 1.0 : 0.0;
+    if (0 == quality._samples++) {
+        quality._latency_ms = latency;
+        quality._error_rate = error;
+    } else {
+        quality._latency_ms += kQUALITY_EWMA_WEIGHT * (latency - quality._latency_ms);
+        quality._error_rate += kQUALITY_EWMA_WEIGHT * (error - quality._error_rate);
+    }
+
+    CloseIfDrained(handle, quality._inflight);
+}
+
+double RouteQuality::GetLoad(int64_t handle)
+{
+    HandleQualityMap& quality_map = GetHandleQualityMap();
+    HandleQualityMap::iterator it = quality_map.find(handle);
+    if (quality_map.end() == it) {
+        return 0.0;
+    }
+
+    const HandleQuality& quality = it->second;
+    double error_rate = quality._error_rate < kQUALITY_MAX_ERROR_RATE ?
+        quality._error_rate : kQUALITY_MAX_ERROR_RATE;
+    return (quality._latency_ms + 1.0) * (quality._inflight + 1) / (1.0 - error_rate);
+}
+
+void RouteQuality::OnRequestCancelled(int64_t handle)
+{
+    HandleQualityMap& quality_map = GetHandleQualityMap();
+    HandleQualityMap::iterator it = quality_map.find(handle);
+    if (quality_map.end() == it) {
+        return;
+    }
+    if (it->second._inflight > 0) {
+        --(it->second._inflight);
+    }
+    // 探测请求被取消时没有结论，允许立即再次探测
+    if (kCIRCUIT_HALF_OPEN == it->second._circuit) {
+        it->second._circuit  = kCIRCUIT_OPEN;
+        it->second._probe_ms = 0;
+    }
+
+    CloseIfDrained(handle, it->second._inflight);
+}
+
+void RouteQuality::Remove(int64_t handle)
+{
+    HandleQualityMap& quality_map = GetHandleQualityMap();
+    HandleQualityMap::iterator it = quality_map.find(handle);
+    if (quality_map.end() != it) {
+        CloseCircuit(&(it->second));
+        quality_map.erase(it);
+    }
+}
+
+void RouteQuality::Drain(int64_t handle, const OnHandleClosed& on_closed)
+{
+    GetDrainingHandles()[handle] = on_closed;
+
+    HandleQualityMap& quality_map = GetHandleQualityMap();
+    HandleQualityMap::iterator it = quality_map.find(handle);
+    CloseIfDrained(handle, quality_map.end() != it ? it->second._inflight : 0);
+}
+
+bool RouteQuality::IsDraining(int64_t handle)
+{
+    return GetDrainingHandles().count(handle) > 0;
+}
+
+void RouteQuality::SetCircuitBreaker(uint32_t failure_threshold, uint32_t open_ms)
+{
+    g_circuit_failure_threshold = failure_threshold;
+    g_circuit_open_ms           = open_ms;
+
+    // 关闭熔断时恢复所有已熔断的handle
+    if (0 == failure_threshold && g_circuit_open_num > 0) {
+        HandleQualityMap& quality_map = GetHandleQualityMap();
+        for (HandleQualityMap::iterator it = quality_map.begin(); it != quality_map.end(); ++it) {
+            CloseCircuit(&(it->second));
+        }
+    }
+}
+
+bool RouteQuality::AllowRequest(int64_t handle)
+{
+    if (0 == g_circuit_open_num) {
+        return true;
+    }
+
+    HandleQualityMap& quality_map = GetHandleQualityMap();
+    HandleQualityMap::iterator it = quality_map.find(handle);
+    if (quality_map.end() == it) {
+        return true;
+    }
+
+    switch (it->second._circuit) {
+        case kCIRCUIT_OPEN:
+            return TimeUtility::GetCurrentMS() >= it->second._probe_ms;
+        case kCIRCUIT_HALF_OPEN:
+            return false;
+        default:
+            return true;
+    }
+}
+
+bool RouteQuality::HasOpenCircuit()
+{
+    return g_circuit_open_num > 0;
+}
+
+CircuitState RouteQuality::GetCircuitState(int64_t handle)
+{
+    HandleQualityMap& quality_map = GetHandleQualityMap();
+    HandleQualityMap::iterator it = quality_map.find(handle);
+    return quality_map.end() != it ? it->second._circuit : kCIRCUIT_CLOSED;
+}
+
+QualityRoutePolicy::QualityRoutePolicy()
+    :   m_seed(static_cast<uint32_t>(TimeUtility::GetCurrentUS()))
+{
+}
+
+int64_t QualityRoutePolicy::GetRoute(uint64_t key, const std::vector<int64_t>& handles)
+{
+    uint32_t num = handles.size();
+    if (0 == num) {
+        return kROUTER_NONE_VALID_HANDLE;
+    }
+    if (1 == num) {
+        return handles[0];
+    }
+
+    uint32_t first  = rand_r(&m_seed) % num;
+    uint32_t second = rand_r(&m_seed) % (num - 1);
+    if (second >= first) {
+        ++second;
+    }
+
+    return RouteQuality::GetLoad(handles[first]) <= RouteQuality::GetLoad(handles[second]) ?
+        handles[first] : handles[second];
+}
+
+typedef cxx::unordered_map<int64_t, Router*> HandleRouterMap;
+
+// handle到所属Router的索引，由各Router在地址变化和析构时维护
+static HandleRouterMap& GetHandleRouterMap() {
+    static HandleRouterMap handle_router_map;
+    return handle_router_map;
+}
+
+Router* Router::GetRouterByHandle(int64_t handle)
+{
+    HandleRouterMap& router_map = GetHandleRouterMap();
+    HandleRouterMap::iterator it = router_map.find(handle);
+    return router_map.end() != it ? it->second : NULL;
+}
+
 Router::Router(const std::string& name_path)
     :   m_route_name(name_path), m_route_type(kROUND_ROUTE),
         m_route_policy(NULL), m_naming(NULL)
@@ -32,6 +409,9 @@ Router::~Router()
         m_naming->UnWatchName(m_route_name);
         m_naming = NULL;
     }
+    for (uint32_t idx = 0 ; idx < m_route_handles.size() ; ++idx) {
+        GetHandleRouterMap().erase(m_route_handles[idx]);
+    }
 }
 
 int32_t Router::Init(Naming* naming)
@@ -60,13 +440,17 @@ int32_t Router::SetRoutePolicy(RoutePolicyType policy_type, IRoutePolicy* policy
         }
         break;
     case kQUALITY_ROUTE:
-        return kROUTER_NOT_SUPPORTTED;
+        policy = new pebble::QualityRoutePolicy;
+        break;
     case kROUND_ROUTE:
         policy = new pebble::RoundRoutePolicy;
         break;
     case kMOD_ROUTE:
         policy = new pebble::ModRoutePolicy;
         break;
+    case kCONSISTENT_HASH_ROUTE:
+        policy = new pebble::ConsistentHashRoutePolicy;
+        break;
     default:
         return kROUTER_INVAILD_PARAM;
     }
@@ -75,31 +459,120 @@ int32_t Router::SetRoutePolicy(RoutePolicyType policy_type, IRoutePolicy* policy
     }
     m_route_type = policy_type;
     m_route_policy = policy;
+    m_route_policy->OnRouteChanged(m_route_handles, m_route_urls);
     return 0;
 }
 
 int64_t Router::GetRoute(uint64_t key)
 {
-    if (NULL != m_route_policy) {
+    if (NULL == m_route_policy) {
+        return kROUTER_NOT_SUPPORTTED;
+    }
+    if (!HasOpenCircuit()) {
         return m_route_policy->GetRoute(key, m_route_handles);
     }
-    return kROUTER_NOT_SUPPORTTED;
+    return GetRouteAvailable(key, NULL);
 }
 
-void Router::NameWatch(const std::string& name, const std::vector<std::string>& urls)
+bool Router::HasOpenCircuit() const
 {
-    // TODO: 后续优化，目前实现有点粗暴
+    if (!RouteQuality::HasOpenCircuit()) {
+        return false;
+    }
     for (uint32_t idx = 0 ; idx < m_route_handles.size() ; ++idx) {
-        Message::Close(m_route_handles[idx]);
+        if (kCIRCUIT_CLOSED != RouteQuality::GetCircuitState(m_route_handles[idx])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int64_t Router::GetRouteExclude(uint64_t key, const std::vector<int64_t>& excludes)
+{
+    if (NULL == m_route_policy) {
+        return kROUTER_NOT_SUPPORTTED;
     }
-    m_route_handles.clear();
+    return GetRouteAvailable(key, &excludes);
+}
 
+int64_t Router::GetRouteAvailable(uint64_t key, const std::vector<int64_t>* excludes)
+{
+    bool has_open_circuit = false;
+    std::vector<int64_t>& handles = m_available_handles;
+    handles.clear();
+    for (uint32_t idx = 0 ; idx < m_route_handles.size() ; ++idx) {
+        int64_t handle = m_route_handles[idx];
+        if (excludes && excludes->end() != std::find(excludes->begin(), excludes->end(), handle)) {
+            continue;
+        }
+        if (!RouteQuality::AllowRequest(handle)) {
+            has_open_circuit = true;
+            continue;
+        }
+        handles.push_back(handle);
+    }
+    if (handles.empty()) {
+        return has_open_circuit ? kROUTER_CIRCUIT_OPEN : kROUTER_NONE_VALID_HANDLE;
+    }
+
+    // 用户自定义策略可能返回不在候选列表中的handle，此时在剩余handle中取模
+    int64_t handle = m_route_policy->GetRoute(key, handles);
+    if (handle >= 0 && handles.end() == std::find(handles.begin(), handles.end(), handle)) {
+        handle = handles[key % handles.size()];
+    }
+    return handle;
+}
+
+void Router::NameWatch(const std::string& name, const std::vector<std::string>& urls)
+{
+    // 地址列表增量更新，未变化的地址保留原有连接，避免重连风暴和中断在途请求
+    cxx::unordered_map<std::string, int64_t> old_handles;
+    for (uint32_t idx = 0 ; idx < m_route_urls.size() ; ++idx) {
+        old_handles[m_route_urls[idx]] = m_route_handles[idx];
+    }
+
+    std::vector<int64_t> new_handles;
+    std::vector<std::string> new_urls;
+    new_handles.reserve(urls.size());
+    new_urls.reserve(urls.size());
+    // 名字服务返回的重复地址只保留一个，否则多建的连接在下次比较时找不到而泄漏
+    cxx::unordered_map<std::string, bool> seen_urls;
+    cxx::unordered_map<std::string, int64_t>::iterator it;
     for (uint32_t idx = 0 ; idx < urls.size() ; ++idx) {
-        int64_t handle = Message::Connect(urls[idx]);
+        if (!seen_urls.insert(std::make_pair(urls[idx], true)).second) {
+            continue;
+        }
+        int64_t handle = -1;
+        it = old_handles.find(urls[idx]);
+        if (old_handles.end() != it) {
+            handle = it->second;
+            // 从old_handles中移除，剩下的即为需要关闭的地址
+            old_handles.erase(it);
+        } else {
+            handle = Message::Connect(urls[idx]);
+        }
         if (handle < 0) {
             continue;
         }
-        m_route_handles.push_back(handle);
+        new_handles.push_back(handle);
+        new_urls.push_back(urls[idx]);
+    }
+
+    // 移除的地址不再参与路由，连接等在途请求完成后再关闭，避免请求只能等到超时
+    HandleRouterMap& router_map = GetHandleRouterMap();
+    for (it = old_handles.begin() ; it != old_handles.end() ; ++it) {
+        router_map.erase(it->second);
+        RouteQuality::Drain(it->second, m_on_handle_closed);
+    }
+    for (uint32_t idx = 0 ; idx < new_handles.size() ; ++idx) {
+        router_map[new_handles[idx]] = this;
+    }
+
+    m_route_handles.swap(new_handles);
+    m_route_urls.swap(new_urls);
+
+    if (NULL != m_route_policy) {
+        m_route_policy->OnRouteChanged(m_route_handles, m_route_urls);
     }
 
     if (m_on_address_changed) {
@@ -116,6 +589,11 @@ void Router::SetOnAddressChanged(const OnAddressChanged& on_address_changed)
     }
 }
 
+void Router::SetOnHandleClosed(const OnHandleClosed& on_handle_closed)
+{
+    m_on_handle_closed = on_handle_closed;
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////
 // 避免全局变量构造、析构顺序问题
 static cxx::unordered_map<int32_t, cxx::shared_ptr<RouterFactory> > * g_router_factory_map = NULL;
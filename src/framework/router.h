@@ -26,6 +26,7 @@ typedef enum {
     kROUTER_NONE_VALID_HANDLE       =   ROUTER_ERROR_CODE_BASE - 2,
     kROUTER_FACTORY_MAP_NULL        =   ROUTER_ERROR_CODE_BASE - 3,     ///< 名字工厂map为空
     kROUTER_FACTORY_EXISTED         =   ROUTER_ERROR_CODE_BASE - 4,     ///< 名字工厂已存在
+    kROUTER_CIRCUIT_OPEN            =   ROUTER_ERROR_CODE_BASE - 5,     ///< 所有handle均已熔断
 }RouterErrorCode;
 
 class RouterErrorStringRegister {
@@ -35,6 +36,7 @@ public:
         SetErrorString(kROUTER_NONE_VALID_HANDLE, "none valid handle");
         SetErrorString(kROUTER_FACTORY_MAP_NULL, "router factory map is null");
         SetErrorString(kROUTER_FACTORY_EXISTED, "router factory is existed");
+        SetErrorString(kROUTER_CIRCUIT_OPEN, "all handles are circuit open");
     }
 };
 
@@ -45,6 +47,7 @@ typedef enum {
     kROUND_ROUTE,       ///< 轮询路由类型
     kMOD_ROUTE,         ///< 取模路由类型
     kHASH_ROUTE = kMOD_ROUTE,   ///< 哈希路由类型，由外部传入hash_key，因此等价于kMOD_ROUTE
+    kCONSISTENT_HASH_ROUTE,     ///< 一致性哈希路由类型，地址增减时只有少量key的路由发生变化
 }RoutePolicyType;
 
 class IRoutePolicy
@@ -52,6 +55,12 @@ class IRoutePolicy
 public:
     virtual ~IRoutePolicy() {}
     virtual int64_t GetRoute(uint64_t key, const std::vector<int64_t>& handles) = 0;
+
+    /// @brief 目标地址列表变化时由Router调用，策略可在此重建内部数据，避免每次路由时计算
+    /// @param handles 变化后的全量handle列表
+    /// @param urls 与handles一一对应的地址列表
+    virtual void OnRouteChanged(const std::vector<int64_t>& handles,
+        const std::vector<std::string>& urls) {}
 };
 
 class RoundRoutePolicy      :   public IRoutePolicy
@@ -81,6 +90,99 @@ public:
     }
 };
 
+/// @brief 一致性哈希路由，使用带虚拟节点的哈希环，节点位置由地址url决定
+/// @note 哈希环在地址列表变化时重建，路由时做一次二分查找；
+///   传入的handles不含环上选中的handle(熔断或排除)时，顺时针取下一个可用的虚拟节点
+class ConsistentHashRoutePolicy :   public IRoutePolicy
+{
+public:
+    /// @param virtual_node_num 每个地址在哈希环上的虚拟节点数，越大分布越均匀
+    explicit ConsistentHashRoutePolicy(uint32_t virtual_node_num = 160);
+
+    int64_t GetRoute(uint64_t key, const std::vector<int64_t>& handles);
+
+    void OnRouteChanged(const std::vector<int64_t>& handles, const std::vector<std::string>& urls);
+
+private:
+    uint32_t    m_virtual_node_num;
+    /// @brief 哈希环，按哈希值升序排列的<虚拟节点哈希值, handle>
+    std::vector< std::pair<uint64_t, int64_t> > m_ring;
+    /// @brief 排序后的可用handle，沿环查找时二分判断是否可用，复用内存
+    std::vector<int64_t> m_sorted_handles;
+};
+
+/// @brief 从地址列表中移除的handle在途请求全部完成、连接关闭时的回调函数
+/// @param handle 已关闭的handle
+typedef cxx::function<void(int64_t handle)> OnHandleClosed;
+
+/// @brief handle的熔断状态
+typedef enum {
+    kCIRCUIT_CLOSED,    ///< 正常
+    kCIRCUIT_OPEN,      ///< 熔断，不发送请求，直到探测时间
+    kCIRCUIT_HALF_OPEN, ///< 探测请求在途，探测成功恢复正常，失败重新熔断
+}CircuitState;
+
+/// @brief 各handle的访问质量统计，由RPC层在请求发出/完成时上报，供kQUALITY_ROUTE使用
+/// @note 同时维护每个handle的熔断器: 连续传输失败达到门限后熔断，所有路由策略跳过熔断的handle，
+///   RPC请求直接失败；熔断期满后放行一个探测请求，同一handle每个熔断周期最多探测一次
+class RouteQuality
+{
+public:
+    /// @brief 请求发出时调用，在途请求数加1
+    static void OnRequestSent(int64_t handle);
+
+    /// @brief 请求完成(收到响应或超时)时调用，在途请求数减1，并更新时延和错误率的EWMA
+    /// @param handle 请求的目标handle
+    /// @param ret_code 传输层结果，0为成功
+    /// @param time_cost_ms 请求耗时
+    static void OnRequestDone(int64_t handle, int32_t ret_code, int64_t time_cost_ms);
+
+    /// @brief 获取handle的负载评分，值越小越优，未统计过的handle评分最低
+    static double GetLoad(int64_t handle);
+
+    /// @brief 请求被主动取消(如对冲请求的落败方)时调用，在途请求数减1，不计入时延和错误率
+    static void OnRequestCancelled(int64_t handle);
+
+    /// @brief handle关闭时清除其统计数据
+    static void Remove(int64_t handle);
+
+    /// @brief handle从地址列表中移除后不再参与路由，等待在途请求全部完成(响应、超时或取消)后
+    ///   关闭连接并清除统计数据，没有在途请求时立即关闭
+    /// @param on_closed 连接关闭后调用，上层可在此时解除handle与处理器的绑定
+    static void Drain(int64_t handle, const OnHandleClosed& on_closed = OnHandleClosed());
+
+    /// @brief handle是否正在等待在途请求完成后关闭
+    static bool IsDraining(int64_t handle);
+
+    /// @brief 判断结果是否为传输层失败(超时、发送失败、服务端过载等)，而非业务结果
+    static bool IsTransportFailed(int32_t ret_code);
+
+    /// @brief 设置熔断参数
+    /// @param failure_threshold 连续传输失败多少次后熔断，0表示关闭熔断，默认为5
+    /// @param open_ms 熔断时长，也是探测请求的最小间隔，默认为1000ms
+    static void SetCircuitBreaker(uint32_t failure_threshold, uint32_t open_ms);
+
+    /// @brief handle当前是否可以发送请求: 未熔断，或者熔断期满且没有在途的探测请求
+    static bool AllowRequest(int64_t handle);
+
+    /// @brief 是否有任意handle处于熔断状态，没有时路由无需逐个检查handle
+    static bool HasOpenCircuit();
+
+    /// @brief 获取handle的熔断状态
+    static CircuitState GetCircuitState(int64_t handle);
+};
+
+/// @brief 根据访问质量路由，随机选取两个候选(power of two choices)，取负载评分较低者
+/// @note 负载评分 = (时延EWMA + 1) * (在途请求数 + 1) / (1 - 错误率EWMA)
+class QualityRoutePolicy    :   public IRoutePolicy
+{
+public:
+    QualityRoutePolicy();
+    int64_t GetRoute(uint64_t key, const std::vector<int64_t>& handles);
+private:
+    uint32_t    m_seed;
+};
+
 /// @brief 目标地址列表变化回调函数
 /// @param handles 变化后的全量handle列表
 typedef cxx::function<void(const std::vector<int64_t>& handles)> OnAddressChanged;
@@ -115,15 +217,39 @@ public:
     /// @param on_address_changed 当地址列表发生变化时，调用此函数
     virtual void SetOnAddressChanged(const OnAddressChanged& on_address_changed);
 
+    /// @brief 设置地址移除的handle在途请求完成、连接关闭时的回调函数
+    /// @param on_handle_closed 移除的handle关闭时调用，在此之前该handle上的响应仍会到达
+    /// @note 回调在地址移除时复制给正在等待关闭的handle，router析构后仍可能被调用
+    virtual void SetOnHandleClosed(const OnHandleClosed& on_handle_closed);
+
+    /// @brief 根据key获取路由，跳过指定的handle，用于对冲、重试等需要换一个目标的场景
+    /// @param key 传入的key
+    /// @param excludes 不参与路由的handle列表
+    /// @return 非负数 - 成功，其它失败@see RouterErrorCode
+    virtual int64_t GetRouteExclude(uint64_t key, const std::vector<int64_t>& excludes);
+
+    /// @brief 查找handle所属的Router
+    /// @return handle由某个Router连接时返回该Router，否则返回NULL
+    static Router* GetRouterByHandle(int64_t handle);
+
 protected:
     void NameWatch(const std::string& name, const std::vector<std::string>& urls);
 
+    // 在未排除且未熔断的handle中路由
+    int64_t GetRouteAvailable(uint64_t key, const std::vector<int64_t>* excludes);
+
+    // 本Router的handle中是否有未恢复的熔断，其他Router的熔断不影响本Router的路由
+    bool HasOpenCircuit() const;
+
     std::string             m_route_name;
     RoutePolicyType         m_route_type;
     IRoutePolicy*           m_route_policy;
     Naming*                 m_naming;
     std::vector<int64_t>    m_route_handles;
+    std::vector<std::string> m_route_urls;
     OnAddressChanged        m_on_address_changed;
+    OnHandleClosed          m_on_handle_closed;
+    std::vector<int64_t>    m_available_handles;    // 过滤后的候选handle，复用内存
 };
 
 class RouterFactory {
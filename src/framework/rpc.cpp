@@ -11,12 +11,15 @@
  *
  */
 
+#include <algorithm>
 #include <sstream>
+#include <stdlib.h>
 #include <string.h>
 
 #include "common/log.h"
 #include "common/timer.h"
 #include "common/time_utility.h"
+#include "framework/router.h"
 #include "framework/rpc.h"
 
 namespace pebble {
@@ -38,6 +41,15 @@ public:
         m_timerid     = -1;
         m_start_time  = 0;
         m_server_side = false;
+        m_next        = NULL;
+        m_retryable   = false;
+        m_backoff     = false;
+        m_attempts    = 0;
+        m_deadline    = 0;
+        m_cache_ttl   = 0;
+        m_stream      = false;
+        m_stream_window = 0;
+        m_stream_credit = 0;
     }
 
     uint64_t m_session_id;
@@ -47,13 +59,72 @@ public:
     RpcHead  m_rpc_head;
     bool     m_server_side;
     OnRpcResponse m_rsp;
+
+    RpcSession* m_next;     // 会话哈希桶链表
+
+    // 自动重试，重试时m_rpc_head中为本次尝试的会话ID，只接受本次尝试的响应
+    bool     m_retryable;
+    bool     m_backoff;         // 正在退避等待，请求未发出
+    uint32_t m_attempts;
+    int64_t  m_deadline;        // 原请求的超时时刻，各次尝试共用
+    std::string m_retry_data;
+    std::vector<int64_t> m_tried_handles;
+
+    // 响应缓存，成功的响应以m_cache_key写入缓存
+    uint32_t m_cache_ttl;
+    std::string m_cache_key;
+
+    // 流式调用，客户端的m_stream_credit为已确认未通知的帧数，服务端为剩余可发送的帧数
+    bool     m_stream;
+    uint32_t m_stream_window;
+    uint32_t m_stream_credit;
+    OnRpcStream m_on_frame;
+    cxx::function<void()> m_on_credit; // 服务端等待窗口的回调
 };
 
+// 会话哈希桶初始大小，会话数超过桶数时翻倍
+static const uint32_t kSESSION_BUCKET_INIT_SIZE = 1024;
+// 重试预算令牌上限，即空闲后允许的突发重试数
+static const double kRETRY_MAX_TOKENS = 10.0;
+// 拒绝级别的调整周期，过载持续一个周期升一级，不过载的周期降一级
+static const int64_t kSHED_WINDOW_MS = 100;
+// 响应缓存默认的字节数上限
+static const uint64_t kRESPONSE_CACHE_MAX_BYTES = 16 * 1024 * 1024;
+// 流式请求的默认窗口
+static const uint32_t kSTREAM_DEFAULT_WINDOW = 16;
+// 不在分发流式请求时的会话ID，会话ID递增使用，不会取到此值
+static const uint64_t kINVALID_SESSION_ID = static_cast<uint64_t>(-1);
+
+static inline void WriteUint32(uint32_t value, uint8_t* buff) {
+    buff[0] = static_cast<uint8_t>(value >> 24);
+    buff[1] = static_cast<uint8_t>(value >> 16);
+    buff[2] = static_cast<uint8_t>(value >> 8);
+    buff[3] = static_cast<uint8_t>(value);
+}
+
+static inline uint32_t ReadUint32(const uint8_t* buff) {
+    return (static_cast<uint32_t>(buff[0]) << 24) | (static_cast<uint32_t>(buff[1]) << 16)
+        | (static_cast<uint32_t>(buff[2]) << 8) | static_cast<uint32_t>(buff[3]);
+}
+
 // TODO: timer改为外部传入
 IRpc::IRpc() {
     m_session_id        = 0;
-    m_timer             = new SequenceTimer();
+    m_timer             = new WheelTimer();
     m_proc_req_timeout_ms = REQ_PROC_TIMEOUT_MS;
+    m_use_function_id   = false;
+    m_propagate_timeout = false;
+    m_retry_budget_ratio = 0.1;
+    m_retry_tokens      = kRETRY_MAX_TOKENS;
+    m_retry_seed        = static_cast<uint32_t>(TimeUtility::GetCurrentUS());
+    m_shed_level        = kRPC_PRIORITY_LOW;
+    m_shed_window_start_ms = 0;
+    m_shed_window_overload = false;
+    m_session_num       = 0;
+    m_session_buckets.resize(kSESSION_BUCKET_INIT_SIZE, NULL);
+    m_response_cache.SetMaxBytes(kRESPONSE_CACHE_MAX_BYTES);
+    m_batch_reply_handle = -1;
+    m_stream_session_id = kINVALID_SESSION_ID;
 }
 
 IRpc::~IRpc() {
@@ -61,6 +132,17 @@ IRpc::~IRpc() {
         delete m_timer;
         m_timer = NULL;
     }
+
+    for (uint32_t idx = 0; idx < m_session_buckets.size(); ++idx) {
+        while (m_session_buckets[idx]) {
+            RpcSession* session = m_session_buckets[idx];
+            m_session_buckets[idx] = session->m_next;
+            delete session;
+        }
+    }
+    for (uint32_t idx = 0; idx < m_free_sessions.size(); ++idx) {
+        delete m_free_sessions[idx];
+    }
 }
 
 int32_t IRpc::Update() {
@@ -68,6 +150,8 @@ int32_t IRpc::Update() {
     if (m_timer) {
         num += m_timer->Update();
     }
+    num += ProcessCachedResponses();
+    num += FlushBatches();
 
     return num;
 }
@@ -103,9 +187,10 @@ int32_t IRpc::OnMessage(int64_t handle, const uint8_t* msg,
     int32_t ret = kRPC_UNKNOWN_TYPE;
     switch (head.m_message_type) {
         case kRPC_CALL:
-            if (is_overload != 0) {
+        case kRPC_STREAM_CALL:
+            if (ShedRequest(head, is_overload)) {
                 ret = ResponseException(handle, kRPC_SYSTEM_OVERLOAD_BASE - is_overload, head);
-                RequestProcComplete(head.m_function_name, kRPC_SYSTEM_OVERLOAD_BASE - is_overload,
+                RequestProcComplete(GetFunctionName(head), kRPC_SYSTEM_OVERLOAD_BASE - is_overload,
                     head.m_arrived_ms > 0 ? TimeUtility::GetCurrentMS() - head.m_arrived_ms : 0);
                 break;
             }
@@ -118,6 +203,18 @@ int32_t IRpc::OnMessage(int64_t handle, const uint8_t* msg,
             ret = ProcessResponse(head, data, data_len);
             break;
 
+        case kRPC_BATCH:
+            ret = ProcessBatch(handle, data, data_len, msg_info, is_overload);
+            break;
+
+        case kRPC_STREAM_DATA:
+            ret = ProcessStreamData(head, data, data_len);
+            break;
+
+        case kRPC_STREAM_CREDIT:
+            ret = ProcessStreamCredit(handle, head, data, data_len);
+            break;
+
         default:
             PLOG_ERROR_N_EVERY_SECOND(1, "rpc msg type error(%d)", head.m_message_type);
             break;
@@ -127,16 +224,36 @@ int32_t IRpc::OnMessage(int64_t handle, const uint8_t* msg,
 }
 
 int32_t IRpc::AddOnRequestFunction(const std::string& name, const OnRpcRequest& on_request) {
+    return AddOnRequestFunction(name, GenFunctionId(name), on_request);
+}
+
+int32_t IRpc::AddOnRequestFunction(const std::string& name, uint32_t function_id,
+    const OnRpcRequest& on_request) {
     if (name.empty() || !on_request) {
         PLOG_ERROR("param invalid: name = %s, !on_request = %u", name.c_str(), !on_request);
         return kRPC_INVALID_PARAM;
     }
 
-    if (false == m_service_map.insert({name, on_request}).second) {
+    const std::string* exist_name = NULL;
+    if (function_id != 0 && FindFunction(function_id, &exist_name) != NULL) {
+        PLOG_ERROR("the function id %u of %s is conflict with %s",
+            function_id, name.c_str(), exist_name->c_str());
+        return kRPC_FUNCTION_NAME_EXISTED;
+    }
+
+    RpcFunction function(function_id, on_request);
+    cxx::unordered_map<std::string, uint32_t>::iterator pit = m_function_priorities.find(name);
+    if (m_function_priorities.end() != pit) {
+        function.m_priority = pit->second;
+    }
+
+    if (false == m_service_map.insert({name, function}).second) {
         PLOG_ERROR("the %s is existed", name.c_str());
         return kRPC_FUNCTION_NAME_EXISTED;
     }
 
+    RebuildFunctionIndex();
+
     if (m_event_handler) {
         m_event_handler->AddNameToStat(name);
     }
@@ -148,7 +265,125 @@ int32_t IRpc::RemoveOnRequestFunction(const std::string& name) {
     if (m_event_handler) {
         m_event_handler->RemoveNameFromStat(name);
     }
-    return m_service_map.erase(name) == 1 ? kRPC_SUCCESS : kRPC_FUNCTION_NAME_UNEXISTED;
+    if (m_service_map.erase(name) != 1) {
+        return kRPC_FUNCTION_NAME_UNEXISTED;
+    }
+    RebuildFunctionIndex();
+    return kRPC_SUCCESS;
+}
+
+uint32_t IRpc::GenFunctionId(const std::string& name) {
+    // FNV-1a，需要和IDL编译器中的实现保持一致
+    uint32_t hash = 2166136261u;
+    for (std::string::const_iterator it = name.begin(); it != name.end(); ++it) {
+        hash ^= static_cast<uint8_t>(*it);
+        hash *= 16777619u;
+    }
+    // 0为无效ID
+    return hash != 0 ? hash : 1;
+}
+
+void IRpc::RebuildFunctionIndex() {
+    // 装载因子不超过0.5，保证线性探测总能遇到空槽位
+    uint32_t capacity = 16;
+    while (capacity < m_service_map.size() * 2) {
+        capacity <<= 1;
+    }
+
+    FunctionSlot empty_slot = { NULL, NULL };
+    m_function_index.assign(capacity, empty_slot);
+
+    uint32_t mask = capacity - 1;
+    for (cxx::unordered_map<std::string, RpcFunction>::iterator it = m_service_map.begin();
+        it != m_service_map.end(); ++it) {
+        if (0 == it->second.m_function_id) {
+            continue;
+        }
+        uint32_t idx = it->second.m_function_id & mask;
+        while (m_function_index[idx]._function != NULL) {
+            idx = (idx + 1) & mask;
+        }
+        m_function_index[idx]._name     = &(it->first);
+        m_function_index[idx]._function = &(it->second);
+    }
+}
+
+const RpcFunction* IRpc::FindFunction(uint32_t function_id, const std::string** name) const {
+    if (m_function_index.empty() || 0 == function_id) {
+        return NULL;
+    }
+
+    uint32_t mask = m_function_index.size() - 1;
+    for (uint32_t idx = function_id & mask; m_function_index[idx]._function != NULL; idx = (idx + 1) & mask) {
+        if (m_function_index[idx]._function->m_function_id == function_id) {
+            if (name) {
+                *name = m_function_index[idx]._name;
+            }
+            return m_function_index[idx]._function;
+        }
+    }
+    return NULL;
+}
+
+int32_t IRpc::SetFunctionPriority(const std::string& name, uint32_t priority) {
+    if (name.empty() || priority > kRPC_PRIORITY_CRITICAL) {
+        PLOG_ERROR("param invalid: name = %s, priority = %u", name.c_str(), priority);
+        return kRPC_INVALID_PARAM;
+    }
+
+    m_function_priorities[name] = priority;
+
+    cxx::unordered_map<std::string, RpcFunction>::iterator it = m_service_map.find(name);
+    if (m_service_map.end() != it) {
+        it->second.m_priority = priority;
+    }
+
+    return kRPC_SUCCESS;
+}
+
+bool IRpc::ShedRequest(const RpcHead& rpc_head, uint32_t is_overload) {
+    // 按周期调整拒绝级别: 过载持续则多拒绝一级，空闲的周期逐级恢复
+    int64_t now = TimeUtility::GetCurrentMS();
+    if (now - m_shed_window_start_ms >= kSHED_WINDOW_MS) {
+        int64_t windows = (now - m_shed_window_start_ms) / kSHED_WINDOW_MS;
+        if (m_shed_window_overload) {
+            if (m_shed_level + 1 < kRPC_PRIORITY_CRITICAL) {
+                ++m_shed_level;
+            }
+            --windows;
+        }
+        m_shed_level = windows >= m_shed_level ? 0 : m_shed_level - windows;
+        m_shed_window_start_ms = now;
+        m_shed_window_overload = false;
+    }
+
+    if (0 == is_overload) {
+        return false;
+    }
+    m_shed_window_overload = true;
+
+    // 只查找服务注册信息，不解码请求体，找不到的方法按最低优先级处理
+    const RpcFunction* function = NULL;
+    if (rpc_head.m_function_name.empty()) {
+        function = FindFunction(rpc_head.m_function_id, NULL);
+    } else {
+        cxx::unordered_map<std::string, RpcFunction>::iterator it =
+            m_service_map.find(rpc_head.m_function_name);
+        if (m_service_map.end() != it) {
+            function = &(it->second);
+        }
+    }
+
+    uint32_t priority = function ? function->m_priority : static_cast<uint32_t>(kRPC_PRIORITY_LOW);
+    return priority <= m_shed_level;
+}
+
+const std::string& IRpc::GetFunctionName(const RpcHead& rpc_head) const {
+    const std::string* name = NULL;
+    if (rpc_head.m_function_name.empty() && FindFunction(rpc_head.m_function_id, &name) != NULL) {
+        return *name;
+    }
+    return rpc_head.m_function_name;
 }
 
 void IRpc::GetResourceUsed(cxx::unordered_map<std::string, int64_t>* resource_info) {
@@ -161,7 +396,17 @@ void IRpc::GetResourceUsed(cxx::unordered_map<std::string, int64_t>* resource_in
 
     std::ostringstream session;
     session << "Rpc(" << this << "):session";
-    (*resource_info)[session.str()] = m_session_map.size();
+    (*resource_info)[session.str()] = m_session_num;
+
+    if (m_cache_ttls.empty() && 0 == m_response_cache.GetSize()) {
+        return;
+    }
+    std::ostringstream cache;
+    cache << "Rpc(" << this << "):cache_";
+    (*resource_info)[cache.str() + "hit"]      = m_response_cache.GetHits();
+    (*resource_info)[cache.str() + "miss"]     = m_response_cache.GetMisses();
+    (*resource_info)[cache.str() + "eviction"] = m_response_cache.GetEvictions();
+    (*resource_info)[cache.str() + "bytes"]    = m_response_cache.GetBytes();
     return;
 }
 
@@ -177,35 +422,627 @@ int32_t IRpc::SendRequest(int64_t handle,
         return kRPC_INVALID_PARAM;
     }
 
+    if (timeout_ms <= 0) {
+        timeout_ms = 10 * 1000;
+    }
+    // 超时时间随请求头发送给服务端，服务端据此丢弃已超时的请求，调用方的请求头保持不变
+    m_send_head = rpc_head;
+    if (on_rsp) {
+        m_send_head.m_timeout_ms = timeout_ms;
+    }
+    const RpcHead& head = m_send_head;
+
+    // 可缓存的方法先查缓存，命中时不发送请求
+    uint32_t cache_ttl = 0;
+    if (on_rsp && !m_cache_ttls.empty()) {
+        cxx::unordered_map<std::string, uint32_t>::iterator it =
+            m_cache_ttls.find(head.m_function_name);
+        if (it != m_cache_ttls.end()) {
+            cache_ttl = it->second;
+            m_cache_key.assign(head.m_function_name);
+            m_cache_key.push_back('\0');
+            if (buff_len > 0) {
+                m_cache_key.append(reinterpret_cast<const char*>(buff), buff_len);
+            }
+            ResponseCache::Data data = m_response_cache.Get(m_cache_key);
+            if (data) {
+                m_cached_responses.push_back(CachedResponse());
+                CachedResponse& cached = m_cached_responses.back();
+                cached._session_id    = head.m_session_id;
+                cached._rsp           = on_rsp;
+                cached._data          = data;
+                cached._function_name = head.m_function_name;
+                return kRPC_SUCCESS;
+            }
+        }
+    }
+
+    // 目标已熔断时直接失败，不占用会话等待超时
+    if (on_rsp && !RouteQuality::AllowRequest(handle)) {
+        ResponseProcComplete(head.m_function_name, kRPC_CIRCUIT_OPEN, 0);
+        return kRPC_CIRCUIT_OPEN;
+    }
+
     // 发送请求
-    int32_t ret = SendMessage(handle, rpc_head, buff, buff_len);
+    int32_t ret = SendMessage(handle, head, buff, buff_len);
     if (ret != kRPC_SUCCESS) {
-        ResponseProcComplete(rpc_head.m_function_name, kRPC_SEND_FAILED, 0);
+        ResponseProcComplete(head.m_function_name, kRPC_SEND_FAILED, 0);
         return ret;
     }
 
     // ONEWAY请求
     if (!on_rsp) {
-        ResponseProcComplete(rpc_head.m_function_name, kRPC_SUCCESS, 0);
+        ResponseProcComplete(head.m_function_name, kRPC_SUCCESS, 0);
         return kRPC_SUCCESS;
     }
 
     // 保持会话
-    cxx::shared_ptr<RpcSession> session(new RpcSession());
-    session->m_session_id  = rpc_head.m_session_id;
+    RpcSession* session    = AllocSession(head.m_session_id);
     session->m_handle      = handle;
     session->m_rsp         = on_rsp;
-    session->m_rpc_head    = rpc_head;
+    session->m_rpc_head    = head;
     session->m_server_side = false;
-    TimeoutCallback cb     = cxx::bind(&IRpc::OnTimeout, this, session->m_session_id);
+
+    session->m_timerid     = m_timer->StartTimer(timeout_ms, &IRpc::OnSessionTimeout,
+        this, session->m_session_id);
+    session->m_start_time  = TimeUtility::GetCurrentMS();
+    session->m_attempts    = 1;
+
+    // 重试时需要重发请求数据，会话复用时字符串容量也被复用
+    if (!m_retry_policies.empty()
+        && m_retry_policies.find(head.m_function_name) != m_retry_policies.end()) {
+        session->m_retryable = true;
+        session->m_deadline  = session->m_start_time + timeout_ms;
+        session->m_retry_data.assign(reinterpret_cast<const char*>(buff), buff_len);
+        session->m_tried_handles.push_back(handle);
+    }
+
+    // 缓存key的内存随会话复用
+    if (cache_ttl > 0) {
+        session->m_cache_ttl = cache_ttl;
+        session->m_cache_key.swap(m_cache_key);
+    }
+
+    RouteQuality::OnRequestSent(handle);
+
+    return kRPC_SUCCESS;
+}
+
+int32_t IRpc::SendStreamRequest(int64_t handle,
+                    const RpcHead& rpc_head,
+                    const uint8_t* buff,
+                    uint32_t buff_len,
+                    const OnRpcStream& on_frame,
+                    const OnRpcResponse& on_rsp,
+                    int32_t timeout_ms,
+                    uint32_t window) {
+    if ((buff_len != 0 && NULL == buff) || !on_frame || !on_rsp) {
+        PLOG_ERROR_N_EVERY_SECOND(1, "param invalid: buff = %p, buff_len = %u, !on_frame = %d, !on_rsp = %d",
+            buff, buff_len, !on_frame, !on_rsp);
+        return kRPC_INVALID_PARAM;
+    }
 
     if (timeout_ms <= 0) {
         timeout_ms = 10 * 1000;
     }
-    session->m_timerid     = m_timer->StartTimer(timeout_ms, cb);
+    if (0 == window) {
+        window = kSTREAM_DEFAULT_WINDOW;
+    }
+    m_send_head = rpc_head;
+    m_send_head.m_message_type = kRPC_STREAM_CALL;
+    m_send_head.m_timeout_ms   = timeout_ms;
+    const RpcHead& head = m_send_head;
+
+    if (!RouteQuality::AllowRequest(handle)) {
+        ResponseProcComplete(head.m_function_name, kRPC_CIRCUIT_OPEN, 0);
+        return kRPC_CIRCUIT_OPEN;
+    }
+
+    // 初始窗口放在数据部分之前
+    uint8_t window_buff[sizeof(uint32_t)];
+    WriteUint32(window, window_buff);
+    m_stream_request.assign(reinterpret_cast<const char*>(window_buff), sizeof(window_buff));
+    if (buff_len > 0) {
+        m_stream_request.append(reinterpret_cast<const char*>(buff), buff_len);
+    }
+
+    int32_t ret = SendMessage(handle, head,
+        reinterpret_cast<const uint8_t*>(m_stream_request.data()), m_stream_request.size());
+    if (ret != kRPC_SUCCESS) {
+        ResponseProcComplete(head.m_function_name, kRPC_SEND_FAILED, 0);
+        return ret;
+    }
+
+    RpcSession* session    = AllocSession(head.m_session_id);
+    session->m_handle      = handle;
+    session->m_rsp         = on_rsp;
+    session->m_rpc_head    = head;
+    session->m_server_side = false;
+    session->m_stream      = true;
+    session->m_stream_window = window;
+    session->m_stream_credit = 0;
+    session->m_on_frame    = on_frame;
+
+    session->m_timerid     = m_timer->StartTimer(timeout_ms, &IRpc::OnSessionTimeout,
+        this, session->m_session_id);
     session->m_start_time  = TimeUtility::GetCurrentMS();
 
-    m_session_map[session->m_session_id] = session;
+    RouteQuality::OnRequestSent(handle);
+
+    return kRPC_SUCCESS;
+}
+
+int32_t IRpc::AckStream(uint64_t session_id, uint32_t num) {
+    RpcSession* session = FindSession(session_id);
+    if (NULL == session || !session->m_stream || session->m_server_side) {
+        return kRPC_SESSION_NOT_FOUND;
+    }
+
+    // 累计确认半个窗口后再通知，减少窗口增量消息数
+    session->m_stream_credit += num;
+    uint32_t threshold = session->m_stream_window / 2;
+    if (session->m_stream_credit < (threshold > 0 ? threshold : 1)) {
+        return kRPC_SUCCESS;
+    }
+
+    int32_t ret = SendStreamCredit(session, session->m_stream_credit);
+    session->m_stream_credit = 0;
+    return ret;
+}
+
+int32_t IRpc::SendStreamCredit(RpcSession* session, uint32_t credit) {
+    uint8_t buff[sizeof(uint32_t)];
+    WriteUint32(credit, buff);
+
+    session->m_rpc_head.m_message_type = kRPC_STREAM_CREDIT;
+    int32_t ret = SendMessage(session->m_handle, session->m_rpc_head, buff, sizeof(buff));
+    session->m_rpc_head.m_message_type = kRPC_STREAM_CALL;
+    return ret;
+}
+
+int32_t IRpc::ProcessStreamData(const RpcHead& rpc_head, const uint8_t* buff, uint32_t buff_len) {
+    RpcSession* session = FindSession(rpc_head.m_session_id);
+    if (NULL == session || !session->m_stream || session->m_server_side) {
+        PLOG_ERROR_N_EVERY_SECOND(1, "stream session(%lu) not found, function_name(%s)",
+            rpc_head.m_session_id, rpc_head.m_function_name.c_str());
+        return kRPC_SESSION_NOT_FOUND;
+    }
+
+    // 超时时间为等待下一帧的时间
+    m_timer->StopTimer(session->m_timerid);
+    session->m_timerid = m_timer->StartTimer(session->m_rpc_head.m_timeout_ms,
+        &IRpc::OnSessionTimeout, this, session->m_session_id);
+
+    // 回调中可能取消流式请求，会话被释放
+    OnRpcStream on_frame(session->m_on_frame);
+    return on_frame(buff, buff_len);
+}
+
+int32_t IRpc::ProcessStreamCredit(int64_t handle, const RpcHead& rpc_head,
+    const uint8_t* buff, uint32_t buff_len) {
+    // 流式调用结束后仍可能收到窗口增量，直接忽略
+    std::map<std::pair<int64_t, uint64_t>, uint64_t>::iterator it =
+        m_stream_sessions.find(std::make_pair(handle, rpc_head.m_session_id));
+    if (m_stream_sessions.end() == it) {
+        return kRPC_SESSION_NOT_FOUND;
+    }
+    RpcSession* session = FindSession(it->second);
+    if (NULL == session) {
+        return kRPC_SESSION_NOT_FOUND;
+    }
+
+    if (buff_len < sizeof(uint32_t)) {
+        PLOG_ERROR_N_EVERY_SECOND(1, "stream credit len %u invalid", buff_len);
+        return kRPC_DECODE_FAILED;
+    }
+
+    uint32_t credit = ReadUint32(buff);
+    if (0 == credit) {
+        // 调用方已取消，不再发送响应
+        m_timer->StopTimer(session->m_timerid);
+        RequestProcComplete(GetFunctionName(session->m_rpc_head),
+            kRPC_STREAM_CANCELLED, TimeUtility::GetCurrentMS() - session->m_start_time);
+        FreeSession(session);
+        return kRPC_SUCCESS;
+    }
+
+    session->m_stream_credit += credit;
+
+    if (session->m_on_credit) {
+        cxx::function<void()> on_credit;
+        on_credit.swap(session->m_on_credit);
+        on_credit();
+    }
+    return kRPC_SUCCESS;
+}
+
+int32_t IRpc::SetStreamCreditCallback(uint64_t session_id, const cxx::function<void()>& on_credit) {
+    RpcSession* session = FindSession(session_id);
+    if (NULL == session || !session->m_stream || !session->m_server_side) {
+        return kRPC_SESSION_NOT_FOUND;
+    }
+    session->m_on_credit = on_credit;
+    return kRPC_SUCCESS;
+}
+
+int32_t IRpc::SendStreamFrame(uint64_t session_id, const uint8_t* buff, uint32_t buff_len) {
+    if (buff_len != 0 && NULL == buff) {
+        PLOG_ERROR_N_EVERY_SECOND(1, "param invalid: buff = %p, buff_len = %u", buff, buff_len);
+        return kRPC_INVALID_PARAM;
+    }
+
+    RpcSession* session = FindSession(session_id);
+    if (NULL == session || !session->m_stream || !session->m_server_side) {
+        PLOG_ERROR_N_EVERY_SECOND(1, "stream session(%lu) not found", session_id);
+        return kRPC_SESSION_NOT_FOUND;
+    }
+
+    std::string data;
+    while (0 == session->m_stream_credit) {
+        // 等待期间其他协程可能复用编码buff，先保存帧数据
+        if (data.empty() && buff_len > 0) {
+            data.assign(reinterpret_cast<const char*>(buff), buff_len);
+            buff = reinterpret_cast<const uint8_t*>(data.data());
+        }
+        int32_t ret = OnStreamBlocked(session_id);
+        if (ret != kRPC_SUCCESS) {
+            return ret;
+        }
+        // 等待期间调用方可能取消或会话超时
+        session = FindSession(session_id);
+        if (NULL == session) {
+            return kRPC_STREAM_CANCELLED;
+        }
+    }
+
+    session->m_rpc_head.m_message_type = kRPC_STREAM_DATA;
+    int32_t ret = SendMessage(session->m_handle, session->m_rpc_head, buff, buff_len);
+    if (ret != kRPC_SUCCESS) {
+        return ret;
+    }
+    --(session->m_stream_credit);
+    return kRPC_SUCCESS;
+}
+
+void IRpc::SetRetryPolicy(const std::string& name, const RetryPolicy& policy) {
+    if (policy._max_attempts <= 1) {
+        m_retry_policies.erase(name);
+        return;
+    }
+    m_retry_policies[name] = policy;
+}
+
+void IRpc::SetBatchPolicy(const BatchPolicy& policy) {
+    m_batch_policy = policy;
+    // 关闭时已缓存的请求在下一次Update时发出
+    if (m_batch_policy._max_batch_num <= 1) {
+        m_batch_policy._max_delay_ms = 0;
+    }
+}
+
+int32_t IRpc::ProcessBatch(int64_t handle, const uint8_t* buff, uint32_t buff_len,
+    const MsgExternInfo* msg_info, uint32_t is_overload) {
+    if (m_batch_reply_handle >= 0) {
+        PLOG_ERROR_N_EVERY_SECOND(1, "nested batch message from handle %ld", handle);
+        return kRPC_UNKNOWN_TYPE;
+    }
+
+    m_batch_reply_handle = handle;
+    int32_t ret = kRPC_SUCCESS;
+    uint32_t pos = 0;
+    while (pos < buff_len) {
+        if (buff_len - pos < sizeof(uint32_t)) {
+            ret = kRPC_DECODE_FAILED;
+            break;
+        }
+        uint32_t msg_len = ReadUint32(buff + pos);
+        pos += sizeof(uint32_t);
+        if (msg_len > buff_len - pos) {
+            ret = kRPC_DECODE_FAILED;
+            break;
+        }
+        OnMessage(handle, buff + pos, msg_len, msg_info, is_overload);
+        pos += msg_len;
+    }
+    m_batch_reply_handle = -1;
+
+    if (ret != kRPC_SUCCESS) {
+        PLOG_ERROR_N_EVERY_SECOND(1, "batch message decode failed, pos = %u, len = %u", pos, buff_len);
+    }
+
+    cxx::unordered_map<int64_t, BatchBuffer>::iterator it = m_batches.find(handle);
+    if (it != m_batches.end()) {
+        FlushBatch(handle, &(it->second));
+    }
+
+    return ret;
+}
+
+bool IRpc::IsBatchable(int64_t handle, const RpcHead& rpc_head, uint32_t msg_len) const {
+    // 经其他processor转发的消息原路返回，不合并
+    if (rpc_head.m_dst != NULL || msg_len > m_batch_policy._max_batch_bytes) {
+        return false;
+    }
+    switch (rpc_head.m_message_type) {
+        case kRPC_CALL:
+        case kRPC_ONEWAY:
+            return m_batch_policy._max_batch_num > 1;
+
+        case kRPC_REPLY:
+        case kRPC_EXCEPTION:
+            return handle == m_batch_reply_handle;
+
+        default:
+            break;
+    }
+    return false;
+}
+
+int32_t IRpc::AppendBatch(int64_t handle, uint32_t head_len, const uint8_t* buff, uint32_t buff_len) {
+    BatchBuffer& batch = m_batches[handle];
+    uint32_t msg_len = head_len + buff_len;
+    if (batch._data.size() + sizeof(uint32_t) + msg_len > m_batch_policy._max_batch_bytes) {
+        FlushBatch(handle, &batch);
+    }
+
+    if (0 == batch._num) {
+        batch._start_ms = TimeUtility::GetCurrentMS();
+    }
+    char len_buff[sizeof(uint32_t)] = {
+        static_cast<char>(msg_len >> 24), static_cast<char>(msg_len >> 16),
+        static_cast<char>(msg_len >> 8),  static_cast<char>(msg_len)
+    };
+    batch._data.append(len_buff, sizeof(len_buff));
+    batch._data.append(reinterpret_cast<const char*>(m_rpc_head_buff), head_len);
+    if (buff_len > 0) {
+        batch._data.append(reinterpret_cast<const char*>(buff), buff_len);
+    }
+    ++batch._num;
+
+    if (m_batch_policy._max_batch_num > 1 && batch._num >= m_batch_policy._max_batch_num) {
+        return FlushBatch(handle, &batch);
+    }
+    return kRPC_SUCCESS;
+}
+
+int32_t IRpc::FlushBatch(int64_t handle, BatchBuffer* batch) {
+    if (0 == batch->_num) {
+        return kRPC_SUCCESS;
+    }
+
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(batch->_data.data());
+    int32_t ret = kRPC_SUCCESS;
+    if (1 == batch->_num) {
+        // 只有一个消息时去掉长度前缀按普通消息发送
+        const uint8_t* msg_frag[] = { data + sizeof(uint32_t) };
+        uint32_t msg_frag_len[]   = { static_cast<uint32_t>(batch->_data.size() - sizeof(uint32_t)) };
+        ret = SendV(handle, 1, msg_frag, msg_frag_len, 0);
+    } else {
+        RpcHead rpc_head;
+        rpc_head.m_message_type = kRPC_BATCH;
+        int32_t head_len = HeadEncode(rpc_head, m_batch_head_buff, sizeof(m_batch_head_buff));
+        if (head_len < 0) {
+            ret = kRPC_ENCODE_FAILED;
+        } else {
+            const uint8_t* msg_frag[] = { m_batch_head_buff,  data };
+            uint32_t msg_frag_len[]   = { (uint32_t)head_len, static_cast<uint32_t>(batch->_data.size()) };
+            ret = SendV(handle, sizeof(msg_frag)/sizeof(*msg_frag), msg_frag, msg_frag_len, 0);
+        }
+    }
+
+    if (ret != kRPC_SUCCESS) {
+        PLOG_ERROR_N_EVERY_SECOND(1, "send batch failed %d, handle = %ld, num = %u",
+            ret, handle, batch->_num);
+    }
+
+    batch->_data.clear();
+    batch->_num = 0;
+    return ret;
+}
+
+int32_t IRpc::FlushBatches() {
+    if (m_batches.empty()) {
+        return 0;
+    }
+
+    int32_t num = 0;
+    int64_t now = TimeUtility::GetCurrentMS();
+    cxx::unordered_map<int64_t, BatchBuffer>::iterator it = m_batches.begin();
+    while (it != m_batches.end()) {
+        if (0 == it->second._num
+            || now - it->second._start_ms < static_cast<int64_t>(m_batch_policy._max_delay_ms)) {
+            ++it;
+            continue;
+        }
+        ++num;
+        // 发送失败时连接可能已关闭，释放缓存
+        if (FlushBatch(it->first, &(it->second)) != kRPC_SUCCESS) {
+            m_batches.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+
+    return num;
+}
+
+void IRpc::SetResponseCache(const std::string& name, uint32_t ttl_ms) {
+    if (0 == ttl_ms) {
+        m_cache_ttls.erase(name);
+        return;
+    }
+    m_cache_ttls[name] = ttl_ms;
+}
+
+int32_t IRpc::ProcessCachedResponses() {
+    if (m_cached_responses.empty()) {
+        return 0;
+    }
+
+    // 回调中可能发起新的请求再次命中缓存，新命中的请求在下一次Update时回调
+    m_processing_responses.swap(m_cached_responses);
+    int32_t num = 0;
+    for (uint32_t idx = 0; idx < m_processing_responses.size(); ++idx) {
+        CachedResponse& cached = m_processing_responses[idx];
+        if (!cached._rsp) {
+            continue; // 已取消
+        }
+        int32_t ret = cached._rsp(kRPC_SUCCESS,
+            reinterpret_cast<const uint8_t*>(cached._data->data()), cached._data->size());
+        ResponseProcComplete(cached._function_name, ret, 0);
+        ++num;
+    }
+    m_processing_responses.clear();
+
+    return num;
+}
+
+bool IRpc::RetryRequest(RpcSession* session, int32_t ret) {
+    if (kRPC_SUCCESS == ret) {
+        return false;
+    }
+
+    cxx::unordered_map<std::string, RetryPolicy>::iterator it =
+        m_retry_policies.find(session->m_rpc_head.m_function_name);
+    if (m_retry_policies.end() == it || session->m_attempts >= it->second._max_attempts) {
+        return false;
+    }
+
+    const RetryPolicy& policy = it->second;
+    if (policy._retry_codes.empty() ? !RouteQuality::IsTransportFailed(ret)
+        : std::find(policy._retry_codes.begin(), policy._retry_codes.end(), ret)
+            == policy._retry_codes.end()) {
+        return false;
+    }
+
+    // 退避后剩余的时间不足以再尝试一次时不重试
+    int32_t backoff_ms = 0;
+    if (policy._backoff_ms > 0) {
+        uint32_t shift = session->m_attempts - 1;
+        int64_t backoff = static_cast<int64_t>(policy._backoff_ms) << (shift < 20 ? shift : 20);
+        if (backoff > policy._max_backoff_ms) {
+            backoff = policy._max_backoff_ms;
+        }
+        backoff_ms = static_cast<int32_t>(backoff / 2 + rand_r(&m_retry_seed) % (backoff / 2 + 1));
+    }
+    if (session->m_deadline - TimeUtility::GetCurrentMS() <= backoff_ms) {
+        return false;
+    }
+
+    if (m_retry_tokens < 1.0) {
+        PLOG_ERROR_N_EVERY_SECOND(1, "retry budget exhausted, function_name(%s)",
+            session->m_rpc_head.m_function_name.c_str());
+        return false;
+    }
+    m_retry_tokens -= 1.0;
+
+    // 优先选择未尝试过的目标，都尝试过时避开最近一次的目标，无Router时只能重试原handle
+    Router* router = Router::GetRouterByHandle(session->m_handle);
+    if (router != NULL) {
+        int64_t handle = router->GetRouteExclude(session->m_session_id, session->m_tried_handles);
+        if (handle < 0) {
+            handle = router->GetRouteExclude(session->m_session_id,
+                std::vector<int64_t>(1, session->m_handle));
+        }
+        if (handle >= 0) {
+            session->m_handle = handle;
+        }
+    }
+    session->m_tried_handles.push_back(session->m_handle);
+    ++(session->m_attempts);
+
+    // 之前的尝试已上报过结果，退避期间收到的响应都按迟到响应丢弃
+    if (session->m_rpc_head.m_session_id != session->m_session_id) {
+        m_retry_session_ids.erase(session->m_rpc_head.m_session_id);
+    }
+    session->m_rpc_head.m_session_id = session->m_session_id;
+
+    if (backoff_ms > 0) {
+        session->m_backoff = true;
+        session->m_timerid = m_timer->StartTimer(backoff_ms, &IRpc::OnRetryTimeout,
+            this, session->m_session_id);
+        return true;
+    }
+
+    SendRetry(session);
+    return true;
+}
+
+void IRpc::SendRetry(RpcSession* session) {
+    session->m_backoff = false;
+    int64_t remain_ms = session->m_deadline - TimeUtility::GetCurrentMS();
+    int32_t ret = kRPC_CIRCUIT_OPEN;
+    if (remain_ms <= 0) {
+        ret = kRPC_REQUEST_TIMEOUT;
+    } else if (RouteQuality::AllowRequest(session->m_handle)) {
+        // 本次尝试使用新的会话ID，携带剩余的超时时间
+        session->m_rpc_head.m_session_id = GenSessionId();
+        session->m_rpc_head.m_timeout_ms = static_cast<int32_t>(remain_ms);
+        m_retry_session_ids[session->m_rpc_head.m_session_id] = session->m_session_id;
+        ret = SendMessage(session->m_handle, session->m_rpc_head,
+            reinterpret_cast<const uint8_t*>(session->m_retry_data.data()),
+            session->m_retry_data.size());
+    }
+    if (ret != kRPC_SUCCESS) {
+        if (ret != kRPC_CIRCUIT_OPEN && ret != kRPC_REQUEST_TIMEOUT) {
+            ret = kRPC_SEND_FAILED;
+        }
+        if (RetryRequest(session, ret)) {
+            return;
+        }
+        if (session->m_rsp) {
+            session->m_rsp(ret, NULL, 0);
+        }
+        ResponseProcComplete(session->m_rpc_head.m_function_name, ret,
+            TimeUtility::GetCurrentMS() - session->m_start_time);
+        FreeSession(session);
+        return;
+    }
+
+    session->m_timerid    = m_timer->StartTimer(static_cast<uint32_t>(remain_ms),
+        &IRpc::OnSessionTimeout, this, session->m_session_id);
+    session->m_start_time = TimeUtility::GetCurrentMS();
+
+    RouteQuality::OnRequestSent(session->m_handle);
+}
+
+int32_t IRpc::OnRetryTimeout(void* rpc, uint64_t session_id) {
+    IRpc* self = static_cast<IRpc*>(rpc);
+    RpcSession* session = self->FindSession(session_id);
+    if (session != NULL) {
+        self->SendRetry(session);
+    }
+    return kTIMER_BE_REMOVED;
+}
+
+int32_t IRpc::CancelRequest(uint64_t session_id) {
+    RpcSession* session = FindSession(session_id);
+    if (NULL == session) {
+        // 命中缓存的请求没有会话，取消后不再回调
+        std::vector<CachedResponse>* lists[] = { &m_cached_responses, &m_processing_responses };
+        for (uint32_t i = 0; i < sizeof(lists) / sizeof(lists[0]); ++i) {
+            for (uint32_t idx = 0; idx < lists[i]->size(); ++idx) {
+                CachedResponse& cached = (*lists[i])[idx];
+                if (cached._session_id == session_id && cached._rsp) {
+                    cached._rsp = OnRpcResponse();
+                    return kRPC_SUCCESS;
+                }
+            }
+        }
+        return kRPC_SESSION_NOT_FOUND;
+    }
+    if (session->m_server_side) {
+        return kRPC_SESSION_NOT_FOUND;
+    }
+
+    m_timer->StopTimer(session->m_timerid);
+    if (session->m_stream) {
+        SendStreamCredit(session, 0);
+    }
+    if (!session->m_backoff) {
+        RouteQuality::OnRequestCancelled(session->m_handle);
+    }
+    FreeSession(session);
 
     return kRPC_SUCCESS;
 }
@@ -238,31 +1075,30 @@ int32_t IRpc::BroadcastRequest(const std::string& name,
 int32_t IRpc::SendResponse(uint64_t session_id, int32_t ret,
     const uint8_t* buff, uint32_t buff_len) {
 
-    cxx::unordered_map< uint64_t, cxx::shared_ptr<RpcSession> >::iterator it =
-        m_session_map.find(session_id);
-    if (m_session_map.end() == it) {
+    RpcSession* session = FindSession(session_id);
+    if (NULL == session) {
         PLOG_ERROR("session %lu not found", session_id);
         return kRPC_SESSION_NOT_FOUND;
     }
 
-    m_timer->StopTimer(it->second->m_timerid);
+    m_timer->StopTimer(session->m_timerid);
 
     int32_t result = kRPC_SUCCESS;
     int32_t error_code = kRPC_SUCCESS;
     if (kRPC_SUCCESS == ret) {
         // 业务处理成功，构造响应消息返回
-        it->second->m_rpc_head.m_message_type = kRPC_REPLY;
-        result = SendMessage(it->second->m_handle, it->second->m_rpc_head, buff, buff_len);
+        session->m_rpc_head.m_message_type = kRPC_REPLY;
+        result = SendMessage(session->m_handle, session->m_rpc_head, buff, buff_len);
         error_code = result;
     } else {
         // 业务处理失败，构造异常消息携带错误信息返回
-        result = ResponseException(it->second->m_handle, ret, it->second->m_rpc_head, buff, buff_len);
+        result = ResponseException(session->m_handle, ret, session->m_rpc_head, buff, buff_len);
         error_code = ret;
     }
-    RequestProcComplete(it->second->m_rpc_head.m_function_name,
-        error_code, TimeUtility::GetCurrentMS() - it->second->m_start_time);
+    RequestProcComplete(GetFunctionName(session->m_rpc_head),
+        error_code, TimeUtility::GetCurrentMS() - session->m_start_time);
 
-    m_session_map.erase(it);
+    FreeSession(session);
 
     return result;
 }
@@ -275,6 +1111,10 @@ int32_t IRpc::SendMessage(int64_t handle, const RpcHead& rpc_head,
         return kRPC_ENCODE_FAILED;
     }
 
+    if (IsBatchable(handle, rpc_head, sizeof(uint32_t) + head_len + buff_len)) {
+        return AppendBatch(handle, head_len, buff, buff_len);
+    }
+
     const uint8_t* msg_frag[] = { m_rpc_head_buff,    buff     };
     uint32_t msg_frag_len[]   = { (uint32_t)head_len, buff_len };
 
@@ -294,34 +1134,124 @@ int32_t IRpc::SendMessage(int64_t handle, const RpcHead& rpc_head,
 }
 
 int32_t IRpc::OnTimeout(uint64_t session_id) {
-    cxx::unordered_map< uint64_t, cxx::shared_ptr<RpcSession> >::iterator it =
-        m_session_map.find(session_id);
-    if (m_session_map.end() == it) {
+    RpcSession* session = FindSession(session_id);
+    if (NULL == session) {
         PLOG_ERROR("session %lu not found", session_id);
         return kTIMER_BE_REMOVED;
     }
 
-    cxx::shared_ptr<RpcSession> session = it->second;
-
     // request timeout
     if (session->m_rsp) {
+        ReportTransportQuality(session->m_handle, kRPC_REQUEST_TIMEOUT,
+            TimeUtility::GetCurrentMS() - session->m_start_time);
+        if (session->m_retryable && RetryRequest(session, kRPC_REQUEST_TIMEOUT)) {
+            return kTIMER_BE_REMOVED;
+        }
+        // 流式请求等待超时后通知服务端停止发送
+        if (session->m_stream) {
+            SendStreamCredit(session, 0);
+        }
         session->m_rsp(kRPC_REQUEST_TIMEOUT, NULL, 0);
-        ReportTransportQuality(session->m_handle, kRPC_REQUEST_TIMEOUT, 0);
     }
 
     if (session->m_server_side) {
-        RequestProcComplete(session->m_rpc_head.m_function_name,
+        RequestProcComplete(GetFunctionName(session->m_rpc_head),
             kRPC_PROCESS_TIMEOUT, TimeUtility::GetCurrentMS() - session->m_start_time);
     } else {
         ResponseProcComplete(session->m_rpc_head.m_function_name,
             kRPC_REQUEST_TIMEOUT, TimeUtility::GetCurrentMS() - session->m_start_time);
     }
 
-    m_session_map.erase(session_id);
+    FreeSession(session);
 
     return kTIMER_BE_REMOVED;
 }
 
+int32_t IRpc::OnSessionTimeout(void* rpc, uint64_t session_id) {
+    return static_cast<IRpc*>(rpc)->OnTimeout(session_id);
+}
+
+RpcSession* IRpc::AllocSession(uint64_t session_id) {
+    RpcSession* session = NULL;
+    if (m_free_sessions.empty()) {
+        session = new RpcSession();
+    } else {
+        session = m_free_sessions.back();
+        m_free_sessions.pop_back();
+    }
+
+    // 会话数超过桶数时扩容，会话总数稳定后不再分配内存
+    if (m_session_num >= m_session_buckets.size()) {
+        std::vector<RpcSession*> buckets(m_session_buckets.size() * 2, NULL);
+        uint64_t mask = buckets.size() - 1;
+        for (uint32_t idx = 0; idx < m_session_buckets.size(); ++idx) {
+            while (m_session_buckets[idx]) {
+                RpcSession* cur = m_session_buckets[idx];
+                m_session_buckets[idx] = cur->m_next;
+                cur->m_next = buckets[cur->m_session_id & mask];
+                buckets[cur->m_session_id & mask] = cur;
+            }
+        }
+        m_session_buckets.swap(buckets);
+    }
+
+    RpcSession*& bucket = m_session_buckets[session_id & (m_session_buckets.size() - 1)];
+    session->m_session_id = session_id;
+    session->m_next       = bucket;
+    bucket                = session;
+    ++m_session_num;
+
+    return session;
+}
+
+RpcSession* IRpc::FindSession(uint64_t session_id) {
+    RpcSession* session = m_session_buckets[session_id & (m_session_buckets.size() - 1)];
+    while (session && session->m_session_id != session_id) {
+        session = session->m_next;
+    }
+    return session;
+}
+
+void IRpc::FreeSession(RpcSession* session) {
+    RpcSession** cur = &m_session_buckets[session->m_session_id & (m_session_buckets.size() - 1)];
+    while (*cur && *cur != session) {
+        cur = &((*cur)->m_next);
+    }
+    if (NULL == *cur) {
+        return;
+    }
+    *cur = session->m_next;
+    --m_session_num;
+
+    // 只释放回调持有的资源，函数名等字符串保留容量供下次复用
+    session->m_next    = NULL;
+    session->m_timerid = -1;
+    session->m_rsp     = OnRpcResponse();
+    session->m_rpc_head.m_dst = NULL;
+    if (session->m_retryable && session->m_rpc_head.m_session_id != session->m_session_id) {
+        m_retry_session_ids.erase(session->m_rpc_head.m_session_id);
+    }
+    session->m_retryable = false;
+    session->m_backoff   = false;
+    session->m_retry_data.clear();
+    session->m_tried_handles.clear();
+    session->m_cache_ttl = 0;
+    session->m_on_frame  = OnRpcStream();
+
+    // 服务端流式会话结束时唤醒等待窗口的处理方，由其重新查找会话
+    cxx::function<void()> on_credit;
+    if (session->m_stream && session->m_server_side) {
+        m_stream_sessions.erase(std::make_pair(session->m_handle, session->m_rpc_head.m_session_id));
+        on_credit.swap(session->m_on_credit);
+    }
+    session->m_stream    = false;
+    m_free_sessions.push_back(session);
+
+    if (on_credit) {
+        on_credit();
+    }
+}
+
 int32_t IRpc::ProcessRequest(int64_t handle, const RpcHead& rpc_head,
     const uint8_t* buff, uint32_t buff_len) {
     return ProcessRequestImp(handle, rpc_head, buff, buff_len);
@@ -330,57 +1260,120 @@ int32_t IRpc::ProcessRequest(int64_t handle, const RpcHead& rpc_head,
 int32_t IRpc::ProcessRequestImp(int64_t handle, const RpcHead& rpc_head,
     const uint8_t* buff, uint32_t buff_len) {
 
-    cxx::unordered_map<std::string, OnRpcRequest>::iterator it =
-        m_service_map.find(rpc_head.m_function_name);
-    if (m_service_map.end() == it) {
-        PLOG_ERROR_N_EVERY_SECOND(1, "%s's request proc func not found", rpc_head.m_function_name.c_str());
+    // 请求中只携带函数ID时按ID分发，否则按函数名分发
+    const std::string* name = &rpc_head.m_function_name;
+    const RpcFunction* function = NULL;
+    if (rpc_head.m_function_name.empty()) {
+        function = FindFunction(rpc_head.m_function_id, &name);
+    } else {
+        cxx::unordered_map<std::string, RpcFunction>::iterator it =
+            m_service_map.find(rpc_head.m_function_name);
+        if (m_service_map.end() != it) {
+            function = &(it->second);
+        }
+    }
+
+    if (NULL == function) {
+        PLOG_ERROR_N_EVERY_SECOND(1, "%s(%u)'s request proc func not found",
+            rpc_head.m_function_name.c_str(), rpc_head.m_function_id);
         ResponseException(handle, kRPC_UNSUPPORT_FUNCTION_NAME, rpc_head);
-        RequestProcComplete(rpc_head.m_function_name, kRPC_UNSUPPORT_FUNCTION_NAME,
+        RequestProcComplete(*name, kRPC_UNSUPPORT_FUNCTION_NAME,
             rpc_head.m_arrived_ms > 0 ? TimeUtility::GetCurrentMS() - rpc_head.m_arrived_ms : 0);
         return kRPC_UNSUPPORT_FUNCTION_NAME;
     }
 
+    // 调用方已经超时的请求(如在协程队列中等待过久)直接丢弃，结果已经没有人关心
+    uint32_t proc_timeout_ms = m_proc_req_timeout_ms;
+    int64_t deadline = GetDeadline(rpc_head);
+    if (deadline > 0) {
+        int64_t now = TimeUtility::GetCurrentMS();
+        if (now >= deadline) {
+            PLOG_ERROR_N_EVERY_SECOND(1, "%s request expired, timeout = %d ms, wait = %ld ms",
+                name->c_str(), rpc_head.m_timeout_ms, now - rpc_head.m_arrived_ms);
+            RequestProcComplete(*name, kRPC_MESSAGE_EXPIRED, now - rpc_head.m_arrived_ms);
+            return kRPC_MESSAGE_EXPIRED;
+        }
+        if (deadline - now < proc_timeout_ms) {
+            proc_timeout_ms = deadline - now;
+        }
+    }
+
+    uint32_t stream_window = 0;
+    if (kRPC_STREAM_CALL == rpc_head.m_message_type) {
+        if (buff_len < sizeof(uint32_t)) {
+            ResponseException(handle, kRPC_DECODE_FAILED, rpc_head);
+            RequestProcComplete(*name, kRPC_DECODE_FAILED,
+                rpc_head.m_arrived_ms > 0 ? TimeUtility::GetCurrentMS() - rpc_head.m_arrived_ms : 0);
+            return kRPC_DECODE_FAILED;
+        }
+        stream_window = ReadUint32(buff);
+        buff     += sizeof(uint32_t);
+        buff_len -= sizeof(uint32_t);
+    }
+
     if (kRPC_ONEWAY == rpc_head.m_message_type) {
         cxx::function<int32_t(int32_t, const uint8_t*, uint32_t)> rsp; // NOLINT
-        int32_t ret = (it->second)(buff, buff_len, rsp);
-        RequestProcComplete(rpc_head.m_function_name, ret,
+        int32_t ret = function->m_on_request(buff, buff_len, rsp);
+        RequestProcComplete(*name, ret,
             rpc_head.m_arrived_ms > 0 ? TimeUtility::GetCurrentMS() - rpc_head.m_arrived_ms : 0);
         return ret;
     }
 
     // 请求处理也保持会话，方便扩展
-    cxx::shared_ptr<RpcSession> session(new RpcSession());
-    session->m_session_id  = GenSessionId();
+    RpcSession* session    = AllocSession(GenSessionId());
     session->m_handle      = handle;
     session->m_rpc_head    = rpc_head;
     session->m_server_side = true;
 
-    TimeoutCallback cb     = cxx::bind(&IRpc::OnTimeout, this, session->m_session_id);
-    session->m_timerid     = m_timer->StartTimer(m_proc_req_timeout_ms, cb);
+    session->m_timerid     = m_timer->StartTimer(proc_timeout_ms, &IRpc::OnSessionTimeout,
+        this, session->m_session_id);
     session->m_start_time  = rpc_head.m_arrived_ms > 0 ? rpc_head.m_arrived_ms : TimeUtility::GetCurrentMS();
 
-    m_session_map[session->m_session_id] = session;
+    // 流式响应的处理时间从收到请求时算起，发送中间帧和收到窗口增量时不续期，
+    // 定时器保持在请求的截止时刻
+    if (kRPC_STREAM_CALL == rpc_head.m_message_type) {
+        session->m_stream        = true;
+        session->m_stream_credit = stream_window;
+        m_stream_sessions[std::make_pair(handle, rpc_head.m_session_id)] = session->m_session_id;
+    }
 
+    // 业务可能在会话超时释放后才调用rsp，只能按值绑定会话ID，不能引用池化的对象；
+    // tr1::function只在内部保存函数指针，绑定对象仍需一次堆分配
     cxx::function<int32_t(int32_t, const uint8_t*, uint32_t)> rsp = cxx::bind( // NOLINT
         &IRpc::SendResponse, this, session->m_session_id,
         cxx::placeholders::_1, cxx::placeholders::_2, cxx::placeholders::_3);
 
-    return (it->second)(buff, buff_len, rsp);
+    if (!session->m_stream) {
+        return function->m_on_request(buff, buff_len, rsp);
+    }
+
+    // 流式处理函数在分发时取得会话ID，之后通过SendStreamFrame发送中间帧
+    uint64_t prev_stream_session_id = m_stream_session_id;
+    m_stream_session_id = session->m_session_id;
+    int32_t ret = function->m_on_request(buff, buff_len, rsp);
+    m_stream_session_id = prev_stream_session_id;
+    return ret;
 }
 
 int32_t IRpc::ProcessResponse(const RpcHead& rpc_head,
     const uint8_t* buff, uint32_t buff_len) {
 
-    cxx::unordered_map< uint64_t, cxx::shared_ptr<RpcSession> >::iterator it =
-        m_session_map.find(rpc_head.m_session_id);
-    if (m_session_map.end() == it) {
+    RpcSession* session = FindSession(rpc_head.m_session_id);
+    if (NULL == session && !m_retry_session_ids.empty()) {
+        cxx::unordered_map<uint64_t, uint64_t>::iterator it =
+            m_retry_session_ids.find(rpc_head.m_session_id);
+        if (it != m_retry_session_ids.end()) {
+            session = FindSession(it->second);
+        }
+    }
+    // 重试请求之前尝试的迟到响应(含退避期间收到的)，该次尝试已按超时或失败上报过，直接丢弃
+    if (NULL == session || (session->m_retryable && (session->m_backoff
+        || session->m_rpc_head.m_session_id != rpc_head.m_session_id))) {
         PLOG_ERROR_N_EVERY_SECOND(1, "session(%lu) not found, function_name(%s)",
                         rpc_head.m_session_id, rpc_head.m_function_name.c_str());
         return kRPC_SESSION_NOT_FOUND;
     }
 
-    cxx::shared_ptr<RpcSession> session = it->second;
-
     m_timer->StopTimer(session->m_timerid);
 
     int ret = kRPC_SUCCESS;
@@ -402,15 +1395,30 @@ int32_t IRpc::ProcessResponse(const RpcHead& rpc_head,
         }
     }
 
+    // 传输质量以响应本身的结果为准，不受业务回调返回值影响
+    int64_t time_cost = TimeUtility::GetCurrentMS() - session->m_start_time;
+    ReportTransportQuality(session->m_handle, ret, time_cost);
+    if (session->m_retryable && RetryRequest(session, ret)) {
+        return kRPC_SUCCESS;
+    }
+    if (!RouteQuality::IsTransportFailed(ret)) {
+        m_retry_tokens += m_retry_budget_ratio;
+        if (m_retry_tokens > kRETRY_MAX_TOKENS) {
+            m_retry_tokens = kRETRY_MAX_TOKENS;
+        }
+    }
+
+    if (session->m_cache_ttl > 0 && kRPC_SUCCESS == ret && kRPC_REPLY == rpc_head.m_message_type) {
+        m_response_cache.Put(session->m_cache_key, real_buff, real_buff_len, session->m_cache_ttl);
+    }
+
     if (session->m_rsp) {
         ret = session->m_rsp(ret, real_buff, real_buff_len);
     }
 
-    int64_t time_cost = TimeUtility::GetCurrentMS() - session->m_start_time;
-    ReportTransportQuality(session->m_handle, ret, time_cost);
     ResponseProcComplete(session->m_rpc_head.m_function_name, ret, time_cost);
 
-    m_session_map.erase(rpc_head.m_session_id);
+    FreeSession(session);
 
     return ret;
 }
@@ -440,6 +1448,7 @@ int32_t IRpc::ResponseException(int64_t handle, int32_t ret, const RpcHead& rpc_
 
 void IRpc::ReportTransportQuality(int64_t handle, int32_t ret_code,
         int64_t time_cost_ms) {
+    RouteQuality::OnRequestDone(handle, ret_code, time_cost_ms);
     if (m_event_handler) {
         m_event_handler->ReportTransportQuality(handle, ret_code, time_cost_ms);
     }
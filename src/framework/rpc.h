@@ -15,7 +15,10 @@
 #ifndef _PEBBLE_COMMON_RPC_H_
 #define _PEBBLE_COMMON_RPC_H_
 
+#include <map>
+#include <vector>
 #include "framework/processor.h"
+#include "framework/response_cache.h"
 
 
 namespace pebble {
@@ -37,11 +40,16 @@ typedef enum {
     kRPC_PROCESS_TIMEOUT         = kRPC_ERROR_BASE - 13,  // 服务处理超时
     kPRC_BROADCAST_FAILED        = kRPC_ERROR_BASE - 14,  // 广播失败
     kRPC_FUNCTION_NAME_UNEXISTED = kRPC_ERROR_BASE - 15,  // 服务名不存在
+    kRPC_CIRCUIT_OPEN            = kRPC_ERROR_BASE - 16,  // 目标已熔断
+    kRPC_STREAM_NO_CREDIT        = kRPC_ERROR_BASE - 17,  // 流式响应的发送窗口已用完
+    kRPC_STREAM_CANCELLED        = kRPC_ERROR_BASE - 18,  // 流式调用已被调用方取消
     kRPC_PEBBLE_RPC_ERROR_BASE   = kRPC_ERROR_BASE - 100, // PEBBE RPC错误码BASE
     kRPC_RPC_UTIL_ERROR_BASE     = kRPC_ERROR_BASE - 200, // RPC辅助工具错误码BASE
     kRPC_SYSTEM_OVERLOAD_BASE    = kRPC_ERROR_BASE - 300, // 系统过载BASE
     kRPC_MESSAGE_EXPIRED         = kRPC_SYSTEM_OVERLOAD_BASE - 1, // 系统过载-消息过期
     kRPC_TASK_OVERLOAD           = kRPC_SYSTEM_OVERLOAD_BASE - 2, // 系统过载-并发任务过载
+    kRPC_CONCURRENCY_OVERLOAD    = kRPC_SYSTEM_OVERLOAD_BASE - 4, // 系统过载-超出自适应并发限制
+    kRPC_QUEUE_DELAY_OVERLOAD    = kRPC_SYSTEM_OVERLOAD_BASE - 8, // 系统过载-持续排队
     kRPC_SUCCESS                 = 0,
 } RpcErrorCode;
 
@@ -62,8 +70,13 @@ public:
         SetErrorString(kRPC_PROCESS_TIMEOUT, "process service timeout");
         SetErrorString(kPRC_BROADCAST_FAILED, "broadcast request failed");
         SetErrorString(kRPC_FUNCTION_NAME_UNEXISTED, "service name unexisted");
+        SetErrorString(kRPC_CIRCUIT_OPEN, "circuit breaker open");
+        SetErrorString(kRPC_STREAM_NO_CREDIT, "stream window exhausted");
+        SetErrorString(kRPC_STREAM_CANCELLED, "stream cancelled");
         SetErrorString(kRPC_MESSAGE_EXPIRED, "system overload: message expired");
         SetErrorString(kRPC_TASK_OVERLOAD, "system overload: task overload");
+        SetErrorString(kRPC_CONCURRENCY_OVERLOAD, "system overload: concurrency limit");
+        SetErrorString(kRPC_QUEUE_DELAY_OVERLOAD, "system overload: queue delay");
     }
 };
 
@@ -74,11 +87,15 @@ typedef enum {
     kRPC_REPLY     = 2,
     kRPC_EXCEPTION = 3,
     kRPC_ONEWAY    = 4,
+    kRPC_BATCH     = 5, // 批量消息，数据部分为多个带长度前缀的完整RPC消息
+    kRPC_STREAM_CALL   = 6, // 流式请求，数据部分前4字节(大端)为初始窗口(帧数)
+    kRPC_STREAM_DATA   = 7, // 流式响应的中间帧，最后一帧为REPLY或EXCEPTION
+    kRPC_STREAM_CREDIT = 8, // 流式请求的窗口增量，数据部分为4字节(大端)，为0表示取消
 } RpcMessageType;
 
 
 // 前置声明
-class SequenceTimer;
+class WheelTimer;
 struct RpcSession;
 
 /// @brief RPC协议版本号
@@ -92,6 +109,8 @@ struct RpcHead {
         m_version       = kVERSION_0;
         m_message_type  = kRPC_EXCEPTION;
         m_session_id    = 0;
+        m_function_id   = 0;
+        m_timeout_ms    = 0;
         m_arrived_ms    = -1;
         m_dst           = NULL;
     }
@@ -100,14 +119,29 @@ struct RpcHead {
         m_message_type  = rhs.m_message_type;
         m_session_id    = rhs.m_session_id;
         m_function_name = rhs.m_function_name;
+        m_function_id   = rhs.m_function_id;
+        m_timeout_ms    = rhs.m_timeout_ms;
         m_arrived_ms    = rhs.m_arrived_ms;
         m_dst           = rhs.m_dst;
     }
+    RpcHead& operator=(const RpcHead& rhs) {
+        m_version       = rhs.m_version;
+        m_message_type  = rhs.m_message_type;
+        m_session_id    = rhs.m_session_id;
+        m_function_name = rhs.m_function_name;
+        m_function_id   = rhs.m_function_id;
+        m_timeout_ms    = rhs.m_timeout_ms;
+        m_arrived_ms    = rhs.m_arrived_ms;
+        m_dst           = rhs.m_dst;
+        return *this;
+    }
 
     int32_t     m_version;
     int32_t     m_message_type;
     uint64_t    m_session_id;
     std::string m_function_name;
+    uint32_t    m_function_id;  // 函数名对应的数字ID，0表示无效，@see IRpc::GenFunctionId
+    int32_t     m_timeout_ms;   // 请求发出时调用方剩余的等待时间(ms)，<=0表示未设置
 
     int64_t     m_arrived_ms; // 消息到达时间
     IProcessor* m_dst;        // 非消息相关，标示消息来源模块，响应原路返回
@@ -139,6 +173,76 @@ typedef cxx::function<int32_t(const uint8_t* buff, uint32_t buff_len, // NOLINT
 /// @param buff_len 响应消息长度
 typedef cxx::function<int32_t(int32_t ret, const uint8_t* buff, uint32_t buff_len)> OnRpcResponse;
 
+/// @brief RPC流式响应中间帧处理函数原型，由用户实现，RPC负责回调
+/// @param buff 中间帧码流
+/// @param buff_len 中间帧长度
+/// @note 处理完毕后调用IRpc::AckStream归还窗口，服务端才能继续发送
+typedef cxx::function<int32_t(const uint8_t* buff, uint32_t buff_len)> OnRpcStream;
+
+/// @brief RPC方法优先级，系统过载时从低到高逐级拒绝请求
+typedef enum {
+    kRPC_PRIORITY_LOW      = 0, // 默认优先级，过载时首先拒绝，如心跳、数据上报
+    kRPC_PRIORITY_NORMAL   = 1,
+    kRPC_PRIORITY_HIGH     = 2,
+    kRPC_PRIORITY_CRITICAL = 3, // 过载时也不拒绝，如登录、支付
+} RpcPriority;
+
+/// @brief RPC服务函数注册信息
+struct RpcFunction {
+    RpcFunction() : m_function_id(0), m_priority(kRPC_PRIORITY_LOW) {}
+    RpcFunction(uint32_t function_id, const OnRpcRequest& on_request)
+        : m_function_id(function_id), m_priority(kRPC_PRIORITY_LOW), m_on_request(on_request) {}
+
+    uint32_t     m_function_id;
+    uint32_t     m_priority;    // @see RpcPriority
+    OnRpcRequest m_on_request;
+};
+
+/// @brief 对冲请求策略，仅适用于幂等方法
+/// @note 请求在等待指定时间后仍未返回时，向同一Router下的另一个handle再发一次，先返回的响应生效，
+///   另一请求被取消；对冲请求数受预算限制，避免在整体变慢时放大负载
+struct HedgePolicy {
+    HedgePolicy() : _delay_ms(0), _percentile(0), _budget_ratio(0.1) {}
+
+    /// @brief 发出对冲请求前的等待时间(ms)，<=0时不对冲；按百分位计算时作为统计样本不足时的默认值
+    int32_t  _delay_ms;
+    /// @brief 大于0时按该方法近期耗时的百分位(如95)作为等待时间
+    uint32_t _percentile;
+    /// @brief 对冲请求数占该方法请求数的比例上限
+    double   _budget_ratio;
+};
+
+/// @brief 自动重试策略，仅适用于幂等方法
+/// @note 请求以可重试的错误结束时，在重试预算允许的情况下换一个Router目标重发，
+///   各次尝试共用原请求的超时时间，剩余时间不足时不再重试；每次尝试使用新的会话ID，
+///   之前尝试的迟到响应被丢弃，重试对调用方透明，只回调最后一次的结果
+struct RetryPolicy {
+    RetryPolicy() : _max_attempts(1), _backoff_ms(0), _max_backoff_ms(1000) {}
+
+    /// @brief 最大尝试次数(含首次请求)，<=1时不重试
+    uint32_t _max_attempts;
+    /// @brief 首次重试前的退避时间(ms)，之后每次翻倍，实际等待时间在[退避/2, 退避]间随机
+    int32_t  _backoff_ms;
+    /// @brief 退避时间上限(ms)
+    int32_t  _max_backoff_ms;
+    /// @brief 可重试的错误码，为空时重试传输层失败(超时、发送失败、服务端过载等)
+    std::vector<int32_t> _retry_codes;
+};
+
+/// @brief 批量发送策略
+/// @note 同一handle上的请求先缓存，在Update时或达到上限时合并为一个批量消息发送，
+///   对端收到批量消息后逐个处理，并把同步产生的响应合并为一个批量消息返回
+struct BatchPolicy {
+    BatchPolicy() : _max_batch_num(0), _max_batch_bytes(64 * 1024), _max_delay_ms(0) {}
+
+    /// @brief 每批最多的消息数，<=1时关闭请求的批量发送
+    uint32_t _max_batch_num;
+    /// @brief 每批最大的字节数，超出此大小的单个消息直接发送
+    uint32_t _max_batch_bytes;
+    /// @brief 消息在批中最长的等待时间(ms)，0表示在下一次Update时发送，即合并同一轮循环内的请求
+    uint32_t _max_delay_ms;
+};
+
 class IRpc : public IProcessor {
 public:
     IRpc();
@@ -164,6 +268,15 @@ public:
     /// @return 非0 失败 @see RpcErrorCode
     int32_t AddOnRequestFunction(const std::string& name, const OnRpcRequest& on_request);
 
+    /// @brief 添加RPC请求处理函数(RPC服务)，同时注册函数名对应的数字ID
+    /// @param name RPC请求服务的名字
+    /// @param function_id 函数的数字ID，由IDL编译器生成，为0时只支持按名字分发
+    /// @param on_request 请求处理函数
+    /// @return 0 成功
+    /// @return 非0 失败 @see RpcErrorCode
+    int32_t AddOnRequestFunction(const std::string& name, uint32_t function_id,
+        const OnRpcRequest& on_request);
+
     /// @brief 注销RPC请求处理函数(RPC服务)
     /// @param name RPC请求服务的名字
     /// @return 0 成功
@@ -186,6 +299,42 @@ public:
                     const OnRpcResponse& on_rsp,
                     int32_t timeout_ms);
 
+    /// @brief 发送RPC流式请求，服务端可对一个请求返回多个响应帧
+    /// @param handle 网络句柄
+    /// @param rpc_head RPC头部信息
+    /// @param buff RPC数据部分
+    /// @param buff_len RPC数据部分长度
+    /// @param on_frame 中间帧回调
+    /// @param on_rsp 结束回调，流式调用成功结束时ret为0且数据为空
+    /// @param timeout_ms 等待下一帧的超时时间，单位为ms，<=0时使用默认值(10s)
+    /// @param window 初始窗口，即未确认时服务端最多可发送的帧数，为0时使用默认值(16)
+    /// @return 0 成功
+    /// @return 非0 失败 @see RpcErrorCode
+    int32_t SendStreamRequest(int64_t handle,
+                    const RpcHead& rpc_head,
+                    const uint8_t* buff,
+                    uint32_t buff_len,
+                    const OnRpcStream& on_frame,
+                    const OnRpcResponse& on_rsp,
+                    int32_t timeout_ms,
+                    uint32_t window);
+
+    /// @brief 确认已处理的流式响应帧，累计达到窗口的一半时通知服务端扩大窗口
+    /// @param session_id 流式请求的会话ID
+    /// @param num 已处理的帧数
+    /// @return 0 成功
+    /// @return 非0 失败 @see RpcErrorCode
+    int32_t AckStream(uint64_t session_id, uint32_t num);
+
+    /// @brief 发送流式响应的中间帧，窗口用完时在当前协程中等待调用方确认
+    /// @param session_id 服务端的流式会话ID，处理函数中通过GetStreamSessionId获取
+    /// @param buff 中间帧数据
+    /// @param buff_len 中间帧长度
+    /// @return 0 成功
+    /// @return 非0 失败 @see RpcErrorCode
+    /// @note 流式调用由处理函数的rsp结束，rsp的返回码只表示调用结果
+    int32_t SendStreamFrame(uint64_t session_id, const uint8_t* buff, uint32_t buff_len);
+
     /// @brief 广播RPC消息
     /// @param name 广播频道名
     /// @param rpc_head RPC头部信息
@@ -198,13 +347,95 @@ public:
                     const uint8_t* buff,
                     uint32_t buff_len);
 
+    /// @brief 设置发送请求时是否使用数字ID代替函数名
+    /// @param use_function_id true时请求头中只携带函数ID，头部更短且服务端分发无需字符串查找
+    /// @note 需要对端也支持函数ID时才能开启，默认关闭；响应总是和请求使用相同的形式
+    void SetUseFunctionId(bool use_function_id) {
+        m_use_function_id = use_function_id;
+    }
+
+    /// @brief 设置binary编码时请求头中是否携带调用方的超时时间
+    /// @param propagate_timeout true时服务端可丢弃排队期间已超时的请求，嵌套调用继承剩余时间
+    /// @note 需要对端也支持时才能开启，默认关闭；PB编码总是携带超时时间
+    void SetPropagateTimeout(bool propagate_timeout) {
+        m_propagate_timeout = propagate_timeout;
+    }
+
+    /// @brief 设置方法的自动重试策略，只能用于幂等方法
+    /// @param name 方法名，格式为"服务名:方法名"
+    /// @param policy 重试策略，_max_attempts<=1时取消重试
+    void SetRetryPolicy(const std::string& name, const RetryPolicy& policy);
+
+    /// @brief 设置请求的批量发送策略
+    /// @param policy 批量发送策略，默认关闭
+    /// @note 需要对端也支持批量消息时才能开启；批量消息的接收和响应的批量返回总是开启的
+    void SetBatchPolicy(const BatchPolicy& policy);
+
+    /// @brief 设置重试预算，每个成功的请求积累ratio次重试机会，避免故障时重试放大负载
+    /// @param ratio 重试数占成功请求数的比例上限，默认为0.1
+    void SetRetryBudget(double ratio) {
+        m_retry_budget_ratio = ratio;
+    }
+
+    /// @brief 设置方法的优先级，系统过载时按优先级从低到高逐级拒绝请求
+    /// @param name 方法名，格式为"服务名:方法名"，可以在注册服务前设置
+    /// @param priority 优先级 @see RpcPriority，默认为kRPC_PRIORITY_LOW
+    /// @return 0 成功
+    /// @return 非0 失败 @see RpcErrorCode
+    /// @note 过载持续时拒绝的优先级逐步升高，过载消除后逐步恢复；拒绝在解码请求体之前完成
+    int32_t SetFunctionPriority(const std::string& name, uint32_t priority);
+
+    /// @brief 获取当前的拒绝级别，过载时优先级不高于此级别的请求被拒绝
+    uint32_t GetShedLevel() const {
+        return m_shed_level;
+    }
+
+    /// @brief 设置方法的响应缓存，以"方法名+请求数据"为key缓存成功的响应，只能用于结果允许短时复用的方法
+    /// @param name 方法名，格式为"服务名:方法名"
+    /// @param ttl_ms 缓存有效期(ms)，为0时取消缓存
+    /// @note 命中时不发送请求，响应在下一次Update时回调，保证同步调用也能正常返回
+    void SetResponseCache(const std::string& name, uint32_t ttl_ms);
+
+    /// @brief 设置响应缓存占用的字节数上限，超出时淘汰最久未访问的数据，默认为16MB
+    void SetResponseCacheMaxBytes(uint64_t max_bytes) {
+        m_response_cache.SetMaxBytes(max_bytes);
+    }
+
 public:
     static const uint32_t REQ_PROC_TIMEOUT_MS = 20 * 1000; // 20s
 
+    /// @brief 根据函数名生成稳定的数字ID(FNV-1a)，IDL编译器使用相同算法生成ID
+    /// @note 内部使用，用户无需关注
+    static uint32_t GenFunctionId(const std::string& name);
+
+    /// @brief RPC头编码时是否使用函数ID代替函数名
+    /// @note 内部使用，用户无需关注
+    bool UseFunctionId(const RpcHead& rpc_head) const {
+        return rpc_head.m_function_id != 0 && (m_use_function_id || rpc_head.m_function_name.empty());
+    }
+
+    /// @brief RPC头编码时是否携带超时时间
+    /// @note 内部使用，用户无需关注
+    bool PropagateTimeout(const RpcHead& rpc_head) const {
+        return m_propagate_timeout && rpc_head.m_timeout_ms > 0
+            && (kRPC_CALL == rpc_head.m_message_type || kRPC_ONEWAY == rpc_head.m_message_type);
+    }
+
+    /// @brief 获取请求的截止时刻(ms)，请求未携带超时时间时返回-1
+    /// @note 内部使用，用户无需关注
+    static int64_t GetDeadline(const RpcHead& rpc_head) {
+        return (rpc_head.m_timeout_ms > 0 && rpc_head.m_arrived_ms > 0) ?
+            rpc_head.m_arrived_ms + rpc_head.m_timeout_ms : -1;
+    }
+
     /// @note 内部使用，用户无需关注
     int32_t ProcessRequestImp(int64_t handle, const RpcHead& rpc_head,
         const uint8_t* buff, uint32_t buff_len);
 
+    /// @brief 取消等待响应的请求，响应回调不会再被调用
+    /// @note 内部使用，用户无需关注
+    int32_t CancelRequest(uint64_t session_id);
+
     /// @note 内部使用，用户无需关注
     uint64_t GenSessionId() {
         return m_session_id++;
@@ -215,6 +446,16 @@ public:
         m_proc_req_timeout_ms = proc_req_timeout_ms;
     }
 
+    /// @brief 获取正在分发的流式请求的服务端会话ID，只在处理函数中同步调用时有效
+    /// @note 内部使用，用户无需关注
+    uint64_t GetStreamSessionId() const {
+        return m_stream_session_id;
+    }
+
+    /// @brief 设置流式请求的服务端会话获得窗口或结束时的回调，只回调一次
+    /// @note 内部使用，用户无需关注
+    int32_t SetStreamCreditCallback(uint64_t session_id, const cxx::function<void()>& on_credit);
+
 protected:
     /// @brief RPC头的编码接口
     /// @param rpc_head RPC头部信息
@@ -254,6 +495,14 @@ protected:
                     const uint8_t* buff,
                     uint32_t buff_len);
 
+    /// @brief 流式响应的发送窗口用完时调用，返回0时表示已等到窗口或会话已结束
+    /// @param session_id 服务端会话ID
+    /// @return 0 成功，调用方需重新检查会话和窗口
+    /// @return 非0 无法等待，中间帧发送失败
+    virtual int32_t OnStreamBlocked(uint64_t session_id) {
+        return kRPC_STREAM_NO_CREDIT;
+    }
+
 private:
     // 发送RPC响应消息
     int32_t SendResponse(uint64_t session_id, int32_t ret, const uint8_t* buff, uint32_t buff_len);
@@ -264,6 +513,30 @@ private:
     // 超时处理，暂时支持请求的超时，可扩展支持服务处理超时
     int32_t OnTimeout(uint64_t session_id);
 
+    // 定时器回调入口，@see WheelTimer::TimeoutHandler
+    static int32_t OnSessionTimeout(void* rpc, uint64_t session_id);
+
+    // 请求以可重试的错误结束时换一个目标重发，返回true表示已重试，会话继续等待响应
+    bool RetryRequest(RpcSession* session, int32_t ret);
+
+    // 发送重试的请求，发送失败时继续重试或结束请求
+    void SendRetry(RpcSession* session);
+
+    // 退避定时器回调入口，@see WheelTimer::TimeoutHandler
+    static int32_t OnRetryTimeout(void* rpc, uint64_t session_id);
+
+    // 发送流式请求的窗口增量，为0时通知服务端取消
+    int32_t SendStreamCredit(RpcSession* session, uint32_t credit);
+
+    // 从会话池中分配会话并按ID加入索引
+    RpcSession* AllocSession(uint64_t session_id);
+
+    // 按ID查找会话，不存在返回NULL
+    RpcSession* FindSession(uint64_t session_id);
+
+    // 从索引中删除会话并归还会话池
+    void FreeSession(RpcSession* session);
+
 private:
     int32_t ProcessResponse(const RpcHead& rpc_head,
                     const uint8_t* buff,
@@ -281,15 +554,108 @@ private:
     inline void ResponseProcComplete(const std::string& name,
         int32_t result, int32_t time_cost_ms);
 
+    // 根据函数ID查找服务函数，找不到返回NULL
+    const RpcFunction* FindFunction(uint32_t function_id, const std::string** name) const;
+
+    // 获取请求对应的函数名，请求中只有函数ID时从服务注册信息中查找
+    const std::string& GetFunctionName(const RpcHead& rpc_head) const;
+
+    // 服务注册信息变化后重建函数ID索引
+    void RebuildFunctionIndex();
+
+    // 过载时根据请求的优先级和当前拒绝级别决定是否拒绝请求，只依赖请求头
+    bool ShedRequest(const RpcHead& rpc_head, uint32_t is_overload);
+
+    int32_t ProcessStreamData(const RpcHead& rpc_head, const uint8_t* buff, uint32_t buff_len);
+
+    int32_t ProcessStreamCredit(int64_t handle, const RpcHead& rpc_head,
+        const uint8_t* buff, uint32_t buff_len);
+
+    // 回调命中缓存的请求，返回回调的请求数
+    int32_t ProcessCachedResponses();
+
+    // 拆分批量消息并逐个处理，处理期间同步产生的响应合并返回
+    int32_t ProcessBatch(int64_t handle, const uint8_t* buff, uint32_t buff_len,
+        const MsgExternInfo* msg_info, uint32_t is_overload);
+
+    // 消息是否加入批量发送
+    bool IsBatchable(int64_t handle, const RpcHead& rpc_head, uint32_t msg_len) const;
+
+    // 把已编码的RPC头(m_rpc_head_buff)和数据加入handle的批量消息，达到上限时发送
+    int32_t AppendBatch(int64_t handle, uint32_t head_len, const uint8_t* buff, uint32_t buff_len);
+
+    /// @brief 待发送的批量消息
+    struct BatchBuffer {
+        BatchBuffer() : _num(0), _start_ms(0) {}
+
+        std::string _data;      // 多个带长度前缀(4字节，大端)的完整RPC消息
+        uint32_t    _num;
+        int64_t     _start_ms;  // 第一个消息加入的时间
+    };
+
+    // 发送批量消息，只有一个消息时按普通消息发送
+    int32_t FlushBatch(int64_t handle, BatchBuffer* batch);
+
+    // 发送等待时间已到的批量消息，返回发送的批量消息数
+    int32_t FlushBatches();
+
 private:
-    cxx::unordered_map<std::string, OnRpcRequest> m_service_map;
+    /// @brief 函数ID索引的槽位，开放寻址(线性探测)，指向m_service_map中的元素
+    struct FunctionSlot {
+        const std::string* _name;
+        const RpcFunction* _function;
+    };
+
+    cxx::unordered_map<std::string, RpcFunction> m_service_map;
+    std::vector<FunctionSlot> m_function_index;
+    bool m_use_function_id;
+    bool m_propagate_timeout;
+
+    cxx::unordered_map<std::string, RetryPolicy> m_retry_policies;
+    double   m_retry_budget_ratio;
+    double   m_retry_tokens;
+    uint32_t m_retry_seed;
+    cxx::unordered_map<uint64_t, uint64_t> m_retry_session_ids; // 重试请求的会话ID -> 原会话ID
+
+    cxx::unordered_map<std::string, uint32_t> m_function_priorities;
+    uint32_t m_shed_level;
+    int64_t  m_shed_window_start_ms;
+    bool     m_shed_window_overload;
+
+    /// @brief 命中缓存等待回调的请求
+    struct CachedResponse {
+        uint64_t _session_id;
+        OnRpcResponse _rsp;
+        ResponseCache::Data _data;
+        std::string _function_name;
+    };
+
+    cxx::unordered_map<std::string, uint32_t> m_cache_ttls;
+    ResponseCache m_response_cache;
+    std::vector<CachedResponse> m_cached_responses;
+    std::vector<CachedResponse> m_processing_responses;
+    std::string m_cache_key;
+
+    BatchPolicy m_batch_policy;
+    cxx::unordered_map<int64_t, BatchBuffer> m_batches;
+    int64_t m_batch_reply_handle;   // 正在处理的批量消息的来源handle，不在处理中时为-1
+    uint8_t m_batch_head_buff[64];
+
+    // (handle, 调用方会话ID) -> 服务端流式会话ID，用于处理窗口增量
+    std::map<std::pair<int64_t, uint64_t>, uint64_t> m_stream_sessions;
+    uint64_t m_stream_session_id;   // 正在分发的流式请求的服务端会话ID，不在分发中时为kINVALID_SESSION_ID
+    std::string m_stream_request;
+    RpcHead m_send_head;    // 发送请求时修改过的请求头，复用内存
 
     uint8_t m_rpc_head_buff[1024];
     uint8_t m_rpc_exception_buff[10240];
 
-    SequenceTimer* m_timer;
+    WheelTimer* m_timer;
     uint64_t m_session_id;
-    cxx::unordered_map< uint64_t, cxx::shared_ptr<RpcSession> > m_session_map;
+    // 会话池和以会话ID为key的侵入式哈希表，会话数稳定后收发请求无内存分配
+    std::vector<RpcSession*> m_session_buckets;
+    std::vector<RpcSession*> m_free_sessions;
+    uint32_t m_session_num;
     uint32_t m_proc_req_timeout_ms;
 };
 
@@ -22,6 +22,15 @@
 
 namespace pebble {
 
+/// @brief 扩展binary RPC头版本号，格式为:
+///   版本号|标志位|消息类型(i32) + 函数ID(i32)或函数名(string) + [超时时间(i32)] + 会话ID(i64)
+/// @note 和thrift strict模式的VERSION_1区分，不支持扩展头的旧版本解码时会报版本错误而不是误解析
+static const int32_t kEXT_HEAD_VERSION          = static_cast<int32_t>(0x80020000);
+static const int32_t kEXT_HEAD_VERSION_MASK     = static_cast<int32_t>(0xffff0000);
+static const int32_t kEXT_HEAD_FLAG_FUNCTION_ID = 0x00000100;   // 携带函数ID而非函数名
+static const int32_t kEXT_HEAD_FLAG_TIMEOUT     = 0x00000200;   // 携带超时时间
+static const int32_t kEXT_HEAD_TYPE_MASK        = 0x000000ff;
+
 
 int32_t ProtoBufRpcPlugin::HeadEncode(const RpcHead& rpc_head, uint8_t* buff, uint32_t buff_len) {
     if (NULL == buff || 0 == buff_len) {
@@ -44,7 +53,15 @@ int32_t ProtoBufRpcPlugin::HeadEncode(const RpcHead& rpc_head, uint8_t* buff, ui
         // pb_head.version         = rpc_head.m_version; // 暂时不需要版本号
         pb_head.msg_type        = rpc_head.m_message_type;
         pb_head.session_id      = rpc_head.m_session_id;
-        pb_head.function_name   = rpc_head.m_function_name;
+        if (rpc_head.m_timeout_ms > 0 && (kRPC_CALL == rpc_head.m_message_type
+            || kRPC_ONEWAY == rpc_head.m_message_type)) {
+            pb_head.__set_timeout_ms(rpc_head.m_timeout_ms);
+        }
+        if (m_pebble_rpc->UseFunctionId(rpc_head)) {
+            pb_head.__set_function_id(rpc_head.m_function_id);
+        } else {
+            pb_head.function_name = rpc_head.m_function_name;
+        }
 
         // 2. 序列化ProtoBufRpcHead，考虑到性能不使用write(buff, bufflen)接口
         len = pb_head.write(encoder);
@@ -84,13 +101,19 @@ int32_t ProtoBufRpcPlugin::HeadDecode(const uint8_t* buff, uint32_t buff_len, Rp
         rpc_head->m_message_type  = pb_head.msg_type;
         rpc_head->m_session_id    = pb_head.session_id;
         rpc_head->m_function_name = pb_head.function_name;
+        if (pb_head.__isset.function_id) {
+            rpc_head->m_function_id = pb_head.function_id;
+        }
+        if (pb_head.__isset.timeout_ms) {
+            rpc_head->m_timeout_ms = pb_head.timeout_ms;
+        }
     } catch (TException e) {
         PLOG_ERROR_N_EVERY_SECOND(1, "catch exception : %s", e.what());
         return kPEBBLE_RPC_DECODE_HEAD_FAILED;
     }
 
     if (rpc_head->m_message_type < kRPC_CALL
-        || rpc_head->m_message_type > kRPC_ONEWAY) {
+        || rpc_head->m_message_type > kRPC_STREAM_CREDIT) {
         PLOG_ERROR_N_EVERY_SECOND(1, "message type error %d", rpc_head->m_message_type);
         return kRPC_UNKNOWN_TYPE;
     }
@@ -112,11 +135,35 @@ int32_t ThriftRpcPlugin::HeadEncode(const RpcHead& rpc_head, uint8_t* buff, uint
     (static_cast<dr::transport::TMemoryBuffer*>(encoder->getTransport().get()))->
         resetBuffer(buff, buff_len, dr::transport::TMemoryBuffer::OBSERVE);
 
+    // binary编码时按需使用扩展头，其他情况使用标准头
+    int32_t flags = 0;
+    if (kCODE_BINARY == m_pebble_rpc->GetCodeType()) {
+        if (m_pebble_rpc->UseFunctionId(rpc_head)) {
+            flags |= kEXT_HEAD_FLAG_FUNCTION_ID;
+        }
+        if (m_pebble_rpc->PropagateTimeout(rpc_head)) {
+            flags |= kEXT_HEAD_FLAG_TIMEOUT;
+        }
+    }
+
     int32_t len = -1;
     try {
-        len = encoder->writeMessageBegin(rpc_head.m_function_name,
-            static_cast<pebble::dr::protocol::TMessageType>(rpc_head.m_message_type),
-            rpc_head.m_session_id);
+        if (flags != 0) {
+            len = encoder->writeI32(kEXT_HEAD_VERSION | flags | rpc_head.m_message_type);
+            if (flags & kEXT_HEAD_FLAG_FUNCTION_ID) {
+                len += encoder->writeI32(static_cast<int32_t>(rpc_head.m_function_id));
+            } else {
+                len += encoder->writeString(rpc_head.m_function_name);
+            }
+            if (flags & kEXT_HEAD_FLAG_TIMEOUT) {
+                len += encoder->writeI32(rpc_head.m_timeout_ms);
+            }
+            len += encoder->writeI64(static_cast<int64_t>(rpc_head.m_session_id));
+        } else {
+            len = encoder->writeMessageBegin(rpc_head.m_function_name,
+                static_cast<pebble::dr::protocol::TMessageType>(rpc_head.m_message_type),
+                rpc_head.m_session_id);
+        }
     } catch (TException e) {
         PLOG_ERROR_N_EVERY_SECOND(1, "catch exception : %s", e.what());
         return kPEBBLE_RPC_ENCODE_HEAD_FAILED;
@@ -140,20 +187,46 @@ int32_t ThriftRpcPlugin::HeadDecode(const uint8_t* buff, uint32_t buff_len, RpcH
         resetBuffer(const_cast<uint8_t*>(buff), buff_len, dr::transport::TMemoryBuffer::OBSERVE);
 
     // 解消息头
+    // binary编码时先检查是否为扩展RPC头(大端)
+    bool ext_head = false;
+    if (kCODE_BINARY == m_pebble_rpc->GetCodeType() && buff_len >= sizeof(int32_t)) {
+        int32_t version = static_cast<int32_t>((static_cast<uint32_t>(buff[0]) << 24)
+            | (static_cast<uint32_t>(buff[1]) << 16) | (static_cast<uint32_t>(buff[2]) << 8)
+            | static_cast<uint32_t>(buff[3]));
+        ext_head = (kEXT_HEAD_VERSION_MASK & version) == kEXT_HEAD_VERSION;
+    }
+
     int32_t head_len = -1;
     try {
         int64_t seqid = 0;
-        pebble::dr::protocol::TMessageType msg_type = pebble::dr::protocol::T_EXCEPTION;
-        head_len = decoder->readMessageBegin(rpc_head->m_function_name, msg_type, seqid);
-        rpc_head->m_message_type = static_cast<int32_t>(msg_type);
+        if (ext_head) {
+            int32_t version = 0;
+            head_len = decoder->readI32(version);
+            if (version & kEXT_HEAD_FLAG_FUNCTION_ID) {
+                int32_t function_id = 0;
+                head_len += decoder->readI32(function_id);
+                rpc_head->m_function_id = static_cast<uint32_t>(function_id);
+            } else {
+                head_len += decoder->readString(rpc_head->m_function_name);
+            }
+            if (version & kEXT_HEAD_FLAG_TIMEOUT) {
+                head_len += decoder->readI32(rpc_head->m_timeout_ms);
+            }
+            head_len += decoder->readI64(seqid);
+            rpc_head->m_message_type = version & kEXT_HEAD_TYPE_MASK;
+        } else {
+            pebble::dr::protocol::TMessageType msg_type = pebble::dr::protocol::T_EXCEPTION;
+            head_len = decoder->readMessageBegin(rpc_head->m_function_name, msg_type, seqid);
+            rpc_head->m_message_type = static_cast<int32_t>(msg_type);
+        }
         rpc_head->m_session_id   = static_cast<uint64_t>(seqid);
     } catch (TException e) {
         PLOG_ERROR_N_EVERY_SECOND(1, "catch exception : %s", e.what());
         return kPEBBLE_RPC_DECODE_HEAD_FAILED;
     }
 
-    if (rpc_head->m_message_type < dr::protocol::T_CALL
-        || rpc_head->m_message_type > dr::protocol::T_ONEWAY) {
+    if (rpc_head->m_message_type < kRPC_CALL
+        || rpc_head->m_message_type > kRPC_STREAM_CREDIT) {
         PLOG_ERROR_N_EVERY_SECOND(1, "message type error %d", rpc_head->m_message_type);
         return kPEBBLE_RPC_MSG_TYPE_ERROR;
     }
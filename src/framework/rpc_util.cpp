@@ -11,19 +11,84 @@
  *
  */
 
+#include <algorithm>
+
 #include "common/coroutine.h"
 #include "common/log.h"
+#include "common/time_utility.h"
+#include "framework/router.h"
 #include "framework/rpc_util.inh"
 
 
 namespace pebble {
 
+/// @brief 在协程中处理RPC请求的任务，记录请求的截止时刻供嵌套调用继承
+class RpcRequestTask : public CoroutineTask {
+public:
+    RpcRequestTask() : m_rpc(NULL), m_handle(-1), m_buff(NULL), m_buff_len(0) {}
+    virtual ~RpcRequestTask() {}
+
+    void Init(IRpc* rpc, int64_t handle, const RpcHead& rpc_head,
+        const uint8_t* buff, uint32_t buff_len) {
+        m_rpc      = rpc;
+        m_handle   = handle;
+        m_rpc_head = rpc_head;
+        m_buff     = buff;
+        m_buff_len = buff_len;
+    }
+
+    virtual void Run() {
+        m_rpc->ProcessRequestImp(m_handle, m_rpc_head, m_buff, m_buff_len);
+    }
+
+    int64_t GetDeadline() const {
+        return IRpc::GetDeadline(m_rpc_head);
+    }
+
+private:
+    IRpc*           m_rpc;
+    int64_t         m_handle;
+    RpcHead         m_rpc_head;
+    const uint8_t*  m_buff;
+    uint32_t        m_buff_len;
+};
+
+// 对冲预算令牌上限，限制空闲后的突发对冲数
+static const double kHEDGE_MAX_TOKENS = 10.0;
+// 按百分位计算等待时间所需的最少样本数
+static const uint32_t kHEDGE_MIN_SAMPLES = 64;
+// 样本数达到上限时直方图减半，使统计跟随近期耗时变化
+static const uint32_t kHEDGE_MAX_SAMPLES = 4096;
+
+static uint32_t HedgeLatencyToBucket(int64_t latency_ms, uint32_t bucket_num) {
+    if (latency_ms < 8) {
+        return latency_ms > 0 ? static_cast<uint32_t>(latency_ms) : 0;
+    }
+    uint32_t msb = 63 - __builtin_clzll(static_cast<uint64_t>(latency_ms));
+    uint32_t idx = 8 + (msb - 3) * 4 + ((latency_ms >> (msb - 2)) & 3);
+    return idx < bucket_num ? idx : bucket_num - 1;
+}
+
+// 返回桶的耗时上界(ms)
+static int32_t HedgeBucketToLatency(uint32_t idx) {
+    if (idx < 8) {
+        return idx + 1;
+    }
+    uint32_t msb = 3 + (idx - 8) / 4;
+    uint32_t sub = (idx - 8) % 4;
+    return (1 << msb) + (sub + 1) * (1 << (msb - 2));
+}
+
 RpcUtil::RpcUtil(IRpc* rpc, CoroutineSchedule* coroutine_schedule) {
     m_rpc = rpc;
     m_coroutine_schedule = coroutine_schedule;
 }
 
 RpcUtil::~RpcUtil() {
+    for (cxx::unordered_map<std::string, CoalescedCall*>::iterator it = m_coalesced_calls.begin();
+        it != m_coalesced_calls.end(); ++it) {
+        delete it->second;
+    }
     m_rpc = NULL;
     m_coroutine_schedule = NULL;
 }
@@ -44,13 +109,54 @@ int32_t RpcUtil::SendRequestSync(int64_t handle,
         return kRPC_UTIL_NOT_IN_COROUTINE;
     }
 
-    int32_t ret = kRPC_SUCCESS;
+    int32_t ret = InheritTimeout(&timeout_ms);
+    if (ret != kRPC_SUCCESS) {
+        return ret;
+    }
+
+    // 合并的调用只有一个请求在途，不再对冲
+    if (!m_coalesce_methods.empty()
+        && m_coalesce_methods.find(rpc_head.m_function_name) != m_coalesce_methods.end()) {
+        return SendRequestCoalesced(handle, rpc_head, buff, buff_len, on_rsp, timeout_ms);
+    }
+
+    if (!m_hedge_states.empty()) {
+        cxx::unordered_map<std::string, HedgeState>::iterator it =
+            m_hedge_states.find(rpc_head.m_function_name);
+        if (m_hedge_states.end() != it) {
+            return SendRequestHedged(&(it->second), handle, rpc_head, buff, buff_len,
+                on_rsp, timeout_ms);
+        }
+    }
 
     SendRequestInCoroutine(handle, rpc_head, buff, buff_len, on_rsp, timeout_ms, &ret);
 
     return ret;
 }
 
+int32_t RpcUtil::InheritTimeout(int32_t* timeout_ms) {
+    RpcRequestTask* task = dynamic_cast<RpcRequestTask*>(m_coroutine_schedule->CurrentTask());
+    if (NULL == task) {
+        return kRPC_SUCCESS;
+    }
+
+    int64_t deadline = task->GetDeadline();
+    if (deadline < 0) {
+        return kRPC_SUCCESS;
+    }
+
+    // 当前请求的调用方已经超时，嵌套请求不再发出
+    int64_t remain_ms = deadline - TimeUtility::GetCurrentMS();
+    if (remain_ms <= 0) {
+        return kRPC_REQUEST_TIMEOUT;
+    }
+
+    if (*timeout_ms <= 0 || remain_ms < *timeout_ms) {
+        *timeout_ms = static_cast<int32_t>(remain_ms);
+    }
+    return kRPC_SUCCESS;
+}
+
 void RpcUtil::SendRequestInCoroutine(int64_t handle,
                     const RpcHead& rpc_head,
                     const uint8_t* buff,
@@ -71,6 +177,262 @@ void RpcUtil::SendRequestInCoroutine(int64_t handle,
     *ret = on_rsp(m_result._ret, m_result._buff, m_result._buff_len);
 }
 
+int32_t RpcUtil::SendRequestHedged(HedgeState* state,
+                    int64_t handle,
+                    const RpcHead& rpc_head,
+                    const uint8_t* buff,
+                    uint32_t buff_len,
+                    const OnRpcResponse& on_rsp,
+                    int32_t timeout_ms) {
+    int64_t start_ms = TimeUtility::GetCurrentMS();
+    if (timeout_ms <= 0) {
+        timeout_ms = 10 * 1000;
+    }
+
+    state->_tokens += state->_policy._budget_ratio;
+    if (state->_tokens > kHEDGE_MAX_TOKENS) {
+        state->_tokens = kHEDGE_MAX_TOKENS;
+    }
+
+    // 只有handle由Router管理时才能选出另一个目标
+    int32_t delay_ms = GetHedgeDelay(*state);
+    bool can_hedge = delay_ms > 0 && delay_ms < timeout_ms && state->_tokens >= 1.0
+        && Router::GetRouterByHandle(handle) != NULL;
+
+    HedgeCall call;
+    call._co_id         = m_coroutine_schedule->CurrentTaskId();
+    call._session_id[0] = rpc_head.m_session_id;
+    call._session_id[1] = 0;
+    call._in_flight[0]  = false;
+    call._in_flight[1]  = false;
+    call._pending       = 0;
+    call._ret           = kRPC_REQUEST_TIMEOUT;
+    call._buff          = NULL;
+    call._buff_len      = 0;
+
+    // 等待期间其他协程可能复用编码buff，需要对冲时先保存请求数据
+    std::string req_data;
+    if (can_hedge) {
+        req_data.assign(reinterpret_cast<const char*>(buff), buff_len);
+    }
+
+    OnRpcResponse rsp = cxx::bind(&RpcUtil::OnHedgeResponse, this,
+        cxx::placeholders::_1, cxx::placeholders::_2, cxx::placeholders::_3, &call, 0u);
+    int32_t ret = m_rpc->SendRequest(handle, rpc_head, buff, buff_len, rsp, timeout_ms);
+    if (ret != kRPC_SUCCESS) {
+        return ret;
+    }
+    call._in_flight[0] = true;
+    call._pending      = 1;
+
+    ret = m_coroutine_schedule->Yield(can_hedge ? delay_ms : -1);
+    if (kCO_TIMEOUT == ret) {
+        // 主请求在等待时间内未返回，Router可能已在等待期间析构，需要重新查找
+        Router* router   = Router::GetRouterByHandle(handle);
+        int64_t remain_ms = timeout_ms - (TimeUtility::GetCurrentMS() - start_ms);
+        int64_t alt_handle = -1;
+        if (router != NULL && remain_ms > 0) {
+            alt_handle = router->GetRouteExclude(rpc_head.m_session_id,
+                std::vector<int64_t>(1, handle));
+        }
+        if (alt_handle >= 0) {
+            RpcHead hedge_head(rpc_head);
+            hedge_head.m_session_id = m_rpc->GenSessionId();
+            rsp = cxx::bind(&RpcUtil::OnHedgeResponse, this,
+                cxx::placeholders::_1, cxx::placeholders::_2, cxx::placeholders::_3, &call, 1u);
+            ret = m_rpc->SendRequest(alt_handle, hedge_head,
+                reinterpret_cast<const uint8_t*>(req_data.data()), req_data.size(),
+                rsp, static_cast<int32_t>(remain_ms));
+            if (kRPC_SUCCESS == ret) {
+                state->_tokens -= 1.0;
+                call._session_id[1] = hedge_head.m_session_id;
+                call._in_flight[1]  = true;
+                ++call._pending;
+            }
+        }
+        m_coroutine_schedule->Yield();
+    } else if (call._pending > 0) {
+        // 定时器启动失败时未让出，退化为普通的同步等待
+        m_coroutine_schedule->Yield();
+    }
+
+    // 先返回的响应生效，取消仍在途的另一请求
+    for (uint32_t idx = 0; idx < 2; ++idx) {
+        if (call._in_flight[idx]) {
+            m_rpc->CancelRequest(call._session_id[idx]);
+        }
+    }
+
+    if (kRPC_SUCCESS == call._ret) {
+        AddHedgeLatency(state, TimeUtility::GetCurrentMS() - start_ms);
+    }
+
+    return on_rsp(call._ret, call._buff, call._buff_len);
+}
+
+int32_t RpcUtil::OnHedgeResponse(int32_t ret,
+                                 const uint8_t* buff,
+                                 uint32_t buff_len,
+                                 HedgeCall* call,
+                                 uint32_t index) {
+    call->_in_flight[index] = false;
+    --(call->_pending);
+
+    // 一个请求传输失败而另一个仍在途时，继续等待另一个的结果
+    if (call->_pending > 0 && RouteQuality::IsTransportFailed(ret)) {
+        return kRPC_SUCCESS;
+    }
+
+    call->_ret      = ret;
+    call->_buff     = buff;
+    call->_buff_len = buff_len;
+
+    m_coroutine_schedule->Resume(call->_co_id);
+    return kRPC_SUCCESS;
+}
+
+int32_t RpcUtil::SendRequestCoalesced(int64_t handle,
+                    const RpcHead& rpc_head,
+                    const uint8_t* buff,
+                    uint32_t buff_len,
+                    const OnRpcResponse& on_rsp,
+                    int32_t timeout_ms) {
+    // 发往不同目标的相同请求不合并，目标可能按handle分区
+    std::string key(reinterpret_cast<const char*>(&handle), sizeof(handle));
+    key.append(rpc_head.m_function_name);
+    key.push_back('\0');
+    key.append(reinterpret_cast<const char*>(buff), buff_len);
+
+    int64_t co_id = m_coroutine_schedule->CurrentTaskId();
+    CoalescedCall* call = NULL;
+    cxx::unordered_map<std::string, CoalescedCall*>::iterator it = m_coalesced_calls.find(key);
+    if (m_coalesced_calls.end() != it) {
+        // 相同的请求在途，等待其响应，超过自己的超时时间则单独返回
+        int64_t deadline = TimeUtility::GetCurrentMS() + timeout_ms;
+        call = it->second;
+        call->_co_ids.push_back(co_id);
+        int32_t ret = m_coroutine_schedule->Yield(timeout_ms);
+        if (ret != 0) {
+            std::vector<int64_t>::iterator pos =
+                std::find(call->_co_ids.begin(), call->_co_ids.end(), co_id);
+            if (call->_co_ids.end() != pos) {
+                call->_co_ids.erase(pos);
+            }
+            // 和单独发送的请求一样，超时也通过回调返回
+            return on_rsp(kCO_TIMEOUT == ret ? kRPC_REQUEST_TIMEOUT : kRPC_SYSTEM_ERROR, NULL, 0);
+        }
+        // 在途请求按其自己的超时时间超时，本调用还有剩余时间时重新发起
+        int64_t remain_ms = deadline - TimeUtility::GetCurrentMS();
+        if (kRPC_REQUEST_TIMEOUT == call->_ret && remain_ms > 0) {
+            return SendRequestCoalesced(handle, rpc_head, buff, buff_len, on_rsp,
+                static_cast<int32_t>(remain_ms));
+        }
+        return on_rsp(call->_ret, call->_buff, call->_buff_len);
+    }
+
+    call = new CoalescedCall;
+    call->_ret      = kRPC_REQUEST_TIMEOUT;
+    call->_buff     = NULL;
+    call->_buff_len = 0;
+
+    OnRpcResponse rsp = cxx::bind(&RpcUtil::OnCoalescedResponse, this,
+        cxx::placeholders::_1, cxx::placeholders::_2, cxx::placeholders::_3, call);
+    int32_t ret = m_rpc->SendRequest(handle, rpc_head, buff, buff_len, rsp, timeout_ms);
+    if (ret != kRPC_SUCCESS) {
+        delete call;
+        return ret;
+    }
+
+    it = m_coalesced_calls.insert(std::make_pair(key, call)).first;
+    call->_key = &(it->first);
+    call->_co_ids.push_back(co_id);
+
+    m_coroutine_schedule->Yield();
+
+    return on_rsp(call->_ret, call->_buff, call->_buff_len);
+}
+
+int32_t RpcUtil::OnCoalescedResponse(int32_t ret,
+                                     const uint8_t* buff,
+                                     uint32_t buff_len,
+                                     CoalescedCall* call) {
+    call->_ret      = ret;
+    call->_buff     = buff;
+    call->_buff_len = buff_len;
+
+    // 先移出在途表，被唤醒的协程再次发起相同请求时重新发送
+    m_coalesced_calls.erase(*(call->_key));
+    call->_key = NULL;
+
+    // 响应数据在回调期间有效，各协程被唤醒后直接解码，无需拷贝
+    for (uint32_t idx = 0; idx < call->_co_ids.size(); ++idx) {
+        m_coroutine_schedule->Resume(call->_co_ids[idx]);
+    }
+
+    delete call;
+    return kRPC_SUCCESS;
+}
+
+int32_t RpcUtil::WaitStreamCredit(uint64_t session_id) {
+    if (!m_coroutine_schedule || m_coroutine_schedule->CurrentTaskId() == INVALID_CO_ID) {
+        return kRPC_STREAM_NO_CREDIT;
+    }
+
+    int64_t co_id = m_coroutine_schedule->CurrentTaskId();
+    int32_t ret = m_rpc->SetStreamCreditCallback(session_id,
+        cxx::bind(&CoroutineSchedule::Resume, m_coroutine_schedule, co_id, 0));
+    if (ret != kRPC_SUCCESS) {
+        return ret;
+    }
+
+    m_coroutine_schedule->Yield();
+    return kRPC_SUCCESS;
+}
+
+void RpcUtil::SetCoalesce(const std::string& name, bool enable) {
+    if (enable) {
+        m_coalesce_methods.insert(name);
+    } else {
+        m_coalesce_methods.erase(name);
+    }
+}
+
+void RpcUtil::SetHedgePolicy(const std::string& name, const HedgePolicy& policy) {
+    if (policy._delay_ms <= 0 && 0 == policy._percentile) {
+        m_hedge_states.erase(name);
+        return;
+    }
+    m_hedge_states[name]._policy = policy;
+}
+
+int32_t RpcUtil::GetHedgeDelay(const HedgeState& state) {
+    const HedgePolicy& policy = state._policy;
+    if (policy._percentile > 0 && policy._percentile < 100 && state._samples >= kHEDGE_MIN_SAMPLES) {
+        uint32_t target = (state._samples * policy._percentile + 99) / 100;
+        uint32_t count  = 0;
+        for (uint32_t idx = 0; idx < kHEDGE_LATENCY_BUCKETS; ++idx) {
+            count += state._latency_hist[idx];
+            if (count >= target) {
+                return HedgeBucketToLatency(idx);
+            }
+        }
+    }
+    return policy._delay_ms;
+}
+
+void RpcUtil::AddHedgeLatency(HedgeState* state, int64_t latency_ms) {
+    ++(state->_latency_hist[HedgeLatencyToBucket(latency_ms, kHEDGE_LATENCY_BUCKETS)]);
+    if (++(state->_samples) < kHEDGE_MAX_SAMPLES) {
+        return;
+    }
+
+    state->_samples = 0;
+    for (uint32_t idx = 0; idx < kHEDGE_LATENCY_BUCKETS; ++idx) {
+        state->_latency_hist[idx] /= 2;
+        state->_samples += state->_latency_hist[idx];
+    }
+}
+
 void RpcUtil::SendRequestParallel(int64_t handle,
                                   const RpcHead& rpc_head,
                                   const uint8_t* buff,
@@ -101,6 +463,13 @@ void RpcUtil::SendRequestParallel(int64_t handle,
         return;
     }
 
+    *ret_code = InheritTimeout(&timeout_ms);
+    if (*ret_code != kRPC_SUCCESS) {
+        --(*num_called);
+        --(*num_parallel);
+        return;
+    }
+
     SendRequestParallelInCoroutine(handle,
                                    rpc_head,
                                    buff,
@@ -188,20 +557,13 @@ int32_t RpcUtil::ProcessRequest(int64_t handle, const RpcHead& rpc_head,
         return m_rpc->ProcessRequestImp(handle, rpc_head, buff, buff_len);
     }
 
-    CommonCoroutineTask* task = m_coroutine_schedule->NewTask<CommonCoroutineTask>();
-    cxx::function<void(void)> run = cxx::bind(&RpcUtil::ProcessRequestInCoroutine, this,
-        handle, rpc_head, buff, buff_len);
-    task->Init(run);
+    RpcRequestTask* task = m_coroutine_schedule->NewTask<RpcRequestTask>();
+    task->Init(m_rpc, handle, rpc_head, buff, buff_len);
     task->Start();
 
     return kRPC_SUCCESS;
 }
 
-int32_t RpcUtil::ProcessRequestInCoroutine(int64_t handle, const RpcHead& rpc_head,
-    const uint8_t* buff, uint32_t buff_len) {
-    return m_rpc->ProcessRequestImp(handle, rpc_head, buff, buff_len);
-}
-
 
 } // namespace pebble
 
@@ -18,7 +18,7 @@
 namespace pebble {
 
 SessionMgr::SessionMgr() {
-    m_timer         = new SequenceTimer();
+    m_timer         = new WheelTimer();
     m_last_error[0] = 0;
 }
 
@@ -22,7 +22,7 @@
 namespace pebble {
 
 // 前置声明
-class SequenceTimer;
+class WheelTimer;
 
 /// @brief Session模块错误码定义
 typedef enum {
@@ -130,7 +130,7 @@ private:
     };
 
 private:
-    SequenceTimer* m_timer;
+    WheelTimer* m_timer;
     cxx::unordered_map<int64_t, SessionInfo> m_sessions;
     char m_last_error[256];
 };
@@ -0,0 +1,873 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "common/log.h"
+#include "common/time_utility.h"
+#include "framework/shm_driver.h"
+
+
+namespace pebble {
+
+// epoll每次最多返回的事件数
+static const int MAX_EPOLL_EVENT_NUM = 256;
+
+// 监听socket名字的前缀，名字位于abstract namespace
+static const char SHM_SOCKET_PREFIX[] = "pebble_shm.";
+
+static const uint32_t SHM_MAGIC   = 0x5045534D; // "PESM"
+static const uint32_t SHM_VERSION = 1;
+
+// 握手时传递的fd：共享内存，Connect->Bind方向的eventfd，Bind->Connect方向的eventfd
+static const int SHM_HANDSHAKE_FD_NUM = 3;
+
+typedef enum {
+	kSHM_FD_LISTENER	= 0,	// Bind的监听socket
+	kSHM_FD_HANDSHAKE	= 1,	// 已accept，等待握手消息的socket
+	kSHM_FD_CTRL		= 2,	// 已建立连接的socket，只用于感知对端关闭
+	kSHM_FD_WAKEUP		= 3,	// 本端接收队列的eventfd
+} ShmFdType;
+
+/// @brief Connect端通过unix socket发送的握手消息，共享内存等fd在附属数据中
+struct ShmHandshakeMsg {
+	uint32_t	_magic;
+	uint32_t	_version;
+	uint64_t	_ring_size;
+};
+
+/// @brief 单个方向的环形队列头，生产者和消费者各自修改的字段放在不同的cache line
+/// @note _tail和_head是累计的字节数，不回绕，两者相等时队列为空
+struct ShmRingHead {
+	uint64_t	_tail;			// 生产者已写入的字节数
+	char		_pad0[56];
+	uint64_t	_head;			// 消费者已释放的字节数
+	char		_pad1[56];
+};
+
+/// @brief 共享内存的布局：段头，两个队列头，Connect->Bind方向的队列数据，Bind->Connect方向的队列数据
+struct ShmSegmentHead {
+	uint32_t	_magic;
+	uint32_t	_version;
+	uint64_t	_ring_size;
+	char		_pad[48];
+	ShmRingHead	_rings[2];
+};
+
+/// @brief 队列中每条消息的头，消息按8字节对齐存放，不跨越队列尾部
+struct ShmMsgHead {
+	uint32_t	_len;
+	uint32_t	_flag;
+};
+
+static const uint32_t kSHM_MSG_PADDING = 1;	// 队列尾部剩余空间不够时的填充，消费者跳到队列开头
+
+static inline uint64_t LoadAcquire(const uint64_t* ptr) {
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void StoreRelease(uint64_t* ptr, uint64_t value) {
+	__atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t Align8(uint64_t len) {
+	return (len + 7) & ~static_cast<uint64_t>(7);
+}
+
+/// @brief 本端看到的一个方向的队列
+struct ShmRing {
+	ShmRing() : _head(NULL), _data(NULL), _size(0), _peer_pos(0) {}
+
+	ShmRingHead*	_head;
+	uint8_t*		_data;
+	uint64_t		_size;
+	uint64_t		_peer_pos;	// 最近读到的对端位置，发送方缓存_head，减少对对端cache line的访问
+};
+
+/// @brief 一个共享内存连接
+struct ShmChannel {
+	ShmChannel() : _local_handle(-1), _trans_handle(-1), _ctrl_fd(-1), _notify_fd(-1), _wait_fd(-1),
+		_mem(NULL), _mem_len(0), _closed(false), _peer_closed(false) {}
+
+	~ShmChannel() {
+		if (_ctrl_fd >= 0) {
+			close(_ctrl_fd);
+		}
+		if (_notify_fd >= 0) {
+			close(_notify_fd);
+		}
+		if (_wait_fd >= 0) {
+			close(_wait_fd);
+		}
+		if (_mem != NULL) {
+			munmap(_mem, _mem_len);
+		}
+	}
+
+	/// @brief 映射共享内存，send_idx为本端发送队列在段头中的下标
+	int32_t Map(int shm_fd, uint64_t ring_size, int send_idx) {
+		_mem_len = sizeof(ShmSegmentHead) + 2 * ring_size;
+		_mem = mmap(NULL, _mem_len, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+		if (MAP_FAILED == _mem) {
+			_mem = NULL;
+			return -1;
+		}
+
+		ShmSegmentHead* segment = static_cast<ShmSegmentHead*>(_mem);
+		uint8_t* data = static_cast<uint8_t*>(_mem) + sizeof(ShmSegmentHead);
+		_send._head = &segment->_rings[send_idx];
+		_send._data = data + send_idx * ring_size;
+		_send._size = ring_size;
+		_recv._head = &segment->_rings[1 - send_idx];
+		_recv._data = data + (1 - send_idx) * ring_size;
+		_recv._size = ring_size;
+		return 0;
+	}
+
+	int64_t		_local_handle;
+	int64_t		_trans_handle;
+	int			_ctrl_fd;
+	int			_notify_fd;		// 对端接收队列的eventfd，由空变为非空时写入
+	int			_wait_fd;		// 本端接收队列的eventfd
+	void*		_mem;
+	size_t		_mem_len;
+	ShmRing		_send;
+	ShmRing		_recv;
+	bool		_closed;
+	bool		_peer_closed;	// 对端已关闭，接收队列中剩余的消息递交完后关闭连接
+};
+
+/// @brief epoll中注册的fd
+struct ShmFdEvent {
+	ShmFdEvent() : _type(kSHM_FD_LISTENER), _handle(-1) {}
+
+	int			_type;
+	int64_t		_handle;
+};
+
+static int32_t NameToAddr(const std::string& name, struct sockaddr_un* addr, socklen_t* addr_len) {
+	bzero(addr, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	// sun_path[0]为'\0'表示abstract namespace
+	size_t len = 1 + sizeof(SHM_SOCKET_PREFIX) - 1 + name.size();
+	if (name.empty() || len > sizeof(addr->sun_path)) {
+		PLOG_ERROR("shm name %s is invalid", name.c_str());
+		return -1;
+	}
+	memcpy(addr->sun_path + 1, SHM_SOCKET_PREFIX, sizeof(SHM_SOCKET_PREFIX) - 1);
+	memcpy(addr->sun_path + sizeof(SHM_SOCKET_PREFIX), name.data(), name.size());
+	*addr_len = offsetof(struct sockaddr_un, sun_path) + len;
+	return 0;
+}
+
+static void CloseFds(int* fds, int num) {
+	for (int i = 0; i < num; i++) {
+		if (fds[i] >= 0) {
+			close(fds[i]);
+			fds[i] = -1;
+		}
+	}
+}
+
+/// @brief 写入一条消息，队列由空变为非空时唤醒对端
+static int32_t RingPush(ShmChannel* channel, uint32_t msg_frag_num,
+	const uint8_t* msg_frag[], uint32_t msg_frag_len[]) {
+	ShmRing& ring = channel->_send;
+
+	uint64_t msg_len = 0;
+	for (uint32_t i = 0; i < msg_frag_num; i++) {
+		msg_len += msg_frag_len[i];
+	}
+	uint64_t need = sizeof(ShmMsgHead) + Align8(msg_len);
+	if (need > ring._size / 2) {
+		PLOG_ERROR("msg len %lu exceed the ring size %lu", msg_len, ring._size);
+		return kMESSAGE_SEND_BUFF_NOT_ENOUGH;
+	}
+
+	uint64_t tail = ring._head->_tail;
+	uint64_t pos = tail & (ring._size - 1);
+	uint64_t skip = (ring._size - pos < need) ? ring._size - pos : 0;
+	if (tail + skip + need - ring._peer_pos > ring._size) {
+		ring._peer_pos = LoadAcquire(&ring._head->_head);
+		if (tail + skip + need - ring._peer_pos > ring._size) {
+			return kMESSAGE_SEND_BUFF_NOT_ENOUGH;
+		}
+	}
+
+	if (skip > 0) {
+		ShmMsgHead* padding = reinterpret_cast<ShmMsgHead*>(ring._data + pos);
+		padding->_len  = 0;
+		padding->_flag = kSHM_MSG_PADDING;
+		pos = 0;
+	}
+
+	ShmMsgHead* head = reinterpret_cast<ShmMsgHead*>(ring._data + pos);
+	head->_len  = static_cast<uint32_t>(msg_len);
+	head->_flag = 0;
+	uint8_t* data = ring._data + pos + sizeof(ShmMsgHead);
+	for (uint32_t i = 0; i < msg_frag_num; i++) {
+		memcpy(data, msg_frag[i], msg_frag_len[i]);
+		data += msg_frag_len[i];
+	}
+	StoreRelease(&ring._head->_tail, tail + skip + need);
+
+	// 和消费者的检查配对：要么本端看到消费者已追上(需要唤醒)，要么消费者看到新的_tail
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	ring._peer_pos = LoadAcquire(&ring._head->_head);
+	if (ring._peer_pos == tail) {
+		uint64_t one = 1;
+		if (write(channel->_notify_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+			PLOG_ERROR("notify peer failed %d:%s", errno, strerror(errno));
+		}
+	}
+	return 0;
+}
+
+ShmDriver::ShmDriver() {
+	m_epoll_fd				= -1;
+	m_in_update				= false;
+	m_list_dirty			= false;
+	m_ring_size				= DEFAULT_RING_SIZE;
+	m_max_msg_num_per_loop	= 0;
+	m_max_msg_num_per_conn	= 0;
+	m_loop_msg_num			= 0;
+	m_dispatch_pos			= 0;
+}
+
+ShmDriver::~ShmDriver() {
+	for (cxx::unordered_map<int64_t, int>::iterator it = m_listeners.begin(); it != m_listeners.end(); ++it) {
+		close(it->second);
+	}
+	m_listeners.clear();
+
+	for (cxx::unordered_map<int, cxx::shared_ptr<ShmFdEvent> >::iterator it = m_fd_events.begin();
+		it != m_fd_events.end(); ++it) {
+		if (kSHM_FD_HANDSHAKE == it->second->_type) {
+			close(it->first);
+		}
+	}
+	m_fd_events.clear();
+
+	// 连接的fd和共享内存在ShmChannel析构时释放
+	m_channels.clear();
+	m_channel_list.clear();
+
+	if (m_epoll_fd >= 0) {
+		close(m_epoll_fd);
+		m_epoll_fd = -1;
+	}
+}
+
+int32_t ShmDriver::Init() {
+	// 资源在首次Bind/Connect时才分配，未使用shm时不占用fd
+	return 0;
+}
+
+int32_t ShmDriver::InitEpoll() {
+	if (m_epoll_fd >= 0) {
+		return 0;
+	}
+
+	m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (m_epoll_fd < 0) {
+		PLOG_ERROR("epoll create failed %d:%s", errno, strerror(errno));
+		return kMESSAGE_EPOLL_INIT_FAILED;
+	}
+	return 0;
+}
+
+int64_t ShmDriver::Bind(const std::string& url) {
+	int32_t ret = InitEpoll();
+	if (ret != 0) {
+		return ret;
+	}
+
+	struct sockaddr_un addr;
+	socklen_t addr_len = 0;
+	if (NameToAddr(url, &addr, &addr_len) != 0) {
+		return kMESSAGE_INVAILD_PARAM;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		PLOG_ERROR("socket failed %d:%s", errno, strerror(errno));
+		return kMESSAGE_SYSTEM_ERROR;
+	}
+
+	if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), addr_len) != 0
+		|| listen(fd, 1024) != 0) {
+		PLOG_ERROR("bind shm://%s failed %d:%s", url.c_str(), errno, strerror(errno));
+		close(fd);
+		return kMESSAGE_BIND_ADDR_FAILED;
+	}
+
+	int64_t handle = GenHandle();
+	if (AddFdEvent(fd, kSHM_FD_LISTENER, handle) != 0) {
+		close(fd);
+		return kMESSAGE_SYSTEM_ERROR;
+	}
+	m_listeners[handle] = fd;
+	return handle;
+}
+
+int64_t ShmDriver::Connect(const std::string& url) {
+	int32_t ret = InitEpoll();
+	if (ret != 0) {
+		return ret;
+	}
+
+	struct sockaddr_un addr;
+	socklen_t addr_len = 0;
+	if (NameToAddr(url, &addr, &addr_len) != 0) {
+		return kMESSAGE_INVAILD_PARAM;
+	}
+
+	cxx::shared_ptr<ShmChannel> channel(new ShmChannel());
+	// unix domain socket的connect不会返回EINPROGRESS，非阻塞时要么立即完成，要么在对端
+	// listen队列满时返回EAGAIN，此时按连接失败返回，由调用者重试，不阻塞Update循环
+	channel->_ctrl_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (channel->_ctrl_fd < 0) {
+		PLOG_ERROR("socket failed %d:%s", errno, strerror(errno));
+		return kMESSAGE_SYSTEM_ERROR;
+	}
+	if (connect(channel->_ctrl_fd, reinterpret_cast<struct sockaddr*>(&addr), addr_len) != 0) {
+		PLOG_ERROR("connect shm://%s failed %d:%s", url.c_str(), errno, strerror(errno));
+		return kMESSAGE_CONNECT_ADDR_FAILED;
+	}
+
+	int64_t handle = GenHandle();
+
+	// 共享内存只在握手期间有名字，fd传给对端后即删除，进程退出后不会遗留
+	char shm_name[64];
+	snprintf(shm_name, sizeof(shm_name), "/pebble_shm.%d.%ld", getpid(), handle);
+	int fds[SHM_HANDSHAKE_FD_NUM] = { -1, -1, -1 };
+	fds[0] = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fds[0] < 0) {
+		PLOG_ERROR("shm_open %s failed %d:%s", shm_name, errno, strerror(errno));
+		return kMESSAGE_SYSTEM_ERROR;
+	}
+
+	ret = kMESSAGE_SYSTEM_ERROR;
+	do {
+		if (ftruncate(fds[0], sizeof(ShmSegmentHead) + 2 * static_cast<off_t>(m_ring_size)) != 0) {
+			PLOG_ERROR("ftruncate %s failed %d:%s", shm_name, errno, strerror(errno));
+			break;
+		}
+		if (channel->Map(fds[0], m_ring_size, 0) != 0) {
+			PLOG_ERROR("mmap %s failed %d:%s", shm_name, errno, strerror(errno));
+			break;
+		}
+		ShmSegmentHead* segment = static_cast<ShmSegmentHead*>(channel->_mem);
+		segment->_magic     = SHM_MAGIC;
+		segment->_version   = SHM_VERSION;
+		segment->_ring_size = m_ring_size;
+
+		fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		fds[2] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (fds[1] < 0 || fds[2] < 0) {
+			PLOG_ERROR("eventfd failed %d:%s", errno, strerror(errno));
+			break;
+		}
+
+		ShmHandshakeMsg handshake;
+		handshake._magic     = SHM_MAGIC;
+		handshake._version   = SHM_VERSION;
+		handshake._ring_size = m_ring_size;
+		struct iovec iov;
+		iov.iov_base = &handshake;
+		iov.iov_len  = sizeof(handshake);
+
+		char control[CMSG_SPACE(sizeof(fds))];
+		memset(control, 0, sizeof(control));
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov        = &iov;
+		msg.msg_iovlen     = 1;
+		msg.msg_control    = control;
+		msg.msg_controllen = sizeof(control);
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type  = SCM_RIGHTS;
+		cmsg->cmsg_len   = CMSG_LEN(sizeof(fds));
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+		if (sendmsg(channel->_ctrl_fd, &msg, MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(handshake))) {
+			PLOG_ERROR("send handshake to shm://%s failed %d:%s", url.c_str(), errno, strerror(errno));
+			ret = kMESSAGE_CONNECT_ADDR_FAILED;
+			break;
+		}
+
+		channel->_notify_fd = fds[1];
+		channel->_wait_fd   = fds[2];
+		fds[1] = -1;
+		fds[2] = -1;
+		ret = 0;
+	} while (0);
+
+	shm_unlink(shm_name);
+	CloseFds(fds, SHM_HANDSHAKE_FD_NUM);
+	if (ret != 0) {
+		return ret;
+	}
+
+	channel->_local_handle = handle;
+	channel->_trans_handle = handle;
+	if (AddFdEvent(channel->_ctrl_fd, kSHM_FD_CTRL, handle) != 0
+		|| AddFdEvent(channel->_wait_fd, kSHM_FD_WAKEUP, handle) != 0) {
+		DelFdEvent(channel->_ctrl_fd);
+		return kMESSAGE_SYSTEM_ERROR;
+	}
+	AddChannel(channel);
+	return handle;
+}
+
+int32_t ShmDriver::Send(int64_t handle, const uint8_t* msg, uint32_t msg_len, int32_t flag) {
+	const uint8_t* msg_frag[] = { msg };
+	uint32_t msg_frag_len[] = { msg_len };
+	return SendV(handle, 1, msg_frag, msg_frag_len, flag);
+}
+
+int32_t ShmDriver::SendV(int64_t handle, uint32_t msg_frag_num,
+	const uint8_t* msg_frag[], uint32_t msg_frag_len[], int32_t flag) {
+	cxx::unordered_map<int64_t, cxx::shared_ptr<ShmChannel> >::iterator it = m_channels.find(handle);
+	if (m_channels.end() == it) {
+		return kMESSAGE_INVAILD_HANDLE;
+	}
+	if (it->second->_peer_closed) {
+		return kMESSAGE_ON_DISCONNECTED;
+	}
+	return RingPush(it->second.get(), msg_frag_num, msg_frag, msg_frag_len);
+}
+
+int32_t ShmDriver::Close(int64_t handle) {
+	cxx::unordered_map<int64_t, int>::iterator it = m_listeners.find(handle);
+	if (it != m_listeners.end()) {
+		// 和tcp一致，关闭监听不影响已建立的连接
+		DelFdEvent(it->second);
+		close(it->second);
+		m_listeners.erase(it);
+		return 0;
+	}
+
+	if (m_channels.find(handle) == m_channels.end()) {
+		return kMESSAGE_INVAILD_HANDLE;
+	}
+	CloseChannel(handle, false);
+	return 0;
+}
+
+int32_t ShmDriver::Update() {
+	m_loop_msg_num = 0;
+
+	if (m_epoll_fd < 0) {
+		return 0;
+	}
+
+	m_in_update = true;
+
+	int num = 0;
+	if (!m_fd_events.empty()) {
+		struct epoll_event events[MAX_EPOLL_EVENT_NUM];
+		int event_num = epoll_wait(m_epoll_fd, events, MAX_EPOLL_EVENT_NUM, 0);
+		for (int i = 0; i < event_num; i++) {
+			OnFdEvent(events[i].data.fd, events[i].events);
+		}
+		num += (event_num > 0 ? event_num : 0);
+	}
+
+	// 从上次配额用完的连接开始轮转，每个连接每轮最多处理自己的配额
+	size_t channel_num = m_channel_list.size();
+	uint32_t start = (channel_num > 0) ? m_dispatch_pos % channel_num : 0;
+	std::vector<int64_t> peer_closed_handles;
+	for (size_t i = 0; i < channel_num; i++) {
+		uint32_t budget = GetDispatchBudget();
+		if (0 == budget) {
+			break;
+		}
+		if (m_max_msg_num_per_conn > 0 && m_max_msg_num_per_conn < budget) {
+			budget = m_max_msg_num_per_conn;
+		}
+
+		size_t idx = (start + i) % channel_num;
+		// 回调中可能关闭连接，持有引用保证共享内存在递交期间有效
+		cxx::shared_ptr<ShmChannel> channel = m_channel_list[idx];
+		if (channel->_closed) {
+			continue;
+		}
+		uint32_t dispatch_num = Dispatch(channel, budget);
+		if (GetDispatchBudget() == 0) {
+			m_dispatch_pos = static_cast<uint32_t>(idx);
+		}
+		if (!channel->_closed && channel->_peer_closed && dispatch_num < budget) {
+			peer_closed_handles.push_back(channel->_trans_handle);
+		}
+	}
+	if (GetDispatchBudget() > 0 && channel_num > 0) {
+		m_dispatch_pos = (start + 1) % channel_num;
+	}
+
+	for (std::vector<int64_t>::iterator it = peer_closed_handles.begin();
+		it != peer_closed_handles.end(); ++it) {
+		CloseChannel(*it, true);
+	}
+
+	m_in_update = false;
+	CompactChannelList();
+
+	return num + m_loop_msg_num;
+}
+
+int32_t ShmDriver::SetRingSize(uint32_t ring_size) {
+	if (ring_size < MIN_RING_SIZE || ring_size > MAX_RING_SIZE) {
+		return kMESSAGE_INVAILD_PARAM;
+	}
+	uint32_t size = MIN_RING_SIZE;
+	while (size < ring_size) {
+		size <<= 1;
+	}
+	m_ring_size = size;
+	return 0;
+}
+
+void ShmDriver::SetDispatchBudget(uint32_t max_msg_num_per_loop, uint32_t max_msg_num_per_conn) {
+	m_max_msg_num_per_loop = max_msg_num_per_loop;
+	m_max_msg_num_per_conn = max_msg_num_per_conn;
+}
+
+int32_t ShmDriver::Wait(int64_t timeout_us) {
+	if (timeout_us <= 0) {
+		return 0;
+	}
+	if (m_epoll_fd < 0) {
+		usleep(timeout_us);
+		return 0;
+	}
+
+	// epoll_wait的超时精度为ms，用ppoll等待epoll fd可读以保持us精度
+	struct pollfd pfd;
+	pfd.fd      = m_epoll_fd;
+	pfd.events  = POLLIN;
+	pfd.revents = 0;
+	struct timespec ts;
+	ts.tv_sec  = timeout_us / 1000000;
+	ts.tv_nsec = (timeout_us % 1000000) * 1000;
+	int ret = ppoll(&pfd, 1, &ts, NULL);
+	return ret > 0 ? 1 : 0;
+}
+
+uint32_t ShmDriver::GetDispatchBudget() const {
+	if (0 == m_max_msg_num_per_loop) {
+		return UINT32_MAX;
+	}
+	return m_loop_msg_num < m_max_msg_num_per_loop ? m_max_msg_num_per_loop - m_loop_msg_num : 0;
+}
+
+void ShmDriver::OnFdEvent(int fd, uint32_t events) {
+	cxx::unordered_map<int, cxx::shared_ptr<ShmFdEvent> >::iterator it = m_fd_events.find(fd);
+	if (m_fd_events.end() == it) {
+		return;
+	}
+	int type = it->second->_type;
+	int64_t handle = it->second->_handle;
+
+	switch (type) {
+		case kSHM_FD_LISTENER:
+			Accept(handle, fd);
+			break;
+
+		case kSHM_FD_HANDSHAKE:
+			Handshake(handle, fd);
+			break;
+
+		case kSHM_FD_CTRL: {
+			// 握手后对端不再发送数据，可读即表示对端关闭
+			char buff[1];
+			ssize_t ret = recv(fd, buff, sizeof(buff), MSG_DONTWAIT);
+			if (ret < 0 && (EAGAIN == errno || EINTR == errno)) {
+				break;
+			}
+			cxx::unordered_map<int64_t, cxx::shared_ptr<ShmChannel> >::iterator cit = m_channels.find(handle);
+			if (cit != m_channels.end()) {
+				cit->second->_peer_closed = true;
+				DelFdEvent(cit->second->_wait_fd);
+			}
+			DelFdEvent(fd);
+			break;
+		}
+
+		case kSHM_FD_WAKEUP: {
+			// 读取清零，消息本身在Update中轮询队列处理
+			uint64_t value = 0;
+			if (read(fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+				PLOG_ERROR("read eventfd failed %d:%s", errno, strerror(errno));
+			}
+			break;
+		}
+
+		default:
+			break;
+	}
+}
+
+void ShmDriver::Accept(int64_t listen_handle, int listen_fd) {
+	while (true) {
+		int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno != EAGAIN && errno != EINTR) {
+				PLOG_ERROR("accept failed %d:%s", errno, strerror(errno));
+			}
+			return;
+		}
+
+		if (AddFdEvent(fd, kSHM_FD_HANDSHAKE, listen_handle) != 0) {
+			close(fd);
+			continue;
+		}
+		// Connect端在connect后立即发送握手消息，通常已经到达
+		Handshake(listen_handle, fd);
+	}
+}
+
+int32_t ShmDriver::Handshake(int64_t listen_handle, int fd) {
+	ShmHandshakeMsg handshake;
+	struct iovec iov;
+	iov.iov_base = &handshake;
+	iov.iov_len  = sizeof(handshake);
+
+	int fds[SHM_HANDSHAKE_FD_NUM] = { -1, -1, -1 };
+	char control[CMSG_SPACE(sizeof(fds))];
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov        = &iov;
+	msg.msg_iovlen     = 1;
+	msg.msg_control    = control;
+	msg.msg_controllen = sizeof(control);
+
+	ssize_t ret = recvmsg(fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+	if (ret < 0 && (EAGAIN == errno || EINTR == errno)) {
+		return 1;
+	}
+
+	struct cmsghdr* cmsg = (ret > 0) ? CMSG_FIRSTHDR(&msg) : NULL;
+	if (cmsg != NULL && SOL_SOCKET == cmsg->cmsg_level && SCM_RIGHTS == cmsg->cmsg_type) {
+		size_t fd_num = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		memcpy(fds, CMSG_DATA(cmsg), (fd_num < SHM_HANDSHAKE_FD_NUM ? fd_num : SHM_HANDSHAKE_FD_NUM) * sizeof(int));
+	}
+
+	DelFdEvent(fd);
+
+	cxx::shared_ptr<ShmChannel> channel(new ShmChannel());
+	channel->_ctrl_fd = fd;
+	do {
+		if (m_listeners.find(listen_handle) == m_listeners.end()) {
+			// 握手期间监听已关闭
+			break;
+		}
+		if (ret != static_cast<ssize_t>(sizeof(handshake)) || (msg.msg_flags & MSG_CTRUNC)
+			|| handshake._magic != SHM_MAGIC || handshake._version != SHM_VERSION
+			|| fds[0] < 0 || fds[1] < 0 || fds[2] < 0) {
+			PLOG_ERROR("recv invalid handshake(%ld)", ret);
+			break;
+		}
+
+		uint64_t ring_size = handshake._ring_size;
+		struct stat st;
+		if (ring_size < MIN_RING_SIZE || ring_size > MAX_RING_SIZE || (ring_size & (ring_size - 1)) != 0
+			|| fstat(fds[0], &st) != 0
+			|| static_cast<uint64_t>(st.st_size) < sizeof(ShmSegmentHead) + 2 * ring_size) {
+			PLOG_ERROR("invalid shm ring size %lu", ring_size);
+			break;
+		}
+		if (channel->Map(fds[0], ring_size, 1) != 0) {
+			PLOG_ERROR("mmap failed %d:%s", errno, strerror(errno));
+			break;
+		}
+
+		int64_t peer = GenHandle();
+		channel->_local_handle = listen_handle;
+		channel->_trans_handle = peer;
+		channel->_notify_fd    = fds[2];
+		channel->_wait_fd      = fds[1];
+		fds[1] = -1;
+		fds[2] = -1;
+		if (AddFdEvent(channel->_ctrl_fd, kSHM_FD_CTRL, peer) != 0
+			|| AddFdEvent(channel->_wait_fd, kSHM_FD_WAKEUP, peer) != 0) {
+			DelFdEvent(channel->_ctrl_fd);
+			break;
+		}
+
+		CloseFds(fds, SHM_HANDSHAKE_FD_NUM);
+		AddChannel(channel);
+		if (m_cbs._on_peer_connected) {
+			m_cbs._on_peer_connected(listen_handle, peer);
+		}
+		return 0;
+	} while (0);
+
+	// channel析构时关闭socket，对端感知到连接关闭
+	CloseFds(fds, SHM_HANDSHAKE_FD_NUM);
+	return 0;
+}
+
+int32_t ShmDriver::AddFdEvent(int fd, int type, int64_t handle) {
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events  = EPOLLIN;
+	event.data.fd = fd;
+	if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+		PLOG_ERROR("epoll add fd %d failed %d:%s", fd, errno, strerror(errno));
+		return -1;
+	}
+
+	cxx::shared_ptr<ShmFdEvent> fd_event(new ShmFdEvent());
+	fd_event->_type   = type;
+	fd_event->_handle = handle;
+	m_fd_events[fd] = fd_event;
+	return 0;
+}
+
+void ShmDriver::DelFdEvent(int fd) {
+	cxx::unordered_map<int, cxx::shared_ptr<ShmFdEvent> >::iterator it = m_fd_events.find(fd);
+	if (m_fd_events.end() == it) {
+		return;
+	}
+	epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	m_fd_events.erase(it);
+}
+
+uint32_t ShmDriver::Dispatch(const cxx::shared_ptr<ShmChannel>& channel, uint32_t budget) {
+	ShmRing& ring = channel->_recv;
+	uint64_t head = ring._head->_head;
+	uint64_t tail = LoadAcquire(&ring._head->_tail);
+	if (head == tail) {
+		return 0;
+	}
+
+	uint32_t num = 0;
+	while (num < budget) {
+		if (head == tail) {
+			// 和生产者的检查配对，确认队列确实为空，否则生产者可能认为不需要唤醒
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			tail = LoadAcquire(&ring._head->_tail);
+			if (head == tail) {
+				break;
+			}
+		}
+
+		uint64_t pos = head & (ring._size - 1);
+		const ShmMsgHead* msg_head = reinterpret_cast<const ShmMsgHead*>(ring._data + pos);
+		if (kSHM_MSG_PADDING == msg_head->_flag) {
+			head += ring._size - pos;
+			StoreRelease(&ring._head->_head, head);
+			continue;
+		}
+
+		// 消息在回调返回前一直留在队列中，回调直接使用共享内存中的数据
+		uint32_t msg_len = msg_head->_len;
+		// 消息头由对端写入，长度越过队列尾部或已提交的数据时说明对端异常，关闭连接
+		if (msg_len > ring._size - pos - sizeof(ShmMsgHead)
+			|| sizeof(ShmMsgHead) + Align8(msg_len) > tail - head) {
+			PLOG_ERROR("invalid shm msg len %u, ring size %lu, close handle %ld",
+				msg_len, ring._size, channel->_trans_handle);
+			CloseChannel(channel->_trans_handle, true);
+			break;
+		}
+		if (m_cbs._on_message) {
+			MsgExternInfo msg_info;
+			msg_info._self_handle	 = channel->_local_handle;
+			msg_info._remote_handle	 = channel->_trans_handle;
+			msg_info._msg_arrived_ms = TimeUtility::GetCurrentMS();
+			m_cbs._on_message(ring._data + pos + sizeof(ShmMsgHead), msg_len, &msg_info);
+		}
+		num++;
+		m_loop_msg_num++;
+		if (channel->_closed) {
+			// 回调中连接被关闭
+			break;
+		}
+
+		head += sizeof(ShmMsgHead) + Align8(msg_len);
+		StoreRelease(&ring._head->_head, head);
+	}
+
+	return num;
+}
+
+void ShmDriver::AddChannel(const cxx::shared_ptr<ShmChannel>& channel) {
+	m_channels[channel->_trans_handle] = channel;
+	m_channel_list.push_back(channel);
+}
+
+void ShmDriver::CompactChannelList() {
+	if (!m_list_dirty || m_in_update) {
+		return;
+	}
+
+	size_t num = 0;
+	for (size_t i = 0; i < m_channel_list.size(); i++) {
+		if (!m_channel_list[i]->_closed) {
+			m_channel_list[num++] = m_channel_list[i];
+		}
+	}
+	m_channel_list.resize(num);
+	m_list_dirty = false;
+}
+
+void ShmDriver::CloseChannel(int64_t handle, bool notify) {
+	cxx::unordered_map<int64_t, cxx::shared_ptr<ShmChannel> >::iterator it = m_channels.find(handle);
+	if (m_channels.end() == it) {
+		return;
+	}
+
+	cxx::shared_ptr<ShmChannel> channel = it->second;
+	m_channels.erase(it);
+
+	channel->_closed = true;
+	DelFdEvent(channel->_ctrl_fd);
+	DelFdEvent(channel->_wait_fd);
+	// 先关闭socket让对端尽快感知，共享内存在轮转列表释放引用后解除映射
+	close(channel->_ctrl_fd);
+	channel->_ctrl_fd = -1;
+
+	m_list_dirty = true;
+	CompactChannelList();
+
+	if (!notify) {
+		return;
+	}
+	if (channel->_local_handle == channel->_trans_handle) {
+		if (m_cbs._on_closed) {
+			m_cbs._on_closed(channel->_local_handle);
+		}
+	} else {
+		if (m_cbs._on_peer_closed) {
+			m_cbs._on_peer_closed(channel->_local_handle, channel->_trans_handle);
+		}
+	}
+}
+
+
+} // namespace pebble
+
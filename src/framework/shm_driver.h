@@ -0,0 +1,132 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _PEBBLE_SHM_DRIVER_H_
+#define _PEBBLE_SHM_DRIVER_H_
+
+#include <vector>
+#include "framework/message.h"
+
+
+namespace pebble {
+
+struct ShmChannel;
+struct ShmFdEvent;
+
+
+/// @brief 共享内存网络驱动，用于同机部署的进程间通信
+/// @note 每个连接拥有一块共享内存，内含两个方向的单生产者单消费者环形队列，收发消息不经过内核：
+///     - 发送时消息直接写入对端的接收队列，只有队列由空变为非空时才通过eventfd唤醒对端
+///     - 接收时把队列中的消息地址直接递交给_on_message，回调返回后才释放队列空间，没有拷贝
+/// @note 地址形式："shm://name"，Bind在abstract namespace的unix socket上监听此名字，
+///     Connect创建共享内存和eventfd，通过unix socket把fd传给对端，此socket同时用于感知对端退出
+/// @note 队列满时Send返回kMESSAGE_SEND_BUFF_NOT_ENOUGH，不做额外缓存，单条消息不能超过队列大小的一半
+class ShmDriver : public MessageDriver {
+public:
+    ShmDriver();
+    virtual ~ShmDriver();
+
+    // 每个方向队列的默认大小
+    static const uint32_t DEFAULT_RING_SIZE = 4 * 1024 * 1024;
+
+    // 队列大小的范围
+    static const uint32_t MIN_RING_SIZE = 4 * 1024;
+    static const uint32_t MAX_RING_SIZE = 1024 * 1024 * 1024;
+
+    virtual int32_t Init();
+
+    virtual int64_t Bind(const std::string& url);
+
+    virtual int64_t Connect(const std::string& url);
+
+    virtual int32_t Send(int64_t handle, const uint8_t* msg, uint32_t msg_len, int32_t flag);
+
+    virtual int32_t SendV(int64_t handle, uint32_t msg_frag_num,
+                          const uint8_t* msg_frag[], uint32_t msg_frag_len[], int32_t flag);
+
+    virtual int32_t Close(int64_t handle);
+
+    virtual int32_t Update();
+
+    virtual const char* Prefix() const { return "shm"; }
+
+    /// @brief 设置Connect创建的每个方向队列的大小，只影响之后建立的连接，Bind端使用Connect端的设置
+    /// @param ring_size 队列大小，向上取整为2的幂，范围为[MIN_RING_SIZE, MAX_RING_SIZE]
+    /// @return 0 成功
+    /// @return <0 失败 @see MessageErrorCode
+    int32_t SetRingSize(uint32_t ring_size);
+
+    /// @brief 设置每次Update递交消息的配额，配额用完后未处理的消息留在队列中，下次Update按连接轮转继续处理
+    /// @param max_msg_num_per_loop 每次Update最多递交的消息数，0表示不限制(默认)
+    /// @param max_msg_num_per_conn 每个连接每轮最多递交的消息数，0表示不限制(默认)
+    void SetDispatchBudget(uint32_t max_msg_num_per_loop, uint32_t max_msg_num_per_conn);
+
+    /// @brief 空闲时代替sleep，等待对端的唤醒通知或新连接，最多等待timeout_us
+    /// @return >0 等到事件
+    /// @return 0 超时
+    int32_t Wait(int64_t timeout_us);
+
+private:
+    int32_t InitEpoll();
+
+    /// @brief 本轮剩余的配额，不限制时返回UINT32_MAX
+    uint32_t GetDispatchBudget() const;
+
+    void OnFdEvent(int fd, uint32_t events);
+
+    void Accept(int64_t listen_handle, int listen_fd);
+
+    /// @brief 接收Connect端发来的共享内存和eventfd
+    /// @return 0 连接建立或失败关闭，不再需要等待
+    /// @return >0 握手消息还未到达
+    int32_t Handshake(int64_t listen_handle, int fd);
+
+    int32_t AddFdEvent(int fd, int type, int64_t handle);
+
+    void DelFdEvent(int fd);
+
+    /// @brief 递交一个连接上的消息
+    /// @return 递交的消息数
+    uint32_t Dispatch(const cxx::shared_ptr<ShmChannel>& channel, uint32_t budget);
+
+    void AddChannel(const cxx::shared_ptr<ShmChannel>& channel);
+
+    /// @brief 从轮转列表中移除已关闭的连接
+    void CompactChannelList();
+
+    /// @brief 关闭连接并释放资源，notify为true时通知上层
+    void CloseChannel(int64_t handle, bool notify);
+
+private:
+    int m_epoll_fd;
+    bool m_in_update;
+    bool m_list_dirty;                          // m_channel_list中有已关闭的连接
+    uint32_t m_ring_size;
+
+    uint32_t m_max_msg_num_per_loop;
+    uint32_t m_max_msg_num_per_conn;
+    uint32_t m_loop_msg_num;                    // 本次Update已递交的消息数
+    uint32_t m_dispatch_pos;                    // 下次Update开始轮转的连接位置
+
+    cxx::unordered_map<int64_t, int> m_listeners;               // handle -> 监听fd
+    cxx::unordered_map<int64_t, cxx::shared_ptr<ShmChannel> > m_channels;
+    std::vector<cxx::shared_ptr<ShmChannel> > m_channel_list;   // 按轮转顺序排列的连接
+    cxx::unordered_map<int, cxx::shared_ptr<ShmFdEvent> > m_fd_events;
+};
+
+
+} // namespace pebble
+
+#endif // _PEBBLE_SHM_DRIVER_H_
+
@@ -22,7 +22,9 @@
 
 #include "common/kv_cache.h"
 #include "common/log.h"
+#include "common/mutex.h"
 #include "common/string_utility.h"
+#include "common/thread.h"
 #include "common/time_utility.h"
 #include "ev.h"
 #include "framework/tcp_driver.h"
@@ -44,6 +46,19 @@ struct TcpMsgHead {
 };
 #pragma pack()
 
+/*
+	I/O线程模式下handle的分配:
+		bit 60-62 : driver序号(由Message分配)
+		bit 48-55 : I/O线程序号+1，0表示在业务线程处理
+*/
+#define TCP_IO_THREAD_SHIFT 48
+#define TCP_IO_THREAD_MASK  0xFFLL
+#define MAX_IO_THREAD_NUM   64
+
+static inline uint32_t IoThreadIndex(int64_t handle) {
+	return static_cast<uint32_t>((handle >> TCP_IO_THREAD_SHIFT) & TCP_IO_THREAD_MASK);
+}
+
 
 struct Listener {
 protected:
@@ -51,7 +66,9 @@ protected:
 public:
 	Listener(TcpDriver* driver, struct ev_loop* loop, int64_t handle);
 	~Listener();
-	int Listen(const std::string& ip, uint16_t port);
+	int Listen(const std::string& ip, uint16_t port, bool reuse_port);
+	int Open(const std::string& ip, uint16_t port, bool reuse_port);
+	void StartAccept();
 	void Accept();
 
 	bool 			_start_accept;
@@ -74,7 +91,12 @@ public:
 	void RegisterWatcher(int fd);
 	int Connect(const std::string& ip, uint16_t port);
 	int ReConnect();
+	int ReserveRecvBuff(uint32_t min_free_len);
+	void ShrinkRecvBuff(bool force);
 	void Recv();
+	void ProcessRecvBuff();
+	void PauseRead();
+	void ResumeRead();
 	void SendCacheData();
 	int SendV(uint32_t msg_frag_num, const uint8_t* msg_frag[], uint32_t msg_frag_len[]);
 	void OnError();
@@ -90,22 +112,97 @@ public:
 	int64_t			_trans_handle;
 	std::string		_ip;
 	uint16_t		_port;
+	char*			_recv_buff;		// 连接独占的接收缓冲区，按需扩容，空闲时收缩
+	uint32_t		_recv_buff_len;
+	uint32_t		_recv_len;
+	uint32_t		_small_read_num;	// 连续读取后数据量不超过初始大小的次数
+	bool			_read_paused;	// 配额用完后暂停读取，由内核接收窗口对发送方反压
+	bool			_pending;		// 已在driver的待处理队列中
+	uint32_t		_close_seq;		// 每次关闭时递增，用于发现回调中连接被关闭或重连
 };
 
-int32_t UrlToIpPort(const std::string& url, std::string* ip, uint16_t* port) {
-    if (NULL == ip || NULL == port) {
-        return -1;
-    }
+/// @brief I/O线程与业务线程之间传递的事件/命令，数据存放在所属TcpIoBox的_buff中
+struct TcpIoEvent {
+	enum {
+		// I/O线程 -> 业务线程
+		kIO_MESSAGE = 0,
+		kIO_PEER_CONNECTED,
+		kIO_PEER_CLOSED,
+		kIO_CLOSED,
+		// 业务线程 -> I/O线程
+		kIO_SEND,
+		kIO_CLOSE,
+		kIO_LISTEN,
+	};
+
+	TcpIoEvent() : _type(kIO_MESSAGE), _local_handle(-1), _remote_handle(-1),
+		_arrived_ms(0), _offset(0), _len(0), _listener(NULL) {}
+
+	int32_t		_type;
+	int64_t		_local_handle;
+	int64_t		_remote_handle;
+	int64_t		_arrived_ms;
+	uint32_t	_offset;
+	uint32_t	_len;
+	Listener*	_listener;
+};
 
-    size_t pos = url.find_last_of(':');
-    if (std::string::npos == pos || url.size() == pos) {
-        return -1;
-    }
+struct TcpIoBox {
+	void Swap(TcpIoBox* rhs) {
+		_events.swap(rhs->_events);
+		_buff.swap(rhs->_buff);
+	}
+	// clear不释放内存，稳定运行后不再有内存分配
+	void Clear() {
+		_events.clear();
+		_buff.clear();
+	}
 
-    ip->assign(url.substr(0, pos));
-    *port = static_cast<uint16_t>(atoi(url.substr(pos + 1).c_str()));
-    return 0;
-}
+	std::vector<TcpIoEvent>	_events;
+	std::string				_buff;
+};
+
+/// @brief I/O线程，内部持有一个使用独立事件循环的TcpDriver，复用其收包、拆包、发送逻辑，
+///     内部TcpDriver的回调不直接递交业务，而是写入队列，由业务线程在TcpDriver::Update中取出
+class TcpIoThread : public Thread {
+public:
+	TcpIoThread(TcpDriver* owner, uint32_t index);
+	virtual ~TcpIoThread();
+
+	int32_t Init();
+	virtual void Run();
+	void Stop();
+
+	// 业务线程调用
+	void PostSend(int64_t handle, uint32_t msg_frag_num, const uint8_t* msg_frag[], uint32_t msg_frag_len[]);
+	void PostClose(int64_t handle);
+	void PostListener(Listener* listener);
+	int32_t Dispatch(const MessageCallbacks& cbs, uint32_t max_msg_num);
+
+	// I/O线程调用
+	void OnCommand();
+	bool IsEventQueueFull();
+	int OnMessage(const uint8_t* msg, uint32_t msg_len, MsgExternInfo* info);
+	int OnPeerConnected(int64_t local_handle, int64_t peer_handle);
+	int OnPeerClosed(int64_t local_handle, int64_t peer_handle);
+	int OnClosed(int64_t handle);
+
+	TcpDriver*	_owner;
+	TcpDriver*	_driver;
+	uint32_t	_index;
+	bool		_stop;
+	ev_async	_notify;
+
+	Mutex		_cmd_mutex;
+	TcpIoBox	_commands;		// 业务线程写入
+	TcpIoBox	_executing;		// I/O线程执行
+
+	Mutex		_event_mutex;
+	TcpIoBox	_events;		// I/O线程写入
+	bool		_events_full;	// _events达到上限，I/O线程已暂停读取
+	TcpIoBox	_dispatching;	// 业务线程递交
+	size_t		_dispatch_pos;	// 配额用完时_dispatching中下一个待递交的事件
+};
 
 static int set_nonblock(int fd) {
     int flags = fcntl(fd, F_GETFL);
@@ -127,6 +224,8 @@ static void on_accept(EV_P_ ev_io *w, int revents) {
 
 static void on_read(EV_P_ ev_io *w, int revents) {
 	Connection* connection = CONTAINER(Connection, _rw, w);
+	// 回调中可能关闭连接，处理期间保持引用
+	cxx::shared_ptr<Connection> holder = connection->_driver->GetConnection(connection->_trans_handle);
 	connection->Recv();
 }
 
@@ -135,6 +234,11 @@ static void on_write(EV_P_ ev_io *w, int revents) {
 	connection->SendCacheData();
 }
 
+static void on_notify(EV_P_ ev_async *w, int revents) {
+	TcpIoThread* io_thread = static_cast<TcpIoThread*>(w->data);
+	io_thread->OnCommand();
+}
+
 Listener::Listener(TcpDriver* driver, struct ev_loop* loop, int64_t handle)
 	: _driver(driver), _loop(loop), _handle(handle) {
 	_start_accept = false;
@@ -147,7 +251,17 @@ Listener::~Listener() {
 	if (_fd >= 0) 		{ close(_fd);	}
 }
 
-int Listener::Listen(const std::string& ip, uint16_t port) {
+int Listener::Listen(const std::string& ip, uint16_t port, bool reuse_port) {
+	int ret = Open(ip, port, reuse_port);
+	if (ret != 0) {
+		return ret;
+	}
+
+	StartAccept();
+	return 0;
+}
+
+int Listener::Open(const std::string& ip, uint16_t port, bool reuse_port) {
 	// check
 	if (_fd >= 0) {
 		PLOG_ERROR("Already listen in fd %d", _fd);
@@ -155,11 +269,12 @@ int Listener::Listen(const std::string& ip, uint16_t port) {
 	}
 
 	// socket
-    _fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (_fd < 0) {
-        PLOG_ERROR("socket failed %d:%s", errno, strerror(errno));
-        return -2;
-    }
+	struct sockaddr_storage socket_addr;
+	socklen_t socket_addr_len = 0;
+	_fd = _driver->CreateSocket(ip, port, &socket_addr, &socket_addr_len);
+	if (_fd < 0) {
+		return -2;
+	}
 
 	// set nonblock
 	if (set_nonblock(_fd) != 0) {
@@ -172,20 +287,15 @@ int Listener::Listen(const std::string& ip, uint16_t port) {
 		PLOG_ERROR("setsockopt %d failed %d:%s", _fd, errno, strerror(errno));
         return -4;
     }
-	
-	// TODO: TCP_NODELAY
-	struct sockaddr_in socket_addr;
-    bzero(&socket_addr, sizeof(socket_addr));
-    socket_addr.sin_family = AF_INET;
-
-    int rc = inet_aton(ip.c_str(), &(socket_addr.sin_addr));
-    if (rc == 0) {
-        PLOG_ERROR("ip %s is invalid", ip.c_str());
-		return -5;
-    }
-    socket_addr.sin_port = htons(port);
 
-    if (0 != bind(_fd, (struct sockaddr *)&socket_addr, sizeof(socket_addr))) {
+	// 多个I/O线程各自监听同一地址，由内核在监听socket间分发连接
+	if (reuse_port && 0 != setsockopt(_fd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag))) {
+		PLOG_ERROR("setsockopt SO_REUSEPORT %d failed %d:%s", _fd, errno, strerror(errno));
+		return -4;
+	}
+
+	// TODO: TCP_NODELAY
+    if (0 != bind(_fd, (struct sockaddr *)&socket_addr, socket_addr_len)) {
 		PLOG_ERROR("bind %d failed %d:%s", _fd, errno, strerror(errno));
         return -6;
     }
@@ -195,19 +305,21 @@ int Listener::Listen(const std::string& ip, uint16_t port) {
         return -7;
     }
 
-	// register watcher
-	ev_io_init(&_aw, on_accept, _fd, EV_READ);
-	ev_io_start(_loop, &_aw);
-	_start_accept = true;
-
 	_ip = ip;
 	_port = port;
 
 	return 0;
 }
 
+void Listener::StartAccept() {
+	// register watcher
+	ev_io_init(&_aw, on_accept, _fd, EV_READ);
+	ev_io_start(_loop, &_aw);
+	_start_accept = true;
+}
+
 void Listener::Accept() {
-	struct sockaddr_in addr;
+	struct sockaddr_storage addr;
     socklen_t addr_len = sizeof(addr);
     int32_t fd = accept(_fd, (struct sockaddr*)(&addr), &addr_len);
     if (fd < 0) {
@@ -233,18 +345,31 @@ Connection::Connection(TcpDriver* driver, struct ev_loop* loop, int64_t local, i
 	_start_write = false;
 	_fd = -1;
 	_port = 0;
+	_recv_buff = NULL;
+	_recv_buff_len = 0;
+	_recv_len = 0;
+	_small_read_num = 0;
+	_read_paused = false;
+	_pending = false;
+	_close_seq = 0;
 }
 
 Connection::~Connection() {
 	Close();
+	free(_recv_buff);
+	_recv_buff = NULL;
 }
 
 void Connection::Close() {
 	if (_start_read)  { ev_io_stop(_loop, &_rw); _start_read = false;  }
 	if (_start_write) { ev_io_stop(_loop, &_ww); _start_write = false; }
 	if (_fd >= 0) 	  { close(_fd); _fd = -1; }
+	_read_paused = false;
+	_close_seq++;
 	_driver->GetSendCache()->Del(_trans_handle);
-	_driver->GetRecvCache()->Del(_trans_handle);
+	// 断开后残留的不完整消息不再有效
+	_recv_len = 0;
+	ShrinkRecvBuff(true);
 }
 
 void Connection::RegisterWatcher(int fd) {
@@ -270,11 +395,12 @@ void Connection::OnError() {
 
 int Connection::Connect(const std::string& ip, uint16_t port) {
 	// socket
-	_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (_fd < 0) {
-        PLOG_ERROR("socket failed %d:%s", errno, strerror(errno));
-        return -1;
-    }
+	struct sockaddr_storage socket_addr;
+	socklen_t socket_addr_len = 0;
+	_fd = _driver->CreateSocket(ip, port, &socket_addr, &socket_addr_len);
+	if (_fd < 0) {
+		return -1;
+	}
 
 	// set nonblock
 	if (set_nonblock(_fd) != 0) {
@@ -282,18 +408,7 @@ int Connection::Connect(const std::string& ip, uint16_t port) {
 	}
 
 	// connect
-    struct sockaddr_in socket_addr;
-    bzero(&socket_addr, sizeof(socket_addr));
-    socket_addr.sin_family = AF_INET;
-
-    int rc = inet_aton(ip.c_str(), &(socket_addr.sin_addr));
-    if (rc == 0) {
-        PLOG_ERROR("ip %s is invalid", ip.c_str());
-		return -3;
-    }
-    socket_addr.sin_port = htons(port);
-
-    int ret = connect(_fd, reinterpret_cast<struct sockaddr*>(&socket_addr), sizeof(socket_addr));
+    int ret = connect(_fd, reinterpret_cast<struct sockaddr*>(&socket_addr), socket_addr_len);
     if (ret < 0 && errno != EINPROGRESS)
     {
         PLOG_ERROR("connect %d failed %d:%s", _fd, errno, strerror(errno));
@@ -307,15 +422,71 @@ int Connection::Connect(const std::string& ip, uint16_t port) {
 	return 0;
 }
 
-void Connection::Recv() {
-	char* buff = _driver->GetCommonBuff();
-	int buff_len = TcpDriver::DEFAULT_COMMON_BUFF_LEN;
-	KVCache* cache = _driver->GetRecvCache();
+int Connection::ReserveRecvBuff(uint32_t min_free_len) {
+	uint32_t need_len = _recv_len + min_free_len;
+
+	// 已收到消息头时按整个消息的长度预留，避免大消息多次扩容
+	uint32_t data_len = 0;
+	int head_len = _driver->ParseHead((const uint8_t*)_recv_buff, _recv_len, &data_len);
+	if (head_len > 0 && head_len + data_len > need_len) {
+		need_len = head_len + data_len;
+	}
 
-	// 1. get cache
-	int cache_len = cache->Get(_trans_handle, buff, buff_len);
-	if (cache_len >= buff_len || cache_len < 0) {
-		PLOG_ERROR_N_EVERY_SECOND(1, "get %ld's cache failed %d", _trans_handle, cache_len);
+	if (need_len <= _recv_buff_len) {
+		return 0;
+	}
+	if (need_len > (uint32_t)TcpDriver::DEFAULT_COMMON_BUFF_LEN) {
+		if (_recv_len >= (uint32_t)TcpDriver::DEFAULT_COMMON_BUFF_LEN) {
+			return -1;
+		}
+		need_len = TcpDriver::DEFAULT_COMMON_BUFF_LEN;
+	}
+
+	uint32_t new_len = (_recv_buff_len > 0 ? _recv_buff_len : TcpDriver::RECV_BUFF_INIT_LEN);
+	while (new_len < need_len) {
+		new_len <<= 1;
+	}
+	if (new_len > (uint32_t)TcpDriver::DEFAULT_COMMON_BUFF_LEN) {
+		new_len = TcpDriver::DEFAULT_COMMON_BUFF_LEN;
+	}
+
+	char* buff = (char*)realloc(_recv_buff, new_len);
+	if (NULL == buff) {
+		return -2;
+	}
+	_recv_buff 	   = buff;
+	_recv_buff_len = new_len;
+	return 0;
+}
+
+void Connection::ShrinkRecvBuff(bool force) {
+	// 连接空闲(无残留数据)且最近一段时间没有大消息时才归还扩容的内存，避免大小消息交替时反复realloc
+	if (_recv_len > 0 || _recv_buff_len <= (uint32_t)TcpDriver::RECV_BUFF_INIT_LEN) {
+		return;
+	}
+	if (!force && _small_read_num < TcpDriver::RECV_BUFF_SHRINK_READS) {
+		return;
+	}
+	char* buff = (char*)realloc(_recv_buff, TcpDriver::RECV_BUFF_INIT_LEN);
+	if (buff != NULL) {
+		_recv_buff 	   = buff;
+		_recv_buff_len = TcpDriver::RECV_BUFF_INIT_LEN;
+	}
+}
+
+void Connection::Recv() {
+	// 1. reserve
+	// SOCK_SEQPACKET每次recv读取一个报文，缓冲区不够时报文被截断，先取得报文的长度
+	uint32_t min_free_len = TcpDriver::RECV_BUFF_MIN_FREE_LEN;
+	if (SOCK_SEQPACKET == _driver->SocketType()) {
+		int32_t record_len = recv(_fd, NULL, 0, MSG_PEEK | MSG_TRUNC);
+		if (record_len > 0 && static_cast<uint32_t>(record_len) > min_free_len) {
+			min_free_len = record_len;
+		}
+	}
+	int ret = ReserveRecvBuff(min_free_len);
+	if (ret != 0) {
+		PLOG_ERROR_N_EVERY_SECOND(1, "reserve %ld's recv buff failed %d, len = %u", _trans_handle, ret, _recv_len);
 		OnError();
 		return;
 	}
@@ -323,7 +494,7 @@ void Connection::Recv() {
 	// 2. recv
 	int32_t recv_len = 0;
 	do {
-		recv_len = recv(_fd, buff + cache_len, buff_len, 0);
+		recv_len = recv(_fd, _recv_buff + _recv_len, _recv_buff_len - _recv_len, 0);
 	} while (recv_len < 0 && errno == EINTR);
 
 	if (recv_len == 0 || (recv_len < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
@@ -333,21 +504,64 @@ void Connection::Recv() {
 	}
 
 	if (recv_len < 0) {
-		cache->Put(_trans_handle, buff, cache_len);
 		return;
 	}
+	_recv_len += recv_len;
+	if (_recv_len > (uint32_t)TcpDriver::RECV_BUFF_INIT_LEN) {
+		_small_read_num = 0;
+	} else if (_small_read_num < TcpDriver::RECV_BUFF_SHRINK_READS) {
+		_small_read_num++;
+	}
 
 	// 3. proc
-	int proc_len = _driver->OnMessage(this, (uint8_t*)buff, cache_len + recv_len);
-	int rest_len = cache_len + recv_len - proc_len;
-	if (rest_len > 0) {
-		int ret = cache->Put(_trans_handle, buff + proc_len, rest_len);
-		if (ret != 0) {
-			PLOG_ERROR_N_EVERY_SECOND(1, "put %ld's cache failed %d, len = ", _trans_handle, ret, rest_len);
-			OnError();
-			return;
+	ProcessRecvBuff();
+}
+
+void Connection::ProcessRecvBuff() {
+	// 直接在接收缓冲区上拆包，剩余的消息移到缓冲区头部
+	uint32_t close_seq = _close_seq;
+	int proc_len = _driver->OnMessage(this, (uint8_t*)_recv_buff, _recv_len);
+	if (_close_seq != close_seq) {
+		// 回调中连接被关闭或重连，缓冲区中的数据已失效
+		return;
+	}
+	if (proc_len > 0) {
+		_recv_len -= proc_len;
+		if (_recv_len > 0) {
+			memmove(_recv_buff, _recv_buff + proc_len, _recv_len);
 		}
 	}
+
+	// 配额用完时缓冲区中仍有完整消息，暂停读取，等待driver下次Update轮转到此连接
+	uint32_t data_len = 0;
+	int head_len = _driver->ParseHead((const uint8_t*)_recv_buff, _recv_len, &data_len);
+	if (head_len > 0 && head_len + data_len <= _recv_len) {
+		PauseRead();
+		if (!_pending) {
+			_pending = true;
+			_driver->AddPendingConnection(_trans_handle);
+		}
+		return;
+	}
+
+	ResumeRead();
+	ShrinkRecvBuff(false);
+}
+
+void Connection::PauseRead() {
+	if (_start_read) {
+		ev_io_stop(_loop, &_rw);
+		_start_read  = false;
+		_read_paused = true;
+	}
+}
+
+void Connection::ResumeRead() {
+	if (_read_paused) {
+		ev_io_start(_loop, &_rw);
+		_start_read  = true;
+		_read_paused = false;
+	}
 }
 
 void Connection::SendCacheData() {
@@ -355,46 +569,65 @@ void Connection::SendCacheData() {
 	int buff_len = TcpDriver::DEFAULT_COMMON_BUFF_LEN;
 	KVCache* cache = _driver->GetSendCache();
 
-	// 1. get cache
-	int cache_len = cache->Get(_trans_handle, buff, buff_len);
-	if (cache_len >= buff_len || cache_len < 0) {
-		PLOG_ERROR_N_EVERY_SECOND(1, "get %ld's cache failed %d", _trans_handle, cache_len);
+	// 1. peek cache
+	// 缓存可能超过buff_len，每次最多取buff_len，发送成功的部分再从缓存中删除，保证数据顺序
+	int cache_len = cache->Peek(_trans_handle, buff, buff_len);
+	if (cache_len < 0) {
+		PLOG_ERROR_N_EVERY_SECOND(1, "peek %ld's cache failed %d", _trans_handle, cache_len);
 		OnError();
 		return;
 	}
 
 	// 2. send
+	// SOCK_SEQPACKET的一次send是一个报文，缓存的数据按消息逐个发送，报文不超过socket的发送缓冲区
+	bool seqpacket = (SOCK_SEQPACKET == _driver->SocketType());
 	int32_t send_ret = 0;
 	int32_t send_cnt = 0;
 	while (send_cnt < cache_len) {
-		send_ret = send(_fd, buff + send_cnt, cache_len - send_cnt, 0);
-		if ((send_ret < 0 && errno != EINTR) || send_ret == 0) {
+		int32_t send_len = cache_len - send_cnt;
+		if (seqpacket) {
+			uint32_t data_len = 0;
+			int head_len = _driver->ParseHead((const uint8_t*)buff + send_cnt, send_len, &data_len);
+			if (head_len <= 0 || head_len + data_len > static_cast<uint32_t>(send_len)) {
+				// 只取到了消息的一部分，留到下次发送
+				break;
+			}
+			send_len = head_len + data_len;
+		}
+		send_ret = send(_fd, buff + send_cnt, send_len, 0);
+		if (send_ret < 0 && errno == EINTR) {
+			continue;
+		}
+		if (send_ret <= 0) {
 			break;
 		}
 		send_cnt += send_ret;
 	}
 
-	// send complete
-	if (send_cnt == cache_len) {
-		ev_io_stop(_loop, &_ww);
-		_start_write = false;
-		return;
-	}
-
 	if (send_ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
 		PLOG_ERROR_N_EVERY_SECOND(1, "send failed %d:%s, need close the socket[%d]", errno, strerror(errno), _fd);
 		OnError();
 		return;
 	}
 
-	// cache
-	int rest_len = cache_len - send_ret;
-	int ret = cache->Put(_trans_handle, buff + send_ret, rest_len);
-	if (ret != 0) {
-		PLOG_ERROR_N_EVERY_SECOND(1, "put %ld's cache failed %d, len = %d", _trans_handle, ret, rest_len);
+	if (seqpacket && 0 == send_cnt && 0 == send_ret && cache_len >= buff_len) {
+		PLOG_ERROR_N_EVERY_SECOND(1, "%ld's cached msg too large", _trans_handle);
 		OnError();
 		return;
 	}
+
+	// 3. 删除已发送的部分
+	if (send_cnt > 0) {
+		cache->Get(_trans_handle, buff, send_cnt);
+	}
+
+	// send complete
+	if (send_cnt == cache_len && cache_len < buff_len) {
+		ev_io_stop(_loop, &_ww);
+		_start_write = false;
+		return;
+	}
+
 	ev_io_start(_loop, &_ww);
 	_start_write = true;
 }
@@ -435,22 +668,28 @@ int Connection::SendV(uint32_t msg_frag_num, const uint8_t* msg_frag[], uint32_t
 	}
 
 	while (send_cnt < need_send_cnt) {
-		while (send_ret > 0) {
-			if (msg.msg_iov->iov_len <= static_cast<uint32_t>(send_ret)) {
-				send_ret -= msg.msg_iov->iov_len;
+		send_ret = sendmsg(_fd, &msg, 0);
+		if (send_ret < 0 && errno == EINTR) {
+			continue;
+		}
+		if (send_ret <= 0) {
+			break;
+		}
+		send_cnt += send_ret;
+
+		// 跳过已发送的部分
+		uint32_t sent_len = send_ret;
+		while (sent_len > 0) {
+			if (msg.msg_iov->iov_len <= sent_len) {
+				sent_len -= msg.msg_iov->iov_len;
 				msg.msg_iov++;
 				msg.msg_iovlen--;
 			} else {
-				msg.msg_iov->iov_base = ((uint8_t*)(msg.msg_iov->iov_base)) + send_ret;
-				msg.msg_iov->iov_len -= send_ret;
+				msg.msg_iov->iov_base = ((uint8_t*)(msg.msg_iov->iov_base)) + sent_len;
+				msg.msg_iov->iov_len -= sent_len;
 				break;
 			}
 		}
-		send_ret = sendmsg(_fd, &msg, 0);
-		if ((send_ret < 0 && errno != EINTR) || send_ret == 0) {
-			break;
-		}
-		send_cnt += send_ret;
 	}
 
 	if (send_cnt == need_send_cnt) {
@@ -463,29 +702,297 @@ int Connection::SendV(uint32_t msg_frag_num, const uint8_t* msg_frag[], uint32_t
 		return -1;
 	}
 
+	// 未发送的部分放入发送缓存，可写时继续发送
+	KVCache* cache = _driver->GetSendCache();
+	for (size_t i = 0; i < msg.msg_iovlen; i++) {
+		int ret = cache->Put(_trans_handle, (char*)msg.msg_iov[i].iov_base, msg.msg_iov[i].iov_len);
+		if (ret != 0) {
+			PLOG_ERROR_N_EVERY_SECOND(1, "put %ld's cache failed %d, len = %lu", _trans_handle, ret, msg.msg_iov[i].iov_len);
+			OnError();
+			return kMESSAGE_SYSTEM_ERROR;
+		}
+	}
+
 	ev_io_start(_loop, &_ww);
 	_start_write = true;
 
 	return 0;
 }
 
+TcpIoThread::TcpIoThread(TcpDriver* owner, uint32_t index)
+	: _owner(owner), _driver(NULL), _index(index), _stop(false), _events_full(false), _dispatch_pos(0) {
+}
+
+TcpIoThread::~TcpIoThread() {
+	// 未被I/O线程接管的监听对象
+	for (std::vector<TcpIoEvent>::iterator it = _commands._events.begin(); it != _commands._events.end(); ++it) {
+		if (TcpIoEvent::kIO_LISTEN == it->_type) {
+			delete it->_listener;
+		}
+	}
+	if (_driver) {
+		if (_driver->m_loop) {
+			ev_async_stop(_driver->m_loop, &_notify);
+		}
+		delete _driver;
+		_driver = NULL;
+	}
+}
+
+int32_t TcpIoThread::Init() {
+	_driver = new TcpDriver();
+	_driver->m_owner_thread = this;
+	_driver->m_loop = ev_loop_new(EVFLAG_AUTO);
+	if (NULL == _driver->m_loop) {
+		PLOG_ERROR("io thread %u new loop failed", _index);
+		return kMESSAGE_SYSTEM_ERROR;
+	}
+	ev_async_init(&_notify, on_notify);
+	_notify.data = this;
+	_driver->SetHandleMask(_owner->GetHandleMask() | (static_cast<int64_t>(_index + 1) << TCP_IO_THREAD_SHIFT));
+	int32_t ret = _driver->Init();
+	if (ret != 0) {
+		return ret;
+	}
+
+	MessageCallbacks cbs;
+	using namespace cxx::placeholders;
+	cbs._on_message = cxx::bind(&TcpIoThread::OnMessage, this, _1, _2, _3);
+	cbs._on_peer_connected = cxx::bind(&TcpIoThread::OnPeerConnected, this, _1, _2);
+	cbs._on_peer_closed = cxx::bind(&TcpIoThread::OnPeerClosed, this, _1, _2);
+	cbs._on_closed = cxx::bind(&TcpIoThread::OnClosed, this, _1);
+	_driver->SetCallBack(cbs);
+
+	ev_async_start(_driver->m_loop, &_notify);
+
+	return 0;
+}
+
+void TcpIoThread::Run() {
+	// 阻塞等待网络事件，有命令或退出时由_notify唤醒
+	ev_run(_driver->m_loop, 0);
+}
+
+void TcpIoThread::Stop() {
+	{
+		AutoLocker locker(&_cmd_mutex);
+		_stop = true;
+	}
+	ev_async_send(_driver->m_loop, &_notify);
+}
+
+void TcpIoThread::PostSend(int64_t handle, uint32_t msg_frag_num,
+	const uint8_t* msg_frag[], uint32_t msg_frag_len[]) {
+	{
+		AutoLocker locker(&_cmd_mutex);
+		TcpIoEvent event;
+		event._type			 = TcpIoEvent::kIO_SEND;
+		event._remote_handle = handle;
+		event._offset		 = _commands._buff.size();
+		for (uint32_t i = 0; i < msg_frag_num; i++) {
+			_commands._buff.append(reinterpret_cast<const char*>(msg_frag[i]), msg_frag_len[i]);
+		}
+		event._len = _commands._buff.size() - event._offset;
+		_commands._events.push_back(event);
+	}
+	ev_async_send(_driver->m_loop, &_notify);
+}
+
+void TcpIoThread::PostClose(int64_t handle) {
+	{
+		AutoLocker locker(&_cmd_mutex);
+		TcpIoEvent event;
+		event._type			 = TcpIoEvent::kIO_CLOSE;
+		event._remote_handle = handle;
+		_commands._events.push_back(event);
+	}
+	ev_async_send(_driver->m_loop, &_notify);
+}
+
+void TcpIoThread::PostListener(Listener* listener) {
+	{
+		AutoLocker locker(&_cmd_mutex);
+		TcpIoEvent event;
+		event._type			= TcpIoEvent::kIO_LISTEN;
+		event._local_handle	= listener->_handle;
+		event._listener		= listener;
+		_commands._events.push_back(event);
+	}
+	ev_async_send(_driver->m_loop, &_notify);
+}
+
+void TcpIoThread::OnCommand() {
+	bool stop = false;
+	{
+		AutoLocker locker(&_cmd_mutex);
+		_executing.Swap(&_commands);
+		stop = _stop;
+	}
+
+	for (std::vector<TcpIoEvent>::iterator it = _executing._events.begin(); it != _executing._events.end(); ++it) {
+		switch (it->_type) {
+			case TcpIoEvent::kIO_SEND: {
+				const uint8_t* frag[1] = { reinterpret_cast<const uint8_t*>(_executing._buff.data()) + it->_offset };
+				uint32_t frag_len[1]   = { it->_len };
+				_driver->SendRaw(it->_remote_handle, 1, frag, frag_len);
+				break;
+			}
+			case TcpIoEvent::kIO_CLOSE:
+				_driver->Close(it->_remote_handle);
+				break;
+			case TcpIoEvent::kIO_LISTEN:
+				it->_listener->StartAccept();
+				_driver->m_listeners[it->_local_handle] = cxx::shared_ptr<Listener>(it->_listener);
+				break;
+			default:
+				break;
+		}
+	}
+	_executing.Clear();
+
+	// 业务线程取走队列后唤醒，继续处理因队列满暂停读取的连接
+	_driver->DispatchPending(false);
+
+	if (stop) {
+		ev_break(_driver->m_loop, EVBREAK_ALL);
+	}
+}
+
+int TcpIoThread::OnMessage(const uint8_t* msg, uint32_t msg_len, MsgExternInfo* info) {
+	AutoLocker locker(&_event_mutex);
+	TcpIoEvent event;
+	event._type			 = TcpIoEvent::kIO_MESSAGE;
+	event._local_handle	 = info->_self_handle;
+	event._remote_handle = info->_remote_handle;
+	event._arrived_ms	 = info->_msg_arrived_ms;
+	event._offset		 = _events._buff.size();
+	event._len			 = msg_len;
+	_events._buff.append(reinterpret_cast<const char*>(msg), msg_len);
+	_events._events.push_back(event);
+	if (_events._buff.size() + _events._events.size() * sizeof(TcpIoEvent) >= _owner->m_io_queue_len) {
+		_events_full = true;
+	}
+	return 0;
+}
+
+bool TcpIoThread::IsEventQueueFull() {
+	AutoLocker locker(&_event_mutex);
+	return _events_full;
+}
+
+int TcpIoThread::OnPeerConnected(int64_t local_handle, int64_t peer_handle) {
+	AutoLocker locker(&_event_mutex);
+	TcpIoEvent event;
+	event._type			 = TcpIoEvent::kIO_PEER_CONNECTED;
+	event._local_handle	 = local_handle;
+	event._remote_handle = peer_handle;
+	_events._events.push_back(event);
+	return 0;
+}
+
+int TcpIoThread::OnPeerClosed(int64_t local_handle, int64_t peer_handle) {
+	AutoLocker locker(&_event_mutex);
+	TcpIoEvent event;
+	event._type			 = TcpIoEvent::kIO_PEER_CLOSED;
+	event._local_handle	 = local_handle;
+	event._remote_handle = peer_handle;
+	_events._events.push_back(event);
+	return 0;
+}
+
+int TcpIoThread::OnClosed(int64_t handle) {
+	AutoLocker locker(&_event_mutex);
+	TcpIoEvent event;
+	event._type			= TcpIoEvent::kIO_CLOSED;
+	event._local_handle	= handle;
+	_events._events.push_back(event);
+	return 0;
+}
+
+int32_t TcpIoThread::Dispatch(const MessageCallbacks& cbs, uint32_t max_msg_num) {
+	// 上次配额用完留下的事件处理完后再取新事件，保证事件顺序
+	if (_dispatch_pos >= _dispatching._events.size()) {
+		_dispatching.Clear();
+		_dispatch_pos = 0;
+		bool resume = false;
+		{
+			AutoLocker locker(&_event_mutex);
+			_dispatching.Swap(&_events);
+			resume = _events_full;
+			_events_full = false;
+		}
+		if (resume) {
+			ev_async_send(_driver->m_loop, &_notify);
+		}
+	}
+
+	uint32_t num = 0;
+	const uint8_t* buff = reinterpret_cast<const uint8_t*>(_dispatching._buff.data());
+	for (; _dispatch_pos < _dispatching._events.size(); ++_dispatch_pos) {
+		TcpIoEvent* it = &_dispatching._events[_dispatch_pos];
+		if (TcpIoEvent::kIO_MESSAGE == it->_type && num >= max_msg_num) {
+			break;
+		}
+		switch (it->_type) {
+			case TcpIoEvent::kIO_MESSAGE:
+				if (cbs._on_message) {
+					MsgExternInfo msg_info;
+					msg_info._self_handle	 = it->_local_handle;
+					msg_info._remote_handle	 = it->_remote_handle;
+					msg_info._msg_arrived_ms = it->_arrived_ms;
+					cbs._on_message(buff + it->_offset, it->_len, &msg_info);
+					num++;
+				}
+				break;
+			case TcpIoEvent::kIO_PEER_CONNECTED:
+				if (cbs._on_peer_connected) {
+					cbs._on_peer_connected(it->_local_handle, it->_remote_handle);
+				}
+				break;
+			case TcpIoEvent::kIO_PEER_CLOSED:
+				if (cbs._on_peer_closed) {
+					cbs._on_peer_closed(it->_local_handle, it->_remote_handle);
+				}
+				break;
+			case TcpIoEvent::kIO_CLOSED:
+				if (cbs._on_closed) {
+					cbs._on_closed(it->_local_handle);
+				}
+				break;
+			default:
+				break;
+		}
+	}
+
+	return num;
+}
+
 TcpDriver::TcpDriver() {
 	m_loop 			= NULL;
-	m_recv_cache	= NULL;
+	m_send_cache	= NULL;
 	m_common_buff	= NULL;
 	m_proc_num      = 0;
+	m_reuse_port	= false;
+	m_io_thread_num	= 0;
+	m_io_queue_len	= DEFAULT_IO_QUEUE_LEN;
+	m_owner_thread	= NULL;
+	m_max_msg_num_per_loop = 0;
+	m_max_msg_num_per_conn = 0;
+	m_loop_msg_num	= 0;
 }
 
 TcpDriver::~TcpDriver() {
+	StopIoThreads();
+
 	m_connections.clear();
 	m_listeners.clear();
 
-    ev_loop_destroy(m_loop);
+	if (m_loop) {
+		ev_loop_destroy(m_loop);
+	}
 
 	delete m_send_cache;
 	m_send_cache = NULL;
-	delete m_recv_cache;
-	m_recv_cache = NULL;
 
 	delete [] m_common_buff;
 	m_common_buff = NULL;
@@ -499,16 +1006,12 @@ int32_t TcpDriver::Init() {
 		return kMESSAGE_SYSTEM_ERROR;
 	}
 
-	m_recv_cache = new KVCache();
-	ret = m_recv_cache->Init(100000, 20000, 2048);
-	if (ret != 0) {
-		PLOG_ERROR("cache init failed(%d)", ret);
-		return kMESSAGE_SYSTEM_ERROR;
-	}
-
 	m_common_buff = new char[DEFAULT_COMMON_BUFF_LEN];
 
-	m_loop = ev_default_loop(0); // TODO: NEW, confict with business
+	// I/O线程内部的driver已经创建了独立的loop
+	if (NULL == m_loop) {
+		m_loop = ev_default_loop(0); // TODO: NEW, confict with business
+	}
 
 	signal(SIGPIPE, SIG_IGN);
 
@@ -519,7 +1022,7 @@ int64_t TcpDriver::Bind(const std::string& url) {
 	// get ip port
 	std::string ip;
     uint16_t port = 0;
-    if (UrlToIpPort(url, &ip, &port) != 0) {
+    if (ParseAddress(url, &ip, &port) != 0) {
         return kMESSAGE_INVAILD_PARAM;
     }
 
@@ -529,8 +1032,32 @@ int64_t TcpDriver::Bind(const std::string& url) {
 		return kMESSAGE_SYSTEM_ERROR;
 	}
 
+	if (m_io_thread_num > 0) {
+		if (StartIoThreads() != 0) {
+			return kMESSAGE_SYSTEM_ERROR;
+		}
+
+		// 在业务线程完成监听保证错误能同步返回，再交给各I/O线程开始accept
+		std::vector<Listener*> listeners;
+		for (std::vector<TcpIoThread*>::iterator it = m_io_threads.begin(); it != m_io_threads.end(); ++it) {
+			Listener* listener = new Listener((*it)->_driver, (*it)->_driver->m_loop, handle);
+			listeners.push_back(listener);
+			if (listener->Open(ip, port, true) != 0) {
+				for (std::vector<Listener*>::iterator lit = listeners.begin(); lit != listeners.end(); ++lit) {
+					delete *lit;
+				}
+				return kMESSAGE_BIND_ADDR_FAILED;
+			}
+		}
+		for (uint32_t i = 0; i < m_io_threads.size(); i++) {
+			m_io_threads[i]->PostListener(listeners[i]);
+		}
+
+		return handle;
+	}
+
 	cxx::shared_ptr<Listener> listener(new Listener(this, m_loop, handle));
-	if (listener->Listen(ip, port) != 0) {
+	if (listener->Listen(ip, port, m_reuse_port) != 0) {
 		return kMESSAGE_BIND_ADDR_FAILED;
 	}
 
@@ -543,7 +1070,7 @@ int64_t TcpDriver::Connect(const std::string& url) {
 	// get ip port
     std::string ip;
     uint16_t port = 0;
-    if (UrlToIpPort(url, &ip, &port) != 0) {
+    if (ParseAddress(url, &ip, &port) != 0) {
         return kMESSAGE_INVAILD_PARAM;
     }
 
@@ -599,6 +1126,17 @@ int32_t TcpDriver::SendV(int64_t handle, uint32_t msg_frag_num,
 }
 
 int32_t TcpDriver::SendRaw(int64_t handle, uint32_t msg_frag_num, const uint8_t* msg_frag[], uint32_t msg_frag_len[]) {
+	uint32_t index = IoThreadIndex(handle);
+	if (index > 0 && !m_io_threads.empty()) {
+		// 由所属I/O线程异步发送，发送失败时通过连接关闭事件通知
+		if (index > m_io_threads.size()) {
+			return kMESSAGE_INVAILD_HANDLE;
+		}
+		m_io_threads[index - 1]->PostSend(handle, msg_frag_num, msg_frag, msg_frag_len);
+		m_proc_num++;
+		return 0;
+	}
+
 	cxx::unordered_map<int64_t, cxx::shared_ptr<Connection> >::iterator it = m_connections.find(handle);
 	if (m_connections.end() == it) {
 		return kMESSAGE_INVAILD_HANDLE;
@@ -609,18 +1147,179 @@ int32_t TcpDriver::SendRaw(int64_t handle, uint32_t msg_frag_num, const uint8_t*
 }
 
 int32_t TcpDriver::Close(int64_t handle) {
+	uint32_t index = IoThreadIndex(handle);
+	if (index > 0 && !m_io_threads.empty()) {
+		if (index > m_io_threads.size()) {
+			return kMESSAGE_INVAILD_HANDLE;
+		}
+		m_io_threads[index - 1]->PostClose(handle);
+		return 0;
+	}
+
+	// I/O线程模式下Bind的handle在每个I/O线程都有一个监听
+	for (std::vector<TcpIoThread*>::iterator it = m_io_threads.begin(); it != m_io_threads.end(); ++it) {
+		(*it)->PostClose(handle);
+	}
+
 	m_listeners.erase(handle);
-	m_connections.erase(handle);
+	cxx::unordered_map<int64_t, cxx::shared_ptr<Connection> >::iterator it = m_connections.find(handle);
+	if (it != m_connections.end()) {
+		// 可能在该连接的消息回调中关闭，连接对象由调用方持有引用，这里先关闭socket
+		it->second->Close();
+		m_connections.erase(it);
+	}
 	return 0;
 }
 
 int32_t TcpDriver::Update() {
+	m_loop_msg_num = 0;
+
+	// 上次积压的连接先各处理一轮，再接收新数据，剩余配额继续轮转处理积压的连接
+	DispatchPending(true);
 	ev_run(m_loop, EVRUN_NOWAIT);
+	DispatchPending(false);
+
 	int num = m_proc_num;
 	m_proc_num = 0;
+
+	for (std::vector<TcpIoThread*>::iterator it = m_io_threads.begin(); it != m_io_threads.end(); ++it) {
+		uint32_t dispatch_num = (*it)->Dispatch(m_cbs, GetDispatchBudget());
+		m_loop_msg_num += dispatch_num;
+		num += dispatch_num;
+	}
 	return num;
 }
 
+void TcpDriver::SetDispatchBudget(uint32_t max_msg_num_per_loop, uint32_t max_msg_num_per_conn) {
+	m_max_msg_num_per_loop = max_msg_num_per_loop;
+	m_max_msg_num_per_conn = max_msg_num_per_conn;
+	// I/O线程内部的driver只负责收包入队，不受配额限制，只受I/O队列上限的约束
+}
+
+uint32_t TcpDriver::GetDispatchBudget() const {
+	// I/O线程的队列满时不再拆包，连接暂停读取并加入待处理队列
+	if (m_owner_thread != NULL && m_owner_thread->IsEventQueueFull()) {
+		return 0;
+	}
+	if (0 == m_max_msg_num_per_loop) {
+		return UINT32_MAX;
+	}
+	return m_loop_msg_num < m_max_msg_num_per_loop ? m_max_msg_num_per_loop - m_loop_msg_num : 0;
+}
+
+void TcpDriver::AddPendingConnection(int64_t trans_handle) {
+	m_pending_connections.push_back(trans_handle);
+}
+
+void TcpDriver::DispatchPending(bool one_round) {
+	size_t round_num = m_pending_connections.size();
+	while (!m_pending_connections.empty() && GetDispatchBudget() > 0) {
+		if (one_round && 0 == round_num--) {
+			break;
+		}
+
+		int64_t handle = m_pending_connections.front();
+		m_pending_connections.pop_front();
+
+		cxx::unordered_map<int64_t, cxx::shared_ptr<Connection> >::iterator it = m_connections.find(handle);
+		if (m_connections.end() == it) {
+			continue;
+		}
+
+		// 回调中可能关闭连接，处理期间保持引用；仍有积压时重新排到队尾
+		cxx::shared_ptr<Connection> connection = it->second;
+		connection->_pending = false;
+		connection->ProcessRecvBuff();
+	}
+}
+
+int32_t TcpDriver::SetIoThreadNum(uint32_t num) {
+	if (num > MAX_IO_THREAD_NUM) {
+		PLOG_ERROR("io thread num %u > %d", num, MAX_IO_THREAD_NUM);
+		return kMESSAGE_INVAILD_PARAM;
+	}
+	if (!m_io_threads.empty()) {
+		PLOG_ERROR("io threads already started");
+		return kMESSAGE_UNSUPPORT;
+	}
+
+	m_io_thread_num = num;
+	return 0;
+}
+
+int32_t TcpDriver::SetIoQueueLen(uint32_t max_queue_len) {
+	if (0 == max_queue_len) {
+		return kMESSAGE_INVAILD_PARAM;
+	}
+	if (!m_io_threads.empty()) {
+		PLOG_ERROR("io threads already started");
+		return kMESSAGE_UNSUPPORT;
+	}
+
+	m_io_queue_len = max_queue_len;
+	return 0;
+}
+
+int32_t TcpDriver::StartIoThreads() {
+	if (!m_io_threads.empty()) {
+		return 0;
+	}
+
+	for (uint32_t i = 0; i < m_io_thread_num; i++) {
+		TcpIoThread* io_thread = new TcpIoThread(this, i);
+		if (io_thread->Init() != 0) {
+			delete io_thread;
+			StopIoThreads();
+			return kMESSAGE_SYSTEM_ERROR;
+		}
+		if (!io_thread->Start()) {
+			PLOG_ERROR("io thread %u start failed", i);
+			delete io_thread;
+			StopIoThreads();
+			return kMESSAGE_SYSTEM_ERROR;
+		}
+		m_io_threads.push_back(io_thread);
+	}
+
+	PLOG_INFO("start %u io threads", m_io_thread_num);
+	return 0;
+}
+
+void TcpDriver::StopIoThreads() {
+	for (std::vector<TcpIoThread*>::iterator it = m_io_threads.begin(); it != m_io_threads.end(); ++it) {
+		(*it)->Stop();
+	}
+	for (std::vector<TcpIoThread*>::iterator it = m_io_threads.begin(); it != m_io_threads.end(); ++it) {
+		(*it)->Join();
+		delete *it;
+	}
+	m_io_threads.clear();
+}
+
+int32_t TcpDriver::ParseAddress(const std::string& url, std::string* ip, uint16_t* port) {
+	return UrlToIpPort(url, ip, port);
+}
+
+int TcpDriver::CreateSocket(const std::string& ip, uint16_t port,
+	struct sockaddr_storage* addr, socklen_t* addr_len) {
+	struct sockaddr_in* socket_addr = reinterpret_cast<struct sockaddr_in*>(addr);
+	bzero(socket_addr, sizeof(*socket_addr));
+	socket_addr->sin_family = AF_INET;
+	if (0 == inet_aton(ip.c_str(), &(socket_addr->sin_addr))) {
+		PLOG_ERROR("ip %s is invalid", ip.c_str());
+		return -1;
+	}
+	socket_addr->sin_port = htons(port);
+	*addr_len = sizeof(*socket_addr);
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		PLOG_ERROR("socket failed %d:%s", errno, strerror(errno));
+		return -2;
+	}
+	return fd;
+}
+
 int32_t TcpDriver::ParseHead(const uint8_t* head, uint32_t head_len, uint32_t* data_len) {
     if (head == NULL || data_len == NULL || head_len < sizeof(TcpMsgHead)) {
         return -1;
@@ -652,6 +1351,22 @@ void TcpDriver::Accept(int64_t handle, int fd) {
 	}
 }
 
+int64_t TcpDriver::GetRecvBuffLen(int64_t trans_handle) {
+	cxx::unordered_map<int64_t, cxx::shared_ptr<Connection> >::iterator it = m_connections.find(trans_handle);
+	if (m_connections.end() == it) {
+		return kMESSAGE_INVAILD_HANDLE;
+	}
+	return it->second->_recv_buff_len;
+}
+
+cxx::shared_ptr<Connection> TcpDriver::GetConnection(int64_t trans_handle) {
+	cxx::unordered_map<int64_t, cxx::shared_ptr<Connection> >::iterator it = m_connections.find(trans_handle);
+	if (m_connections.end() == it) {
+		return cxx::shared_ptr<Connection>();
+	}
+	return it->second;
+}
+
 void TcpDriver::CloseListener(int64_t handle) {
 	m_listeners.erase(handle);
 	if (m_cbs._on_closed) {
@@ -660,7 +1375,11 @@ void TcpDriver::CloseListener(int64_t handle) {
 }
 
 void TcpDriver::CloseConnection(int64_t local_handle, int64_t trans_handle) {
-	m_connections.erase(trans_handle);
+	cxx::unordered_map<int64_t, cxx::shared_ptr<Connection> >::iterator it = m_connections.find(trans_handle);
+	if (it != m_connections.end()) {
+		it->second->Close();
+		m_connections.erase(it);
+	}
 	if (local_handle == trans_handle) {
 		if (m_cbs._on_closed) {
 			m_cbs._on_closed(local_handle);
@@ -676,7 +1395,15 @@ int32_t TcpDriver::OnMessage(Connection* connection, const uint8_t* msg, uint32_
 	const uint8_t* buff = msg;
 	uint32_t buff_len = msg_len;
 	int32_t  proc_len = 0;
-	do {
+
+	// 单个连接每轮最多处理自己的配额，且不超过本次Update剩余的总配额
+	uint32_t budget = GetDispatchBudget();
+	if (m_max_msg_num_per_conn > 0 && m_max_msg_num_per_conn < budget) {
+		budget = m_max_msg_num_per_conn;
+	}
+	uint32_t close_seq = connection->_close_seq;
+
+	for (uint32_t num = 0; num < budget; num++) {
 		uint32_t data_len = 0;
 		int head_len = ParseHead(buff, buff_len, &data_len);
 		if (head_len < 0) {
@@ -693,13 +1420,19 @@ int32_t TcpDriver::OnMessage(Connection* connection, const uint8_t* msg, uint32_
 			msg_info._remote_handle  = connection->_trans_handle;
 			msg_info._msg_arrived_ms = TimeUtility::GetCurrentMS();
 			m_cbs._on_message(buff, data_len, &msg_info);
-			buff += data_len;
-			buff_len -= data_len;
 
 			m_proc_num++;
+			if (connection->_close_seq != close_seq) {
+				// 回调中连接被关闭或重连，缓冲区已失效
+				m_loop_msg_num++;
+				return proc_len;
+			}
 		}
+		buff += data_len;
+		buff_len -= data_len;
 		proc_len += head_len + data_len;
-	} while (true); // TODO: avoid other connection hunger
+		m_loop_msg_num++;
+	}
 
 	return proc_len;
 }
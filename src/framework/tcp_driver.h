@@ -15,6 +15,9 @@
 #ifndef _PEBBLE_TCP_DRIVER_H_
 #define _PEBBLE_TCP_DRIVER_H_
 
+#include <list>
+#include <vector>
+#include <sys/socket.h>
 #include "framework/message.h"
 //#include "ev.h"
 
@@ -25,6 +28,7 @@ namespace pebble {
 class Connection;
 class KVCache;
 class Listener;
+class TcpIoThread;
 
 
 /// @brief RAW TCP/UDP网络驱动接口
@@ -34,9 +38,19 @@ public:
     TcpDriver();
 	virtual ~TcpDriver();
 
-    // 默认接收缓冲区为2M
+    // 默认接收缓冲区为2M，也是单个连接接收缓冲区的上限
     static const int32_t DEFAULT_COMMON_BUFF_LEN = 1024 * 1024 * 2;
 
+    // 连接接收缓冲区的初始大小，及每次recv前保证的最小空闲空间
+    static const int32_t RECV_BUFF_INIT_LEN = 1024 * 16;
+    static const int32_t RECV_BUFF_MIN_FREE_LEN = 1024 * 4;
+
+    // 扩容后连续这么多次读取的数据量都不超过初始大小，才把接收缓冲区收缩回初始大小
+    static const uint32_t RECV_BUFF_SHRINK_READS = 64;
+
+    // I/O线程模式下每个I/O线程待递交队列的默认上限(消息数据加事件本身的字节数)
+    static const uint32_t DEFAULT_IO_QUEUE_LEN = 1024 * 1024 * 16;
+
     virtual int32_t Init();
 
     virtual int64_t Bind(const std::string& url);
@@ -54,7 +68,43 @@ public:
 
 	virtual const char* Prefix() const { return "tcp"; }
 
+    /// @brief 设置I/O线程数，需要在Bind之前设置
+    /// @param num 0 所有网络事件都在业务线程的Update中处理(默认)
+    ///            >0 启动num个I/O线程，每个线程拥有独立的事件循环和SO_REUSEPORT监听socket，
+    ///               收包和拆包在I/O线程完成，完整消息经队列在Update中递交给业务
+    /// @return 0 成功
+    /// @return <0 失败 @see MessageErrorCode
+    /// @note 只影响Bind产生的被动连接，Connect建立的主动连接仍在业务线程处理
+    int32_t SetIoThreadNum(uint32_t num);
+
+    /// @brief 设置I/O线程待递交队列的上限，需要在Bind之前设置
+    /// @param max_queue_len 队列中消息数据的字节数上限，队列满时I/O线程暂停读取有完整消息的连接，
+    ///     由内核接收窗口对发送方反压，业务线程取走队列后恢复读取
+    /// @return 0 成功
+    /// @return <0 失败 @see MessageErrorCode
+    /// @note 每个连接一次读取的消息会完整入队，实际占用可能超出上限一个接收缓冲区
+    int32_t SetIoQueueLen(uint32_t max_queue_len);
+
+    /// @brief 设置每次Update递交消息的配额，配额用完后未处理的完整消息留在连接的接收缓冲区，
+    ///     暂停读取该连接，下次Update按连接轮转继续处理，避免个别连接占满整个Update
+    /// @param max_msg_num_per_loop 每次Update最多递交的消息数，0表示不限制(默认)
+    /// @param max_msg_num_per_conn 每个连接每轮最多递交的消息数，0表示不限制(默认)
+    /// @note I/O线程模式下连接由I/O线程读取，只有每次Update的总配额生效
+    void SetDispatchBudget(uint32_t max_msg_num_per_loop, uint32_t max_msg_num_per_conn);
+
 public:
+	/// @brief 解析Bind/Connect的地址，派生的driver可以使用其他地址形式
+	virtual int32_t ParseAddress(const std::string& url, std::string* ip, uint16_t* port);
+
+	/// @brief 创建socket并生成bind/connect使用的地址，派生的driver可以替换地址族和socket类型
+	/// @return >=0 socket fd
+	/// @return <0 失败
+	virtual int CreateSocket(const std::string& ip, uint16_t port,
+		struct sockaddr_storage* addr, socklen_t* addr_len);
+
+	/// @brief socket类型，SOCK_SEQPACKET时每次收发一个完整的报文
+	virtual int SocketType() const { return SOCK_STREAM; }
+
 	virtual int32_t ParseHead(const uint8_t* head, uint32_t head_len, uint32_t* data_len);
 
 	virtual int32_t OnMessage(Connection* connection, const uint8_t* msg, uint32_t msg_len);
@@ -66,21 +116,54 @@ public:
 
 	void CloseConnection(int64_t local_handle, int64_t trans_handle);
 
+	/// @brief 连接因配额用完仍有未处理的完整消息，加入待处理队列
+	void AddPendingConnection(int64_t trans_handle);
+
+	/// @brief 本轮剩余的配额，不限制时返回UINT32_MAX
+	uint32_t GetDispatchBudget() const;
+
 	KVCache* GetSendCache() { return m_send_cache; }
 
-	KVCache* GetRecvCache() { return m_recv_cache; }
+	cxx::shared_ptr<Connection> GetConnection(int64_t trans_handle);
+
+	/// @brief 连接当前接收缓冲区的大小，用于观察内存占用
+	/// @return <0 连接不存在或由I/O线程管理
+	int64_t GetRecvBuffLen(int64_t trans_handle);
 
 	char* GetCommonBuff() { return m_common_buff; }
 
 protected:
-	int32_t SendRaw(int64_t handle, uint32_t msg_frag_num, const uint8_t* msg_frag[], uint32_t msg_frag_len[]);
+	friend class TcpIoThread;
+
+	int32_t StartIoThreads();
+
+	void StopIoThreads();
+
+	/// @brief 发送已加上消息头的数据，派生的driver可以替换发送方式
+	virtual int32_t SendRaw(int64_t handle, uint32_t msg_frag_num, const uint8_t* msg_frag[], uint32_t msg_frag_len[]);
+
+	/// @brief 按连接轮转处理待处理队列，one_round为true时每个连接只处理一次
+	void DispatchPending(bool one_round);
+
+protected:
+	struct ev_loop* m_loop;		// Init时为NULL则使用libev的默认loop
+
+	uint32_t m_max_msg_num_per_loop;
+	uint32_t m_max_msg_num_per_conn;
+	uint32_t m_loop_msg_num;					// 本次Update已递交的消息数
 
 private:
-	struct ev_loop* m_loop;
 	KVCache* m_send_cache;
-	KVCache* m_recv_cache;
 	char* m_common_buff;
 	int m_proc_num;
+	bool m_reuse_port;
+
+	uint32_t m_io_thread_num;
+	uint32_t m_io_queue_len;
+	std::vector<TcpIoThread*> m_io_threads;
+	TcpIoThread* m_owner_thread;				// I/O线程内部的driver所属的I/O线程
+
+	std::list<int64_t> m_pending_connections;	// 有未处理消息的连接，按轮转顺序排列
 
 	cxx::unordered_map<int64_t, cxx::shared_ptr<Listener> > m_listeners;
 	cxx::unordered_map<int64_t, cxx::shared_ptr<Connection> > m_connections;
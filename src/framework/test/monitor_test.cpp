@@ -0,0 +1,176 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "common/time_utility.h"
+#include "framework/monitor.h"
+#include "gtest/gtest.h"
+
+using namespace pebble;
+
+namespace {
+
+// 用固定时延的样本完成一个统计窗口(至少100ms、10个样本)
+void RunWindow(ConcurrencyLimitMonitor* monitor, int64_t rtt_ms) {
+    monitor->OnRequestComplete(rtt_ms);
+    usleep(105 * 1000);
+    for (int i = 0; i < 9; i++) {
+        monitor->OnRequestComplete(rtt_ms);
+    }
+}
+
+} // namespace
+
+TEST(ConcurrencyLimitMonitorTest, DisabledNeverOverloads) {
+    ConcurrencyLimitMonitor monitor;
+    monitor.SetLimitRange(1, 10);
+    monitor.SetTaskNum(100);
+    EXPECT_EQ(kNO_OVERLOAD, monitor.IsOverLoad());
+
+    monitor.SetEnable(true);
+    EXPECT_EQ(kCONCURRENCY_OVERLOAD, monitor.IsOverLoad());
+    monitor.SetTaskNum(9);
+    EXPECT_EQ(kNO_OVERLOAD, monitor.IsOverLoad());
+}
+
+TEST(ConcurrencyLimitMonitorTest, LimitFallsWhenLatencyRises) {
+    ConcurrencyLimitMonitor monitor;
+    monitor.SetEnable(true);
+    monitor.SetLimitRange(5, 100);
+    monitor.SetTaskNum(100);
+    EXPECT_EQ(100u, monitor.GetLimit());
+
+    // 时延平稳时保持在上限
+    for (int i = 0; i < 3; i++) {
+        RunWindow(&monitor, 10);
+    }
+    EXPECT_EQ(100u, monitor.GetLimit());
+
+    // 时延升高到基准的10倍，限制逐窗口下降
+    uint32_t last = monitor.GetLimit();
+    for (int i = 0; i < 4; i++) {
+        RunWindow(&monitor, 100);
+        EXPECT_LT(monitor.GetLimit(), last);
+        last = monitor.GetLimit();
+    }
+    EXPECT_GE(last, 5u);
+
+    monitor.SetTaskNum(last);
+    EXPECT_EQ(kCONCURRENCY_OVERLOAD, monitor.IsOverLoad());
+    monitor.SetTaskNum(last - 1);
+    EXPECT_EQ(kNO_OVERLOAD, monitor.IsOverLoad());
+}
+
+TEST(ConcurrencyLimitMonitorTest, LimitGrowsOnlyWhenBusy) {
+    ConcurrencyLimitMonitor monitor;
+    monitor.SetEnable(true);
+    monitor.SetLimitRange(5, 100);
+    monitor.SetTaskNum(100);
+    RunWindow(&monitor, 10);
+    for (int i = 0; i < 3; i++) {
+        RunWindow(&monitor, 100);
+    }
+    ASSERT_LT(monitor.GetLimit(), 100u);
+
+    // 并发任务数远低于限制时，时延恢复也不上调(第一个窗口仍包含之前的并发峰值)
+    monitor.SetTaskNum(1);
+    RunWindow(&monitor, 10);
+    uint32_t low = monitor.GetLimit();
+    RunWindow(&monitor, 10);
+    RunWindow(&monitor, 10);
+    EXPECT_LE(monitor.GetLimit(), low);
+
+    // 并发任务数达到限制且时延正常时，逐步上调探测
+    low = monitor.GetLimit();
+    monitor.SetTaskNum(low);
+    RunWindow(&monitor, 10);
+    EXPECT_GT(monitor.GetLimit(), low);
+}
+
+TEST(ConcurrencyLimitMonitorTest, LimitClampedToMin) {
+    ConcurrencyLimitMonitor monitor;
+    monitor.SetEnable(true);
+    monitor.SetLimitRange(20, 30);
+    monitor.SetTaskNum(30);
+    RunWindow(&monitor, 1);
+    for (int i = 0; i < 8; i++) {
+        RunWindow(&monitor, 1000);
+    }
+    EXPECT_EQ(20u, monitor.GetLimit());
+
+    // 下限为0时按1处理
+    monitor.SetLimitRange(0, 0);
+    EXPECT_EQ(1u, monitor.GetLimit());
+}
+
+namespace {
+
+// 以排队时间sojourn_ms出队一个消息，返回是否丢弃
+bool Dequeue(CoDelMonitor* monitor, int64_t sojourn_ms) {
+    monitor->OnMessage(TimeUtility::GetCurrentMS() - sojourn_ms);
+    return kQUEUE_DELAY_OVERLOAD == monitor->IsOverLoad();
+}
+
+} // namespace
+
+TEST(CoDelMonitorTest, ShortBurstNotDropped) {
+    CoDelMonitor monitor;
+    monitor.SetTarget(5, 100);
+    EXPECT_FALSE(Dequeue(&monitor, 1000));
+
+    monitor.SetEnable(true);
+    // 排队时间超标但不满一个观察周期
+    EXPECT_FALSE(Dequeue(&monitor, 50));
+    usleep(50 * 1000);
+    EXPECT_FALSE(Dequeue(&monitor, 50));
+    EXPECT_FALSE(monitor.IsDropping());
+
+    // 中间有一个消息低于目标，重新开始观察
+    EXPECT_FALSE(Dequeue(&monitor, 1));
+    usleep(60 * 1000);
+    EXPECT_FALSE(Dequeue(&monitor, 50));
+    EXPECT_FALSE(monitor.IsDropping());
+
+    // 没有到达时间的消息不参与统计
+    monitor.OnMessage(0);
+    EXPECT_EQ(kNO_OVERLOAD, monitor.IsOverLoad());
+}
+
+TEST(CoDelMonitorTest, SustainedQueueDropsAtControlLawPace) {
+    CoDelMonitor monitor;
+    monitor.SetEnable(true);
+    monitor.SetTarget(5, 100);
+
+    EXPECT_FALSE(Dequeue(&monitor, 50));
+    usleep(105 * 1000);
+    // 排队时间持续一个周期高于目标，进入丢弃状态并丢弃当前消息
+    EXPECT_TRUE(Dequeue(&monitor, 50));
+    EXPECT_TRUE(monitor.IsDropping());
+
+    // 两次丢弃之间间隔interval/sqrt(count)，期间的消息正常处理
+    EXPECT_FALSE(Dequeue(&monitor, 50));
+    EXPECT_TRUE(monitor.IsDropping());
+    usleep(105 * 1000);
+    EXPECT_TRUE(Dequeue(&monitor, 50));
+    usleep(75 * 1000);
+    EXPECT_TRUE(Dequeue(&monitor, 50));
+
+    // 排队时间回落到目标以下时退出丢弃状态
+    EXPECT_FALSE(Dequeue(&monitor, 1));
+    EXPECT_FALSE(monitor.IsDropping());
+
+    monitor.SetEnable(false);
+    EXPECT_FALSE(Dequeue(&monitor, 1000));
+}
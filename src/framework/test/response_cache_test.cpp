@@ -0,0 +1,96 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <string>
+#include <unistd.h>
+
+#include "framework/response_cache.h"
+#include "gtest/gtest.h"
+
+using namespace pebble;
+
+namespace {
+
+void Put(ResponseCache* cache, const std::string& key, const std::string& data, uint32_t ttl_ms) {
+    cache->Put(key, reinterpret_cast<const uint8_t*>(data.data()), data.size(), ttl_ms);
+}
+
+} // namespace
+
+TEST(ResponseCacheTest, HitAndExpire) {
+    ResponseCache cache;
+    cache.SetMaxBytes(1024);
+    EXPECT_FALSE(cache.Get("k"));
+
+    Put(&cache, "k", "value", 50);
+    ResponseCache::Data data = cache.Get("k");
+    ASSERT_TRUE(data);
+    EXPECT_EQ("value", *data);
+    EXPECT_EQ(1u, cache.GetHits());
+    EXPECT_EQ(1u, cache.GetMisses());
+    EXPECT_EQ(6u, cache.GetBytes());
+
+    // 过期后未命中并释放空间
+    usleep(60 * 1000);
+    EXPECT_FALSE(cache.Get("k"));
+    EXPECT_EQ(0u, cache.GetSize());
+    EXPECT_EQ(0u, cache.GetBytes());
+}
+
+TEST(ResponseCacheTest, OverwriteKeepsHeldData) {
+    ResponseCache cache;
+    cache.SetMaxBytes(1024);
+    Put(&cache, "k", "old", 1000);
+    ResponseCache::Data held = cache.Get("k");
+
+    // 覆盖写入不影响已取出的数据
+    Put(&cache, "k", "newer", 1000);
+    EXPECT_EQ("old", *held);
+    EXPECT_EQ("newer", *cache.Get("k"));
+    EXPECT_EQ(1u, cache.GetSize());
+    EXPECT_EQ(6u, cache.GetBytes());
+}
+
+TEST(ResponseCacheTest, EvictsLeastRecentlyUsed) {
+    ResponseCache cache;
+    cache.SetMaxBytes(30);
+    Put(&cache, "a", "123456789", 1000);
+    Put(&cache, "b", "123456789", 1000);
+    Put(&cache, "c", "123456789", 1000);
+    EXPECT_EQ(30u, cache.GetBytes());
+
+    // 访问a后写入d，淘汰最久未访问的b
+    EXPECT_TRUE(cache.Get("a"));
+    Put(&cache, "d", "123456789", 1000);
+    EXPECT_TRUE(cache.Get("a"));
+    EXPECT_FALSE(cache.Get("b"));
+    EXPECT_TRUE(cache.Get("c"));
+    EXPECT_TRUE(cache.Get("d"));
+    EXPECT_EQ(1u, cache.GetEvictions());
+
+    // 超过上限的单条数据不缓存，也不淘汰已有数据
+    Put(&cache, "e", std::string(40, 'x'), 1000);
+    EXPECT_FALSE(cache.Get("e"));
+    EXPECT_EQ(3u, cache.GetSize());
+
+    // 缩小上限时立即淘汰
+    cache.SetMaxBytes(10);
+    EXPECT_EQ(1u, cache.GetSize());
+    EXPECT_TRUE(cache.Get("d"));
+    EXPECT_EQ(3u, cache.GetEvictions());
+
+    cache.Clear();
+    EXPECT_EQ(0u, cache.GetSize());
+    EXPECT_EQ(0u, cache.GetBytes());
+}
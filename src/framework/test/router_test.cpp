@@ -0,0 +1,419 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <algorithm>
+#include <map>
+#include <unistd.h>
+#include <vector>
+
+#include "framework/message.h"
+#include "framework/router.h"
+#include "framework/rpc.h"
+#include "framework/test/test_util.h"
+#include "gtest/gtest.h"
+
+using namespace pebble;
+using namespace pebble::test;
+
+namespace {
+
+// 测试使用的handle不对应真实连接，只用于路由和质量统计
+std::vector<int64_t> MakeHandles(int64_t first, uint32_t num) {
+    std::vector<int64_t> handles;
+    for (uint32_t i = 0; i < num; i++) {
+        handles.push_back(first + i);
+    }
+    return handles;
+}
+
+void RemoveQuality(const std::vector<int64_t>& handles) {
+    for (uint32_t i = 0; i < handles.size(); i++) {
+        RouteQuality::Remove(handles[i]);
+    }
+}
+
+} // namespace
+
+TEST(RouteQualityTest, LoadGrowsWithLatencyAndInflight) {
+    const int64_t kHANDLE = 1001;
+    EXPECT_EQ(0.0, RouteQuality::GetLoad(kHANDLE));
+
+    RouteQuality::OnRequestSent(kHANDLE);
+    RouteQuality::OnRequestDone(kHANDLE, 0, 10);
+    double base = RouteQuality::GetLoad(kHANDLE);
+    EXPECT_GT(base, 0.0);
+
+    RouteQuality::OnRequestSent(kHANDLE);
+    EXPECT_GT(RouteQuality::GetLoad(kHANDLE), base);
+    RouteQuality::OnRequestCancelled(kHANDLE);
+    EXPECT_EQ(base, RouteQuality::GetLoad(kHANDLE));
+
+    RouteQuality::OnRequestSent(kHANDLE);
+    RouteQuality::OnRequestDone(kHANDLE, 0, 100);
+    double slower = RouteQuality::GetLoad(kHANDLE);
+    EXPECT_GT(slower, base);
+
+    RouteQuality::Remove(kHANDLE);
+    EXPECT_EQ(0.0, RouteQuality::GetLoad(kHANDLE));
+}
+
+TEST(RouteQualityTest, OnlyTransportFailuresRaiseErrorRate) {
+    // 时延相同，业务错误不计入错误率，传输失败提高评分
+    const int64_t kOK = 1101;
+    const int64_t kAPP_ERROR = 1102;
+    const int64_t kTIMEOUT = 1103;
+    RouteQuality::OnRequestSent(kOK);
+    RouteQuality::OnRequestDone(kOK, 0, 10);
+    RouteQuality::OnRequestSent(kAPP_ERROR);
+    RouteQuality::OnRequestDone(kAPP_ERROR, -12345, 10);
+    RouteQuality::OnRequestSent(kTIMEOUT);
+    RouteQuality::OnRequestDone(kTIMEOUT, kRPC_REQUEST_TIMEOUT, 10);
+
+    EXPECT_EQ(RouteQuality::GetLoad(kOK), RouteQuality::GetLoad(kAPP_ERROR));
+    EXPECT_GT(RouteQuality::GetLoad(kTIMEOUT), RouteQuality::GetLoad(kOK));
+
+    RouteQuality::Remove(kOK);
+    RouteQuality::Remove(kAPP_ERROR);
+    RouteQuality::Remove(kTIMEOUT);
+}
+
+TEST(QualityRoutePolicyTest, AvoidsSlowHandle) {
+    std::vector<int64_t> handles = MakeHandles(2001, 4);
+    for (uint32_t i = 0; i < handles.size(); i++) {
+        RouteQuality::OnRequestSent(handles[i]);
+        RouteQuality::OnRequestDone(handles[i], 0, 0 == i ? 200 : 2);
+    }
+
+    // 两个候选总是不同的handle，最慢的handle每次比较都落败
+    QualityRoutePolicy policy;
+    std::map<int64_t, int32_t> counts;
+    for (int32_t i = 0; i < 3000; i++) {
+        int64_t handle = policy.GetRoute(i, handles);
+        ASSERT_TRUE(handles.end() != std::find(handles.begin(), handles.end(), handle));
+        counts[handle]++;
+    }
+    EXPECT_EQ(0, counts[handles[0]]);
+    for (uint32_t i = 1; i < handles.size(); i++) {
+        EXPECT_GT(counts[handles[i]], 500);
+    }
+
+    RemoveQuality(handles);
+}
+
+TEST(QualityRoutePolicyTest, PrefersLessInflight) {
+    std::vector<int64_t> handles = MakeHandles(3001, 2);
+    for (int32_t i = 0; i < 10; i++) {
+        RouteQuality::OnRequestSent(handles[0]);
+    }
+    QualityRoutePolicy policy;
+    for (int32_t i = 0; i < 100; i++) {
+        EXPECT_EQ(handles[1], policy.GetRoute(i, handles));
+    }
+    EXPECT_EQ(kROUTER_NONE_VALID_HANDLE, policy.GetRoute(0, std::vector<int64_t>()));
+
+    RemoveQuality(handles);
+}
+
+namespace {
+
+void MakeRing(ConsistentHashRoutePolicy* policy, const std::vector<int64_t>& handles) {
+    std::vector<std::string> urls;
+    for (uint32_t i = 0; i < handles.size(); i++) {
+        char url[64];
+        snprintf(url, sizeof(url), "tcp://10.0.0.%u:8000", static_cast<uint32_t>(handles[i] % 256));
+        urls.push_back(url);
+    }
+    policy->OnRouteChanged(handles, urls);
+}
+
+} // namespace
+
+TEST(ConsistentHashRoutePolicyTest, AddingNodeMovesFewKeys) {
+    const uint32_t kKEY_NUM = 10000;
+    std::vector<int64_t> handles = MakeHandles(4001, 4);
+    ConsistentHashRoutePolicy policy;
+    MakeRing(&policy, handles);
+
+    std::vector<int64_t> before;
+    for (uint32_t key = 0; key < kKEY_NUM; key++) {
+        before.push_back(policy.GetRoute(key, handles));
+    }
+
+    // 增加一个节点，迁移的key都迁到新节点上，比例约为1/5
+    handles.push_back(4005);
+    MakeRing(&policy, handles);
+    uint32_t moved = 0;
+    for (uint32_t key = 0; key < kKEY_NUM; key++) {
+        int64_t handle = policy.GetRoute(key, handles);
+        if (handle != before[key]) {
+            EXPECT_EQ(4005, handle);
+            moved++;
+        }
+    }
+    EXPECT_GT(moved, kKEY_NUM / 10);
+    EXPECT_LT(moved, kKEY_NUM * 3 / 10);
+}
+
+TEST(ConsistentHashRoutePolicyTest, FilteredHandleOnlyMovesItsKeys) {
+    const uint32_t kKEY_NUM = 10000;
+    std::vector<int64_t> handles = MakeHandles(5001, 5);
+    ConsistentHashRoutePolicy policy;
+    MakeRing(&policy, handles);
+
+    std::vector<int64_t> before;
+    for (uint32_t key = 0; key < kKEY_NUM; key++) {
+        before.push_back(policy.GetRoute(key, handles));
+    }
+
+    // 候选列表中去掉一个handle(如熔断)，环不变，只有该handle上的key迁移，且分散到其他节点
+    std::vector<int64_t> available(handles.begin() + 1, handles.end());
+    std::map<int64_t, uint32_t> moved_to;
+    for (uint32_t key = 0; key < kKEY_NUM; key++) {
+        int64_t handle = policy.GetRoute(key, available);
+        EXPECT_NE(handles[0], handle);
+        if (before[key] != handles[0]) {
+            EXPECT_EQ(before[key], handle);
+        } else {
+            moved_to[handle]++;
+        }
+    }
+    EXPECT_GT(moved_to.size(), 1u);
+
+    EXPECT_EQ(kROUTER_NONE_VALID_HANDLE, policy.GetRoute(0, std::vector<int64_t>()));
+}
+
+namespace {
+
+// 暴露Router内部的熔断判断
+class TestRouter : public Router {
+public:
+    explicit TestRouter(const std::string& name) : Router(name) {}
+    using Router::HasOpenCircuit;
+};
+
+// 连续失败failures次使handle熔断
+void Fail(int64_t handle, uint32_t failures) {
+    for (uint32_t i = 0; i < failures; i++) {
+        RouteQuality::OnRequestSent(handle);
+        RouteQuality::OnRequestDone(handle, kRPC_REQUEST_TIMEOUT, 1);
+    }
+}
+
+class RouterTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        MessageCallbacks cbs;
+        Message::Init(cbs);
+        m_listeners.push_back(Message::Bind("tcp://127.0.0.1:19881"));
+        m_listeners.push_back(Message::Bind("tcp://127.0.0.1:19882"));
+        m_router = new TestRouter("test.router");
+        ASSERT_EQ(0, m_router->Init(&m_naming));
+        m_router->SetOnAddressChanged(cxx::bind(&RouterTest::OnAddressChanged, this,
+            cxx::placeholders::_1));
+        m_router->SetOnHandleClosed(cxx::bind(&RouterTest::OnHandleClosed, this,
+            cxx::placeholders::_1));
+    }
+
+    virtual void TearDown() {
+        delete m_router;
+        for (uint32_t i = 0; i < m_handles.size(); i++) {
+            Message::Close(m_handles[i]);
+            RouteQuality::Remove(m_handles[i]);
+        }
+        for (uint32_t i = 0; i < m_listeners.size(); i++) {
+            Message::Close(m_listeners[i]);
+        }
+        RouteQuality::SetCircuitBreaker(5, 1000); // 恢复默认的熔断参数
+    }
+
+    void OnAddressChanged(const std::vector<int64_t>& handles) {
+        m_handles = handles;
+    }
+
+    void OnHandleClosed(int64_t handle) {
+        m_closed.push_back(handle);
+    }
+
+    bool IsOpen(int64_t handle) {
+        const uint8_t msg[] = "ping";
+        return 0 == Message::Send(handle, msg, sizeof(msg));
+    }
+
+    FakeNaming m_naming;
+    TestRouter* m_router;
+    std::vector<int64_t> m_listeners;
+    std::vector<int64_t> m_handles;
+    std::vector<int64_t> m_closed;
+};
+
+} // namespace
+
+TEST(CircuitBreakerTest, OpensAfterConsecutiveTransportFailures) {
+    const int64_t kHANDLE = 9001;
+    RouteQuality::SetCircuitBreaker(3, 100);
+
+    // 业务错误和中间的成功都不计入连续失败
+    Fail(kHANDLE, 2);
+    RouteQuality::OnRequestSent(kHANDLE);
+    RouteQuality::OnRequestDone(kHANDLE, 0, 1);
+    Fail(kHANDLE, 2);
+    RouteQuality::OnRequestSent(kHANDLE);
+    RouteQuality::OnRequestDone(kHANDLE, -1, 1);
+    EXPECT_EQ(kCIRCUIT_CLOSED, RouteQuality::GetCircuitState(kHANDLE));
+    EXPECT_FALSE(RouteQuality::HasOpenCircuit());
+
+    Fail(kHANDLE, 3);
+    EXPECT_EQ(kCIRCUIT_OPEN, RouteQuality::GetCircuitState(kHANDLE));
+    EXPECT_TRUE(RouteQuality::HasOpenCircuit());
+    EXPECT_FALSE(RouteQuality::AllowRequest(kHANDLE));
+
+    // 熔断期满后只允许一个探测请求，探测成功后恢复
+    usleep(110 * 1000);
+    EXPECT_TRUE(RouteQuality::AllowRequest(kHANDLE));
+    RouteQuality::OnRequestSent(kHANDLE);
+    EXPECT_EQ(kCIRCUIT_HALF_OPEN, RouteQuality::GetCircuitState(kHANDLE));
+    EXPECT_FALSE(RouteQuality::AllowRequest(kHANDLE));
+    RouteQuality::OnRequestDone(kHANDLE, 0, 1);
+    EXPECT_EQ(kCIRCUIT_CLOSED, RouteQuality::GetCircuitState(kHANDLE));
+    EXPECT_FALSE(RouteQuality::HasOpenCircuit());
+
+    RouteQuality::Remove(kHANDLE);
+    RouteQuality::SetCircuitBreaker(5, 1000);
+}
+
+TEST(CircuitBreakerTest, FailedProbeReopens) {
+    const int64_t kHANDLE = 9002;
+    RouteQuality::SetCircuitBreaker(1, 50);
+    Fail(kHANDLE, 1);
+    ASSERT_EQ(kCIRCUIT_OPEN, RouteQuality::GetCircuitState(kHANDLE));
+
+    // 探测失败重新熔断，需要再等一个熔断周期
+    usleep(60 * 1000);
+    Fail(kHANDLE, 1);
+    EXPECT_EQ(kCIRCUIT_OPEN, RouteQuality::GetCircuitState(kHANDLE));
+    EXPECT_FALSE(RouteQuality::AllowRequest(kHANDLE));
+
+    // 探测请求被取消时允许立即再次探测
+    usleep(60 * 1000);
+    RouteQuality::OnRequestSent(kHANDLE);
+    EXPECT_FALSE(RouteQuality::AllowRequest(kHANDLE));
+    RouteQuality::OnRequestCancelled(kHANDLE);
+    EXPECT_TRUE(RouteQuality::AllowRequest(kHANDLE));
+
+    // 关闭熔断时恢复所有handle
+    RouteQuality::SetCircuitBreaker(0, 50);
+    EXPECT_EQ(kCIRCUIT_CLOSED, RouteQuality::GetCircuitState(kHANDLE));
+    EXPECT_FALSE(RouteQuality::HasOpenCircuit());
+
+    RouteQuality::Remove(kHANDLE);
+    RouteQuality::SetCircuitBreaker(5, 1000);
+}
+
+TEST_F(RouterTest, RouteSkipsOpenCircuit) {
+    m_naming.SetUrls("tcp://127.0.0.1:19881", "tcp://127.0.0.1:19882");
+    ASSERT_EQ(2u, m_handles.size());
+    RouteQuality::SetCircuitBreaker(2, 1000);
+
+    Fail(m_handles[0], 2);
+    EXPECT_TRUE(m_router->HasOpenCircuit());
+    for (uint64_t key = 0; key < 10; key++) {
+        EXPECT_EQ(m_handles[1], m_router->GetRoute(key));
+    }
+
+    // 全部熔断时返回熔断错误
+    Fail(m_handles[1], 2);
+    EXPECT_EQ(kROUTER_CIRCUIT_OPEN, m_router->GetRoute(0));
+}
+
+TEST_F(RouterTest, OtherRouterCircuitIgnored) {
+    m_naming.SetUrls("tcp://127.0.0.1:19881");
+    ASSERT_EQ(1u, m_handles.size());
+
+    FakeNaming other_naming;
+    TestRouter other("test.other");
+    ASSERT_EQ(0, other.Init(&other_naming));
+    other_naming.SetUrls("tcp://127.0.0.1:19882");
+    int64_t other_handle = other.GetRoute(0);
+    ASSERT_GE(other_handle, 0);
+    ASSERT_NE(m_handles[0], other_handle);
+
+    // 另一个Router的handle熔断，本Router仍直接使用路由策略
+    RouteQuality::SetCircuitBreaker(1, 1000);
+    Fail(other_handle, 1);
+    EXPECT_TRUE(RouteQuality::HasOpenCircuit());
+    EXPECT_TRUE(other.HasOpenCircuit());
+    EXPECT_FALSE(m_router->HasOpenCircuit());
+    EXPECT_EQ(m_handles[0], m_router->GetRoute(0));
+
+    RouteQuality::Remove(other_handle);
+}
+
+TEST_F(RouterTest, RemovedHandleDrainsBeforeClose) {
+    m_naming.SetUrls("tcp://127.0.0.1:19881", "tcp://127.0.0.1:19882");
+    ASSERT_EQ(2u, m_handles.size());
+    int64_t removed = m_handles[0];
+    int64_t kept = m_handles[1];
+
+    RouteQuality::OnRequestSent(removed);
+    RouteQuality::OnRequestSent(removed);
+    m_naming.SetUrls("tcp://127.0.0.1:19882");
+    ASSERT_EQ(1u, m_handles.size());
+    EXPECT_EQ(kept, m_handles[0]);
+
+    // 移除的handle不再参与路由，但在途请求完成前连接保持
+    EXPECT_TRUE(RouteQuality::IsDraining(removed));
+    EXPECT_TRUE(NULL == Router::GetRouterByHandle(removed));
+    for (uint64_t key = 0; key < 10; key++) {
+        EXPECT_EQ(kept, m_router->GetRoute(key));
+    }
+    EXPECT_TRUE(IsOpen(removed));
+
+    RouteQuality::OnRequestDone(removed, 0, 1);
+    EXPECT_TRUE(IsOpen(removed));
+    EXPECT_TRUE(m_closed.empty());
+
+    // 最后一个在途请求结束后关闭，并通知上层
+    RouteQuality::OnRequestCancelled(removed);
+    EXPECT_FALSE(RouteQuality::IsDraining(removed));
+    EXPECT_FALSE(IsOpen(removed));
+    ASSERT_EQ(1u, m_closed.size());
+    EXPECT_EQ(removed, m_closed[0]);
+}
+
+TEST_F(RouterTest, IdleRemovedHandleClosesImmediately) {
+    m_naming.SetUrls("tcp://127.0.0.1:19881", "tcp://127.0.0.1:19882");
+    ASSERT_EQ(2u, m_handles.size());
+    int64_t removed = m_handles[1];
+
+    m_naming.SetUrls("tcp://127.0.0.1:19881");
+    EXPECT_FALSE(RouteQuality::IsDraining(removed));
+    EXPECT_FALSE(IsOpen(removed));
+    EXPECT_TRUE(IsOpen(m_handles[0]));
+    ASSERT_EQ(1u, m_closed.size());
+    EXPECT_EQ(removed, m_closed[0]);
+}
+
+TEST_F(RouterTest, DuplicateUrlsShareOneHandle) {
+    m_naming.SetUrls("tcp://127.0.0.1:19881", "tcp://127.0.0.1:19881");
+    ASSERT_EQ(1u, m_handles.size());
+    int64_t handle = m_handles[0];
+
+    // 重复地址只建一个连接，地址移除后连接被关闭
+    m_naming.SetUrls("tcp://127.0.0.1:19882");
+    ASSERT_EQ(1u, m_handles.size());
+    EXPECT_NE(handle, m_handles[0]);
+    EXPECT_FALSE(IsOpen(handle));
+    ASSERT_EQ(1u, m_closed.size());
+    EXPECT_EQ(handle, m_closed[0]);
+}
@@ -0,0 +1,715 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <set>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "common/time_utility.h"
+#include "framework/message.h"
+#include "framework/monitor.h"
+#include "framework/pebble_rpc.h"
+#include "framework/router.h"
+#include "gtest/gtest.h"
+
+using namespace pebble;
+
+namespace {
+
+// 同一个PebbleRpc同时作为客户端和服务端，通过本地回环连接收发消息
+PebbleRpc* g_rpc = NULL;
+// 模拟消息在队列中等待的时间
+int64_t g_queue_delay_ms = 0;
+// 模拟系统过载状态 @see OverLoadType
+uint32_t g_overload = kNO_OVERLOAD;
+// 收到过消息的连接，用例结束时关闭，避免上个用例的消息(会话ID会重复)影响下个用例
+std::set<int64_t> g_remote_handles;
+
+int32_t OnMessage(const uint8_t* msg, uint32_t msg_len, MsgExternInfo* msg_info) {
+    g_remote_handles.insert(msg_info->_remote_handle);
+    msg_info->_msg_arrived_ms -= g_queue_delay_ms;
+    return g_rpc->OnMessage(msg_info->_remote_handle, msg, msg_len, msg_info, g_overload);
+}
+
+struct Response {
+    Response() : num(0), ret(0) {}
+    int32_t num;
+    int32_t ret;
+    std::string data;
+};
+
+int32_t OnResponse(Response* response, int32_t ret, const uint8_t* buff, uint32_t buff_len) {
+    response->num++;
+    response->ret = ret;
+    response->data.assign(reinterpret_cast<const char*>(buff), buff_len);
+    return ret;
+}
+
+int32_t NoResponse(const uint8_t* buff, uint32_t buff_len,
+    cxx::function<int32_t(int32_t ret, const uint8_t* buff, uint32_t buff_len)>& rsp) {
+    return 0;
+}
+
+class RpcTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        m_rpc = new PebbleRpc(kCODE_BINARY, NULL);
+        m_rpc->SetSendFunction(Message::Send, Message::SendV);
+        g_rpc = m_rpc;
+        g_queue_delay_ms = 0;
+        g_overload = kNO_OVERLOAD;
+        m_request_num = 0;
+
+        MessageCallbacks cbs;
+        cbs._on_message = OnMessage;
+        Message::Init(cbs);
+        m_listener = Message::Bind("tcp://127.0.0.1:19890");
+        ASSERT_GE(m_listener, 0);
+        m_handle = Message::Connect("tcp://127.0.0.1:19890");
+        ASSERT_GE(m_handle, 0);
+    }
+
+    virtual void TearDown() {
+        for (std::set<int64_t>::iterator it = g_remote_handles.begin();
+            it != g_remote_handles.end(); ++it) {
+            if (*it != m_handle) {
+                Message::Close(*it);
+            }
+        }
+        g_remote_handles.clear();
+        Message::Close(m_handle);
+        Message::Close(m_listener);
+        RouteQuality::Remove(m_handle);
+        RouteQuality::SetCircuitBreaker(5, 1000); // 恢复默认的熔断参数
+        delete m_rpc;
+        g_rpc = NULL;
+    }
+
+    // 驱动网络和RPC，直到cond满足或超时
+    template<typename Cond>
+    void Pump(Cond cond, int64_t max_ms) {
+        int64_t end = TimeUtility::GetCurrentMS() + max_ms;
+        while (!cond() && TimeUtility::GetCurrentMS() < end) {
+            int32_t num = Message::Update() + m_rpc->Update();
+            if (num <= 0) {
+                usleep(500);
+            }
+        }
+    }
+
+    void PumpFor(int64_t ms) {
+        Pump(AlwaysFalse, ms);
+    }
+
+    static bool AlwaysFalse() {
+        return false;
+    }
+
+    // 原样返回请求数据的服务
+    int32_t Echo(const uint8_t* buff, uint32_t buff_len,
+        cxx::function<int32_t(int32_t ret, const uint8_t* buff, uint32_t buff_len)>& rsp) {
+        m_request_num++;
+        rsp(0, buff, buff_len);
+        return 0;
+    }
+
+    OnRpcRequest EchoFunction() {
+        return cxx::bind(&RpcTest::Echo, this, cxx::placeholders::_1, cxx::placeholders::_2,
+            cxx::placeholders::_3);
+    }
+
+    void AddEcho(const std::string& name, uint32_t function_id) {
+        ASSERT_EQ(0, m_rpc->AddOnRequestFunction(name, function_id, EchoFunction()));
+    }
+
+    RpcHead MakeHead(const std::string& name, uint32_t function_id) {
+        RpcHead head;
+        head.m_message_type  = kRPC_CALL;
+        head.m_session_id    = m_rpc->GenSessionId();
+        head.m_function_name = name;
+        head.m_function_id   = function_id;
+        return head;
+    }
+
+    int32_t Call(const RpcHead& head, const std::string& data, Response* response,
+        int32_t timeout_ms = 1000) {
+        return m_rpc->SendRequest(m_handle, head, reinterpret_cast<const uint8_t*>(data.data()),
+            data.size(), cxx::bind(OnResponse, response, cxx::placeholders::_1,
+                cxx::placeholders::_2, cxx::placeholders::_3), timeout_ms);
+    }
+
+    void WaitResponse(const Response& response, int32_t num = 1, int64_t max_ms = 2000) {
+        Pump([&response, num]() { return response.num >= num; }, max_ms);
+    }
+
+    PebbleRpc* m_rpc;
+    int64_t m_listener;
+    int64_t m_handle;
+    int32_t m_request_num;
+};
+
+} // namespace
+
+TEST_F(RpcTest, FunctionIdMatchesIdlHash) {
+    // FNV-1a 32位，和IDL编译器生成的ID一致
+    EXPECT_EQ(0x811c9dc5u, IRpc::GenFunctionId(""));
+    EXPECT_EQ(0xe40c292cu, IRpc::GenFunctionId("a"));
+    EXPECT_NE(IRpc::GenFunctionId("Test:echo"), IRpc::GenFunctionId("Test:echo2"));
+}
+
+TEST_F(RpcTest, CallByFunctionId) {
+    const std::string kNAME = "Test:echo";
+    const uint32_t kID = IRpc::GenFunctionId(kNAME);
+    AddEcho(kNAME, kID);
+    m_rpc->SetUseFunctionId(true);
+
+    // 请求头只携带函数ID，服务端按ID分发
+    Response response;
+    ASSERT_EQ(0, Call(MakeHead(kNAME, kID), "hello", &response));
+    WaitResponse(response);
+    EXPECT_EQ(1, response.num);
+    EXPECT_EQ(0, response.ret);
+    EXPECT_EQ("hello", response.data);
+
+    // 只有ID没有名字的请求也能分发
+    Response by_id;
+    ASSERT_EQ(0, Call(MakeHead("", kID), "world", &by_id));
+    WaitResponse(by_id);
+    EXPECT_EQ(0, by_id.ret);
+    EXPECT_EQ("world", by_id.data);
+    EXPECT_EQ(2, m_request_num);
+}
+
+TEST_F(RpcTest, UnknownFunctionIdFails) {
+    AddEcho("Test:echo", IRpc::GenFunctionId("Test:echo"));
+    m_rpc->SetUseFunctionId(true);
+
+    Response response;
+    ASSERT_EQ(0, Call(MakeHead("Test:other", IRpc::GenFunctionId("Test:other")), "x", &response));
+    WaitResponse(response);
+    EXPECT_EQ(1, response.num);
+    EXPECT_NE(0, response.ret);
+    EXPECT_EQ(0, m_request_num);
+}
+
+TEST_F(RpcTest, FunctionIdCollisionRejected) {
+    AddEcho("Test:echo", 1234);
+    EXPECT_NE(0, m_rpc->AddOnRequestFunction("Test:echo2", 1234, EchoFunction()));
+}
+
+namespace {
+
+int64_t GetResource(IRpc* rpc, const std::string& suffix) {
+    cxx::unordered_map<std::string, int64_t> resource;
+    rpc->GetResourceUsed(&resource);
+    for (cxx::unordered_map<std::string, int64_t>::iterator it = resource.begin();
+        it != resource.end(); ++it) {
+        if (it->first.size() >= suffix.size()
+            && it->first.compare(it->first.size() - suffix.size(), suffix.size(), suffix) == 0) {
+            return it->second;
+        }
+    }
+    return -1;
+}
+
+} // namespace
+
+TEST_F(RpcTest, SessionsAndTimersReturnToPool) {
+    AddEcho("Test:echo", 0);
+
+    // 会话数超过初始桶数，触发扩容后仍能正确查找
+    const int32_t kNUM = 3000;
+    std::vector<Response> responses(kNUM);
+    for (int32_t i = 0; i < kNUM; i++) {
+        ASSERT_EQ(0, Call(MakeHead("Test:echo", 0), "x", &responses[i]));
+    }
+    EXPECT_EQ(kNUM, GetResource(m_rpc, ":session"));
+    EXPECT_EQ(kNUM, GetResource(m_rpc, ":timer"));
+
+    Pump([&responses]() { return responses.back().num > 0; }, 5000);
+    for (int32_t i = 0; i < kNUM; i++) {
+        ASSERT_EQ(1, responses[i].num);
+        ASSERT_EQ(0, responses[i].ret);
+    }
+    EXPECT_EQ(0, GetResource(m_rpc, ":session"));
+    EXPECT_EQ(0, GetResource(m_rpc, ":timer"));
+}
+
+TEST_F(RpcTest, TimeoutFreesSession) {
+    // 服务端不响应，客户端会话超时释放，服务端会话在处理超时后释放
+    ASSERT_EQ(0, m_rpc->AddOnRequestFunction("Test:drop", 0, NoResponse));
+    m_rpc->SetProcRequestTimeoutMS(50);
+
+    Response response;
+    ASSERT_EQ(0, Call(MakeHead("Test:drop", 0), "x", &response, 50));
+    WaitResponse(response, 1, 1000);
+    EXPECT_EQ(kRPC_REQUEST_TIMEOUT, response.ret);
+    PumpFor(100);
+    EXPECT_EQ(0, GetResource(m_rpc, ":session"));
+    EXPECT_EQ(0, GetResource(m_rpc, ":timer"));
+}
+
+namespace {
+
+int32_t IgnoreFrame(const uint8_t* buff, uint32_t buff_len) {
+    return 0;
+}
+
+} // namespace
+
+TEST_F(RpcTest, SendDoesNotModifyCallerHead) {
+    AddEcho("Test:echo", 0);
+
+    const RpcHead head = MakeHead("Test:echo", 0);
+    Response response;
+    ASSERT_EQ(0, Call(head, "x", &response, 1234));
+    EXPECT_EQ(0, head.m_timeout_ms);
+    EXPECT_EQ(kRPC_CALL, head.m_message_type);
+    WaitResponse(response);
+    EXPECT_EQ(0, response.ret);
+
+    const RpcHead stream_head = MakeHead("Test:stream", 0);
+    Response stream_response;
+    ASSERT_EQ(0, m_rpc->SendStreamRequest(m_handle, stream_head, NULL, 0, IgnoreFrame,
+        cxx::bind(OnResponse, &stream_response, cxx::placeholders::_1,
+            cxx::placeholders::_2, cxx::placeholders::_3), 1234, 0));
+    EXPECT_EQ(0, stream_head.m_timeout_ms);
+    EXPECT_EQ(kRPC_CALL, stream_head.m_message_type);
+    WaitResponse(stream_response);
+    EXPECT_EQ(1, stream_response.num);
+}
+
+TEST_F(RpcTest, ExpiredRequestDroppedByServer) {
+    AddEcho("Test:echo", 0);
+    m_rpc->SetPropagateTimeout(true);
+
+    // 请求在服务端排队超过调用方的超时时间，不再处理
+    g_queue_delay_ms = 500;
+    Response expired;
+    ASSERT_EQ(0, Call(MakeHead("Test:echo", 0), "x", &expired, 100));
+    WaitResponse(expired, 1, 1000);
+    EXPECT_EQ(kRPC_REQUEST_TIMEOUT, expired.ret);
+    EXPECT_EQ(0, m_request_num);
+
+    g_queue_delay_ms = 0;
+    Response response;
+    ASSERT_EQ(0, Call(MakeHead("Test:echo", 0), "x", &response, 100));
+    WaitResponse(response);
+    EXPECT_EQ(0, response.ret);
+    EXPECT_EQ(1, m_request_num);
+}
+
+TEST_F(RpcTest, SheddingFollowsPriority) {
+    EXPECT_NE(0, m_rpc->SetFunctionPriority("", kRPC_PRIORITY_HIGH));
+    EXPECT_NE(0, m_rpc->SetFunctionPriority("Test:low", kRPC_PRIORITY_CRITICAL + 1));
+
+    // 注册服务前后都可以设置优先级
+    ASSERT_EQ(0, m_rpc->SetFunctionPriority("Test:high", kRPC_PRIORITY_HIGH));
+    AddEcho("Test:low", 0);
+    AddEcho("Test:high", 0);
+    AddEcho("Test:critical", 0);
+    ASSERT_EQ(0, m_rpc->SetFunctionPriority("Test:critical", kRPC_PRIORITY_CRITICAL));
+    // 同一个连接上的过载拒绝会触发调用方熔断，这里只测试服务端
+    RouteQuality::SetCircuitBreaker(0, 1000);
+
+    // 刚开始过载时只拒绝最低优先级的请求
+    g_overload = kTASK_OVERLOAD;
+    Response low, high;
+    ASSERT_EQ(0, Call(MakeHead("Test:low", 0), "x", &low));
+    ASSERT_EQ(0, Call(MakeHead("Test:high", 0), "x", &high));
+    WaitResponse(low);
+    WaitResponse(high);
+    EXPECT_EQ(kRPC_TASK_OVERLOAD, low.ret);
+    EXPECT_EQ(0, high.ret);
+    EXPECT_EQ(1, m_request_num);
+
+    // 过载持续时拒绝级别逐步升高，但不拒绝CRITICAL的请求
+    for (int i = 0; i < 8; i++) {
+        Response busy;
+        ASSERT_EQ(0, Call(MakeHead("Test:low", 0), "x", &busy));
+        WaitResponse(busy);
+        PumpFor(50);
+    }
+    EXPECT_EQ(static_cast<uint32_t>(kRPC_PRIORITY_HIGH), m_rpc->GetShedLevel());
+    Response shed, critical;
+    ASSERT_EQ(0, Call(MakeHead("Test:high", 0), "x", &shed));
+    ASSERT_EQ(0, Call(MakeHead("Test:critical", 0), "x", &critical));
+    WaitResponse(shed);
+    WaitResponse(critical);
+    EXPECT_EQ(kRPC_TASK_OVERLOAD, shed.ret);
+    EXPECT_EQ(0, critical.ret);
+
+    // 过载消除后所有请求都正常处理，空闲的周期逐级恢复拒绝级别
+    g_overload = kNO_OVERLOAD;
+    Response recovered;
+    ASSERT_EQ(0, Call(MakeHead("Test:low", 0), "x", &recovered));
+    WaitResponse(recovered);
+    EXPECT_EQ(0, recovered.ret);
+    PumpFor(350);
+    Response idle;
+    ASSERT_EQ(0, Call(MakeHead("Test:low", 0), "x", &idle));
+    WaitResponse(idle);
+    EXPECT_EQ(static_cast<uint32_t>(kRPC_PRIORITY_LOW), m_rpc->GetShedLevel());
+}
+
+namespace {
+
+int32_t FailRequest(const uint8_t* buff, uint32_t buff_len,
+    cxx::function<int32_t(int32_t ret, const uint8_t* buff, uint32_t buff_len)>& rsp) {
+    rsp(-5, NULL, 0);
+    return 0;
+}
+
+} // namespace
+
+TEST_F(RpcTest, CachedResponseSkipsServer) {
+    AddEcho("Test:echo", 0);
+    m_rpc->SetResponseCache("Test:echo", 1000);
+
+    Response first;
+    ASSERT_EQ(0, Call(MakeHead("Test:echo", 0), "x", &first));
+    WaitResponse(first);
+    EXPECT_EQ("x", first.data);
+    EXPECT_EQ(1, m_request_num);
+
+    // 命中缓存时不发送请求，在下一次Update时回调
+    Response cached;
+    ASSERT_EQ(0, Call(MakeHead("Test:echo", 0), "x", &cached));
+    EXPECT_EQ(0, cached.num);
+    WaitResponse(cached);
+    EXPECT_EQ(0, cached.ret);
+    EXPECT_EQ("x", cached.data);
+    EXPECT_EQ(1, m_request_num);
+    EXPECT_EQ(1, GetResource(m_rpc, ":cache_hit"));
+
+    // 请求数据不同时不命中
+    Response other;
+    ASSERT_EQ(0, Call(MakeHead("Test:echo", 0), "y", &other));
+    WaitResponse(other);
+    EXPECT_EQ("y", other.data);
+    EXPECT_EQ(2, m_request_num);
+
+    // 取消命中缓存的请求后不再回调
+    RpcHead head = MakeHead("Test:echo", 0);
+    Response cancelled;
+    ASSERT_EQ(0, Call(head, "x", &cancelled));
+    EXPECT_EQ(0, m_rpc->CancelRequest(head.m_session_id));
+    PumpFor(20);
+    EXPECT_EQ(0, cancelled.num);
+}
+
+TEST_F(RpcTest, FailedResponseNotCached) {
+    ASSERT_EQ(0, m_rpc->AddOnRequestFunction("Test:fail", 0, FailRequest));
+    m_rpc->SetResponseCache("Test:fail", 1000);
+
+    for (int i = 0; i < 2; i++) {
+        Response response;
+        ASSERT_EQ(0, Call(MakeHead("Test:fail", 0), "x", &response));
+        WaitResponse(response);
+        EXPECT_EQ(-5, response.ret);
+    }
+    EXPECT_EQ(0, GetResource(m_rpc, ":cache_hit"));
+    EXPECT_EQ(2, GetResource(m_rpc, ":cache_miss"));
+}
+
+namespace {
+
+// 记录经RPC发出的消息帧，用于检查批量合并的结果
+std::vector<std::string> g_frames;
+
+int32_t CountSend(int64_t handle, const uint8_t* buff, uint32_t buff_len, int32_t flag) {
+    g_frames.push_back(std::string(reinterpret_cast<const char*>(buff), buff_len));
+    return Message::Send(handle, buff, buff_len, flag);
+}
+
+int32_t CountSendV(int64_t handle, uint32_t msg_frag_num,
+    const uint8_t* msg_frag[], uint32_t msg_frag_len[], int32_t flag) {
+    std::string frame;
+    for (uint32_t i = 0; i < msg_frag_num; i++) {
+        frame.append(reinterpret_cast<const char*>(msg_frag[i]), msg_frag_len[i]);
+    }
+    g_frames.push_back(frame);
+    return Message::SendV(handle, msg_frag_num, msg_frag, msg_frag_len, flag);
+}
+
+} // namespace
+
+class RpcBatchTest : public RpcTest {
+protected:
+    virtual void SetUp() {
+        RpcTest::SetUp();
+        g_frames.clear();
+        m_rpc->SetSendFunction(CountSend, CountSendV);
+        AddEcho("Test:echo", 0);
+    }
+
+    void SetBatch(uint32_t max_num, uint32_t max_bytes = 64 * 1024) {
+        BatchPolicy policy;
+        policy._max_batch_num   = max_num;
+        policy._max_batch_bytes = max_bytes;
+        m_rpc->SetBatchPolicy(policy);
+    }
+
+    // 直接把消息交给RPC处理，模拟从连接上收到
+    int32_t Deliver(const std::string& frame) {
+        MsgExternInfo msg_info;
+        msg_info._self_handle    = m_handle;
+        msg_info._remote_handle  = m_handle;
+        msg_info._msg_arrived_ms = TimeUtility::GetCurrentMS();
+        return m_rpc->OnMessage(m_handle, reinterpret_cast<const uint8_t*>(frame.data()),
+            frame.size(), &msg_info, kNO_OVERLOAD);
+    }
+};
+
+TEST_F(RpcBatchTest, CallsInOneTickShareOneFrame) {
+    SetBatch(8);
+
+    const int32_t kNUM = 5;
+    std::vector<Response> responses(kNUM);
+    for (int32_t i = 0; i < kNUM; i++) {
+        ASSERT_EQ(0, Call(MakeHead("Test:echo", 0), std::string(1, 'a' + i), &responses[i]));
+    }
+    // 请求缓存到Update时才发送
+    EXPECT_EQ(0u, g_frames.size());
+    m_rpc->Update();
+    EXPECT_EQ(1u, g_frames.size());
+
+    Pump([&responses]() { return responses.back().num > 0; }, 2000);
+    for (int32_t i = 0; i < kNUM; i++) {
+        EXPECT_EQ(1, responses[i].num);
+        EXPECT_EQ(0, responses[i].ret);
+        EXPECT_EQ(std::string(1, 'a' + i), responses[i].data);
+    }
+    EXPECT_EQ(kNUM, m_request_num);
+    // 服务端同步产生的响应也合并为一个消息返回
+    EXPECT_EQ(2u, g_frames.size());
+}
+
+TEST_F(RpcBatchTest, FullBatchFlushedImmediately) {
+    SetBatch(2);
+
+    std::vector<Response> responses(4);
+    for (size_t i = 0; i < responses.size(); i++) {
+        ASSERT_EQ(0, Call(MakeHead("Test:echo", 0), "x", &responses[i]));
+    }
+    EXPECT_EQ(2u, g_frames.size());
+
+    Pump([&responses]() { return responses.back().num > 0; }, 2000);
+    for (size_t i = 0; i < responses.size(); i++) {
+        EXPECT_EQ(0, responses[i].ret);
+    }
+    EXPECT_EQ(4u, g_frames.size());
+}
+
+TEST_F(RpcBatchTest, SingleAndOversizeMessagesSentPlain) {
+    SetBatch(8, 256);
+
+    // 批中只有一个消息时按普通消息发送，和不开启批量时的消息相同
+    Response single;
+    ASSERT_EQ(0, Call(MakeHead("Test:echo", 0), "x", &single));
+    m_rpc->Update();
+    ASSERT_EQ(1u, g_frames.size());
+    WaitResponse(single);
+    EXPECT_EQ(0, single.ret);
+    const std::string batched_single = g_frames[0];
+
+    SetBatch(0);
+    g_frames.clear();
+    RpcHead head = MakeHead("Test:echo", 0);
+    Response plain;
+    ASSERT_EQ(0, Call(head, "x", &plain));
+    ASSERT_EQ(1u, g_frames.size());
+    EXPECT_EQ(batched_single.size(), g_frames[0].size());
+    WaitResponse(plain);
+
+    // 超过批大小的消息不等待直接发送，其他消息仍然合并
+    SetBatch(8, 256);
+    g_frames.clear();
+    Response small1, big, small2;
+    ASSERT_EQ(0, Call(MakeHead("Test:echo", 0), "x", &small1));
+    ASSERT_EQ(0, Call(MakeHead("Test:echo", 0), std::string(1000, 'b'), &big));
+    EXPECT_EQ(1u, g_frames.size());
+    ASSERT_EQ(0, Call(MakeHead("Test:echo", 0), "y", &small2));
+    m_rpc->Update();
+    EXPECT_EQ(2u, g_frames.size());
+
+    Pump([&small1, &big, &small2]() {
+        return small1.num > 0 && big.num > 0 && small2.num > 0; }, 2000);
+    EXPECT_EQ("x", small1.data);
+    EXPECT_EQ(std::string(1000, 'b'), big.data);
+    EXPECT_EQ("y", small2.data);
+}
+
+TEST_F(RpcBatchTest, MalformedBatchRejected) {
+    SetBatch(8);
+
+    const int32_t kNUM = 3;
+    std::vector<Response> responses(kNUM);
+    for (int32_t i = 0; i < kNUM; i++) {
+        ASSERT_EQ(0, Call(MakeHead("Test:echo", 0), "x", &responses[i]));
+    }
+    m_rpc->Update();
+    ASSERT_EQ(1u, g_frames.size());
+    const std::string batch = g_frames[0];
+    Pump([&responses]() { return responses.back().num > 0; }, 2000);
+    ASSERT_EQ(kNUM, m_request_num);
+
+    // 完整的批量消息逐个分发(会话已结束，响应被丢弃)
+    m_request_num = 0;
+    EXPECT_EQ(0, Deliver(batch));
+    EXPECT_EQ(kNUM, m_request_num);
+
+    // 最后一个消息的长度超出剩余数据，之前的消息仍然处理
+    m_request_num = 0;
+    EXPECT_EQ(kRPC_DECODE_FAILED, Deliver(batch.substr(0, batch.size() - 1)));
+    EXPECT_EQ(kNUM - 1, m_request_num);
+
+    // 结尾不足一个长度前缀
+    m_request_num = 0;
+    EXPECT_EQ(kRPC_DECODE_FAILED, Deliver(batch + std::string(2, '\0')));
+    EXPECT_EQ(kNUM, m_request_num);
+    PumpFor(20);
+}
+
+namespace {
+
+// 保存流式请求的会话，由测试代码控制发送中间帧和结束
+struct StreamServer {
+    StreamServer() : session_id(0), num(0) {}
+    uint64_t session_id;
+    int32_t  num;
+    cxx::function<int32_t(int32_t ret, const uint8_t* buff, uint32_t buff_len)> rsp; // NOLINT
+};
+
+int32_t OpenStream(StreamServer* server, const uint8_t* buff, uint32_t buff_len,
+    cxx::function<int32_t(int32_t ret, const uint8_t* buff, uint32_t buff_len)>& rsp) {
+    server->session_id = g_rpc->GetStreamSessionId();
+    server->num++;
+    server->rsp = rsp;
+    return 0;
+}
+
+int32_t OnFrame(std::vector<std::string>* frames, const uint8_t* buff, uint32_t buff_len) {
+    frames->push_back(std::string(reinterpret_cast<const char*>(buff), buff_len));
+    return 0;
+}
+
+} // namespace
+
+class RpcStreamTest : public RpcTest {
+protected:
+    virtual void SetUp() {
+        RpcTest::SetUp();
+        ASSERT_EQ(0, m_rpc->AddOnRequestFunction("Test:stream", 0,
+            cxx::bind(OpenStream, &m_server, cxx::placeholders::_1, cxx::placeholders::_2,
+                cxx::placeholders::_3)));
+    }
+
+    int32_t Open(const RpcHead& head, uint32_t window, int32_t timeout_ms = 1000) {
+        return m_rpc->SendStreamRequest(m_handle, head, NULL, 0,
+            cxx::bind(OnFrame, &m_frames, cxx::placeholders::_1, cxx::placeholders::_2),
+            cxx::bind(OnResponse, &m_end, cxx::placeholders::_1,
+                cxx::placeholders::_2, cxx::placeholders::_3), timeout_ms, window);
+    }
+
+    int32_t Write(const std::string& data) {
+        return m_rpc->SendStreamFrame(m_server.session_id,
+            reinterpret_cast<const uint8_t*>(data.data()), data.size());
+    }
+
+    void WaitFrames(size_t num) {
+        std::vector<std::string>& frames = m_frames;
+        Pump([&frames, num]() { return frames.size() >= num; }, 2000);
+    }
+
+    StreamServer m_server;
+    std::vector<std::string> m_frames;
+    Response m_end;
+};
+
+TEST_F(RpcStreamTest, FramesLimitedByCreditWindow) {
+    const RpcHead head = MakeHead("Test:stream", 0);
+    ASSERT_EQ(0, Open(head, 2));
+    Pump([this]() { return m_server.num > 0; }, 2000);
+    ASSERT_EQ(1, m_server.num);
+
+    // 窗口用完且没有协程可等待时发送失败
+    EXPECT_EQ(0, Write("a"));
+    EXPECT_EQ(0, Write("b"));
+    EXPECT_EQ(kRPC_STREAM_NO_CREDIT, Write("c"));
+    WaitFrames(2);
+    ASSERT_EQ(2u, m_frames.size());
+    EXPECT_EQ("a", m_frames[0]);
+    EXPECT_EQ("b", m_frames[1]);
+
+    // 调用方确认后服务端获得窗口
+    EXPECT_EQ(0, m_rpc->AckStream(head.m_session_id, 2));
+    PumpFor(20);
+    EXPECT_EQ(0, Write("c"));
+    WaitFrames(3);
+    EXPECT_EQ("c", m_frames.back());
+    EXPECT_EQ(0, m_end.num);
+
+    m_server.rsp(0, NULL, 0);
+    WaitResponse(m_end);
+    EXPECT_EQ(1, m_end.num);
+    EXPECT_EQ(0, m_end.ret);
+    EXPECT_EQ(kRPC_SESSION_NOT_FOUND, Write("d"));
+}
+
+TEST_F(RpcStreamTest, AnyReturnCodeFinishesStream) {
+    const RpcHead head = MakeHead("Test:stream", 0);
+    ASSERT_EQ(0, Open(head, 4));
+    Pump([this]() { return m_server.num > 0; }, 2000);
+    EXPECT_EQ(0, Write("a"));
+
+    // rsp的返回码只表示结果，返回码1也结束流式调用
+    m_server.rsp(1, NULL, 0);
+    WaitResponse(m_end);
+    EXPECT_EQ(1, m_end.num);
+    EXPECT_EQ(1, m_end.ret);
+    EXPECT_EQ(1u, m_frames.size());
+    EXPECT_EQ(0, GetResource(m_rpc, ":session"));
+
+    // 普通请求的处理函数拿不到流式会话
+    Response plain;
+    ASSERT_EQ(0, Call(MakeHead("Test:stream", 0), "x", &plain));
+    Pump([this]() { return m_server.num > 1; }, 2000);
+    EXPECT_EQ(kRPC_SESSION_NOT_FOUND, Write("b"));
+    m_server.rsp(0, NULL, 0);
+    WaitResponse(plain);
+    EXPECT_EQ(0, plain.ret);
+    EXPECT_EQ(1u, m_frames.size());
+}
+
+TEST_F(RpcStreamTest, FramesDoNotExtendProcessTimeout) {
+    m_rpc->SetProcRequestTimeoutMS(100);
+    const RpcHead head = MakeHead("Test:stream", 0);
+    ASSERT_EQ(0, Open(head, 64));
+    Pump([this]() { return m_server.num > 0; }, 2000);
+    int64_t start = TimeUtility::GetCurrentMS();
+
+    // 持续发送中间帧和确认也不延长服务端的处理时间
+    int32_t ret = kRPC_SUCCESS;
+    while (kRPC_SUCCESS == ret && TimeUtility::GetCurrentMS() - start < 500) {
+        ret = Write("x");
+        m_rpc->AckStream(head.m_session_id, 1);
+        PumpFor(20);
+    }
+    EXPECT_EQ(kRPC_SESSION_NOT_FOUND, ret);
+    EXPECT_LT(TimeUtility::GetCurrentMS() - start, 300);
+    EXPECT_FALSE(m_frames.empty());
+    m_rpc->CancelRequest(head.m_session_id);
+}
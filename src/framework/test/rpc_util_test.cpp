@@ -0,0 +1,473 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <map>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "common/coroutine.h"
+#include "common/time_utility.h"
+#include "common/timer.h"
+#include "framework/message.h"
+#include "framework/naming.h"
+#include "framework/pebble_rpc.h"
+#include "framework/router.h"
+#include "framework/test/test_util.h"
+#include "gtest/gtest.h"
+
+using namespace pebble;
+using namespace pebble::test;
+
+namespace {
+
+typedef cxx::function<int32_t(int32_t ret, const uint8_t* buff, uint32_t buff_len)> RspFunction;
+
+// 按消息到达的本端handle把消息分给客户端或某个服务端
+std::map<int64_t, IRpc*> g_processors;
+// 模拟消息在某个handle上排队的时间
+std::map<int64_t, int64_t> g_queue_delays;
+// 客户端收到的消息，用于重放迟到的响应
+std::map<int64_t, std::vector<std::string> > g_client_msgs;
+IRpc* g_client = NULL;
+
+int32_t OnMessage(const uint8_t* msg, uint32_t msg_len, MsgExternInfo* msg_info) {
+    std::map<int64_t, IRpc*>::iterator it = g_processors.find(msg_info->_self_handle);
+    if (g_processors.end() == it) {
+        return -1;
+    }
+    if (it->second == g_client) {
+        g_client_msgs[msg_info->_self_handle].push_back(
+            std::string(reinterpret_cast<const char*>(msg), msg_len));
+    }
+    msg_info->_msg_arrived_ms -= g_queue_delays[msg_info->_self_handle];
+    return it->second->OnMessage(msg_info->_remote_handle, msg, msg_len, msg_info, 0);
+}
+
+/// @brief 测试用的服务端，响应数据为"服务端序号:请求数据"，可以设置响应延迟或直接返回错误
+class TestServer {
+public:
+    TestServer() : m_rpc(kCODE_BINARY, NULL), m_index(0), m_delay_ms(0), m_ret(0), m_request_num(0) {}
+
+    void Init(uint32_t index) {
+        m_index = index;
+        m_rpc.SetSendFunction(Message::Send, Message::SendV);
+        m_rpc.AddOnRequestFunction("Test:echo", 0,
+            cxx::bind(&TestServer::OnRequest, this, cxx::placeholders::_1,
+                cxx::placeholders::_2, cxx::placeholders::_3));
+    }
+
+    int32_t OnRequest(const uint8_t* buff, uint32_t buff_len, RspFunction& rsp) {
+        m_request_num++;
+        char prefix[16];
+        snprintf(prefix, sizeof(prefix), "%u:", m_index);
+        Delayed delayed;
+        delayed._due_ms = TimeUtility::GetCurrentMS() + m_delay_ms;
+        delayed._rsp = rsp;
+        delayed._data.assign(prefix);
+        delayed._data.append(reinterpret_cast<const char*>(buff), buff_len);
+        delayed._ret = m_ret;
+        m_delayed.push_back(delayed);
+        Flush();
+        return 0;
+    }
+
+    // 发送到期的响应
+    int32_t Flush() {
+        int32_t num = 0;
+        int64_t now = TimeUtility::GetCurrentMS();
+        for (std::vector<Delayed>::iterator it = m_delayed.begin(); it != m_delayed.end();) {
+            if (it->_due_ms > now) {
+                ++it;
+                continue;
+            }
+            it->_rsp(it->_ret, reinterpret_cast<const uint8_t*>(it->_data.data()), it->_data.size());
+            it = m_delayed.erase(it);
+            num++;
+        }
+        return num + m_rpc.Update();
+    }
+
+    struct Delayed {
+        int64_t _due_ms;
+        RspFunction _rsp;
+        std::string _data;
+        int32_t _ret;
+    };
+
+    PebbleRpc m_rpc;
+    uint32_t m_index;
+    int64_t m_delay_ms;
+    int32_t m_ret;
+    int32_t m_request_num;
+    std::vector<Delayed> m_delayed;
+};
+
+struct CallResult {
+    CallResult() : done(false), ret(0), send_ret(0), cost_ms(0) {}
+    bool done;
+    int32_t ret;
+    int32_t send_ret;
+    int64_t cost_ms;
+    std::string data;
+};
+
+int32_t OnCallResponse(CallResult* result, int32_t ret, const uint8_t* buff, uint32_t buff_len) {
+    result->ret = ret;
+    result->data.assign(reinterpret_cast<const char*>(buff), buff_len);
+    return ret;
+}
+
+/// @brief 一个客户端经Router访问多个服务端，同步调用在协程中发起
+class RpcClusterTest : public ::testing::Test {
+protected:
+    static const uint32_t kSERVER_NUM = 2;
+    static const uint16_t kBASE_PORT = 19901;
+
+    virtual void SetUp() {
+        g_processors.clear();
+        g_queue_delays.clear();
+        g_client_msgs.clear();
+        MessageCallbacks cbs;
+        cbs._on_message = OnMessage;
+        Message::Init(cbs);
+
+        ASSERT_EQ(0, m_schedule.Init(&m_timer));
+        m_client = new PebbleRpc(kCODE_BINARY, &m_schedule);
+        m_client->SetSendFunction(Message::Send, Message::SendV);
+        g_client = m_client;
+
+        std::vector<std::string> urls;
+        for (uint32_t i = 0; i < kSERVER_NUM; i++) {
+            char url[64];
+            snprintf(url, sizeof(url), "tcp://127.0.0.1:%u", kBASE_PORT + i);
+            urls.push_back(url);
+            m_servers[i].Init(i);
+            int64_t listener = Message::Bind(url);
+            ASSERT_GE(listener, 0);
+            m_listeners.push_back(listener);
+            g_processors[listener] = &m_servers[i].m_rpc;
+        }
+
+        m_router = new Router("test.cluster");
+        ASSERT_EQ(0, m_router->Init(&m_naming));
+        m_router->SetOnAddressChanged(cxx::bind(&RpcClusterTest::OnAddressChanged, this,
+            cxx::placeholders::_1));
+        m_naming.SetUrls(urls);
+        ASSERT_EQ(2u, m_handles.size());
+    }
+
+    virtual void TearDown() {
+        delete m_router;
+        for (uint32_t i = 0; i < m_handles.size(); i++) {
+            Message::Close(m_handles[i]);
+            RouteQuality::Remove(m_handles[i]);
+        }
+        for (uint32_t i = 0; i < m_listeners.size(); i++) {
+            Message::Close(m_listeners[i]);
+        }
+        delete m_client;
+        g_client = NULL;
+        g_processors.clear();
+    }
+
+    void OnAddressChanged(const std::vector<int64_t>& handles) {
+        m_handles = handles;
+        for (uint32_t i = 0; i < handles.size(); i++) {
+            g_processors[handles[i]] = m_client;
+        }
+    }
+
+    int32_t Update() {
+        int32_t num = Message::Update() + m_client->Update() + m_timer.Update();
+        for (uint32_t i = 0; i < kSERVER_NUM; i++) {
+            num += m_servers[i].Flush();
+        }
+        return num;
+    }
+
+    template<typename Cond>
+    void Pump(Cond cond, int64_t max_ms) {
+        int64_t end = TimeUtility::GetCurrentMS() + max_ms;
+        while (!cond() && TimeUtility::GetCurrentMS() < end) {
+            if (Update() <= 0) {
+                usleep(500);
+            }
+        }
+    }
+
+    void PumpFor(int64_t ms) {
+        Pump(AlwaysFalse, ms);
+    }
+
+    static bool AlwaysFalse() {
+        return false;
+    }
+
+    // 在协程中调用SendRequestSync，返回后记录结果
+    void CallSync(int64_t handle, const std::string& name, const std::string& data,
+        int32_t timeout_ms, CallResult* result) {
+        RpcHead head;
+        head.m_message_type  = kRPC_CALL;
+        head.m_session_id    = m_client->GenSessionId();
+        head.m_function_name = name;
+        int64_t start_ms = TimeUtility::GetCurrentMS();
+        result->send_ret = m_client->SendRequestSync(handle, head,
+            reinterpret_cast<const uint8_t*>(data.data()), data.size(),
+            cxx::bind(OnCallResponse, result, cxx::placeholders::_1, cxx::placeholders::_2,
+                cxx::placeholders::_3), timeout_ms);
+        result->cost_ms = TimeUtility::GetCurrentMS() - start_ms;
+        result->done = true;
+    }
+
+    void StartCall(int64_t handle, const std::string& data, int32_t timeout_ms, CallResult* result) {
+        CommonCoroutineTask* task = m_schedule.NewTask<CommonCoroutineTask>();
+        task->Init(cxx::bind(&RpcClusterTest::CallSync, this, handle, std::string("Test:echo"),
+            data, timeout_ms, result));
+        task->Start();
+    }
+
+    // 异步调用，不经过RpcUtil
+    int32_t Call(int64_t handle, const std::string& data, int32_t timeout_ms, CallResult* result) {
+        RpcHead head;
+        head.m_message_type  = kRPC_CALL;
+        head.m_session_id    = m_client->GenSessionId();
+        head.m_function_name = "Test:echo";
+        result->cost_ms = TimeUtility::GetCurrentMS();
+        return m_client->SendRequest(handle, head,
+            reinterpret_cast<const uint8_t*>(data.data()), data.size(),
+            cxx::bind(&RpcClusterTest::OnAsyncResponse, result, cxx::placeholders::_1,
+                cxx::placeholders::_2, cxx::placeholders::_3), timeout_ms);
+    }
+
+    static int32_t OnAsyncResponse(CallResult* result, int32_t ret,
+        const uint8_t* buff, uint32_t buff_len) {
+        result->done = true;
+        result->cost_ms = TimeUtility::GetCurrentMS() - result->cost_ms;
+        return OnCallResponse(result, ret, buff, buff_len);
+    }
+
+    int64_t GetSessionNum() {
+        int64_t num = 0;
+        cxx::unordered_map<std::string, int64_t> resource;
+        m_client->GetResourceUsed(&resource);
+        for (cxx::unordered_map<std::string, int64_t>::iterator it = resource.begin();
+            it != resource.end(); ++it) {
+            if (it->first.find(":session") != std::string::npos) {
+                num += it->second;
+            }
+        }
+        return num;
+    }
+
+    void WaitCall(const CallResult& result, int64_t max_ms = 3000) {
+        Pump([&result]() { return result.done; }, max_ms);
+    }
+
+    WheelTimer m_timer;
+    CoroutineSchedule m_schedule;
+    PebbleRpc* m_client;
+    TestServer m_servers[kSERVER_NUM];
+    FakeNaming m_naming;
+    Router* m_router;
+    std::vector<int64_t> m_listeners;
+    std::vector<int64_t> m_handles;
+};
+
+} // namespace
+
+TEST_F(RpcClusterTest, HedgeWinsOverSlowHandle) {
+    HedgePolicy policy;
+    policy._delay_ms = 20;
+    policy._budget_ratio = 1.0;
+    m_client->SetHedgePolicy("Test:echo", policy);
+    m_servers[0].m_delay_ms = 500;
+
+    // 主请求发往慢的服务端，等待20ms后对冲请求发往另一个服务端并先返回
+    CallResult result;
+    StartCall(m_handles[0], "hello", 2000, &result);
+    WaitCall(result);
+    ASSERT_TRUE(result.done);
+    EXPECT_EQ(0, result.ret);
+    EXPECT_EQ("1:hello", result.data);
+    EXPECT_LT(result.cost_ms, 300);
+    EXPECT_EQ(1, m_servers[0].m_request_num);
+    EXPECT_EQ(1, m_servers[1].m_request_num);
+
+    // 落败的请求被取消，迟到的响应被丢弃
+    PumpFor(600);
+    EXPECT_EQ(0, GetSessionNum());
+}
+
+TEST_F(RpcClusterTest, NoHedgeWhenFastOrOutOfBudget) {
+    HedgePolicy policy;
+    policy._delay_ms = 50;
+    policy._budget_ratio = 0.1;
+    m_client->SetHedgePolicy("Test:echo", policy);
+
+    // 主请求在等待时间内返回，不发对冲请求
+    CallResult fast;
+    StartCall(m_handles[0], "a", 2000, &fast);
+    WaitCall(fast);
+    EXPECT_EQ("0:a", fast.data);
+    EXPECT_EQ(0, m_servers[1].m_request_num);
+
+    // 预算不足一个令牌时不对冲，只能等待慢的响应
+    m_servers[0].m_delay_ms = 150;
+    CallResult slow;
+    StartCall(m_handles[0], "b", 2000, &slow);
+    WaitCall(slow);
+    EXPECT_EQ(0, slow.ret);
+    EXPECT_EQ("0:b", slow.data);
+    EXPECT_GE(slow.cost_ms, 140);
+    EXPECT_EQ(0, m_servers[1].m_request_num);
+}
+
+TEST_F(RpcClusterTest, RetryStopsAtOriginalDeadline) {
+    RetryPolicy policy;
+    policy._max_attempts = 5;
+    m_client->SetRetryPolicy("Test:echo", policy);
+    m_servers[0].m_delay_ms = 1000;
+    m_servers[1].m_delay_ms = 1000;
+
+    // 超时发生在原请求的截止时刻，没有剩余时间再重试
+    CallResult result;
+    ASSERT_EQ(0, Call(m_handles[0], "x", 300, &result));
+    WaitCall(result);
+    ASSERT_TRUE(result.done);
+    EXPECT_EQ(kRPC_REQUEST_TIMEOUT, result.ret);
+    EXPECT_LT(result.cost_ms, 450);
+    EXPECT_EQ(1, m_servers[0].m_request_num + m_servers[1].m_request_num);
+    EXPECT_EQ(0, GetSessionNum());
+}
+
+TEST_F(RpcClusterTest, RetryCarriesRemainingBudget) {
+    const int32_t kRETRY_CODE = -12345;
+    RetryPolicy policy;
+    policy._max_attempts = 2;
+    policy._retry_codes.push_back(kRETRY_CODE);
+    m_client->SetRetryPolicy("Test:echo", policy);
+    m_client->SetPropagateTimeout(true);
+    m_servers[0].m_rpc.SetPropagateTimeout(true);
+    m_servers[1].m_rpc.SetPropagateTimeout(true);
+    m_servers[0].m_delay_ms = 200;
+    m_servers[0].m_ret = kRETRY_CODE;
+
+    // 重试请求只携带剩余的约300ms，在服务端排队350ms后已过期，不再处理
+    g_queue_delays[m_listeners[1]] = 350;
+    CallResult result;
+    ASSERT_EQ(0, Call(m_handles[0], "x", 500, &result));
+    WaitCall(result);
+    ASSERT_TRUE(result.done);
+    EXPECT_EQ(kRPC_REQUEST_TIMEOUT, result.ret);
+    EXPECT_LT(result.cost_ms, 650);
+    EXPECT_EQ(1, m_servers[0].m_request_num);
+    EXPECT_EQ(0, m_servers[1].m_request_num);
+
+    // 携带完整超时时间时服务端会处理
+    g_queue_delays[m_listeners[1]] = 0;
+    CallResult retried;
+    ASSERT_EQ(0, Call(m_handles[0], "y", 500, &retried));
+    WaitCall(retried);
+    EXPECT_EQ(0, retried.ret);
+    EXPECT_EQ("1:y", retried.data);
+}
+
+TEST_F(RpcClusterTest, LateReplyOfEarlierAttemptDropped) {
+    const int32_t kRETRY_CODE = -12345;
+    RetryPolicy policy;
+    policy._max_attempts = 2;
+    policy._retry_codes.push_back(kRETRY_CODE);
+    m_client->SetRetryPolicy("Test:echo", policy);
+    m_servers[0].m_ret = kRETRY_CODE;
+    m_servers[1].m_delay_ms = 200;
+
+    CallResult result;
+    ASSERT_EQ(0, Call(m_handles[0], "x", 1000, &result));
+    Pump([this]() { return 1 == m_servers[1].m_request_num; }, 1000);
+    ASSERT_EQ(1, m_servers[1].m_request_num);
+    ASSERT_EQ(1u, g_client_msgs[m_handles[0]].size());
+    EXPECT_FALSE(result.done);
+
+    // 重放第一次尝试的失败响应，已被重试的请求不受影响
+    std::string late = g_client_msgs[m_handles[0]][0];
+    MsgExternInfo msg_info;
+    msg_info._self_handle     = m_handles[0];
+    msg_info._remote_handle   = m_handles[0];
+    msg_info._msg_arrived_ms  = TimeUtility::GetCurrentMS();
+    EXPECT_EQ(kRPC_SESSION_NOT_FOUND, m_client->OnMessage(m_handles[0],
+        reinterpret_cast<const uint8_t*>(late.data()), late.size(), &msg_info, 0));
+    EXPECT_FALSE(result.done);
+
+    WaitCall(result);
+    ASSERT_TRUE(result.done);
+    EXPECT_EQ(0, result.ret);
+    EXPECT_EQ("1:x", result.data);
+    EXPECT_EQ(0, GetSessionNum());
+}
+
+TEST_F(RpcClusterTest, CoalesceSharesInflightRequest) {
+    m_client->SetCoalesce("Test:echo", true);
+    m_servers[0].m_delay_ms = 100;
+
+    // 发往同一handle的相同请求只发送一次
+    CallResult results[3];
+    for (int i = 0; i < 3; i++) {
+        StartCall(m_handles[0], "x", 1000, &results[i]);
+    }
+    // 请求数据或目标不同时不合并
+    CallResult other_data, other_handle;
+    StartCall(m_handles[0], "y", 1000, &other_data);
+    StartCall(m_handles[1], "x", 1000, &other_handle);
+
+    for (int i = 0; i < 3; i++) {
+        WaitCall(results[i]);
+        EXPECT_EQ(0, results[i].ret);
+        EXPECT_EQ("0:x", results[i].data);
+    }
+    WaitCall(other_data);
+    WaitCall(other_handle);
+    EXPECT_EQ("0:y", other_data.data);
+    EXPECT_EQ("1:x", other_handle.data);
+    EXPECT_EQ(2, m_servers[0].m_request_num);
+    EXPECT_EQ(1, m_servers[1].m_request_num);
+}
+
+TEST_F(RpcClusterTest, CoalescedCallsKeepOwnDeadline) {
+    m_client->SetCoalesce("Test:echo", true);
+    m_servers[0].m_delay_ms = 300;
+
+    // 等待方的超时时间短于在途请求时，按自己的超时时间返回
+    CallResult leader, short_waiter;
+    StartCall(m_handles[0], "x", 1000, &leader);
+    StartCall(m_handles[0], "x", 100, &short_waiter);
+    WaitCall(short_waiter);
+    EXPECT_EQ(kRPC_REQUEST_TIMEOUT, short_waiter.ret);
+    EXPECT_LT(short_waiter.cost_ms, 250);
+    WaitCall(leader);
+    EXPECT_EQ("0:x", leader.data);
+    EXPECT_EQ(1, m_servers[0].m_request_num);
+
+    // 在途请求先超时，超时时间更长的等待方重新发起请求
+    CallResult short_leader, long_waiter;
+    StartCall(m_handles[0], "z", 100, &short_leader);
+    StartCall(m_handles[0], "z", 1000, &long_waiter);
+    WaitCall(short_leader);
+    EXPECT_EQ(kRPC_REQUEST_TIMEOUT, short_leader.ret);
+    WaitCall(long_waiter);
+    EXPECT_EQ(0, long_waiter.ret);
+    EXPECT_EQ("0:z", long_waiter.data);
+    EXPECT_GE(long_waiter.cost_ms, 350);
+    EXPECT_EQ(3, m_servers[0].m_request_num);
+}
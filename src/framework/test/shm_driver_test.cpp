@@ -0,0 +1,168 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <map>
+#include <string>
+#include <unistd.h>
+
+#include "framework/message.h"
+#include "framework/shm_driver.h"
+#include "framework/test/test_util.h"
+#include "gtest/gtest.h"
+
+using namespace pebble;
+using namespace pebble::test;
+
+namespace {
+
+const char* kSHM_NAME = "pebble_shm_driver_test";
+
+Received& g_events = GetReceived();
+
+class ShmDriverTest : public DriverTest<ShmDriver> {
+protected:
+    virtual void SetUp() {
+        DriverTest<ShmDriver>::SetUp();
+        ASSERT_EQ(0, m_driver.Init());
+        m_listener = m_driver.Bind(kSHM_NAME);
+        ASSERT_GE(m_listener, 0);
+    }
+
+    virtual void TearDown() {
+        m_driver.Close(m_listener);
+    }
+
+    // 建立连接并等待服务端完成握手，返回服务端的对端handle
+    int64_t Connect(int64_t* client) {
+        size_t connected = g_events.connected.size();
+        *client = m_driver.Connect(kSHM_NAME);
+        EXPECT_GE(*client, 0);
+        WaitUntil([connected]() { return g_events.connected.size() > connected; });
+        EXPECT_EQ(connected + 1, g_events.connected.size());
+        return g_events.connected.empty() ? -1 : g_events.connected.back();
+    }
+
+    int64_t m_listener;
+};
+
+} // namespace
+
+TEST_F(ShmDriverTest, MessagesFlowBothWays) {
+    int64_t client = -1;
+    int64_t peer = Connect(&client);
+    ASSERT_GE(peer, 0);
+    EXPECT_NE(client, peer);
+
+    ASSERT_EQ(0, Send(client, "ping"));
+    UpdateUntil(1);
+    ASSERT_EQ(1u, g_events.msgs.size());
+    EXPECT_EQ("ping", g_events.msgs[0]);
+    EXPECT_EQ(peer, g_events.handles[0]);
+
+    ASSERT_EQ(0, Send(peer, "pong"));
+    UpdateUntil(2);
+    ASSERT_EQ(2u, g_events.msgs.size());
+    EXPECT_EQ("pong", g_events.msgs[1]);
+    EXPECT_EQ(client, g_events.handles[1]);
+
+    // 一端关闭后另一端得到通知
+    m_driver.Close(client);
+    WaitUntil([]() { return !g_events.closed.empty(); });
+    ASSERT_EQ(1u, g_events.closed.size());
+    EXPECT_EQ(peer, g_events.closed[0]);
+    EXPECT_NE(0, Send(peer, "x"));
+}
+
+TEST_F(ShmDriverTest, FullRingRejectsSend) {
+    EXPECT_EQ(kMESSAGE_INVAILD_PARAM, m_driver.SetRingSize(ShmDriver::MIN_RING_SIZE - 1));
+    EXPECT_EQ(kMESSAGE_INVAILD_PARAM, m_driver.SetRingSize(ShmDriver::MAX_RING_SIZE + 1));
+    ASSERT_EQ(0, m_driver.SetRingSize(ShmDriver::MIN_RING_SIZE));
+
+    int64_t client = -1;
+    ASSERT_GE(Connect(&client), 0);
+
+    // 超过队列一半的消息不能发送
+    EXPECT_EQ(kMESSAGE_SEND_BUFF_NOT_ENOUGH, Send(client, std::string(ShmDriver::MIN_RING_SIZE / 2 + 1, 'x')));
+
+    // 对端不取消息时队列写满，不做额外缓存
+    const std::string msg(256, 'm');
+    size_t sent = 0;
+    int32_t ret = 0;
+    for (; sent < 64; sent++) {
+        ret = Send(client, msg);
+        if (ret != 0) {
+            break;
+        }
+    }
+    EXPECT_EQ(kMESSAGE_SEND_BUFF_NOT_ENOUGH, ret);
+    EXPECT_GT(sent, 0u);
+    EXPECT_LT(sent, 64u);
+
+    // 对端取走消息后可以继续发送
+    UpdateUntil(sent);
+    EXPECT_EQ(sent, g_events.msgs.size());
+    EXPECT_EQ(0, Send(client, msg));
+    m_driver.Close(client);
+}
+
+TEST_F(ShmDriverTest, BacklogServedRoundRobin) {
+    int64_t client1 = -1;
+    int64_t client2 = -1;
+    ASSERT_GE(Connect(&client1), 0);
+    ASSERT_GE(Connect(&client2), 0);
+    m_driver.SetDispatchBudget(6, 2);
+
+    const int kNUM = 10;
+    for (int i = 0; i < kNUM; i++) {
+        ASSERT_EQ(0, Send(client1, std::string(1, 'a' + i)));
+        ASSERT_EQ(0, Send(client2, std::string(1, 'A' + i)));
+    }
+
+    // 每次Update递交的消息不超过总配额，其中每个连接不超过单连接配额
+    size_t last = 0;
+    for (int i = 0; i < 1000 && g_events.msgs.size() < 2u * kNUM; i++) {
+        m_driver.Update();
+        ASSERT_LE(g_events.msgs.size() - last, 6u);
+        std::map<int64_t, uint32_t> conn_num;
+        for (size_t j = last; j < g_events.msgs.size(); j++) {
+            EXPECT_LE(++conn_num[g_events.handles[j]], 2u);
+        }
+        last = g_events.msgs.size();
+    }
+    ASSERT_EQ(2u * kNUM, g_events.msgs.size());
+
+    // 各连接的消息保持顺序
+    int num1 = 0, num2 = 0;
+    for (size_t i = 0; i < g_events.msgs.size(); i++) {
+        if (g_events.msgs[i][0] >= 'a') {
+            EXPECT_EQ(std::string(1, 'a' + num1++), g_events.msgs[i]);
+        } else {
+            EXPECT_EQ(std::string(1, 'A' + num2++), g_events.msgs[i]);
+        }
+    }
+    EXPECT_EQ(kNUM, num1);
+    EXPECT_EQ(kNUM, num2);
+    m_driver.Close(client1);
+    m_driver.Close(client2);
+}
+
+TEST(MessageTest, ShmDriverRegisteredOnFirstUse) {
+    Message::Init(RecordCallbacks());
+    EXPECT_FALSE(Message::GetDriverByPrefix("shm"));
+
+    int64_t handle = Message::Bind(std::string("shm://") + kSHM_NAME);
+    ASSERT_GE(handle, 0);
+    ASSERT_TRUE(Message::GetDriverByPrefix("shm"));
+    EXPECT_EQ(Message::GetDriverByPrefix("shm"), Message::GetDriver(handle));
+    Message::Close(handle);
+}
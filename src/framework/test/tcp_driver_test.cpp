@@ -0,0 +1,225 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+
+#include "framework/tcp_driver.h"
+#include "framework/test/test_util.h"
+#include "gtest/gtest.h"
+
+using namespace pebble;
+using namespace pebble::test;
+
+namespace {
+
+const uint16_t kTEST_PORT = 19876;
+
+Received& g_received = GetReceived();
+
+// 消息内容开头的序号
+uint32_t Seq(size_t idx) {
+    uint32_t seq = 0;
+    if (g_received.msgs[idx].size() >= sizeof(seq)) {
+        memcpy(&seq, g_received.msgs[idx].data(), sizeof(seq));
+    }
+    return seq;
+}
+
+// 按TcpDriver的消息格式编码num条消息，消息内容以序号开头
+std::string Encode(uint32_t first_seq, uint32_t num, uint32_t msg_len) {
+    std::string data;
+    for (uint32_t i = 0; i < num; i++) {
+        std::string msg(msg_len, 'x');
+        uint32_t seq = first_seq + i;
+        memcpy(&msg[0], &seq, sizeof(seq));
+        data.append(EncodeTcpMsg(msg));
+    }
+    return data;
+}
+
+// 从data的offset处开始非阻塞写入，返回新的offset
+size_t WriteNonBlock(int fd, const std::string& data, size_t offset) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    while (offset < data.size()) {
+        ssize_t ret = write(fd, data.data() + offset, data.size() - offset);
+        if (ret <= 0) {
+            break;
+        }
+        offset += ret;
+    }
+    return offset;
+}
+
+typedef DriverTest<TcpDriver> TcpDriverTest;
+
+} // namespace
+
+TEST_F(TcpDriverTest, IoQueueFullPausesReading) {
+    ASSERT_EQ(0, m_driver.SetIoThreadNum(1));
+    ASSERT_EQ(0, m_driver.SetIoQueueLen(64 * 1024));
+    ASSERT_EQ(0, m_driver.Init());
+    ASSERT_GE(m_driver.Bind("127.0.0.1:19876"), 0);
+
+    int fd = ConnectTcp(kTEST_PORT);
+    ASSERT_GE(fd, 0);
+
+    // 业务线程不取队列时，I/O线程读到上限后停止读取，发送方最终被内核缓冲区阻塞
+    const uint32_t kMSG_NUM = 64 * 1024;
+    std::string data = Encode(0, kMSG_NUM, 1020);
+    size_t sent = 0;
+    for (int i = 0; i < 200 && sent < data.size(); i++) {
+        sent = WriteNonBlock(fd, data, sent);
+        usleep(5000);
+    }
+    EXPECT_LT(sent, data.size());
+    EXPECT_TRUE(g_received.msgs.empty());
+
+    // 取走队列后I/O线程恢复读取，所有消息按顺序到达
+    for (int i = 0; i < 20000 && g_received.msgs.size() < kMSG_NUM; i++) {
+        if (sent < data.size()) {
+            sent = WriteNonBlock(fd, data, sent);
+        }
+        if (m_driver.Update() <= 0) {
+            usleep(500);
+        }
+    }
+    ASSERT_EQ(kMSG_NUM, g_received.msgs.size());
+    for (uint32_t i = 0; i < kMSG_NUM; i++) {
+        ASSERT_EQ(i, Seq(i));
+    }
+    close(fd);
+}
+
+TEST_F(TcpDriverTest, IoQueueLenMustBeSetBeforeBind) {
+    EXPECT_EQ(kMESSAGE_INVAILD_PARAM, m_driver.SetIoQueueLen(0));
+    ASSERT_EQ(0, m_driver.SetIoThreadNum(1));
+    ASSERT_EQ(0, m_driver.Init());
+    ASSERT_GE(m_driver.Bind("127.0.0.1:19876"), 0);
+    EXPECT_EQ(kMESSAGE_UNSUPPORT, m_driver.SetIoQueueLen(1024));
+}
+
+TEST_F(TcpDriverTest, RecvBuffShrinksOnlyAfterSmallReads) {
+    ASSERT_EQ(0, m_driver.Init());
+    ASSERT_GE(m_driver.Bind("127.0.0.1:19876"), 0);
+
+    int fd = ConnectTcp(kTEST_PORT);
+    ASSERT_GE(fd, 0);
+    const int64_t kINIT_LEN = TcpDriver::RECV_BUFF_INIT_LEN;
+
+    // 大消息使接收缓冲区扩容
+    std::string big = Encode(0, 1, 100 * 1024);
+    ASSERT_EQ(big.size(), WriteNonBlock(fd, big, 0));
+    UpdateUntil(1, 2000);
+    ASSERT_EQ(1u, g_received.msgs.size());
+    int64_t handle = g_received.handles[0];
+    EXPECT_GT(m_driver.GetRecvBuffLen(handle), kINIT_LEN);
+
+    // 缓冲区读空后不立即收缩，连续多次小数据读取后才收缩
+    uint32_t seq = 1;
+    for (uint32_t i = 0; i + 1 < TcpDriver::RECV_BUFF_SHRINK_READS; i++, seq++) {
+        std::string small = Encode(seq, 1, 64);
+        ASSERT_EQ(small.size(), WriteNonBlock(fd, small, 0));
+        UpdateUntil(seq + 1, 2000);
+        ASSERT_EQ(seq + 1, g_received.msgs.size());
+        ASSERT_GT(m_driver.GetRecvBuffLen(handle), kINIT_LEN);
+    }
+
+    std::string small = Encode(seq, 1, 64);
+    ASSERT_EQ(small.size(), WriteNonBlock(fd, small, 0));
+    UpdateUntil(seq + 1, 2000);
+    ASSERT_EQ(seq + 1, g_received.msgs.size());
+    EXPECT_EQ(kINIT_LEN, m_driver.GetRecvBuffLen(handle));
+
+    EXPECT_EQ(kMESSAGE_INVAILD_HANDLE, m_driver.GetRecvBuffLen(-1));
+    close(fd);
+}
+
+TEST_F(TcpDriverTest, DispatchBudgetLimitsEachUpdate) {
+    ASSERT_EQ(0, m_driver.Init());
+    ASSERT_GE(m_driver.Bind("127.0.0.1:19876"), 0);
+    m_driver.SetDispatchBudget(10, 0);
+
+    int fd = ConnectTcp(kTEST_PORT);
+    ASSERT_GE(fd, 0);
+    const uint32_t kMSG_NUM = 35;
+    std::string data = Encode(0, kMSG_NUM, 64);
+    ASSERT_EQ(data.size(), WriteNonBlock(fd, data, 0));
+
+    // 一次读到的消息超出配额时，剩余的消息留到之后的Update处理
+    size_t last = 0;
+    for (int i = 0; i < 2000 && g_received.msgs.size() < kMSG_NUM; i++) {
+        if (m_driver.Update() <= 0) {
+            usleep(1000);
+        }
+        ASSERT_LE(g_received.msgs.size() - last, 10u);
+        last = g_received.msgs.size();
+    }
+    ASSERT_EQ(kMSG_NUM, g_received.msgs.size());
+    for (uint32_t i = 0; i < kMSG_NUM; i++) {
+        EXPECT_EQ(i, Seq(i));
+    }
+    close(fd);
+}
+
+TEST_F(TcpDriverTest, BacklogServedRoundRobin) {
+    ASSERT_EQ(0, m_driver.Init());
+    ASSERT_GE(m_driver.Bind("127.0.0.1:19876"), 0);
+    m_driver.SetDispatchBudget(12, 3);
+
+    int fd1 = ConnectTcp(kTEST_PORT);
+    int fd2 = ConnectTcp(kTEST_PORT);
+    ASSERT_GE(fd1, 0);
+    ASSERT_GE(fd2, 0);
+    for (int i = 0; i < 20; i++) {
+        m_driver.Update();
+        usleep(1000);
+    }
+
+    // 两个连接同时积压消息
+    const uint32_t kMSG_NUM = 30;
+    std::string data1 = Encode(0, kMSG_NUM, 64);
+    std::string data2 = Encode(1000, kMSG_NUM, 64);
+    ASSERT_EQ(data1.size(), WriteNonBlock(fd1, data1, 0));
+    ASSERT_EQ(data2.size(), WriteNonBlock(fd2, data2, 0));
+    usleep(10000);
+
+    size_t last = 0;
+    for (int i = 0; i < 2000 && g_received.msgs.size() < 2 * kMSG_NUM; i++) {
+        if (m_driver.Update() <= 0) {
+            usleep(1000);
+        }
+        ASSERT_LE(g_received.msgs.size() - last, 12u);
+        last = g_received.msgs.size();
+    }
+    ASSERT_EQ(2 * kMSG_NUM, g_received.msgs.size());
+
+    // 两个连接都有积压时，每个连接连续处理的消息数不超过单连接配额
+    uint32_t num1 = 0, num2 = 0, run = 0;
+    for (size_t i = 0; i < g_received.msgs.size() && num1 < kMSG_NUM && num2 < kMSG_NUM; i++) {
+        run = (i > 0 && g_received.handles[i] == g_received.handles[i - 1]) ? run + 1 : 1;
+        EXPECT_LE(run, 3u);
+        if (Seq(i) < 1000) {
+            EXPECT_EQ(num1++, Seq(i));
+        } else {
+            EXPECT_EQ(1000 + num2++, Seq(i));
+        }
+    }
+    EXPECT_GT(num1, 0u);
+    EXPECT_GT(num2, 0u);
+    close(fd1);
+    close(fd2);
+}
@@ -0,0 +1,191 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _PEBBLE_FRAMEWORK_TEST_TEST_UTIL_H_
+#define _PEBBLE_FRAMEWORK_TEST_TEST_UTIL_H_
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "framework/message.h"
+#include "framework/naming.h"
+#include "gtest/gtest.h"
+
+namespace pebble {
+namespace test {
+
+/// @brief driver回调收到的消息和连接事件
+struct Received {
+    std::vector<int64_t> self_handles;
+    std::vector<int64_t> handles;           ///< 消息的对端handle
+    std::vector<std::string> msgs;
+    std::vector<int64_t> connected;
+    std::vector<int64_t> closed;
+    std::vector<std::string> drivers;       ///< 通过AddDriver注册的驱动前缀
+};
+
+inline Received& GetReceived() {
+    static Received received;
+    return received;
+}
+
+inline int32_t RecordMessage(const uint8_t* msg, uint32_t msg_len, MsgExternInfo* msg_info) {
+    GetReceived().self_handles.push_back(msg_info->_self_handle);
+    GetReceived().handles.push_back(msg_info->_remote_handle);
+    GetReceived().msgs.push_back(std::string(reinterpret_cast<const char*>(msg), msg_len));
+    return 0;
+}
+
+inline int32_t RecordPeerConnected(int64_t local_handle, int64_t peer_handle) {
+    GetReceived().connected.push_back(peer_handle);
+    return 0;
+}
+
+inline int32_t RecordPeerClosed(int64_t local_handle, int64_t peer_handle) {
+    GetReceived().closed.push_back(peer_handle);
+    return 0;
+}
+
+inline void RecordDriverAdded(const char* prefix) {
+    GetReceived().drivers.push_back(prefix);
+}
+
+/// @brief 把消息和事件记录到GetReceived()的回调
+inline MessageCallbacks RecordCallbacks() {
+    MessageCallbacks cbs;
+    cbs._on_message        = RecordMessage;
+    cbs._on_peer_connected = RecordPeerConnected;
+    cbs._on_peer_closed    = RecordPeerClosed;
+    cbs._on_driver_added   = RecordDriverAdded;
+    return cbs;
+}
+
+inline int32_t SendString(MessageDriver* driver, int64_t handle, const std::string& msg) {
+    return driver->Send(handle, reinterpret_cast<const uint8_t*>(msg.data()), msg.size(), 0);
+}
+
+/// @brief 反复Update直到共收到msg_num条消息，没有事件时休眠1ms
+inline void UpdateUntil(MessageDriver* driver, size_t msg_num, int max_loop = 2000) {
+    for (int i = 0; i < max_loop && GetReceived().msgs.size() < msg_num; i++) {
+        if (driver->Update() <= 0) {
+            usleep(1000);
+        }
+    }
+}
+
+/// @brief 反复Update直到cond()为true，没有事件时休眠1ms
+template <typename Cond>
+void WaitUntil(MessageDriver* driver, Cond cond, int max_loop = 2000) {
+    for (int i = 0; i < max_loop && !cond(); i++) {
+        if (driver->Update() <= 0) {
+            usleep(1000);
+        }
+    }
+}
+
+/// @brief 按TcpDriver的消息格式编码一条消息
+inline std::string EncodeTcpMsg(const std::string& msg) {
+    uint32_t head[2] = { htonl(0xA5A5A5A5), htonl(msg.size()) };
+    return std::string(reinterpret_cast<const char*>(head), sizeof(head)) + msg;
+}
+
+/// @brief 用阻塞socket连接本机端口，失败返回-1
+inline int ConnectTcp(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/// @brief 每个用例开始时清空记录
+class RecordTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        GetReceived() = Received();
+    }
+};
+
+/// @brief 单个driver的测试夹具，driver的回调已设置为记录回调，由用例自己调用Init
+template <typename Driver>
+class DriverTest : public RecordTest {
+protected:
+    virtual void SetUp() {
+        RecordTest::SetUp();
+        m_driver.SetCallBack(RecordCallbacks());
+    }
+
+    int32_t Send(int64_t handle, const std::string& msg) {
+        return SendString(&m_driver, handle, msg);
+    }
+
+    void UpdateUntil(size_t msg_num, int max_loop = 2000) {
+        test::UpdateUntil(&m_driver, msg_num, max_loop);
+    }
+
+    template <typename Cond>
+    void WaitUntil(Cond cond) {
+        test::WaitUntil(&m_driver, cond);
+    }
+
+    Driver m_driver;
+};
+
+/// @brief 测试用的Naming，地址列表由用例直接设置
+class FakeNaming : public Naming {
+public:
+    virtual int32_t WatchName(const std::string& name, const CbNodeChanged& wc) {
+        m_name = name;
+        m_cb = wc;
+        return 0;
+    }
+
+    virtual int32_t UnWatchName(const std::string& name) {
+        m_cb = CbNodeChanged();
+        return 0;
+    }
+
+    void SetUrls(const std::vector<std::string>& urls) {
+        if (m_cb) {
+            m_cb(m_name, urls);
+        }
+    }
+
+    void SetUrls(const std::string& url1, const std::string& url2 = "") {
+        std::vector<std::string> urls(1, url1);
+        if (!url2.empty()) {
+            urls.push_back(url2);
+        }
+        SetUrls(urls);
+    }
+
+    std::string m_name;
+    CbNodeChanged m_cb;
+};
+
+} // namespace test
+} // namespace pebble
+
+#endif // _PEBBLE_FRAMEWORK_TEST_TEST_UTIL_H_
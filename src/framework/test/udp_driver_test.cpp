@@ -0,0 +1,141 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <string>
+#include <unistd.h>
+
+#include "framework/message.h"
+#include "framework/test/test_util.h"
+#include "framework/udp_driver.h"
+#include "gtest/gtest.h"
+
+using namespace pebble;
+using namespace pebble::test;
+
+namespace {
+
+Received& g_events = GetReceived();
+
+class UdpDriverTest : public DriverTest<UdpDriver> {
+protected:
+    virtual void SetUp() {
+        DriverTest<UdpDriver>::SetUp();
+        ASSERT_EQ(0, m_driver.Init());
+        m_listener = m_driver.Bind("127.0.0.1:19880");
+        ASSERT_GE(m_listener, 0);
+        m_client = m_driver.Connect("127.0.0.1:19880");
+        ASSERT_GE(m_client, 0);
+    }
+
+    int64_t m_listener;
+    int64_t m_client;
+};
+
+} // namespace
+
+TEST_F(UdpDriverTest, PeerAddressMapsToStableHandle) {
+    ASSERT_EQ(0, Send(m_client, "hello"));
+    UpdateUntil(1, 1000);
+    ASSERT_EQ(1u, g_events.msgs.size());
+    EXPECT_EQ("hello", g_events.msgs[0]);
+    EXPECT_EQ(m_listener, g_events.self_handles[0]);
+    int64_t peer = g_events.handles[0];
+    EXPECT_NE(m_listener, peer);
+    EXPECT_NE(m_client, peer);
+    ASSERT_EQ(1u, g_events.connected.size());
+    EXPECT_EQ(peer, g_events.connected[0]);
+
+    // 同一个对端地址的后续报文使用同一个handle，每个报文是一条完整的消息
+    ASSERT_EQ(0, Send(m_client, "again"));
+    UpdateUntil(2, 1000);
+    ASSERT_EQ(2u, g_events.msgs.size());
+    EXPECT_EQ("again", g_events.msgs[1]);
+    EXPECT_EQ(peer, g_events.handles[1]);
+    EXPECT_EQ(1u, g_events.connected.size());
+
+    // 通过对端handle回复
+    ASSERT_EQ(0, Send(peer, "world"));
+    UpdateUntil(3, 1000);
+    ASSERT_EQ(3u, g_events.msgs.size());
+    EXPECT_EQ("world", g_events.msgs[2]);
+    EXPECT_EQ(m_client, g_events.handles[2]);
+}
+
+TEST_F(UdpDriverTest, DispatchBudgetLeavesDatagramsQueued) {
+    m_driver.SetDispatchBudget(5);
+    const int kNUM = 12;
+    for (int i = 0; i < kNUM; i++) {
+        ASSERT_EQ(0, Send(m_client, std::string(1, 'a' + i)));
+    }
+    usleep(10000);
+
+    // 超出配额的报文留在socket缓冲区，之后的Update按顺序继续读取
+    size_t last = 0;
+    for (int i = 0; i < 1000 && g_events.msgs.size() < static_cast<size_t>(kNUM); i++) {
+        m_driver.Update();
+        ASSERT_LE(g_events.msgs.size() - last, 5u);
+        last = g_events.msgs.size();
+    }
+    ASSERT_EQ(static_cast<size_t>(kNUM), g_events.msgs.size());
+    for (int i = 0; i < kNUM; i++) {
+        EXPECT_EQ(std::string(1, 'a' + i), g_events.msgs[i]);
+    }
+}
+
+TEST_F(UdpDriverTest, IdlePeerReclaimed) {
+    m_driver.SetPeerIdleTimeout(50);
+    ASSERT_EQ(0, Send(m_client, "x"));
+    UpdateUntil(1, 1000);
+    ASSERT_EQ(1u, g_events.msgs.size());
+    int64_t peer = g_events.handles[0];
+
+    for (int i = 0; i < 1500 && g_events.closed.empty(); i++) {
+        m_driver.Update();
+        usleep(1000);
+    }
+    ASSERT_EQ(1u, g_events.closed.size());
+    EXPECT_EQ(peer, g_events.closed[0]);
+    EXPECT_NE(0, Send(peer, "y"));
+
+    // 回收后同一地址再发来报文时分配新的handle
+    ASSERT_EQ(0, Send(m_client, "z"));
+    UpdateUntil(2, 1000);
+    ASSERT_EQ(2u, g_events.msgs.size());
+    EXPECT_NE(peer, g_events.handles[1]);
+    EXPECT_EQ(2u, g_events.connected.size());
+}
+
+TEST(MessageTest, UdpDriverRegisteredOnFirstUse) {
+    g_events = Received();
+    Message::Init(RecordCallbacks());
+    EXPECT_FALSE(Message::GetDriverByPrefix("udp"));
+
+    int64_t handle = Message::Bind("udp://127.0.0.1:19881");
+    ASSERT_GE(handle, 0);
+    cxx::shared_ptr<MessageDriver> driver = Message::GetDriverByPrefix("udp");
+    ASSERT_TRUE(driver);
+    EXPECT_EQ(driver, Message::GetDriver(handle));
+    ASSERT_FALSE(g_events.drivers.empty());
+    EXPECT_EQ("udp", g_events.drivers.back());
+    size_t driver_num = g_events.drivers.size();
+
+    // 已注册的驱动不重复注册
+    int64_t client = Message::Connect("udp://127.0.0.1:19881");
+    ASSERT_GE(client, 0);
+    EXPECT_EQ(driver, Message::GetDriver(client));
+    EXPECT_EQ(driver_num, g_events.drivers.size());
+
+    EXPECT_EQ(kMESSAGE_UNINSTALL_DRIVER, Message::Bind("nosuch://127.0.0.1:19881"));
+    Message::Close(client);
+    Message::Close(handle);
+}
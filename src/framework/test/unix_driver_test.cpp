@@ -0,0 +1,155 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "framework/message.h"
+#include "framework/test/test_util.h"
+#include "framework/unix_driver.h"
+#include "gtest/gtest.h"
+
+using namespace pebble;
+using namespace pebble::test;
+
+namespace {
+
+const char* kSOCKET_PATH = "/tmp/pebble_unix_driver_test.sock";
+
+Received& g_received = GetReceived();
+
+class UnixDriverTest : public RecordTest {
+protected:
+    virtual void SetUp() {
+        RecordTest::SetUp();
+        unlink(kSOCKET_PATH);
+    }
+
+    virtual void TearDown() {
+        unlink(kSOCKET_PATH);
+    }
+
+    void InitDriver(UnixDriver* driver) {
+        driver->SetCallBack(RecordCallbacks());
+        ASSERT_EQ(0, driver->Init());
+    }
+
+    // 双向收发一条消息
+    void RoundTrip(UnixDriver* driver, const std::string& address) {
+        int64_t listener = driver->Bind(address);
+        ASSERT_GE(listener, 0);
+        int64_t client = driver->Connect(address);
+        ASSERT_GE(client, 0);
+
+        ASSERT_EQ(0, SendString(driver, client, "ping"));
+        UpdateUntil(driver, 1);
+        ASSERT_EQ(1u, g_received.msgs.size());
+        EXPECT_EQ("ping", g_received.msgs[0]);
+        int64_t peer = g_received.handles[0];
+        EXPECT_NE(client, peer);
+
+        ASSERT_EQ(0, SendString(driver, peer, "pong"));
+        UpdateUntil(driver, 2);
+        ASSERT_EQ(2u, g_received.msgs.size());
+        EXPECT_EQ("pong", g_received.msgs[1]);
+        EXPECT_EQ(client, g_received.handles[1]);
+
+        driver->Close(client);
+        driver->Close(listener);
+    }
+};
+
+} // namespace
+
+TEST_F(UnixDriverTest, StreamSocketRoundTrip) {
+    UnixDriver driver(false);
+    EXPECT_STREQ("unix", driver.Prefix());
+    InitDriver(&driver);
+    RoundTrip(&driver, kSOCKET_PATH);
+}
+
+TEST_F(UnixDriverTest, AbstractNamespaceRoundTrip) {
+    UnixDriver driver(false);
+    InitDriver(&driver);
+    RoundTrip(&driver, "@pebble_unix_driver_test");
+}
+
+TEST_F(UnixDriverTest, SeqpacketKeepsMessageBoundaries) {
+    UnixDriver driver(true);
+    EXPECT_STREQ("unixpacket", driver.Prefix());
+    InitDriver(&driver);
+
+    int64_t listener = driver.Bind(kSOCKET_PATH);
+    ASSERT_GE(listener, 0);
+    int64_t client = driver.Connect(kSOCKET_PATH);
+    ASSERT_GE(client, 0);
+
+    const size_t kNUM = 16;
+    for (size_t i = 0; i < kNUM; i++) {
+        ASSERT_EQ(0, SendString(&driver, client, std::string(1 + i * 100, 'a' + i)));
+    }
+    UpdateUntil(&driver, kNUM);
+    ASSERT_EQ(kNUM, g_received.msgs.size());
+    for (size_t i = 0; i < kNUM; i++) {
+        EXPECT_EQ(std::string(1 + i * 100, 'a' + i), g_received.msgs[i]);
+    }
+    driver.Close(client);
+    driver.Close(listener);
+}
+
+TEST_F(UnixDriverTest, StaleSocketFileReplaced) {
+    // 模拟进程退出后遗留的socket文件
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT_GE(fd, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, kSOCKET_PATH, sizeof(addr.sun_path) - 1);
+    ASSERT_EQ(0, bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)));
+    close(fd);
+
+    UnixDriver driver(false);
+    InitDriver(&driver);
+    int64_t listener = driver.Bind(kSOCKET_PATH);
+    ASSERT_GE(listener, 0);
+
+    // 仍在监听的socket文件不会被删除
+    UnixDriver other(false);
+    InitDriver(&other);
+    EXPECT_LT(other.Bind(kSOCKET_PATH), 0);
+    driver.Close(listener);
+}
+
+TEST_F(UnixDriverTest, InvalidPathRejected) {
+    UnixDriver driver(false);
+    InitDriver(&driver);
+    EXPECT_LT(driver.Bind(""), 0);
+    EXPECT_LT(driver.Bind("@"), 0);
+    EXPECT_LT(driver.Bind(std::string(sizeof(((struct sockaddr_un*)0)->sun_path), 'x')), 0);
+}
+
+TEST(MessageTest, UnixDriversRegisteredOnFirstUse) {
+    Message::Init(RecordCallbacks());
+    EXPECT_FALSE(Message::GetDriverByPrefix("unix"));
+    EXPECT_FALSE(Message::GetDriverByPrefix("unixpacket"));
+
+    int64_t handle = Message::Bind("unix://@pebble_unix_driver_test");
+    ASSERT_GE(handle, 0);
+    ASSERT_TRUE(Message::GetDriverByPrefix("unix"));
+    EXPECT_EQ(Message::GetDriverByPrefix("unix"), Message::GetDriver(handle));
+    EXPECT_FALSE(Message::GetDriverByPrefix("unixpacket"));
+    Message::Close(handle);
+}
@@ -0,0 +1,167 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <algorithm>
+#include <string>
+#include <unistd.h>
+
+#include "framework/message.h"
+#include "framework/test/test_util.h"
+#include "framework/uring_driver.h"
+#include "gtest/gtest.h"
+
+using namespace pebble;
+using namespace pebble::test;
+
+// io_uring不可用时driver回退到libev，下面的用例不依赖具体使用哪种方式，在两种模式下都应通过
+
+namespace {
+
+const uint16_t kTEST_PORT = 19890;
+
+Received& g_events = GetReceived();
+
+class UringDriverTest : public DriverTest<UringDriver> {
+protected:
+    virtual void SetUp() {
+        DriverTest<UringDriver>::SetUp();
+        ASSERT_EQ(0, m_driver.Init());
+    }
+};
+
+} // namespace
+
+TEST_F(UringDriverTest, RingCreatedOnFirstBind) {
+    EXPECT_STREQ("uring", m_driver.Prefix());
+    EXPECT_FALSE(m_driver.IsUringEnabled());
+    EXPECT_EQ(0, m_driver.Update());
+    EXPECT_EQ(kMESSAGE_INVAILD_HANDLE, Send(1, "x"));
+    EXPECT_EQ(kMESSAGE_INVAILD_HANDLE, m_driver.Close(1));
+
+    int64_t listener = m_driver.Bind("127.0.0.1:19890");
+    ASSERT_GE(listener, 0);
+    m_driver.Close(listener);
+}
+
+TEST_F(UringDriverTest, MessagesFlowBothWays) {
+    int64_t listener = m_driver.Bind("127.0.0.1:19890");
+    ASSERT_GE(listener, 0);
+    int64_t client = m_driver.Connect("127.0.0.1:19890");
+    ASSERT_GE(client, 0);
+
+    ASSERT_EQ(0, Send(client, "ping"));
+    UpdateUntil(1);
+    ASSERT_EQ(1u, g_events.msgs.size());
+    EXPECT_EQ("ping", g_events.msgs[0]);
+    int64_t peer = g_events.handles[0];
+    EXPECT_NE(client, peer);
+
+    // 超过单个接收缓冲区的消息跨多个缓冲区拼接
+    std::string big(UringDriver::RECV_BUFF_LEN * 3 + 17, 'b');
+    ASSERT_EQ(0, Send(peer, big));
+    UpdateUntil(2);
+    ASSERT_EQ(2u, g_events.msgs.size());
+    EXPECT_EQ(big, g_events.msgs[1]);
+    EXPECT_EQ(client, g_events.handles[1]);
+
+    // 对端关闭后得到通知
+    m_driver.Close(client);
+    WaitUntil([]() { return !g_events.closed.empty(); });
+    ASSERT_EQ(1u, g_events.closed.size());
+    EXPECT_EQ(peer, g_events.closed[0]);
+    m_driver.Close(listener);
+}
+
+TEST_F(UringDriverTest, AcceptsTcpFramesInPieces) {
+    int64_t listener = m_driver.Bind("127.0.0.1:19890");
+    ASSERT_GE(listener, 0);
+    int fd = ConnectTcp(kTEST_PORT);
+    ASSERT_GE(fd, 0);
+
+    // 和tcp://对端使用相同的消息格式，消息头和消息体可能分多次到达
+    std::string data = EncodeTcpMsg("first") + EncodeTcpMsg(std::string(1000, 'm')) + EncodeTcpMsg("last");
+    for (size_t pos = 0; pos < data.size(); pos += 3) {
+        ASSERT_GT(write(fd, data.data() + pos, std::min<size_t>(3, data.size() - pos)), 0);
+        if (pos % 300 == 0) {
+            m_driver.Update();
+        }
+    }
+    UpdateUntil(3);
+    ASSERT_EQ(3u, g_events.msgs.size());
+    EXPECT_EQ("first", g_events.msgs[0]);
+    EXPECT_EQ(std::string(1000, 'm'), g_events.msgs[1]);
+    EXPECT_EQ("last", g_events.msgs[2]);
+    close(fd);
+    m_driver.Close(listener);
+}
+
+TEST_F(UringDriverTest, DispatchBudgetLimitsEachUpdate) {
+    int64_t listener = m_driver.Bind("127.0.0.1:19890");
+    ASSERT_GE(listener, 0);
+    int fd1 = ConnectTcp(kTEST_PORT);
+    int fd2 = ConnectTcp(kTEST_PORT);
+    ASSERT_GE(fd1, 0);
+    ASSERT_GE(fd2, 0);
+    m_driver.SetDispatchBudget(6, 2);
+
+    const int kNUM = 10;
+    std::string data1, data2;
+    for (int i = 0; i < kNUM; i++) {
+        data1 += EncodeTcpMsg(std::string(1, 'a' + i));
+        data2 += EncodeTcpMsg(std::string(1, 'A' + i));
+    }
+    ASSERT_EQ(static_cast<ssize_t>(data1.size()), write(fd1, data1.data(), data1.size()));
+    ASSERT_EQ(static_cast<ssize_t>(data2.size()), write(fd2, data2.data(), data2.size()));
+    usleep(10000);
+
+    // 每次Update递交的消息不超过总配额，两个连接都有积压时每个连接连续递交的消息数不超过单连接配额，
+    // 各连接的消息保持顺序
+    int num1 = 0, num2 = 0;
+    size_t last = 0;
+    for (int i = 0; i < 2000 && g_events.msgs.size() < 2u * kNUM; i++) {
+        if (m_driver.Update() <= 0) {
+            usleep(1000);
+        }
+        ASSERT_LE(g_events.msgs.size() - last, 6u);
+        uint32_t run = 0;
+        for (size_t j = last; j < g_events.msgs.size(); j++) {
+            run = (j > last && g_events.handles[j] == g_events.handles[j - 1]) ? run + 1 : 1;
+            if (num1 < kNUM && num2 < kNUM) {
+                EXPECT_LE(run, 2u);
+            }
+            if (g_events.msgs[j][0] >= 'a') {
+                EXPECT_EQ(std::string(1, 'a' + num1++), g_events.msgs[j]);
+            } else {
+                EXPECT_EQ(std::string(1, 'A' + num2++), g_events.msgs[j]);
+            }
+        }
+        last = g_events.msgs.size();
+    }
+    ASSERT_EQ(2u * kNUM, g_events.msgs.size());
+    EXPECT_EQ(kNUM, num1);
+    EXPECT_EQ(kNUM, num2);
+    close(fd1);
+    close(fd2);
+    m_driver.Close(listener);
+}
+
+TEST(MessageTest, UringDriverRegisteredOnFirstUse) {
+    Message::Init(RecordCallbacks());
+    EXPECT_FALSE(Message::GetDriverByPrefix("uring"));
+
+    int64_t handle = Message::Bind("uring://127.0.0.1:19891");
+    ASSERT_GE(handle, 0);
+    ASSERT_TRUE(Message::GetDriverByPrefix("uring"));
+    EXPECT_EQ(Message::GetDriverByPrefix("uring"), Message::GetDriver(handle));
+    Message::Close(handle);
+}
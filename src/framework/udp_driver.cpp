@@ -0,0 +1,632 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "common/log.h"
+#include "common/time_utility.h"
+#include "framework/udp_driver.h"
+
+
+namespace pebble {
+
+// 每次Update单个socket最多读取的批次数，避免持续的报文洪峰让Update无法返回
+static const uint32_t MAX_RECV_BATCH_PER_UPDATE = 8;
+
+// epoll每次最多返回的事件数
+static const uint32_t MAX_EPOLL_EVENT_NUM = 1024;
+
+// 空闲对端的检查间隔
+static const int64_t CHECK_IDLE_INTERVAL_MS = 1000;
+
+/// @brief Bind或Connect打开的socket
+struct UdpEndpoint {
+	UdpEndpoint() : _handle(-1), _net_addr(INVAILD_NETADDR), _port(0), _connected(false) {}
+
+	int64_t		_handle;
+	NetAddr		_net_addr;
+	std::string	_ip;
+	uint16_t	_port;
+	bool		_connected;		// Connect打开的socket只和固定的对端通信，不再区分对端handle
+	cxx::unordered_map<uint64_t, int64_t> _peers;	// 对端地址 -> 对端handle
+};
+
+/// @brief Bind的socket上的一个对端地址
+struct UdpPeer {
+	UdpPeer() : _local_handle(-1), _addr_key(0), _last_active_ms(0) {
+		memset(&_addr, 0, sizeof(_addr));
+	}
+
+	int64_t		_local_handle;
+	uint64_t	_addr_key;
+	struct sockaddr_in _addr;
+	int64_t		_last_active_ms;
+};
+
+// 和NetIO::RecvFrom返回的远端地址编码一致
+static inline uint64_t AddrKey(const struct sockaddr_in& addr) {
+	return (static_cast<uint64_t>(addr.sin_addr.s_addr) << 32) | addr.sin_port;
+}
+
+UdpDriver::UdpDriver() {
+	m_epoll					= NULL;
+	m_net_io				= NULL;
+	m_proc_num				= 0;
+	m_in_update				= false;
+	m_max_msg_num_per_loop	= 0;
+	m_loop_msg_num			= 0;
+	m_peer_idle_ms			= DEFAULT_PEER_IDLE_MS;
+	m_last_check_idle_ms	= 0;
+	m_recv_buff				= NULL;
+	m_recv_msgs				= NULL;
+	m_recv_iovs				= NULL;
+	m_recv_addrs			= NULL;
+	m_send_buff				= NULL;
+	m_send_buff_used		= 0;
+	m_send_num				= 0;
+	m_send_msgs				= NULL;
+	m_send_iovs				= NULL;
+	m_send_addrs			= NULL;
+	m_send_fds				= NULL;
+}
+
+UdpDriver::~UdpDriver() {
+	m_peers.clear();
+	m_endpoints.clear();
+	m_net_addr_to_handle.clear();
+
+	// NetIO析构时关闭所有socket
+	delete m_net_io;
+	m_net_io = NULL;
+	delete m_epoll;
+	m_epoll = NULL;
+
+	delete [] m_recv_buff;
+	delete [] m_recv_msgs;
+	delete [] m_recv_iovs;
+	delete [] m_recv_addrs;
+	delete [] m_send_buff;
+	delete [] m_send_msgs;
+	delete [] m_send_iovs;
+	delete [] m_send_addrs;
+	delete [] m_send_fds;
+}
+
+int32_t UdpDriver::Init() {
+	// 资源在首次Bind/Connect时才分配，未使用udp时不占用内存
+	return 0;
+}
+
+int32_t UdpDriver::InitNetIO() {
+	if (m_net_io != NULL) {
+		return 0;
+	}
+
+	Epoll* epoll = new Epoll();
+	if (epoll->Init(MAX_EPOLL_EVENT_NUM) != 0) {
+		PLOG_ERROR("epoll init failed: %s", epoll->GetLastError());
+		delete epoll;
+		return kMESSAGE_EPOLL_INIT_FAILED;
+	}
+
+	NetIO* net_io = new NetIO();
+	if (net_io->Init(epoll) != 0) {
+		PLOG_ERROR("netio init failed: %s", net_io->GetLastError());
+		delete net_io;
+		delete epoll;
+		return kMESSAGE_NETIO_INIT_FAILED;
+	}
+
+	m_epoll  = epoll;
+	m_net_io = net_io;
+
+	m_recv_buff  = new char[MAX_BATCH_NUM * MAX_UDP_MSG_LEN];
+	m_recv_msgs  = new struct mmsghdr[MAX_BATCH_NUM];
+	m_recv_iovs  = new struct iovec[MAX_BATCH_NUM];
+	m_recv_addrs = new struct sockaddr_in[MAX_BATCH_NUM];
+	memset(m_recv_msgs, 0, MAX_BATCH_NUM * sizeof(struct mmsghdr));
+	for (uint32_t i = 0; i < MAX_BATCH_NUM; i++) {
+		m_recv_iovs[i].iov_base = m_recv_buff + i * MAX_UDP_MSG_LEN;
+		m_recv_iovs[i].iov_len  = MAX_UDP_MSG_LEN;
+		m_recv_msgs[i].msg_hdr.msg_name   = &m_recv_addrs[i];
+		m_recv_msgs[i].msg_hdr.msg_iov    = &m_recv_iovs[i];
+		m_recv_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	m_send_buff  = new char[MAX_BATCH_NUM * MAX_UDP_MSG_LEN];
+	m_send_msgs  = new struct mmsghdr[MAX_BATCH_NUM];
+	m_send_iovs  = new struct iovec[MAX_BATCH_NUM];
+	m_send_addrs = new struct sockaddr_in[MAX_BATCH_NUM];
+	m_send_fds   = new int[MAX_BATCH_NUM];
+
+	return 0;
+}
+
+int64_t UdpDriver::Bind(const std::string& url) {
+	// get ip port
+	std::string ip;
+	uint16_t port = 0;
+	if (UrlToIpPort(url, &ip, &port) != 0) {
+		return kMESSAGE_INVAILD_PARAM;
+	}
+
+	int32_t ret = InitNetIO();
+	if (ret != 0) {
+		return ret;
+	}
+
+	int64_t handle = GenHandle();
+	if (handle < 0) {
+		PLOG_ERROR("gen handle %ld invalid", handle);
+		return kMESSAGE_SYSTEM_ERROR;
+	}
+
+	NetAddr net_addr = m_net_io->Listen("udp://" + ip, port);
+	if (INVAILD_NETADDR == net_addr) {
+		PLOG_ERROR("bind %s failed: %s", url.c_str(), m_net_io->GetLastError());
+		return kMESSAGE_BIND_ADDR_FAILED;
+	}
+
+	cxx::shared_ptr<UdpEndpoint> endpoint(new UdpEndpoint());
+	endpoint->_handle	= handle;
+	endpoint->_net_addr	= net_addr;
+	endpoint->_ip		= ip;
+	endpoint->_port		= port;
+
+	m_endpoints[handle] = endpoint;
+	m_net_addr_to_handle[net_addr] = handle;
+
+	return handle;
+}
+
+int64_t UdpDriver::Connect(const std::string& url) {
+	// get ip port
+	std::string ip;
+	uint16_t port = 0;
+	if (UrlToIpPort(url, &ip, &port) != 0) {
+		return kMESSAGE_INVAILD_PARAM;
+	}
+
+	int32_t ret = InitNetIO();
+	if (ret != 0) {
+		return ret;
+	}
+
+	int64_t handle = GenHandle();
+	if (handle < 0) {
+		PLOG_ERROR("gen handle %ld invalid", handle);
+		return kMESSAGE_SYSTEM_ERROR;
+	}
+
+	NetAddr net_addr = m_net_io->ConnectPeer("udp://" + ip, port);
+	if (INVAILD_NETADDR == net_addr) {
+		PLOG_ERROR("connect %s failed: %s", url.c_str(), m_net_io->GetLastError());
+		return kMESSAGE_CONNECT_ADDR_FAILED;
+	}
+
+	cxx::shared_ptr<UdpEndpoint> endpoint(new UdpEndpoint());
+	endpoint->_handle	 = handle;
+	endpoint->_net_addr	 = net_addr;
+	endpoint->_ip		 = ip;
+	endpoint->_port		 = port;
+	endpoint->_connected = true;
+
+	m_endpoints[handle] = endpoint;
+	m_net_addr_to_handle[net_addr] = handle;
+
+	return handle;
+}
+
+int32_t UdpDriver::Send(int64_t handle, const uint8_t* msg, uint32_t msg_len, int32_t flag) {
+	const uint8_t* frags[1] = { msg     };
+	uint32_t fragslen[1]    = { msg_len };
+
+	return SendV(handle, 1, frags, fragslen, flag);
+}
+
+int32_t UdpDriver::SendV(int64_t handle, uint32_t msg_frag_num,
+						 const uint8_t* msg_frag[], uint32_t msg_frag_len[], int32_t flag) {
+	if (msg_frag_num > Message::MAX_SENDV_DATA_NUM) {
+		PLOG_ERROR_N_EVERY_SECOND(1, "msg_frag_num %d > MAX_FRAG %d", msg_frag_num, Message::MAX_SENDV_DATA_NUM);
+		return kMESSAGE_SYSTEM_ERROR;
+	}
+
+	uint32_t msg_len = 0;
+	for (uint32_t i = 0; i < msg_frag_num; i++) {
+		msg_len += msg_frag_len[i];
+	}
+	if (msg_len > MAX_UDP_MSG_LEN) {
+		PLOG_ERROR_N_EVERY_SECOND(1, "msg_len %u > MAX_UDP_MSG_LEN %u", msg_len, MAX_UDP_MSG_LEN);
+		return kMESSAGE_SEND_BUFF_NOT_ENOUGH;
+	}
+
+	// Bind的handle上的对端按地址发送，Connect的handle直接发送
+	int64_t local_handle = handle;
+	const struct sockaddr_in* addr = NULL;
+	cxx::unordered_map<int64_t, cxx::shared_ptr<UdpPeer> >::iterator pit = m_peers.find(handle);
+	if (pit != m_peers.end()) {
+		local_handle = pit->second->_local_handle;
+		addr = &(pit->second->_addr);
+	}
+
+	cxx::unordered_map<int64_t, cxx::shared_ptr<UdpEndpoint> >::iterator it = m_endpoints.find(local_handle);
+	if (m_endpoints.end() == it || (NULL == addr && !it->second->_connected)) {
+		return kMESSAGE_INVAILD_HANDLE;
+	}
+
+	int fd = GetSocketFd(it->second.get());
+	if (fd < 0) {
+		return kMESSAGE_SEND_FAILED;
+	}
+	m_proc_num++;
+
+	// Update期间(通常是处理请求时回的响应)先缓存，Update结束时批量发出
+	if (m_in_update) {
+		return CacheMsg(fd, addr, msg_frag_num, msg_frag, msg_frag_len);
+	}
+	return SendMsg(fd, addr, msg_frag_num, msg_frag, msg_frag_len);
+}
+
+int32_t UdpDriver::Close(int64_t handle) {
+	cxx::unordered_map<int64_t, cxx::shared_ptr<UdpPeer> >::iterator pit = m_peers.find(handle);
+	if (pit != m_peers.end()) {
+		cxx::unordered_map<int64_t, cxx::shared_ptr<UdpEndpoint> >::iterator it =
+			m_endpoints.find(pit->second->_local_handle);
+		if (it != m_endpoints.end()) {
+			it->second->_peers.erase(pit->second->_addr_key);
+		}
+		m_peers.erase(pit);
+		return 0;
+	}
+
+	cxx::unordered_map<int64_t, cxx::shared_ptr<UdpEndpoint> >::iterator it = m_endpoints.find(handle);
+	if (m_endpoints.end() == it) {
+		return kMESSAGE_INVAILD_HANDLE;
+	}
+
+	// 缓存中可能有该socket的报文，先发出，避免fd关闭后被复用
+	FlushSend();
+
+	ClosePeers(it->second.get());
+	m_net_addr_to_handle.erase(it->second->_net_addr);
+	m_net_io->Close(it->second->_net_addr);
+	m_endpoints.erase(it);
+	return 0;
+}
+
+int32_t UdpDriver::Update() {
+	m_loop_msg_num = 0;
+
+	if (NULL == m_epoll) {
+		return 0;
+	}
+
+	m_in_update = true;
+
+	m_epoll->Wait(0);
+	uint32_t events = 0;
+	uint64_t data = 0;
+	while (m_epoll->GetEvent(&events, &data) == 0) {
+		cxx::unordered_map<NetAddr, int64_t>::iterator hit = m_net_addr_to_handle.find(data);
+		if (m_net_addr_to_handle.end() == hit) {
+			continue;
+		}
+		int64_t handle = hit->second;
+
+		cxx::unordered_map<int64_t, cxx::shared_ptr<UdpEndpoint> >::iterator it = m_endpoints.find(handle);
+		if (m_endpoints.end() == it) {
+			continue;
+		}
+
+		// 出错的socket已被NetIO关闭，这里重新打开
+		if (GetSocketFd(it->second.get()) < 0) {
+			continue;
+		}
+
+		if (events & EPOLLIN) {
+			RecvBatch(handle);
+		}
+	}
+
+	FlushSend();
+
+	m_in_update = false;
+
+	CloseIdlePeers();
+
+	int num = m_proc_num;
+	m_proc_num = 0;
+	return num;
+}
+
+void UdpDriver::SetDispatchBudget(uint32_t max_msg_num_per_loop) {
+	m_max_msg_num_per_loop = max_msg_num_per_loop;
+}
+
+void UdpDriver::SetPeerIdleTimeout(uint32_t idle_ms) {
+	m_peer_idle_ms = idle_ms;
+}
+
+uint32_t UdpDriver::GetDispatchBudget() const {
+	if (0 == m_max_msg_num_per_loop) {
+		return UINT32_MAX;
+	}
+	return m_loop_msg_num < m_max_msg_num_per_loop ? m_max_msg_num_per_loop - m_loop_msg_num : 0;
+}
+
+void UdpDriver::RecvBatch(int64_t local_handle) {
+	for (uint32_t batch = 0; batch < MAX_RECV_BATCH_PER_UPDATE; batch++) {
+		cxx::unordered_map<int64_t, cxx::shared_ptr<UdpEndpoint> >::iterator it = m_endpoints.find(local_handle);
+		if (m_endpoints.end() == it) {
+			return;
+		}
+		// 回调中可能关闭socket，处理期间保持引用
+		cxx::shared_ptr<UdpEndpoint> endpoint = it->second;
+
+		int fd = GetSocketFd(endpoint.get());
+		if (fd < 0) {
+			return;
+		}
+
+		// 配额用完后报文留在socket接收缓冲区，epoll为水平触发，下次Update继续读取
+		uint32_t num = GetDispatchBudget();
+		if (0 == num) {
+			return;
+		}
+		if (num > MAX_BATCH_NUM) {
+			num = MAX_BATCH_NUM;
+		}
+
+		for (uint32_t i = 0; i < num; i++) {
+			m_recv_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+			m_recv_msgs[i].msg_hdr.msg_flags   = 0;
+			m_recv_msgs[i].msg_len             = 0;
+		}
+
+		int ret = recvmmsg(fd, m_recv_msgs, num, MSG_DONTWAIT, NULL);
+		if (ret < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				PLOG_ERROR_N_EVERY_SECOND(1, "recvmmsg %ld failed %d:%s", local_handle, errno, strerror(errno));
+			}
+			return;
+		}
+
+		int64_t now = TimeUtility::GetCurrentMS();
+		for (int i = 0; i < ret; i++) {
+			m_loop_msg_num++;
+
+			if (m_recv_msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+				PLOG_ERROR_N_EVERY_SECOND(1, "recv truncated msg on %ld", local_handle);
+				continue;
+			}
+			if (0 == m_recv_msgs[i].msg_len) {
+				continue;
+			}
+
+			int64_t remote_handle = local_handle;
+			if (!endpoint->_connected) {
+				remote_handle = GetPeerHandle(endpoint.get(), m_recv_addrs[i]);
+				cxx::unordered_map<int64_t, cxx::shared_ptr<UdpPeer> >::iterator pit = m_peers.find(remote_handle);
+				if (m_peers.end() == pit) {
+					continue;
+				}
+				pit->second->_last_active_ms = now;
+			}
+
+			if (m_cbs._on_message) {
+				MsgExternInfo msg_info;
+				msg_info._self_handle 	 = local_handle;
+				msg_info._remote_handle  = remote_handle;
+				msg_info._msg_arrived_ms = now;
+				m_cbs._on_message(reinterpret_cast<const uint8_t*>(m_recv_iovs[i].iov_base),
+					m_recv_msgs[i].msg_len, &msg_info);
+
+				m_proc_num++;
+			}
+
+			if (m_endpoints.find(local_handle) == m_endpoints.end()) {
+				return;
+			}
+		}
+
+		if (static_cast<uint32_t>(ret) < num) {
+			return;
+		}
+	}
+}
+
+int64_t UdpDriver::GetPeerHandle(UdpEndpoint* endpoint, const struct sockaddr_in& addr) {
+	uint64_t addr_key = AddrKey(addr);
+	cxx::unordered_map<uint64_t, int64_t>::iterator it = endpoint->_peers.find(addr_key);
+	if (it != endpoint->_peers.end()) {
+		return it->second;
+	}
+
+	int64_t peer = GenHandle();
+	if (peer < 0) {
+		PLOG_ERROR("gen handle %ld invalid", peer);
+		return peer;
+	}
+
+	cxx::shared_ptr<UdpPeer> udp_peer(new UdpPeer());
+	udp_peer->_local_handle	= endpoint->_handle;
+	udp_peer->_addr_key		= addr_key;
+	udp_peer->_addr			= addr;
+
+	m_peers[peer] = udp_peer;
+	endpoint->_peers[addr_key] = peer;
+
+	if (m_cbs._on_peer_connected) {
+		m_cbs._on_peer_connected(endpoint->_handle, peer);
+	}
+
+	return peer;
+}
+
+int32_t UdpDriver::SendMsg(int fd, const struct sockaddr_in* addr, uint32_t msg_frag_num,
+						   const uint8_t* msg_frag[], uint32_t msg_frag_len[]) {
+	struct iovec iov[Message::MAX_SENDV_DATA_NUM];
+	for (uint32_t i = 0; i < msg_frag_num; i++) {
+		iov[i].iov_base = const_cast<uint8_t*>(msg_frag[i]);
+		iov[i].iov_len  = msg_frag_len[i];
+	}
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov    = iov;
+	msg.msg_iovlen = msg_frag_num;
+	if (addr != NULL) {
+		msg.msg_name    = const_cast<struct sockaddr_in*>(addr);
+		msg.msg_namelen = sizeof(struct sockaddr_in);
+	}
+
+	ssize_t ret = 0;
+	do {
+		ret = sendmsg(fd, &msg, 0);
+	} while (ret < 0 && EINTR == errno);
+
+	if (ret < 0) {
+		PLOG_ERROR_N_EVERY_SECOND(1, "sendmsg %d failed %d:%s", fd, errno, strerror(errno));
+		return kMESSAGE_SEND_FAILED;
+	}
+	return 0;
+}
+
+int32_t UdpDriver::CacheMsg(int fd, const struct sockaddr_in* addr, uint32_t msg_frag_num,
+							const uint8_t* msg_frag[], uint32_t msg_frag_len[]) {
+	if (m_send_num >= MAX_BATCH_NUM) {
+		FlushSend();
+	}
+
+	// 每个报文不超过MAX_UDP_MSG_LEN，缓存区总能放下MAX_BATCH_NUM个报文
+	char* buff = m_send_buff + m_send_buff_used;
+	uint32_t msg_len = 0;
+	for (uint32_t i = 0; i < msg_frag_num; i++) {
+		memcpy(buff + msg_len, msg_frag[i], msg_frag_len[i]);
+		msg_len += msg_frag_len[i];
+	}
+
+	struct mmsghdr* msg = &m_send_msgs[m_send_num];
+	memset(msg, 0, sizeof(*msg));
+	m_send_iovs[m_send_num].iov_base = buff;
+	m_send_iovs[m_send_num].iov_len  = msg_len;
+	msg->msg_hdr.msg_iov    = &m_send_iovs[m_send_num];
+	msg->msg_hdr.msg_iovlen = 1;
+	if (addr != NULL) {
+		m_send_addrs[m_send_num] = *addr;
+		msg->msg_hdr.msg_name    = &m_send_addrs[m_send_num];
+		msg->msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+	}
+	m_send_fds[m_send_num] = fd;
+
+	m_send_buff_used += msg_len;
+	m_send_num++;
+	return 0;
+}
+
+void UdpDriver::FlushSend() {
+	uint32_t pos = 0;
+	while (pos < m_send_num) {
+		// sendmmsg只能作用于一个socket，连续的同一socket的报文合并为一次调用
+		uint32_t end = pos + 1;
+		while (end < m_send_num && m_send_fds[end] == m_send_fds[pos]) {
+			end++;
+		}
+
+		int ret = sendmmsg(m_send_fds[pos], m_send_msgs + pos, end - pos, 0);
+		if (ret < 0) {
+			if (EINTR == errno) {
+				continue;
+			}
+			// UDP不保证送达，发送失败的报文直接丢弃
+			PLOG_ERROR_N_EVERY_SECOND(1, "sendmmsg %d failed %d:%s", m_send_fds[pos], errno, strerror(errno));
+			pos++;
+			continue;
+		}
+		pos += (ret > 0 ? ret : 1);
+	}
+
+	m_send_num = 0;
+	m_send_buff_used = 0;
+}
+
+void UdpDriver::CloseIdlePeers() {
+	if (0 == m_peer_idle_ms || m_peers.empty()) {
+		return;
+	}
+
+	int64_t now = TimeUtility::GetCurrentMS();
+	if (now - m_last_check_idle_ms < CHECK_IDLE_INTERVAL_MS) {
+		return;
+	}
+	m_last_check_idle_ms = now;
+
+	std::vector<int64_t> idle_peers;
+	for (cxx::unordered_map<int64_t, cxx::shared_ptr<UdpPeer> >::iterator it = m_peers.begin();
+		it != m_peers.end(); ++it) {
+		if (now - it->second->_last_active_ms >= m_peer_idle_ms) {
+			idle_peers.push_back(it->first);
+		}
+	}
+
+	for (std::vector<int64_t>::iterator it = idle_peers.begin(); it != idle_peers.end(); ++it) {
+		cxx::unordered_map<int64_t, cxx::shared_ptr<UdpPeer> >::iterator pit = m_peers.find(*it);
+		if (m_peers.end() == pit) {
+			continue;
+		}
+		int64_t local_handle = pit->second->_local_handle;
+		Close(*it);
+		if (m_cbs._on_peer_closed) {
+			m_cbs._on_peer_closed(local_handle, *it);
+		}
+	}
+}
+
+void UdpDriver::ClosePeers(UdpEndpoint* endpoint) {
+	for (cxx::unordered_map<uint64_t, int64_t>::iterator it = endpoint->_peers.begin();
+		it != endpoint->_peers.end(); ++it) {
+		m_peers.erase(it->second);
+	}
+	endpoint->_peers.clear();
+}
+
+int UdpDriver::GetSocketFd(UdpEndpoint* endpoint) {
+	const SocketInfo* socket_info = m_net_io->GetSocketInfo(endpoint->_net_addr);
+	if (socket_info->_state != 0 && socket_info->_socket_fd >= 0) {
+		return socket_info->_socket_fd;
+	}
+
+	// socket出错(如主动连接收到ICMP不可达)时NetIO会关闭fd，重新打开，handle保持不变
+	m_net_addr_to_handle.erase(endpoint->_net_addr);
+	m_net_io->Close(endpoint->_net_addr);
+
+	std::string ip("udp://" + endpoint->_ip);
+	endpoint->_net_addr = endpoint->_connected ?
+		m_net_io->ConnectPeer(ip, endpoint->_port) : m_net_io->Listen(ip, endpoint->_port);
+	if (INVAILD_NETADDR == endpoint->_net_addr) {
+		PLOG_ERROR_N_EVERY_SECOND(1, "reopen %s:%u failed: %s",
+			endpoint->_ip.c_str(), endpoint->_port, m_net_io->GetLastError());
+		return -1;
+	}
+	m_net_addr_to_handle[endpoint->_net_addr] = endpoint->_handle;
+
+	return m_net_io->GetSocketInfo(endpoint->_net_addr)->_socket_fd;
+}
+
+
+} // namespace pebble
+
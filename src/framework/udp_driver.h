@@ -0,0 +1,137 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _PEBBLE_UDP_DRIVER_H_
+#define _PEBBLE_UDP_DRIVER_H_
+
+#include <vector>
+#include "common/net_util.h"
+#include "framework/message.h"
+
+struct iovec;
+struct mmsghdr;
+struct sockaddr_in;
+
+namespace pebble {
+
+struct UdpEndpoint;
+struct UdpPeer;
+
+
+/// @brief RAW UDP网络驱动，基于NetIO管理socket
+/// @note 一个UDP报文即一条消息，不再附加消息头；Bind的地址上每个对端地址映射为一个稳定的handle，
+///     对端handle在空闲超时后回收并通过_on_peer_closed通知
+/// @note 收包使用recvmmsg批量读取，Update期间产生的发送在Update结束时使用sendmmsg批量发出
+class UdpDriver : public MessageDriver {
+public:
+    UdpDriver();
+    virtual ~UdpDriver();
+
+    // 单个UDP报文的最大长度
+    static const uint32_t MAX_UDP_MSG_LEN = 65507;
+
+    // 每次recvmmsg/sendmmsg最多处理的报文数
+    static const uint32_t MAX_BATCH_NUM = 32;
+
+    // 对端handle默认的空闲回收时间
+    static const uint32_t DEFAULT_PEER_IDLE_MS = 60 * 1000;
+
+    virtual int32_t Init();
+
+    virtual int64_t Bind(const std::string& url);
+
+    virtual int64_t Connect(const std::string& url);
+
+    virtual int32_t Send(int64_t handle, const uint8_t* msg, uint32_t msg_len, int32_t flag);
+
+    virtual int32_t SendV(int64_t handle, uint32_t msg_frag_num,
+                          const uint8_t* msg_frag[], uint32_t msg_frag_len[], int32_t flag);
+
+    virtual int32_t Close(int64_t handle);
+
+    virtual int32_t Update();
+
+    virtual const char* Prefix() const { return "udp"; }
+
+    /// @brief 设置每次Update递交消息的配额，配额用完后未读取的报文留在socket接收缓冲区，下次Update继续处理
+    /// @param max_msg_num_per_loop 每次Update最多递交的消息数，0表示不限制(默认)
+    void SetDispatchBudget(uint32_t max_msg_num_per_loop);
+
+    /// @brief 设置对端handle的空闲回收时间，超过此时间未收到对端消息时回收handle
+    /// @param idle_ms 空闲时间，单位ms，0表示不回收
+    void SetPeerIdleTimeout(uint32_t idle_ms);
+
+private:
+    int32_t InitNetIO();
+
+    /// @brief 本轮剩余的配额，不限制时返回UINT32_MAX
+    uint32_t GetDispatchBudget() const;
+
+    /// @brief 批量读取一个socket上的报文并递交
+    void RecvBatch(int64_t local_handle);
+
+    /// @brief 查找对端地址对应的handle，不存在时分配新的handle
+    int64_t GetPeerHandle(UdpEndpoint* endpoint, const struct sockaddr_in& addr);
+
+    int32_t SendMsg(int fd, const struct sockaddr_in* addr, uint32_t msg_frag_num,
+                    const uint8_t* msg_frag[], uint32_t msg_frag_len[]);
+
+    int32_t CacheMsg(int fd, const struct sockaddr_in* addr, uint32_t msg_frag_num,
+                     const uint8_t* msg_frag[], uint32_t msg_frag_len[]);
+
+    /// @brief 把Update期间缓存的报文批量发出
+    void FlushSend();
+
+    void CloseIdlePeers();
+
+    void ClosePeers(UdpEndpoint* endpoint);
+
+    int GetSocketFd(UdpEndpoint* endpoint);
+
+private:
+    Epoll* m_epoll;
+    NetIO* m_net_io;
+    int m_proc_num;
+    bool m_in_update;
+
+    uint32_t m_max_msg_num_per_loop;
+    uint32_t m_loop_msg_num;                    // 本次Update已递交的消息数
+
+    uint32_t m_peer_idle_ms;
+    int64_t  m_last_check_idle_ms;
+
+    char* m_recv_buff;
+    struct mmsghdr* m_recv_msgs;
+    struct iovec* m_recv_iovs;
+    struct sockaddr_in* m_recv_addrs;
+
+    // Update期间缓存的待发送报文
+    char* m_send_buff;
+    uint32_t m_send_buff_used;
+    uint32_t m_send_num;
+    struct mmsghdr* m_send_msgs;
+    struct iovec* m_send_iovs;
+    struct sockaddr_in* m_send_addrs;
+    int* m_send_fds;
+
+    cxx::unordered_map<int64_t, cxx::shared_ptr<UdpEndpoint> > m_endpoints;
+    cxx::unordered_map<NetAddr, int64_t> m_net_addr_to_handle;
+    cxx::unordered_map<int64_t, cxx::shared_ptr<UdpPeer> > m_peers;
+};
+
+
+} // namespace pebble
+
+#endif // _PEBBLE_UDP_DRIVER_H_
+
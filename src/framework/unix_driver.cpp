@@ -0,0 +1,119 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "common/log.h"
+#include "ev.h"
+#include "framework/unix_driver.h"
+
+
+namespace pebble {
+
+UnixDriver::UnixDriver(bool seqpacket) {
+	m_socket_type = seqpacket ? SOCK_SEQPACKET : SOCK_STREAM;
+}
+
+UnixDriver::~UnixDriver() {
+}
+
+int32_t UnixDriver::Init() {
+	// 使用独立的loop，每个driver的Update只处理自己的连接，配额统计互不影响
+	m_loop = ev_loop_new(EVFLAG_AUTO);
+	if (NULL == m_loop) {
+		PLOG_ERROR("new loop failed");
+		return kMESSAGE_SYSTEM_ERROR;
+	}
+	return TcpDriver::Init();
+}
+
+int64_t UnixDriver::Bind(const std::string& url) {
+	if (!url.empty() && url[0] != '@') {
+		RemoveStaleSocket(url);
+	}
+	return TcpDriver::Bind(url);
+}
+
+int32_t UnixDriver::ParseAddress(const std::string& url, std::string* ip, uint16_t* port) {
+	if (NULL == ip || NULL == port) {
+		return -1;
+	}
+
+	// sun_path需要保留结尾的'\0'，abstract namespace的'@'对应开头的'\0'
+	struct sockaddr_un addr;
+	if (url.empty() || url == "@" || url.size() >= sizeof(addr.sun_path)) {
+		PLOG_ERROR("unix socket path %s is invalid", url.c_str());
+		return -1;
+	}
+
+	ip->assign(url);
+	*port = 0;
+	return 0;
+}
+
+int UnixDriver::CreateSocket(const std::string& ip, uint16_t port,
+	struct sockaddr_storage* addr, socklen_t* addr_len) {
+	struct sockaddr_un* socket_addr = reinterpret_cast<struct sockaddr_un*>(addr);
+	bzero(socket_addr, sizeof(*socket_addr));
+	socket_addr->sun_family = AF_UNIX;
+	if (ip.empty() || ip.size() >= sizeof(socket_addr->sun_path)) {
+		PLOG_ERROR("unix socket path %s is invalid", ip.c_str());
+		return -1;
+	}
+	memcpy(socket_addr->sun_path, ip.data(), ip.size());
+
+	// abstract namespace的地址长度只包含名字本身，不包含结尾的'\0'
+	if ('@' == ip[0]) {
+		socket_addr->sun_path[0] = '\0';
+		*addr_len = offsetof(struct sockaddr_un, sun_path) + ip.size();
+	} else {
+		*addr_len = sizeof(*socket_addr);
+	}
+
+	int fd = socket(AF_UNIX, m_socket_type, 0);
+	if (fd < 0) {
+		PLOG_ERROR("socket failed %d:%s", errno, strerror(errno));
+		return -2;
+	}
+	return fd;
+}
+
+void UnixDriver::RemoveStaleSocket(const std::string& path) {
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0 || !S_ISSOCK(st.st_mode)) {
+		return;
+	}
+
+	struct sockaddr_storage addr;
+	socklen_t addr_len = 0;
+	int fd = CreateSocket(path, 0, &addr, &addr_len);
+	if (fd < 0) {
+		return;
+	}
+
+	// 连接被拒绝说明已经没有进程在监听
+	if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), addr_len) != 0 && ECONNREFUSED == errno) {
+		PLOG_INFO("remove stale unix socket %s", path.c_str());
+		unlink(path.c_str());
+	}
+	close(fd);
+}
+
+
+} // namespace pebble
+
@@ -0,0 +1,63 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _PEBBLE_UNIX_DRIVER_H_
+#define _PEBBLE_UNIX_DRIVER_H_
+
+#include "framework/tcp_driver.h"
+
+
+namespace pebble {
+
+/// @brief Unix domain socket网络驱动，用于同机部署的进程间通信，省去TCP协议栈的开销
+/// @note 复用TcpDriver的连接管理、发送缓存、消息头拆包及配额控制，只替换地址族和socket类型
+/// @note 地址形式：
+///     "unix:///tmp/pebble.sock"        文件系统路径，SOCK_STREAM
+///     "unix://@pebble"                 '@'开头为abstract namespace，不在文件系统中创建文件
+///     "unixpacket:///tmp/pebble.sock"  SOCK_SEQPACKET，每条消息是一个独立的报文，
+///                                      单条消息不能超过socket的发送缓冲区大小
+/// @note 不支持I/O线程模式
+class UnixDriver : public TcpDriver {
+public:
+    /// @param seqpacket false 使用SOCK_STREAM，前缀为"unix"
+    ///                  true  使用SOCK_SEQPACKET，前缀为"unixpacket"
+    explicit UnixDriver(bool seqpacket = false);
+    virtual ~UnixDriver();
+
+    virtual int32_t Init();
+
+    virtual int64_t Bind(const std::string& url);
+
+    virtual const char* Prefix() const { return m_socket_type == SOCK_SEQPACKET ? "unixpacket" : "unix"; }
+
+public:
+    virtual int32_t ParseAddress(const std::string& url, std::string* ip, uint16_t* port);
+
+    virtual int CreateSocket(const std::string& ip, uint16_t port,
+        struct sockaddr_storage* addr, socklen_t* addr_len);
+
+    virtual int SocketType() const { return m_socket_type; }
+
+private:
+    /// @brief 删除之前进程退出后遗留的socket文件，文件仍在被监听时不删除
+    void RemoveStaleSocket(const std::string& path);
+
+    int m_socket_type;
+};
+
+
+} // namespace pebble
+
+#endif // _PEBBLE_UNIX_DRIVER_H_
+
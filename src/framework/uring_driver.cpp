@@ -0,0 +1,1149 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// 编译环境的内核头文件中没有io_uring或版本太低时只编译回退到libev的部分
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_ACCEPT_MULTISHOT) && defined(__NR_io_uring_setup)
+#define PEBBLE_HAS_IO_URING 1
+#endif
+
+#include "common/log.h"
+#include "common/time_utility.h"
+#include "ev.h"
+#include "framework/uring_driver.h"
+
+
+namespace pebble {
+
+static_assert((UringDriver::RECV_BUFF_NUM & (UringDriver::RECV_BUFF_NUM - 1)) == 0
+	&& UringDriver::RECV_BUFF_NUM <= 32768, "RECV_BUFF_NUM must be a power of 2 and at most 32768");
+
+/*
+	io_uring请求的user_data:
+		bit 60-63 : 请求类型
+		bit 52-59 : 连接的重连次数，区分重连前后同一handle上的请求
+		bit 0-51  : handle的序号部分，driver序号由GetHandleMask补回
+*/
+#define URING_OP_SHIFT		60
+#define URING_GEN_SHIFT		52
+#define URING_GEN_MASK		0xFFULL
+#define URING_SEQ_MASK		((1ULL << URING_GEN_SHIFT) - 1)
+
+typedef enum {
+	kURING_OP_ACCEPT	= 1,
+	kURING_OP_RECV		= 2,
+	kURING_OP_SEND		= 3,
+	kURING_OP_CONNECT	= 4,
+	kURING_OP_CANCEL	= 5,
+} UringOpType;
+
+static inline uint64_t MakeUserData(uint32_t op, uint32_t gen, int64_t handle) {
+	return (static_cast<uint64_t>(op) << URING_OP_SHIFT)
+		| ((static_cast<uint64_t>(gen) & URING_GEN_MASK) << URING_GEN_SHIFT)
+		| (static_cast<uint64_t>(handle) & URING_SEQ_MASK);
+}
+
+static inline uint32_t UserDataOp(uint64_t user_data) {
+	return static_cast<uint32_t>(user_data >> URING_OP_SHIFT);
+}
+
+// 已关闭连接的索引，op部分清零
+static inline uint64_t UserDataKey(uint64_t user_data) {
+	return user_data & ((1ULL << URING_OP_SHIFT) - 1);
+}
+
+struct UringListener {
+	UringListener() : _handle(-1), _fd(-1) {}
+
+	int64_t		_handle;
+	int			_fd;
+};
+
+struct UringConnection {
+	UringConnection() : _local_handle(-1), _trans_handle(-1), _gen(0), _fd(-1), _port(0),
+		_addr_len(0), _connected(false), _recv_armed(false), _read_paused(false), _send_inflight(false),
+		_send_marked(false), _pending(false), _closed(false), _inflight(0), _close_seq(0), _send_pos(0) {
+		memset(&_addr, 0, sizeof(_addr));
+	}
+
+	uint64_t UserData(uint32_t op) const { return MakeUserData(op, _gen, _trans_handle); }
+
+	int64_t			_local_handle;
+	int64_t			_trans_handle;
+	uint32_t		_gen;
+	int				_fd;
+	std::string		_ip;
+	uint16_t		_port;
+	struct sockaddr_storage _addr;		// connect请求完成前内核会读取
+	socklen_t		_addr_len;
+	bool			_connected;
+	bool			_recv_armed;		// multishot recv仍在内核中
+	bool			_read_paused;		// 积压过多时取消recv，由内核接收窗口对发送方反压
+	bool			_send_inflight;
+	bool			_send_marked;		// 已在待发送列表中
+	bool			_pending;			// 已在待处理队列中
+	bool			_closed;
+	uint32_t		_inflight;			// 内核中未完成的请求数
+	uint32_t		_close_seq;			// 关闭时递增，用于发现回调中连接被关闭
+	std::string		_recv_buff;			// 未处理的数据
+	std::string		_sending;			// 发送请求使用的数据，请求完成前不能修改
+	size_t			_send_pos;			// _sending中已发送的长度
+	std::string		_appending;			// 发送请求进行期间新增的数据
+};
+
+#ifdef PEBBLE_HAS_IO_URING
+
+static inline unsigned LoadAcquire(const unsigned* ptr) {
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void StoreRelease(unsigned* ptr, unsigned value) {
+	__atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+/// @brief io_uring的提交/完成队列和接收缓冲区环，直接使用系统调用，不依赖liburing
+struct UringContext {
+	UringContext() : _fd(-1), _sq_ptr(MAP_FAILED), _sq_len(0), _cq_ptr(MAP_FAILED), _cq_len(0),
+		_sqes(NULL), _sqes_len(0), _sq_head(NULL), _sq_tail(NULL), _sq_flags(NULL), _sq_mask(0),
+		_sq_entries(0), _sqe_tail(0), _cq_head(NULL), _cq_tail(NULL), _cq_mask(0), _cqes(NULL),
+		_buf_ring(NULL), _buf_ring_len(0), _bufs(NULL), _buf_num(0), _buf_len(0), _buf_tail(0) {}
+
+	~UringContext() {
+		// 先关闭ring，内核取消所有请求后再释放缓冲区
+		if (_fd >= 0) {
+			close(_fd);
+		}
+		if (_sq_ptr != MAP_FAILED) {
+			munmap(_sq_ptr, _sq_len);
+		}
+		if (_cq_ptr != MAP_FAILED && _cq_ptr != _sq_ptr) {
+			munmap(_cq_ptr, _cq_len);
+		}
+		if (_sqes != NULL) {
+			munmap(_sqes, _sqes_len);
+		}
+		if (_buf_ring != NULL) {
+			munmap(_buf_ring, _buf_ring_len);
+		}
+		if (_bufs != NULL) {
+			munmap(_bufs, static_cast<size_t>(_buf_num) * _buf_len);
+		}
+	}
+
+	int32_t Init(uint32_t entries, uint32_t buf_num, uint32_t buf_len) {
+		struct io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		params.flags = IORING_SETUP_CQSIZE;
+		params.cq_entries = entries * 4;
+		_fd = syscall(__NR_io_uring_setup, entries, &params);
+		if (_fd < 0) {
+			PLOG_INFO("io_uring_setup failed %d:%s", errno, strerror(errno));
+			return -1;
+		}
+		if (!(params.features & IORING_FEAT_NODROP) || !(params.features & IORING_FEAT_FAST_POLL)) {
+			PLOG_INFO("io_uring features %x not enough", params.features);
+			return -1;
+		}
+
+		_sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		_cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		if (params.features & IORING_FEAT_SINGLE_MMAP) {
+			_sq_len = _sq_len > _cq_len ? _sq_len : _cq_len;
+			_cq_len = _sq_len;
+		}
+		_sq_ptr = mmap(NULL, _sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+		if (MAP_FAILED == _sq_ptr) {
+			PLOG_ERROR("mmap sq ring failed %d:%s", errno, strerror(errno));
+			return -1;
+		}
+		if (params.features & IORING_FEAT_SINGLE_MMAP) {
+			_cq_ptr = _sq_ptr;
+		} else {
+			_cq_ptr = mmap(NULL, _cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+			if (MAP_FAILED == _cq_ptr) {
+				PLOG_ERROR("mmap cq ring failed %d:%s", errno, strerror(errno));
+				return -1;
+			}
+		}
+		_sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+		void* sqes = mmap(NULL, _sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+		if (MAP_FAILED == sqes) {
+			PLOG_ERROR("mmap sqes failed %d:%s", errno, strerror(errno));
+			return -1;
+		}
+		_sqes = static_cast<struct io_uring_sqe*>(sqes);
+
+		char* sq = static_cast<char*>(_sq_ptr);
+		_sq_head    = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+		_sq_tail    = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+		_sq_flags   = reinterpret_cast<unsigned*>(sq + params.sq_off.flags);
+		_sq_mask    = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+		_sq_entries = params.sq_entries;
+		_sqe_tail   = *_sq_tail;
+		// sqe和提交队列的位置一一对应
+		unsigned* sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+		for (unsigned i = 0; i < _sq_entries; i++) {
+			sq_array[i] = i;
+		}
+
+		char* cq = static_cast<char*>(_cq_ptr);
+		_cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+		_cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+		_cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+		_cqes    = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+		if (!Probe()) {
+			return -1;
+		}
+		return InitBufRing(buf_num, buf_len);
+	}
+
+	bool Probe() {
+		const int op_num = 256;
+		std::string buff(sizeof(struct io_uring_probe) + op_num * sizeof(struct io_uring_probe_op), '\0');
+		struct io_uring_probe* probe = reinterpret_cast<struct io_uring_probe*>(&buff[0]);
+		if (syscall(__NR_io_uring_register, _fd, IORING_REGISTER_PROBE, probe, op_num) < 0) {
+			PLOG_INFO("io_uring probe failed %d:%s", errno, strerror(errno));
+			return false;
+		}
+
+		const int ops[] = { IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND,
+			IORING_OP_CONNECT, IORING_OP_ASYNC_CANCEL };
+		for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+			if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+				PLOG_INFO("io_uring op %d unsupported", ops[i]);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	int32_t InitBufRing(uint32_t buf_num, uint32_t buf_len) {
+		// 内核要求缓冲区环的大小为2的幂，RecycleBuffer也按此取模
+		if (0 == buf_num || (buf_num & (buf_num - 1)) != 0 || buf_num > 32768) {
+			PLOG_ERROR("buf num %u invalid", buf_num);
+			return -1;
+		}
+		_buf_ring_len = buf_num * sizeof(struct io_uring_buf);
+		void* ring = mmap(NULL, _buf_ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (MAP_FAILED == ring) {
+			PLOG_ERROR("mmap buf ring failed %d:%s", errno, strerror(errno));
+			return -1;
+		}
+		_buf_ring = static_cast<struct io_uring_buf_ring*>(ring);
+
+		struct io_uring_buf_reg reg;
+		memset(&reg, 0, sizeof(reg));
+		reg.ring_addr    = reinterpret_cast<uint64_t>(_buf_ring);
+		reg.ring_entries = buf_num;
+		reg.bgid         = 0;
+		if (syscall(__NR_io_uring_register, _fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+			PLOG_INFO("register buf ring failed %d:%s", errno, strerror(errno));
+			return -1;
+		}
+
+		void* bufs = mmap(NULL, static_cast<size_t>(buf_num) * buf_len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (MAP_FAILED == bufs) {
+			PLOG_ERROR("mmap bufs failed %d:%s", errno, strerror(errno));
+			return -1;
+		}
+		_bufs    = static_cast<uint8_t*>(bufs);
+		_buf_num = buf_num;
+		_buf_len = buf_len;
+		for (uint32_t i = 0; i < buf_num; i++) {
+			RecycleBuffer(static_cast<uint16_t>(i));
+		}
+		return 0;
+	}
+
+	/// @brief 取一个空闲的sqe，提交队列满时先提交已准备的请求
+	struct io_uring_sqe* GetSqe() {
+		if (_sqe_tail - LoadAcquire(_sq_head) >= _sq_entries) {
+			Submit();
+			if (_sqe_tail - LoadAcquire(_sq_head) >= _sq_entries) {
+				PLOG_ERROR("io_uring sq is full");
+				return NULL;
+			}
+		}
+		struct io_uring_sqe* sqe = &_sqes[_sqe_tail & _sq_mask];
+		memset(sqe, 0, sizeof(*sqe));
+		_sqe_tail++;
+		return sqe;
+	}
+
+	int32_t Submit() {
+		unsigned to_submit = _sqe_tail - LoadAcquire(_sq_head);
+		unsigned flags = 0;
+		// 完成队列溢出时由内核暂存，需要进入内核取回
+		if (LoadAcquire(_sq_flags) & IORING_SQ_CQ_OVERFLOW) {
+			flags |= IORING_ENTER_GETEVENTS;
+		}
+		if (0 == to_submit && 0 == flags) {
+			return 0;
+		}
+		StoreRelease(_sq_tail, _sqe_tail);
+		int ret = syscall(__NR_io_uring_enter, _fd, to_submit, 0, flags, NULL, 0);
+		if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+			PLOG_ERROR("io_uring_enter failed %d:%s", errno, strerror(errno));
+		}
+		return ret;
+	}
+
+	bool PeekCqe(uint64_t* user_data, int32_t* res, uint32_t* flags) {
+		unsigned head = *_cq_head;
+		if (head == LoadAcquire(_cq_tail)) {
+			return false;
+		}
+		const struct io_uring_cqe* cqe = &_cqes[head & _cq_mask];
+		*user_data = cqe->user_data;
+		*res       = cqe->res;
+		*flags     = cqe->flags;
+		// 先释放完成队列的位置，处理过程中可能再次进入内核
+		StoreRelease(_cq_head, head + 1);
+		return true;
+	}
+
+	void PrepAccept(int fd, uint64_t user_data) {
+		struct io_uring_sqe* sqe = GetSqe();
+		if (NULL == sqe) {
+			return;
+		}
+		sqe->opcode       = IORING_OP_ACCEPT;
+		sqe->fd           = fd;
+		sqe->ioprio       = IORING_ACCEPT_MULTISHOT;
+		sqe->accept_flags = SOCK_CLOEXEC;
+		sqe->user_data    = user_data;
+	}
+
+	void PrepRecv(int fd, uint64_t user_data) {
+		struct io_uring_sqe* sqe = GetSqe();
+		if (NULL == sqe) {
+			return;
+		}
+		sqe->opcode    = IORING_OP_RECV;
+		sqe->fd        = fd;
+		sqe->ioprio    = IORING_RECV_MULTISHOT;
+		sqe->flags     = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = 0;
+		sqe->user_data = user_data;
+	}
+
+	void PrepSend(int fd, const void* buff, uint32_t len, uint64_t user_data) {
+		struct io_uring_sqe* sqe = GetSqe();
+		if (NULL == sqe) {
+			return;
+		}
+		sqe->opcode    = IORING_OP_SEND;
+		sqe->fd        = fd;
+		sqe->addr      = reinterpret_cast<uint64_t>(buff);
+		sqe->len       = len;
+		sqe->msg_flags = MSG_NOSIGNAL;
+		sqe->user_data = user_data;
+	}
+
+	void PrepConnect(int fd, const struct sockaddr_storage* addr, socklen_t addr_len, uint64_t user_data) {
+		struct io_uring_sqe* sqe = GetSqe();
+		if (NULL == sqe) {
+			return;
+		}
+		sqe->opcode    = IORING_OP_CONNECT;
+		sqe->fd        = fd;
+		sqe->addr      = reinterpret_cast<uint64_t>(addr);
+		sqe->off       = addr_len;
+		sqe->user_data = user_data;
+	}
+
+	void PrepCancel(uint64_t target, uint64_t user_data) {
+		struct io_uring_sqe* sqe = GetSqe();
+		if (NULL == sqe) {
+			return;
+		}
+		sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+		sqe->fd        = -1;
+		sqe->addr      = target;
+		sqe->user_data = user_data;
+	}
+
+	static bool HasMore(uint32_t flags) {
+		return (flags & IORING_CQE_F_MORE) != 0;
+	}
+
+	/// @brief 取完成事件使用的接收缓冲区
+	bool GetBuffer(uint32_t flags, uint16_t* bid) {
+		if (!(flags & IORING_CQE_F_BUFFER)) {
+			return false;
+		}
+		*bid = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+		return true;
+	}
+
+	const uint8_t* BufferAddr(uint16_t bid) const {
+		return _bufs + static_cast<size_t>(bid) * _buf_len;
+	}
+
+	/// @brief 把缓冲区还给内核
+	void RecycleBuffer(uint16_t bid) {
+		// C++中头文件的柔性数组bufs前有一个空结构体，偏移不为0，这里直接按环的起始地址计算
+		struct io_uring_buf* buf = reinterpret_cast<struct io_uring_buf*>(_buf_ring) + (_buf_tail & (_buf_num - 1));
+		buf->addr = reinterpret_cast<uint64_t>(BufferAddr(bid));
+		buf->len  = _buf_len;
+		buf->bid  = bid;
+		_buf_tail++;
+		__atomic_store_n(&_buf_ring->tail, _buf_tail, __ATOMIC_RELEASE);
+	}
+
+	int			_fd;
+	void*		_sq_ptr;
+	size_t		_sq_len;
+	void*		_cq_ptr;
+	size_t		_cq_len;
+	struct io_uring_sqe* _sqes;
+	size_t		_sqes_len;
+
+	unsigned*	_sq_head;
+	unsigned*	_sq_tail;
+	unsigned*	_sq_flags;
+	unsigned	_sq_mask;
+	unsigned	_sq_entries;
+	unsigned	_sqe_tail;		// 已准备的sqe，Submit时才发布给内核
+
+	unsigned*	_cq_head;
+	unsigned*	_cq_tail;
+	unsigned	_cq_mask;
+	struct io_uring_cqe* _cqes;
+
+	struct io_uring_buf_ring* _buf_ring;
+	size_t		_buf_ring_len;
+	uint8_t*	_bufs;
+	uint32_t	_buf_num;
+	uint32_t	_buf_len;
+	uint16_t	_buf_tail;
+};
+
+#else
+
+/// @brief 编译环境不支持io_uring，Init总是失败，driver回退到libev
+struct UringContext {
+	int32_t Init(uint32_t entries, uint32_t buf_num, uint32_t buf_len) {
+		PLOG_INFO("built without io_uring support");
+		return -1;
+	}
+	int32_t Submit() { return 0; }
+	bool PeekCqe(uint64_t* user_data, int32_t* res, uint32_t* flags) { return false; }
+	void PrepAccept(int fd, uint64_t user_data) {}
+	void PrepRecv(int fd, uint64_t user_data) {}
+	void PrepSend(int fd, const void* buff, uint32_t len, uint64_t user_data) {}
+	void PrepConnect(int fd, const struct sockaddr_storage* addr, socklen_t addr_len, uint64_t user_data) {}
+	void PrepCancel(uint64_t target, uint64_t user_data) {}
+	static bool HasMore(uint32_t flags) { return false; }
+	bool GetBuffer(uint32_t flags, uint16_t* bid) { return false; }
+	const uint8_t* BufferAddr(uint16_t bid) const { return NULL; }
+	void RecycleBuffer(uint16_t bid) {}
+};
+
+#endif // PEBBLE_HAS_IO_URING
+
+
+UringDriver::UringDriver() {
+	m_ring			= NULL;
+	m_backend_inited	= false;
+	m_backend_ret		= 0;
+	m_in_update		= false;
+	m_proc_num		= 0;
+}
+
+UringDriver::~UringDriver() {
+	m_uring_pending.clear();
+	m_send_connections.clear();
+
+	for (cxx::unordered_map<int64_t, cxx::shared_ptr<UringListener> >::iterator it = m_uring_listeners.begin();
+		it != m_uring_listeners.end(); ++it) {
+		close(it->second->_fd);
+	}
+	m_uring_listeners.clear();
+
+	for (cxx::unordered_map<int64_t, cxx::shared_ptr<UringConnection> >::iterator it = m_uring_connections.begin();
+		it != m_uring_connections.end(); ++it) {
+		if (it->second->_fd >= 0) {
+			close(it->second->_fd);
+		}
+	}
+
+	// 关闭ring后内核不再访问连接的发送数据，之后才能释放连接
+	delete m_ring;
+	m_ring = NULL;
+
+	m_uring_connections.clear();
+	m_closing_connections.clear();
+}
+
+int32_t UringDriver::Init() {
+	// ring和接收缓冲区占用较多内存，在第一次Bind/Connect时才创建
+	return 0;
+}
+
+int32_t UringDriver::InitBackend() {
+	if (m_backend_inited) {
+		return m_backend_ret;
+	}
+	m_backend_inited = true;
+
+	UringContext* ring = new UringContext();
+	if (ring->Init(QUEUE_DEPTH, RECV_BUFF_NUM, RECV_BUFF_LEN) == 0) {
+		m_ring = ring;
+		PLOG_INFO("uring driver use io_uring");
+		m_backend_ret = 0;
+		return m_backend_ret;
+	}
+	delete ring;
+
+	PLOG_INFO("io_uring unsupported, uring driver fallback to epoll");
+	// 回退时使用独立的loop，避免和tcp driver共用默认loop
+	m_loop = ev_loop_new(EVFLAG_AUTO);
+	if (NULL == m_loop) {
+		PLOG_ERROR("new loop failed");
+		m_backend_ret = kMESSAGE_SYSTEM_ERROR;
+		return m_backend_ret;
+	}
+	m_backend_ret = TcpDriver::Init();
+	return m_backend_ret;
+}
+
+int64_t UringDriver::Bind(const std::string& url) {
+	if (InitBackend() != 0) {
+		return kMESSAGE_SYSTEM_ERROR;
+	}
+	if (NULL == m_ring) {
+		return TcpDriver::Bind(url);
+	}
+
+	std::string ip;
+	uint16_t port = 0;
+	if (ParseAddress(url, &ip, &port) != 0) {
+		return kMESSAGE_INVAILD_PARAM;
+	}
+
+	struct sockaddr_storage addr;
+	socklen_t addr_len = 0;
+	int fd = CreateSocket(ip, port, &addr, &addr_len);
+	if (fd < 0) {
+		return kMESSAGE_BIND_ADDR_FAILED;
+	}
+
+	int flag = 1;
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag)) != 0
+		|| bind(fd, reinterpret_cast<struct sockaddr*>(&addr), addr_len) != 0
+		|| listen(fd, 10240) != 0) {
+		PLOG_ERROR("listen %s failed %d:%s", url.c_str(), errno, strerror(errno));
+		close(fd);
+		return kMESSAGE_BIND_ADDR_FAILED;
+	}
+
+	cxx::shared_ptr<UringListener> listener(new UringListener());
+	listener->_handle = GenHandle();
+	listener->_fd     = fd;
+	m_uring_listeners[listener->_handle] = listener;
+
+	m_ring->PrepAccept(fd, MakeUserData(kURING_OP_ACCEPT, 0, listener->_handle));
+	if (!m_in_update) {
+		m_ring->Submit();
+	}
+	return listener->_handle;
+}
+
+int64_t UringDriver::Connect(const std::string& url) {
+	if (InitBackend() != 0) {
+		return kMESSAGE_SYSTEM_ERROR;
+	}
+	if (NULL == m_ring) {
+		return TcpDriver::Connect(url);
+	}
+
+	cxx::shared_ptr<UringConnection> connection(new UringConnection());
+	if (ParseAddress(url, &connection->_ip, &connection->_port) != 0) {
+		return kMESSAGE_INVAILD_PARAM;
+	}
+
+	int64_t handle = GenHandle();
+	connection->_local_handle = handle;
+	connection->_trans_handle = handle;
+	if (StartConnect(connection) != 0) {
+		return kMESSAGE_CONNECT_ADDR_FAILED;
+	}
+
+	m_uring_connections[handle] = connection;
+	return handle;
+}
+
+int32_t UringDriver::SendRaw(int64_t handle, uint32_t msg_frag_num,
+	const uint8_t* msg_frag[], uint32_t msg_frag_len[]) {
+	if (!m_backend_inited) {
+		return kMESSAGE_INVAILD_HANDLE;
+	}
+	if (NULL == m_ring) {
+		return TcpDriver::SendRaw(handle, msg_frag_num, msg_frag, msg_frag_len);
+	}
+
+	cxx::unordered_map<int64_t, cxx::shared_ptr<UringConnection> >::iterator it = m_uring_connections.find(handle);
+	if (m_uring_connections.end() == it) {
+		return kMESSAGE_INVAILD_HANDLE;
+	}
+	cxx::shared_ptr<UringConnection> connection = it->second;
+
+	// Connect的连接连接失败后，在下次发送时重连
+	if (connection->_fd < 0 && StartConnect(connection) != 0) {
+		return kMESSAGE_CONNECT_ADDR_FAILED;
+	}
+
+	uint32_t msg_len = 0;
+	for (uint32_t i = 0; i < msg_frag_num; i++) {
+		msg_len += msg_frag_len[i];
+	}
+	if (connection->_sending.size() - connection->_send_pos + connection->_appending.size() + msg_len
+		> MAX_SEND_BUFF_LEN) {
+		PLOG_ERROR_N_EVERY_SECOND(1, "%ld's send buff is full", handle);
+		return kMESSAGE_SEND_BUFF_NOT_ENOUGH;
+	}
+
+	for (uint32_t i = 0; i < msg_frag_num; i++) {
+		connection->_appending.append(reinterpret_cast<const char*>(msg_frag[i]), msg_frag_len[i]);
+	}
+	MarkSend(connection.get());
+	m_proc_num++;
+
+	// Update之外的发送立即提交，Update期间的发送在Update结束时一起提交
+	if (!m_in_update) {
+		FlushSend();
+		m_ring->Submit();
+	}
+	return 0;
+}
+
+int32_t UringDriver::Close(int64_t handle) {
+	if (!m_backend_inited) {
+		return kMESSAGE_INVAILD_HANDLE;
+	}
+	if (NULL == m_ring) {
+		return TcpDriver::Close(handle);
+	}
+
+	cxx::unordered_map<int64_t, cxx::shared_ptr<UringListener> >::iterator lit = m_uring_listeners.find(handle);
+	if (lit != m_uring_listeners.end()) {
+		// multishot accept持有socket的引用，需要取消后socket才真正关闭
+		m_ring->PrepCancel(MakeUserData(kURING_OP_ACCEPT, 0, handle), MakeUserData(kURING_OP_CANCEL, 0, handle));
+		close(lit->second->_fd);
+		m_uring_listeners.erase(lit);
+	} else {
+		cxx::unordered_map<int64_t, cxx::shared_ptr<UringConnection> >::iterator it = m_uring_connections.find(handle);
+		if (it != m_uring_connections.end()) {
+			// 可能在该连接的消息回调中关闭，连接对象由调用方持有引用
+			CloseConnection(it->second, false);
+		}
+	}
+
+	if (!m_in_update) {
+		m_ring->Submit();
+	}
+	return 0;
+}
+
+int32_t UringDriver::Update() {
+	// 还没有Bind/Connect过，没有需要处理的事件
+	if (!m_backend_inited || m_backend_ret != 0) {
+		return 0;
+	}
+	if (NULL == m_ring) {
+		return TcpDriver::Update();
+	}
+
+	m_loop_msg_num = 0;
+	m_in_update = true;
+
+	// 上次积压的连接先各处理一轮，再处理新的完成事件，剩余配额继续轮转处理积压的连接
+	DispatchUringPending(true);
+
+	uint64_t user_data = 0;
+	int32_t res = 0;
+	uint32_t flags = 0;
+	while (m_ring->PeekCqe(&user_data, &res, &flags)) {
+		OnCompletion(user_data, res, flags);
+		m_proc_num++;
+	}
+
+	DispatchUringPending(false);
+
+	// 本次Update产生的所有请求一次提交
+	FlushSend();
+	m_ring->Submit();
+
+	m_in_update = false;
+
+	int num = m_proc_num;
+	m_proc_num = 0;
+	return num;
+}
+
+void UringDriver::OnCompletion(uint64_t user_data, int32_t res, uint32_t flags) {
+	uint32_t op = UserDataOp(user_data);
+	if (kURING_OP_ACCEPT == op) {
+		int64_t handle = GetHandleMask() | static_cast<int64_t>(user_data & URING_SEQ_MASK);
+		cxx::unordered_map<int64_t, cxx::shared_ptr<UringListener> >::iterator it = m_uring_listeners.find(handle);
+		if (m_uring_listeners.end() == it) {
+			// 监听已关闭
+			if (res >= 0) {
+				close(res);
+			}
+			return;
+		}
+		OnAccept(it->second.get(), res, flags);
+		return;
+	}
+
+	if (kURING_OP_CANCEL == op) {
+		return;
+	}
+
+	cxx::shared_ptr<UringConnection> connection = FindConnection(user_data);
+	if (kURING_OP_RECV == op) {
+		uint16_t bid = 0;
+		bool has_buff = m_ring->GetBuffer(flags, &bid);
+		if (connection) {
+			OnRecv(connection, res, flags);
+		}
+		if (has_buff) {
+			m_ring->RecycleBuffer(bid);
+		}
+		if (connection && !UringContext::HasMore(flags)) {
+			connection->_recv_armed = false;
+			OpDone(connection.get());
+			// 接收缓冲区用完(-ENOBUFS)等原因结束时重新提交
+			if (!connection->_closed && connection->_connected && !connection->_read_paused) {
+				ArmRecv(connection.get());
+			}
+		}
+		return;
+	}
+
+	if (!connection) {
+		return;
+	}
+	if (kURING_OP_SEND == op) {
+		connection->_send_inflight = false;
+		OpDone(connection.get());
+		OnSend(connection, res);
+	} else if (kURING_OP_CONNECT == op) {
+		OpDone(connection.get());
+		OnConnect(connection, res);
+	}
+}
+
+void UringDriver::OnAccept(UringListener* listener, int32_t res, uint32_t flags) {
+	int64_t listen_handle = listener->_handle;
+	if (!UringContext::HasMore(flags)) {
+		// multishot accept结束(如达到fd上限)，重新提交
+		m_ring->PrepAccept(listener->_fd, MakeUserData(kURING_OP_ACCEPT, 0, listen_handle));
+	}
+	if (res < 0) {
+		PLOG_ERROR_N_EVERY_SECOND(1, "accept failed %d:%s", -res, strerror(-res));
+		return;
+	}
+
+	cxx::shared_ptr<UringConnection> connection(new UringConnection());
+	connection->_local_handle = listen_handle;
+	connection->_trans_handle = GenHandle();
+	connection->_fd           = res;
+	connection->_connected    = true;
+	m_uring_connections[connection->_trans_handle] = connection;
+	ArmRecv(connection.get());
+
+	if (m_cbs._on_peer_connected) {
+		m_cbs._on_peer_connected(listen_handle, connection->_trans_handle);
+	}
+}
+
+void UringDriver::OnRecv(const cxx::shared_ptr<UringConnection>& connection, int32_t res, uint32_t flags) {
+	if (connection->_closed) {
+		return;
+	}
+	if (-ENOBUFS == res || -ECANCELED == res) {
+		return;
+	}
+	if (res <= 0) {
+		// 对端关闭或出错
+		OnError(connection);
+		return;
+	}
+
+	uint16_t bid = 0;
+	if (!m_ring->GetBuffer(flags, &bid)) {
+		return;
+	}
+	const uint8_t* data = m_ring->BufferAddr(bid);
+
+	// 有积压时追加到连接的缓冲区，保证消息顺序
+	if (!connection->_recv_buff.empty()) {
+		connection->_recv_buff.append(reinterpret_cast<const char*>(data), res);
+		if (!connection->_pending) {
+			ProcessRecvBuff(connection);
+		}
+		return;
+	}
+
+	// 完整的消息直接在共享缓冲区中递交，剩余部分拷贝到连接的缓冲区
+	bool budget_exhausted = false;
+	uint32_t close_seq = connection->_close_seq;
+	int32_t proc_len = DispatchMessage(connection.get(), data, res, &budget_exhausted);
+	if (connection->_close_seq != close_seq) {
+		return;
+	}
+	if (proc_len < 0) {
+		OnError(connection);
+		return;
+	}
+	if (proc_len < res) {
+		connection->_recv_buff.assign(reinterpret_cast<const char*>(data) + proc_len, res - proc_len);
+		if (budget_exhausted) {
+			AddPending(connection.get());
+		}
+	}
+}
+
+void UringDriver::OnSend(const cxx::shared_ptr<UringConnection>& connection, int32_t res) {
+	if (connection->_closed) {
+		return;
+	}
+	if (res < 0 && (-EINTR == res || -EAGAIN == res)) {
+		MarkSend(connection.get());
+		return;
+	}
+	if (res <= 0) {
+		PLOG_ERROR_N_EVERY_SECOND(1, "send failed %d:%s", -res, strerror(-res));
+		OnError(connection);
+		return;
+	}
+
+	connection->_send_pos += res;
+	if (connection->_send_pos >= connection->_sending.size()) {
+		connection->_sending.clear();
+		connection->_send_pos = 0;
+	}
+	if (connection->_send_pos > 0 || !connection->_appending.empty()) {
+		MarkSend(connection.get());
+	}
+}
+
+void UringDriver::OnConnect(const cxx::shared_ptr<UringConnection>& connection, int32_t res) {
+	if (connection->_closed) {
+		return;
+	}
+	if (res < 0) {
+		// 连接失败，丢弃待发送数据，下次发送时重连
+		PLOG_ERROR_N_EVERY_SECOND(1, "connect %s:%u failed %d:%s", connection->_ip.c_str(),
+			connection->_port, -res, strerror(-res));
+		close(connection->_fd);
+		connection->_fd = -1;
+		connection->_sending.clear();
+		connection->_send_pos = 0;
+		connection->_appending.clear();
+		return;
+	}
+
+	connection->_connected = true;
+	ArmRecv(connection.get());
+	if (!connection->_appending.empty()) {
+		MarkSend(connection.get());
+	}
+}
+
+cxx::shared_ptr<UringConnection> UringDriver::FindConnection(uint64_t user_data) {
+	int64_t handle = GetHandleMask() | static_cast<int64_t>(user_data & URING_SEQ_MASK);
+	uint32_t gen = static_cast<uint32_t>((user_data >> URING_GEN_SHIFT) & URING_GEN_MASK);
+	cxx::unordered_map<int64_t, cxx::shared_ptr<UringConnection> >::iterator it = m_uring_connections.find(handle);
+	if (it != m_uring_connections.end() && (it->second->_gen & URING_GEN_MASK) == gen) {
+		return it->second;
+	}
+
+	cxx::unordered_map<uint64_t, cxx::shared_ptr<UringConnection> >::iterator cit =
+		m_closing_connections.find(UserDataKey(user_data));
+	if (cit != m_closing_connections.end()) {
+		return cit->second;
+	}
+	return cxx::shared_ptr<UringConnection>();
+}
+
+int32_t UringDriver::StartConnect(const cxx::shared_ptr<UringConnection>& connection) {
+	connection->_fd = CreateSocket(connection->_ip, connection->_port, &connection->_addr, &connection->_addr_len);
+	if (connection->_fd < 0) {
+		return -1;
+	}
+	connection->_connected = false;
+	connection->_inflight++;
+	m_ring->PrepConnect(connection->_fd, &connection->_addr, connection->_addr_len,
+		connection->UserData(kURING_OP_CONNECT));
+	if (!m_in_update) {
+		m_ring->Submit();
+	}
+	return 0;
+}
+
+void UringDriver::ArmRecv(UringConnection* connection) {
+	if (connection->_recv_armed || connection->_fd < 0) {
+		return;
+	}
+	connection->_recv_armed = true;
+	connection->_inflight++;
+	m_ring->PrepRecv(connection->_fd, connection->UserData(kURING_OP_RECV));
+}
+
+void UringDriver::MarkSend(UringConnection* connection) {
+	if (connection->_send_marked) {
+		return;
+	}
+	connection->_send_marked = true;
+	m_send_connections.push_back(connection->_trans_handle);
+}
+
+void UringDriver::FlushSend() {
+	for (std::vector<int64_t>::iterator it = m_send_connections.begin(); it != m_send_connections.end(); ++it) {
+		cxx::unordered_map<int64_t, cxx::shared_ptr<UringConnection> >::iterator cit = m_uring_connections.find(*it);
+		if (m_uring_connections.end() == cit) {
+			continue;
+		}
+
+		UringConnection* connection = cit->second.get();
+		connection->_send_marked = false;
+		// 连接建立或上一个发送请求完成后会重新加入列表
+		if (!connection->_connected || connection->_send_inflight) {
+			continue;
+		}
+		if (connection->_sending.empty()) {
+			connection->_sending.swap(connection->_appending);
+		}
+		if (connection->_sending.empty()) {
+			continue;
+		}
+
+		connection->_send_inflight = true;
+		connection->_inflight++;
+		m_ring->PrepSend(connection->_fd, connection->_sending.data() + connection->_send_pos,
+			connection->_sending.size() - connection->_send_pos, connection->UserData(kURING_OP_SEND));
+	}
+	m_send_connections.clear();
+}
+
+void UringDriver::OpDone(UringConnection* connection) {
+	if (connection->_inflight > 0) {
+		connection->_inflight--;
+	}
+	if (connection->_closed && 0 == connection->_inflight) {
+		m_closing_connections.erase(UserDataKey(connection->UserData(0)));
+	}
+}
+
+void UringDriver::ProcessRecvBuff(const cxx::shared_ptr<UringConnection>& connection) {
+	bool budget_exhausted = false;
+	uint32_t close_seq = connection->_close_seq;
+	int32_t proc_len = DispatchMessage(connection.get(), reinterpret_cast<const uint8_t*>(connection->_recv_buff.data()),
+		connection->_recv_buff.size(), &budget_exhausted);
+	if (connection->_close_seq != close_seq) {
+		return;
+	}
+	if (proc_len < 0) {
+		OnError(connection);
+		return;
+	}
+	connection->_recv_buff.erase(0, proc_len);
+
+	if (budget_exhausted && !connection->_recv_buff.empty()) {
+		AddPending(connection.get());
+		// 积压过多时停止接收，处理完后再恢复
+		if (!connection->_read_paused && connection->_recv_buff.size() > DEFAULT_COMMON_BUFF_LEN) {
+			connection->_read_paused = true;
+			if (connection->_recv_armed) {
+				m_ring->PrepCancel(connection->UserData(kURING_OP_RECV), connection->UserData(kURING_OP_CANCEL));
+			}
+		}
+	} else if (connection->_read_paused) {
+		connection->_read_paused = false;
+		ArmRecv(connection.get());
+	}
+}
+
+int32_t UringDriver::DispatchMessage(UringConnection* connection, const uint8_t* buff, uint32_t buff_len,
+	bool* budget_exhausted) {
+	int32_t proc_len = 0;
+
+	// 单个连接每轮最多处理自己的配额，且不超过本次Update剩余的总配额
+	uint32_t budget = GetDispatchBudget();
+	if (m_max_msg_num_per_conn > 0 && m_max_msg_num_per_conn < budget) {
+		budget = m_max_msg_num_per_conn;
+	}
+	uint32_t close_seq = connection->_close_seq;
+
+	uint32_t num = 0;
+	for (; num < budget; num++) {
+		uint32_t data_len = 0;
+		int head_len = ParseHead(buff, buff_len, &data_len);
+		if (-1 == head_len) {
+			// 消息头不完整
+			break;
+		}
+		if (head_len < 0) {
+			return -1;
+		}
+		if (data_len + head_len > buff_len) {
+			break;
+		}
+		buff += head_len;
+		buff_len -= head_len;
+		if (m_cbs._on_message) {
+			MsgExternInfo msg_info;
+			msg_info._self_handle 	 = connection->_local_handle;
+			msg_info._remote_handle  = connection->_trans_handle;
+			msg_info._msg_arrived_ms = TimeUtility::GetCurrentMS();
+			m_cbs._on_message(buff, data_len, &msg_info);
+
+			m_proc_num++;
+			if (connection->_close_seq != close_seq) {
+				// 回调中连接被关闭，缓冲区已失效
+				m_loop_msg_num++;
+				return proc_len;
+			}
+		}
+		buff += data_len;
+		buff_len -= data_len;
+		proc_len += head_len + data_len;
+		m_loop_msg_num++;
+	}
+
+	*budget_exhausted = (num == budget);
+	return proc_len;
+}
+
+void UringDriver::AddPending(UringConnection* connection) {
+	if (connection->_pending) {
+		return;
+	}
+	connection->_pending = true;
+	m_uring_pending.push_back(connection->_trans_handle);
+}
+
+void UringDriver::DispatchUringPending(bool one_round) {
+	size_t round_num = m_uring_pending.size();
+	while (!m_uring_pending.empty() && GetDispatchBudget() > 0) {
+		if (one_round && 0 == round_num--) {
+			break;
+		}
+
+		int64_t handle = m_uring_pending.front();
+		m_uring_pending.pop_front();
+
+		cxx::unordered_map<int64_t, cxx::shared_ptr<UringConnection> >::iterator it = m_uring_connections.find(handle);
+		if (m_uring_connections.end() == it) {
+			continue;
+		}
+
+		// 回调中可能关闭连接，处理期间保持引用；仍有积压时重新排到队尾
+		cxx::shared_ptr<UringConnection> connection = it->second;
+		connection->_pending = false;
+		ProcessRecvBuff(connection);
+	}
+}
+
+void UringDriver::OnError(const cxx::shared_ptr<UringConnection>& connection) {
+	if (connection->_local_handle != connection->_trans_handle) {
+		CloseConnection(connection, true);
+		return;
+	}
+
+	// 和TcpDriver一致，Connect的连接出错后立即重连，handle保持不变
+	cxx::shared_ptr<UringConnection> reconnection(new UringConnection());
+	reconnection->_local_handle = connection->_local_handle;
+	reconnection->_trans_handle = connection->_trans_handle;
+	reconnection->_gen          = connection->_gen + 1;
+	reconnection->_ip           = connection->_ip;
+	reconnection->_port         = connection->_port;
+	CloseConnection(connection, false);
+
+	m_uring_connections[reconnection->_trans_handle] = reconnection;
+	if (StartConnect(reconnection) != 0) {
+		reconnection->_fd = -1;
+	}
+}
+
+void UringDriver::CloseConnection(const cxx::shared_ptr<UringConnection>& conn, bool notify) {
+	// conn可能就是m_uring_connections中的元素，从map中删除前先持有引用
+	cxx::shared_ptr<UringConnection> connection = conn;
+	if (connection->_closed) {
+		return;
+	}
+	connection->_closed = true;
+	connection->_close_seq++;
+
+	// TcpDriver的发送是立即进行的，这里尽量把还没提交的数据发出去，保持关闭前发送的消息不丢失
+	if (connection->_fd >= 0 && connection->_connected && !connection->_send_inflight) {
+		connection->_sending.erase(0, connection->_send_pos);
+		connection->_sending.append(connection->_appending);
+		if (!connection->_sending.empty()) {
+			send(connection->_fd, connection->_sending.data(), connection->_sending.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+		}
+	}
+
+	// shutdown让内核中的recv/send请求尽快结束，请求结束前socket和发送数据仍被引用
+	if (connection->_fd >= 0) {
+		shutdown(connection->_fd, SHUT_RDWR);
+		close(connection->_fd);
+		connection->_fd = -1;
+	}
+	connection->_recv_buff.clear();
+	connection->_appending.clear();
+
+	cxx::unordered_map<int64_t, cxx::shared_ptr<UringConnection> >::iterator it =
+		m_uring_connections.find(connection->_trans_handle);
+	if (it != m_uring_connections.end() && it->second == connection) {
+		m_uring_connections.erase(it);
+	}
+	if (connection->_inflight > 0) {
+		m_closing_connections[UserDataKey(connection->UserData(0))] = connection;
+	}
+
+	if (!notify) {
+		return;
+	}
+	if (connection->_local_handle == connection->_trans_handle) {
+		if (m_cbs._on_closed) {
+			m_cbs._on_closed(connection->_local_handle);
+		}
+	} else {
+		if (m_cbs._on_peer_closed) {
+			m_cbs._on_peer_closed(connection->_local_handle, connection->_trans_handle);
+		}
+	}
+}
+
+
+} // namespace pebble
+
@@ -0,0 +1,138 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _PEBBLE_URING_DRIVER_H_
+#define _PEBBLE_URING_DRIVER_H_
+
+#include "framework/tcp_driver.h"
+
+
+namespace pebble {
+
+struct UringConnection;
+struct UringContext;
+struct UringListener;
+
+
+/// @brief 基于io_uring的TCP网络驱动，消息格式与TcpDriver一致，可以和tcp://的对端互通
+/// @note 连接数很多时readiness模型每个事件都要一次recv/send系统调用，这里改为:
+///     - 监听socket使用multishot accept，连接使用multishot recv，一次提交持续产生完成事件
+///     - 接收数据放在向内核注册的共享缓冲区环(provided buffer ring)中，所有连接共用，
+///       完整的消息直接在缓冲区中递交，只有不完整的部分才拷贝到连接自己的缓冲区
+///     - Update期间产生的发送请求和重新提交的请求在Update结束时通过一次io_uring_enter批量提交
+/// @note 地址形式："uring://127.0.0.1:8880"
+/// @note ring和接收缓冲区环在第一次Bind/Connect时创建，只注册不使用时不占用资源
+/// @note io_uring_setup失败、不支持provided buffer ring或所需的操作时自动回退到TcpDriver
+///     基于libev(epoll)的实现，可以通过IsUringEnabled查询；io_uring模式下不支持I/O线程
+class UringDriver : public TcpDriver {
+public:
+    UringDriver();
+    virtual ~UringDriver();
+
+    // 提交队列的大小，完成队列为其4倍
+    static const uint32_t QUEUE_DEPTH = 4096;
+
+    // 接收缓冲区环中的缓冲区个数(必须是2的幂)和每个缓冲区的大小
+    static const uint32_t RECV_BUFF_NUM = 1024;
+    static const uint32_t RECV_BUFF_LEN = 1024 * 16;
+
+    // 单个连接待发送数据的上限
+    static const uint32_t MAX_SEND_BUFF_LEN = 1024 * 1024 * 64;
+
+    virtual int32_t Init();
+
+    virtual int64_t Bind(const std::string& url);
+
+    virtual int64_t Connect(const std::string& url);
+
+    virtual int32_t Close(int64_t handle);
+
+    virtual int32_t Update();
+
+    virtual const char* Prefix() const { return "uring"; }
+
+    /// @brief 是否在使用io_uring，false表示已回退到libev或还没有Bind/Connect
+    bool IsUringEnabled() const { return m_ring != NULL; }
+
+protected:
+    virtual int32_t SendRaw(int64_t handle, uint32_t msg_frag_num,
+        const uint8_t* msg_frag[], uint32_t msg_frag_len[]);
+
+private:
+    /// @brief 第一次Bind/Connect时创建io_uring，失败时回退到libev
+    int32_t InitBackend();
+
+    /// @brief 处理一个完成事件
+    void OnCompletion(uint64_t user_data, int32_t res, uint32_t flags);
+
+    void OnAccept(UringListener* listener, int32_t res, uint32_t flags);
+
+    void OnRecv(const cxx::shared_ptr<UringConnection>& connection, int32_t res, uint32_t flags);
+
+    void OnSend(const cxx::shared_ptr<UringConnection>& connection, int32_t res);
+
+    void OnConnect(const cxx::shared_ptr<UringConnection>& connection, int32_t res);
+
+    /// @brief 查找完成事件所属的连接，包括已关闭但仍有请求未完成的连接
+    cxx::shared_ptr<UringConnection> FindConnection(uint64_t user_data);
+
+    int32_t StartConnect(const cxx::shared_ptr<UringConnection>& connection);
+
+    void ArmRecv(UringConnection* connection);
+
+    void MarkSend(UringConnection* connection);
+
+    /// @brief 为有待发送数据且没有发送中请求的连接准备发送请求
+    void FlushSend();
+
+    /// @brief 请求完成，已关闭的连接在所有请求完成后释放
+    void OpDone(UringConnection* connection);
+
+    void ProcessRecvBuff(const cxx::shared_ptr<UringConnection>& connection);
+
+    /// @brief 递交buff中的完整消息
+    /// @return >=0 处理的字节数
+    /// @return <0 消息头非法
+    int32_t DispatchMessage(UringConnection* connection, const uint8_t* buff, uint32_t buff_len,
+        bool* budget_exhausted);
+
+    void AddPending(UringConnection* connection);
+
+    void DispatchUringPending(bool one_round);
+
+    /// @brief 连接出错，Connect的连接重新连接，Bind的连接关闭并通知上层
+    void OnError(const cxx::shared_ptr<UringConnection>& connection);
+
+    void CloseConnection(const cxx::shared_ptr<UringConnection>& connection, bool notify);
+
+private:
+    UringContext* m_ring;
+    bool m_backend_inited;
+    int32_t m_backend_ret;      // InitBackend的结果
+    bool m_in_update;
+    int m_proc_num;
+
+    cxx::unordered_map<int64_t, cxx::shared_ptr<UringListener> > m_uring_listeners;
+    cxx::unordered_map<int64_t, cxx::shared_ptr<UringConnection> > m_uring_connections;
+    // 已关闭但还有请求在内核中的连接，发送中的数据在请求完成前不能释放
+    cxx::unordered_map<uint64_t, cxx::shared_ptr<UringConnection> > m_closing_connections;
+    std::list<int64_t> m_uring_pending;         // 有未处理消息的连接，按轮转顺序排列
+    std::vector<int64_t> m_send_connections;    // 有待发送数据的连接
+};
+
+
+} // namespace pebble
+
+#endif // _PEBBLE_URING_DRIVER_H_
+
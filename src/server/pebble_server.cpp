@@ -35,8 +35,11 @@
 #include "framework/pebble_rpc.h"
 #include "framework/register_error.h"
 #include "framework/session.h"
+#include "framework/shm_driver.h"
 #include "framework/stat.h"
 #include "framework/stat_manager.h"
+#include "framework/tcp_driver.h"
+#include "framework/udp_driver.h"
 #include "pebble_version.inh"
 #include "server/pebble_server.h"
 #include "src/server/control__PebbleControl.h"
@@ -45,6 +48,8 @@
 
 namespace pebble {
 
+// CoDel丢弃状态下LIFO缓冲区最多暂存的消息数
+static const uint32_t kMAX_LIFO_MESSAGES = 4096;
 
 const char* GetVersion() {
     static char version[256] = {0};
@@ -296,6 +301,8 @@ PebbleServer::PebbleServer() {
     m_monitor_centor     = NULL;
     m_task_monitor       = NULL;
     m_message_expire_monitor = NULL;
+    m_concurrency_limit_monitor = NULL;
+    m_codel_monitor      = NULL;
     m_stat_manager       = NULL;
     m_timer              = NULL;
     m_stat_timer_ms      = 1000;
@@ -344,6 +351,8 @@ PebbleServer::~PebbleServer() {
     delete m_monitor_centor;
     delete m_task_monitor;
     delete m_message_expire_monitor;
+    delete m_concurrency_limit_monitor;
+    delete m_codel_monitor;
     delete m_stat_manager;
     delete m_ini_reader;
     delete m_coroutine_schedule;
@@ -387,11 +396,23 @@ int32_t PebbleServer::Init(AppEventHandler* app_event_handler, NetEventHandler*
 	cbs._on_peer_connected = cxx::bind(&PebbleServer::OnPeerConnected, this, _1, _2);
 	cbs._on_peer_closed = cxx::bind(&PebbleServer::OnPeerClosed, this, _1, _2);
 	cbs._on_closed = cxx::bind(&PebbleServer::OnClosed, this, _1);
+	cbs._on_driver_added = cxx::bind(&PebbleServer::OnDriverAdded, this, _1);
     ret = Message::Init(cbs);
     CHECK_RETURN(ret);
 
+    cxx::shared_ptr<TcpDriver> tcp_driver =
+        cxx::dynamic_pointer_cast<TcpDriver>(Message::GetDriverByPrefix("tcp"));
+    if (tcp_driver) {
+        ret = tcp_driver->SetIoThreadNum(m_options._tcp_io_thread_num);
+        CHECK_RETURN(ret);
+    }
+    SetMessageBudget();
+
     InitMonitor();
 
+    RouteQuality::SetCircuitBreaker(m_options._circuit_breaker_failures,
+        m_options._circuit_breaker_open_ms);
+
     m_last_pid_cpu_use   = GetCurCpuTime();
     m_last_total_cpu_use = GetTotalCpuTime();
 
@@ -476,6 +497,8 @@ int32_t PebbleServer::Attach(Router* router, IProcessor* processor) {
 
     router->SetOnAddressChanged(cxx::bind(&PebbleServer::OnRouterAddressChanged, this,
         router, cxx::placeholders::_1, processor));
+    // 移除的handle在途请求完成、连接关闭后才detach，保证迟到的响应仍能交给processor
+    router->SetOnHandleClosed(cxx::bind(&PebbleServer::Detach, this, cxx::placeholders::_1));
     return 0;
 }
 
@@ -492,6 +515,8 @@ PebbleRpc* PebbleServer::GetPebbleRpc(ProtocolType protocol_type) {
     if (!m_rpc_event_handler) {
         m_rpc_event_handler = new RpcEventHandler();
         static_cast<RpcEventHandler*>(m_rpc_event_handler)->Init(m_stat_manager);
+        static_cast<RpcEventHandler*>(m_rpc_event_handler)
+            ->SetConcurrencyLimitMonitor(m_concurrency_limit_monitor);
     }
 
     CodeType rpc_code_type = kCODE_BUTT;
@@ -517,6 +542,9 @@ PebbleRpc* PebbleServer::GetPebbleRpc(ProtocolType protocol_type) {
     rpc_instance->SetSendFunction(Message::Send, Message::SendV);
     rpc_instance->SetEventHandler(m_rpc_event_handler);
     rpc_instance->SetProcRequestTimeoutMS(m_options._proc_req_timeout_ms);
+    SetRpcPriority(rpc_instance);
+    SetRpcCache(rpc_instance);
+    SetRpcBatch(rpc_instance);
     m_processor_array[protocol_type] = rpc_instance;
 
     return rpc_instance;
@@ -622,6 +650,14 @@ int32_t PebbleServer::Update() {
     Log::Instance().SetCurrentTime(old);
 
 	num += Message::Update();
+    // CoDel丢弃状态下把驱动中积压的消息都收进LIFO缓冲区，而不只是一轮收包的消息
+    uint32_t lifo_num = 0;
+    while (!m_lifo_messages.empty() && m_lifo_messages.size() < kMAX_LIFO_MESSAGES
+        && m_lifo_messages.size() != lifo_num) {
+        lifo_num = m_lifo_messages.size();
+        num += Message::Update();
+    }
+    num += ProcessLifoMessages();
 
     for (int32_t i = 0; i < kNAMING_BUTT; ++i) {
         if (m_naming_array[i]) {
@@ -672,6 +708,10 @@ int32_t PebbleServer::Update() {
 }
 
 int32_t PebbleServer::Reload() {
+    // 配置中删除的方法需要恢复为默认值，先记下重新加载前的配置
+    std::map<std::string, uint32_t> old_rpc_priority = m_options._rpc_priority;
+    std::map<std::string, uint32_t> old_rpc_cache    = m_options._rpc_cache;
+
     if (!m_ini_file_name.empty()) {
         if (LoadOptionsFromIni(m_ini_file_name) != 0) {
             return -1;
@@ -699,14 +739,25 @@ int32_t PebbleServer::Reload() {
     // flow control
     m_task_monitor->SetTaskThreshold(m_options._task_threshold);
     m_message_expire_monitor->SetExpireThreshold(m_options._message_expire_ms);
+    m_concurrency_limit_monitor->SetEnable(m_options._enable_concurrency_limit);
+    m_concurrency_limit_monitor->SetLimitRange(m_options._concurrency_limit_min,
+        m_options._concurrency_limit_max);
+    m_codel_monitor->SetEnable(m_options._enable_codel);
+    m_codel_monitor->SetTarget(m_options._codel_target_ms, m_options._codel_interval_ms);
+    SetMessageBudget();
 
     // rpc
     for (int i = kPEBBLE_RPC_BINARY; i <= kPEBBLE_RPC_PROTOBUF; i++) {
         if (m_processor_array[i]) {
             (dynamic_cast<PebbleRpc*>(m_processor_array[i]))
                 ->SetProcRequestTimeoutMS(m_options._proc_req_timeout_ms);
+            SetRpcPriority(dynamic_cast<PebbleRpc*>(m_processor_array[i]), old_rpc_priority);
+            SetRpcCache(dynamic_cast<PebbleRpc*>(m_processor_array[i]), old_rpc_cache);
+            SetRpcBatch(dynamic_cast<PebbleRpc*>(m_processor_array[i]));
         }
     }
+    RouteQuality::SetCircuitBreaker(m_options._circuit_breaker_failures,
+        m_options._circuit_breaker_open_ms);
 
     return 0;
 }
@@ -723,10 +774,73 @@ void PebbleServer::Idle() {
     Log::Instance().Flush();
     oss::CLogDataAPI::Flush();
 
-    usleep(m_options._idle_us);
+    // 不睡过最近一个定时器的超时时刻
+    int64_t idle_us = m_options._idle_us;
+    int64_t next_expire_ms = m_timer ? m_timer->GetNextExpireMS() : -1;
+    if (next_expire_ms >= 0 && next_expire_ms * 1000 < idle_us) {
+        idle_us = next_expire_ms * 1000;
+    }
+    if (idle_us <= 0) {
+        return;
+    }
+
+    // 有共享内存连接时在其通知上等待，对端发来消息可以立即唤醒
+    cxx::shared_ptr<ShmDriver> shm_driver =
+        cxx::dynamic_pointer_cast<ShmDriver>(Message::GetDriverByPrefix("shm"));
+    if (shm_driver) {
+        shm_driver->Wait(idle_us);
+    } else {
+        usleep(idle_us);
+    }
 }
 
 int32_t PebbleServer::OnMessage(const uint8_t* msg, uint32_t msg_len, MsgExternInfo* info) {
+    if (m_options._enable_flow_control && m_codel_monitor->IsDropping()) {
+        // 排队时间从入队时开始计算，驱动没有提供到达时间时以当前时间为准
+        LifoMessage lifo_msg = { *info, static_cast<uint32_t>(m_lifo_buff.size()), msg_len };
+        if (lifo_msg._info._msg_arrived_ms <= 0) {
+            lifo_msg._info._msg_arrived_ms = TimeUtility::GetCurrentMS();
+        }
+        m_lifo_buff.append(reinterpret_cast<const char*>(msg), msg_len);
+        m_lifo_messages.push_back(lifo_msg);
+        return 1;
+    }
+
+    ProcessMessage(msg, msg_len, info, true);
+    return 1;
+}
+
+int32_t PebbleServer::ProcessLifoMessages() {
+    if (m_lifo_messages.empty()) {
+        return 0;
+    }
+
+    // 队列的排队时间以最早入队的消息为准，CoDel判定丢弃时从最早的消息开始丢弃
+    const uint8_t* buff = reinterpret_cast<const uint8_t*>(m_lifo_buff.data());
+    uint32_t oldest = 0;
+    for (; oldest < m_lifo_messages.size(); ++oldest) {
+        LifoMessage& lifo_msg = m_lifo_messages[oldest];
+        m_codel_monitor->OnMessage(lifo_msg._info._msg_arrived_ms);
+        if (kNO_OVERLOAD == m_codel_monitor->IsOverLoad()) {
+            break;
+        }
+        ProcessMessage(buff + lifo_msg._offset, lifo_msg._len, &(lifo_msg._info), false);
+    }
+
+    // 其余的消息后进先出，新到的消息先处理；这些消息的排队时间不计入CoDel，避免提前退出丢弃状态
+    for (uint32_t idx = m_lifo_messages.size(); idx > oldest; --idx) {
+        LifoMessage& lifo_msg = m_lifo_messages[idx - 1];
+        ProcessMessage(buff + lifo_msg._offset, lifo_msg._len, &(lifo_msg._info), false);
+    }
+
+    int32_t num = m_lifo_messages.size();
+    m_lifo_messages.clear();
+    m_lifo_buff.clear();
+    return num;
+}
+
+void PebbleServer::ProcessMessage(const uint8_t* msg, uint32_t msg_len, MsgExternInfo* info,
+    bool check_codel) {
     cxx::unordered_map<int64_t, IProcessor*>::iterator it = m_processor_map.find(info->_self_handle);
     if (m_processor_map.end() == it) {
         PLOG_ERROR_N_EVERY_SECOND(1, "handle(%ld) not attach a processor remote(%ld)", info->_self_handle, info->_remote_handle);
@@ -734,13 +848,15 @@ int32_t PebbleServer::OnMessage(const uint8_t* msg, uint32_t msg_len, MsgExternI
 	    m_is_overload = kNO_OVERLOAD;
 	    if (m_options._enable_flow_control) {
 	        m_message_expire_monitor->OnMessage(info->_msg_arrived_ms);
+	        if (check_codel) {
+	            m_codel_monitor->OnMessage(info->_msg_arrived_ms);
+	        }
 	        m_task_monitor->SetTaskNum(m_coroutine_schedule->Size()); // 内部实现暂使用协程数
+	        m_concurrency_limit_monitor->SetTaskNum(m_coroutine_schedule->Size());
 	        m_is_overload = m_monitor_centor->IsOverLoad();
 	    }
 	    it->second->OnMessage(info->_remote_handle, msg, msg_len, info, m_is_overload);
 	}
-
-    return 1;
 }
 
 int32_t PebbleServer::OnPeerConnected(int64_t local_handle, int64_t peer_hanlde) {
@@ -764,6 +880,10 @@ int32_t PebbleServer::OnClosed(int64_t handle) {
 	return 0;
 }
 
+void PebbleServer::OnDriverAdded(const char* prefix) {
+    SetMessageBudget();
+}
+
 void PebbleServer::InitLog() {
     Log::Instance().SetOutputDevice(m_options._log_device);
     Log::Instance().SetLogPriority(m_options._log_priority);
@@ -811,21 +931,106 @@ void PebbleServer::InitMonitor() {
     if (!m_message_expire_monitor) {
         m_message_expire_monitor = new MessageExpireMonitor();
     }
+    if (!m_concurrency_limit_monitor) {
+        m_concurrency_limit_monitor = new ConcurrencyLimitMonitor();
+    }
+    if (!m_codel_monitor) {
+        m_codel_monitor = new CoDelMonitor();
+    }
     if (!m_monitor_centor) {
         m_monitor_centor = new MonitorCenter();
     }
 
     m_task_monitor->SetTaskThreshold(m_options._task_threshold);
     m_message_expire_monitor->SetExpireThreshold(m_options._message_expire_ms);
+    m_concurrency_limit_monitor->SetEnable(m_options._enable_concurrency_limit);
+    m_concurrency_limit_monitor->SetLimitRange(m_options._concurrency_limit_min,
+        m_options._concurrency_limit_max);
+    m_codel_monitor->SetEnable(m_options._enable_codel);
+    m_codel_monitor->SetTarget(m_options._codel_target_ms, m_options._codel_interval_ms);
+    if (m_rpc_event_handler) {
+        static_cast<RpcEventHandler*>(m_rpc_event_handler)
+            ->SetConcurrencyLimitMonitor(m_concurrency_limit_monitor);
+    }
 
     m_monitor_centor->Clear();
     m_monitor_centor->AddMonitor(m_task_monitor);
     m_monitor_centor->AddMonitor(m_message_expire_monitor);
+    m_monitor_centor->AddMonitor(m_concurrency_limit_monitor);
+    m_monitor_centor->AddMonitor(m_codel_monitor);
+}
+
+void PebbleServer::SetRpcPriority(PebbleRpc* rpc, const std::map<std::string, uint32_t>& old_priority) {
+    for (std::map<std::string, uint32_t>::const_iterator it = old_priority.begin();
+        it != old_priority.end(); ++it) {
+        if (m_options._rpc_priority.find(it->first) == m_options._rpc_priority.end()) {
+            rpc->SetFunctionPriority(it->first, kRPC_PRIORITY_LOW);
+        }
+    }
+    for (std::map<std::string, uint32_t>::iterator it = m_options._rpc_priority.begin();
+        it != m_options._rpc_priority.end(); ++it) {
+        rpc->SetFunctionPriority(it->first, it->second);
+    }
+}
+
+void PebbleServer::SetRpcCache(PebbleRpc* rpc, const std::map<std::string, uint32_t>& old_cache) {
+    rpc->SetResponseCacheMaxBytes(static_cast<uint64_t>(m_options._rpc_cache_max_mb) * 1024 * 1024);
+    for (std::map<std::string, uint32_t>::const_iterator it = old_cache.begin();
+        it != old_cache.end(); ++it) {
+        if (m_options._rpc_cache.find(it->first) == m_options._rpc_cache.end()) {
+            rpc->SetResponseCache(it->first, 0);
+        }
+    }
+    for (std::map<std::string, uint32_t>::iterator it = m_options._rpc_cache.begin();
+        it != m_options._rpc_cache.end(); ++it) {
+        rpc->SetResponseCache(it->first, it->second);
+    }
+}
+
+void PebbleServer::SetRpcBatch(PebbleRpc* rpc) {
+    BatchPolicy policy;
+    policy._max_batch_num   = m_options._batch_max_num;
+    policy._max_batch_bytes = m_options._batch_max_bytes;
+    policy._max_delay_ms    = m_options._batch_max_delay_ms;
+    rpc->SetBatchPolicy(policy);
+}
+
+void PebbleServer::SetMessageBudget() {
+    // 关闭流控时不限制每个tick处理的消息数
+    uint32_t max_msg_num_per_loop = 0;
+    uint32_t max_msg_num_per_conn = 0;
+    if (m_options._enable_flow_control) {
+        max_msg_num_per_loop = m_options._max_msg_num_per_loop;
+        max_msg_num_per_conn = m_options._max_msg_num_per_conn;
+    }
+
+    // unix domain socket和io_uring的driver复用TcpDriver的实现
+    const char* stream_prefixes[] = { "tcp", "unix", "unixpacket", "uring" };
+    for (uint32_t i = 0; i < sizeof(stream_prefixes) / sizeof(stream_prefixes[0]); i++) {
+        cxx::shared_ptr<TcpDriver> tcp_driver =
+            cxx::dynamic_pointer_cast<TcpDriver>(Message::GetDriverByPrefix(stream_prefixes[i]));
+        if (tcp_driver) {
+            tcp_driver->SetDispatchBudget(max_msg_num_per_loop, max_msg_num_per_conn);
+        }
+    }
+
+    // udp没有连接的概念，只有每个tick的总配额
+    cxx::shared_ptr<UdpDriver> udp_driver =
+        cxx::dynamic_pointer_cast<UdpDriver>(Message::GetDriverByPrefix("udp"));
+    if (udp_driver) {
+        udp_driver->SetDispatchBudget(max_msg_num_per_loop);
+    }
+
+    cxx::shared_ptr<ShmDriver> shm_driver =
+        cxx::dynamic_pointer_cast<ShmDriver>(Message::GetDriverByPrefix("shm"));
+    if (shm_driver) {
+        shm_driver->SetDispatchBudget(max_msg_num_per_loop, max_msg_num_per_conn);
+    }
 }
 
 int32_t PebbleServer::InitTimer() {
     if (!m_timer) {
-        m_timer = new SequenceTimer();
+        m_timer = new WheelTimer();
     }
 
     TimeoutCallback on_stat_timeout = cxx::bind(&PebbleServer::OnStatTimeout, this);
@@ -886,8 +1091,15 @@ int32_t PebbleServer::LoadOptionsFromIni(const std::string& file_name) {
     // flow control
     m_options._enable_flow_control = ini_reader->GetBoolean(kSectionFlowControl, kEnableFlowControl, m_options._enable_flow_control);
     m_options._max_msg_num_per_loop = ini_reader->GetUInt32(kSectionFlowControl, kMaxMsgNumPerLoop, m_options._max_msg_num_per_loop);
+    m_options._max_msg_num_per_conn = ini_reader->GetUInt32(kSectionFlowControl, kMaxMsgNumPerConn, m_options._max_msg_num_per_conn);
     m_options._task_threshold = ini_reader->GetUInt32(kSectionFlowControl, kTaskThreshold, m_options._task_threshold);
     m_options._message_expire_ms = ini_reader->GetUInt32(kSectionFlowControl, kMessageExpireMs, m_options._message_expire_ms);
+    m_options._enable_concurrency_limit = ini_reader->GetBoolean(kSectionFlowControl, kEnableConcurrencyLimit, m_options._enable_concurrency_limit);
+    m_options._concurrency_limit_min = ini_reader->GetUInt32(kSectionFlowControl, kConcurrencyLimitMin, m_options._concurrency_limit_min);
+    m_options._concurrency_limit_max = ini_reader->GetUInt32(kSectionFlowControl, kConcurrencyLimitMax, m_options._concurrency_limit_max);
+    m_options._enable_codel = ini_reader->GetBoolean(kSectionFlowControl, kEnableCoDel, m_options._enable_codel);
+    m_options._codel_target_ms = ini_reader->GetUInt32(kSectionFlowControl, kCoDelTargetMs, m_options._codel_target_ms);
+    m_options._codel_interval_ms = ini_reader->GetUInt32(kSectionFlowControl, kCoDelIntervalMs, m_options._codel_interval_ms);
     m_options._idle_us = ini_reader->GetUInt32(kSectionFlowControl, kIdleUs, m_options._idle_us);
 
     // broadcast
@@ -897,6 +1109,29 @@ int32_t PebbleServer::LoadOptionsFromIni(const std::string& file_name) {
 
     // rpc
     m_options._proc_req_timeout_ms = ini_reader->GetUInt32(kSectionRpc, kProcReqTimeoutMs, m_options._proc_req_timeout_ms);
+    m_options._circuit_breaker_failures = ini_reader->GetUInt32(kSectionRpc, kCircuitBreakerFailures, m_options._circuit_breaker_failures);
+    m_options._circuit_breaker_open_ms = ini_reader->GetUInt32(kSectionRpc, kCircuitBreakerOpenMs, m_options._circuit_breaker_open_ms);
+    m_options._rpc_cache_max_mb = ini_reader->GetUInt32(kSectionRpc, kRpcCacheMaxMB, m_options._rpc_cache_max_mb);
+    m_options._batch_max_num = ini_reader->GetUInt32(kSectionRpc, kBatchMaxNum, m_options._batch_max_num);
+    m_options._batch_max_bytes = ini_reader->GetUInt32(kSectionRpc, kBatchMaxBytes, m_options._batch_max_bytes);
+    m_options._batch_max_delay_ms = ini_reader->GetUInt32(kSectionRpc, kBatchMaxDelayMs, m_options._batch_max_delay_ms);
+
+    // message
+    m_options._tcp_io_thread_num = ini_reader->GetUInt32(kSectionMessage, kTcpIoThreadNum, m_options._tcp_io_thread_num);
+
+    // rpc priority，整个section重新读取，已删除的方法不再保留
+    m_options._rpc_priority.clear();
+    std::set<std::string> methods = ini_reader->GetFields(kSectionRpcPriority);
+    for (std::set<std::string>::iterator it = methods.begin(); it != methods.end(); ++it) {
+        m_options._rpc_priority[*it] = ini_reader->GetUInt32(kSectionRpcPriority, *it, 0);
+    }
+
+    // rpc cache，同rpc priority
+    m_options._rpc_cache.clear();
+    methods = ini_reader->GetFields(kSectionRpcCache);
+    for (std::set<std::string>::iterator it = methods.begin(); it != methods.end(); ++it) {
+        m_options._rpc_cache[*it] = ini_reader->GetUInt32(kSectionRpcCache, *it, 0);
+    }
 
     return 0;
 }
@@ -906,6 +1141,7 @@ int32_t PebbleServer::OnStatTimeout() {
     StatCpu(stat);
     StatMemory(stat);
     StatCoroutine(stat);
+    StatFlowControl(stat);
     StatProcessorResource(stat);
 
     return m_stat_timer_ms;
@@ -924,12 +1160,16 @@ void PebbleServer::OnRouterAddressChanged(Router* router,
         return;
     }
 
-    // 采取简单策略，先把老的都detach，再attach新的
+    // 增量更新，只attach新增的handle；已删除的handle由router在其在途请求完成、连接关闭时
+    // 通过OnHandleClosed回调detach
+    cxx::unordered_map<int64_t, bool> old_handles;
     for (std::vector<int64_t>::iterator oit = it->second.begin(); oit != it->second.end(); ++oit) {
-        Detach(*oit);
+        old_handles[*oit] = true;
     }
     for (std::vector<int64_t>::const_iterator nit = handles.begin(); nit != handles.end(); ++nit) {
-        Attach(*nit, processor);
+        if (old_handles.find(*nit) == old_handles.end()) {
+            Attach(*nit, processor);
+        }
     }
     it->second = handles;
 }
@@ -963,6 +1203,12 @@ void PebbleServer::StatCoroutine(Stat* stat) {
     stat->AddResourceItem("_coroutine", m_coroutine_schedule->Size());
 }
 
+void PebbleServer::StatFlowControl(Stat* stat) {
+    if (m_options._enable_concurrency_limit) {
+        stat->AddResourceItem("_concurrency_limit", m_concurrency_limit_monitor->GetLimit());
+    }
+}
+
 void PebbleServer::StatProcessorResource(Stat* stat) {
     cxx::unordered_map<std::string, int64_t> resource;
     cxx::unordered_map<std::string, int64_t>::iterator it;
@@ -37,6 +37,8 @@ class CoroutineSchedule;
 class IEventHandler;
 class INIReader;
 class IProcessor;
+class CoDelMonitor;
+class ConcurrencyLimitMonitor;
 class MessageExpireMonitor;
 class MonitorCenter;
 class Naming;
@@ -170,6 +172,10 @@ public:
     ///     "http://127.0.0.1:8880[/service]"
     ///     "tcp://127.0.0.1:8880"
     ///     "udp://127.0.0.1:8880"
+    ///     "unix:///tmp/pebble.sock", "unix://@pebble"(abstract namespace)
+    ///     "unixpacket:///tmp/pebble.sock"
+    ///     "shm://pebble"(同机共享内存)
+    ///     "uring://127.0.0.1:8880"(io_uring，与tcp://互通，内核不支持时回退到epoll)
     /// @return >=0 表示成功
     /// @return <0 表示失败，错误码@see MessageErrorCode
     /// @note 原生tcp/udp与tbuspp协议只能二选一
@@ -182,6 +188,10 @@ public:
     ///     "http://127.0.0.1:8880[/service]"
     ///     "tcp://127.0.0.1:8880"
     ///     "udp://127.0.0.1:8880"
+    ///     "unix:///tmp/pebble.sock", "unix://@pebble"(abstract namespace)
+    ///     "unixpacket:///tmp/pebble.sock"
+    ///     "shm://pebble"(同机共享内存)
+    ///     "uring://127.0.0.1:8880"(io_uring，与tcp://互通，内核不支持时回退到epoll)
     /// @return >=0 表示成功
     /// @return <0 表示失败，错误码@see MessageErrorCode
     /// @note 原生tcp/udp与tbuspp协议只能二选一
@@ -349,18 +359,38 @@ public:
 private:
     int32_t OnMessage(const uint8_t* msg, uint32_t msg_len, MsgExternInfo* info);
 
+    // check_codel为false时不以此消息的排队时间更新CoDel状态，沿用之前的丢弃判定
+    void ProcessMessage(const uint8_t* msg, uint32_t msg_len, MsgExternInfo* info, bool check_codel);
+
+    int32_t ProcessLifoMessages();
+
 	int32_t OnPeerConnected(int64_t local_handle, int64_t peer_hanlde);
 	
 	int32_t OnPeerClosed(int64_t local_handle, int64_t peer_hanlde);
 
 	int32_t OnClosed(int64_t handle);
 
+    // 内置的可选驱动在第一次使用时才注册，注册后按当前配置设置
+    void OnDriverAdded(const char* prefix);
+
     void InitLog();
 
     int32_t InitCoSchedule();
 
     void InitMonitor();
 
+    // 按配置设置方法优先级，old_priority中有而当前配置中没有的方法恢复为默认优先级
+    void SetRpcPriority(PebbleRpc* rpc,
+        const std::map<std::string, uint32_t>& old_priority = std::map<std::string, uint32_t>());
+
+    // 按配置设置响应缓存，old_cache中有而当前配置中没有的方法关闭缓存
+    void SetRpcCache(PebbleRpc* rpc,
+        const std::map<std::string, uint32_t>& old_cache = std::map<std::string, uint32_t>());
+
+    void SetRpcBatch(PebbleRpc* rpc);
+
+    void SetMessageBudget();
+
     int32_t InitStat();
 
     int32_t InitTimer();
@@ -378,6 +408,8 @@ private:
 
     void StatCoroutine(Stat* stat);
 
+    void StatFlowControl(Stat* stat);
+
     void StatProcessorResource(Stat* stat);
 
     void OnControlReload(const std::vector<std::string>& options, int32_t* ret_code, std::string* data);
@@ -395,6 +427,8 @@ private:
     MonitorCenter*     m_monitor_centor;
     TaskMonitor*       m_task_monitor;
     MessageExpireMonitor* m_message_expire_monitor;
+    ConcurrencyLimitMonitor* m_concurrency_limit_monitor;
+    CoDelMonitor*      m_codel_monitor;
     Naming*            m_naming_array[kNAMING_BUTT];
     IProcessor*        m_processor_array[kPROTOCOL_TYPE_BUTT];
     IEventHandler*     m_rpc_event_handler;
@@ -417,6 +451,14 @@ private:
     std::string m_ini_file_name;
     uint32_t    m_is_overload;
     MsgExternInfo m_last_msg_info;
+    // CoDel丢弃状态下暂存积压的消息，先按最早消息的排队时间丢弃最早的消息，其余后进先出地处理
+    struct LifoMessage {
+        MsgExternInfo _info;
+        uint32_t      _offset;
+        uint32_t      _len;
+    };
+    std::vector<LifoMessage> m_lifo_messages;
+    std::string m_lifo_buff;
 	std::map<int, IProcessor*> m_user_processor;
 };
 
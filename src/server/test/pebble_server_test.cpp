@@ -0,0 +1,250 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "common/time_utility.h"
+#include "framework/message.h"
+#include "framework/monitor.h"
+#include "framework/processor.h"
+#include "framework/router.h"
+#include "framework/test/test_util.h"
+#include "gtest/gtest.h"
+#include "server/pebble_server.h"
+
+using namespace pebble;
+using namespace pebble::test;
+
+namespace {
+
+const int64_t kFAKE_HANDLE = 1;
+
+/// @brief 测试用的消息驱动，消息的到达时间和所属handle由测试指定，每次Update最多投递m_budget个消息
+class FakeDriver : public MessageDriver {
+public:
+    FakeDriver() : m_budget(4) {}
+
+    virtual int64_t Bind(const std::string& url) { return kFAKE_HANDLE; }
+    virtual int64_t Connect(const std::string& url) {
+        m_connected.push_back(GenHandle());
+        return m_connected.back();
+    }
+    virtual int32_t Send(int64_t handle, const uint8_t* msg, uint32_t msg_len, int32_t flag) {
+        return 0;
+    }
+    virtual int32_t SendV(int64_t handle, uint32_t msg_frag_num,
+        const uint8_t* msg_frag[], uint32_t msg_frag_len[], int32_t flag) {
+        return 0;
+    }
+    virtual int32_t Close(int64_t handle) {
+        m_closed.push_back(handle);
+        return 0;
+    }
+    virtual const char* Prefix() const { return "fake"; }
+
+    virtual int32_t Update() {
+        uint32_t num = 0;
+        for (; num < m_budget && !m_pending.empty(); num++) {
+            MsgExternInfo info;
+            info._self_handle    = m_pending[0]._handle;
+            info._remote_handle  = m_pending[0]._handle;
+            info._msg_arrived_ms = m_pending[0]._arrived_ms;
+            m_cbs._on_message(reinterpret_cast<const uint8_t*>(m_pending[0]._msg.data()),
+                m_pending[0]._msg.size(), &info);
+            m_pending.erase(m_pending.begin());
+        }
+        return num;
+    }
+
+    // 放入一个已经排队sojourn_ms的消息
+    void Push(const std::string& msg, int64_t sojourn_ms, int64_t handle = kFAKE_HANDLE) {
+        Pending pending;
+        pending._msg        = msg;
+        pending._arrived_ms = TimeUtility::GetCurrentMS() - sojourn_ms;
+        pending._handle     = handle;
+        m_pending.push_back(pending);
+    }
+
+    struct Pending {
+        std::string _msg;
+        int64_t     _arrived_ms;
+        int64_t     _handle;
+    };
+
+    uint32_t m_budget;
+    std::vector<Pending> m_pending;
+    std::vector<int64_t> m_connected;
+    std::vector<int64_t> m_closed;
+};
+
+/// @brief 记录消息的处理顺序和过载标记
+class RecordProcessor : public IProcessor {
+public:
+    virtual int32_t OnMessage(int64_t handle, const uint8_t* msg, uint32_t msg_len,
+        const MsgExternInfo* msg_info, uint32_t is_overload) {
+        m_msgs.push_back(std::string(reinterpret_cast<const char*>(msg), msg_len));
+        m_overloads.push_back(is_overload);
+        return 0;
+    }
+
+    virtual int32_t Update() { return 0; }
+
+    virtual void GetResourceUsed(cxx::unordered_map<std::string, int64_t>* resource_info) {}
+
+    void Clear() {
+        m_msgs.clear();
+        m_overloads.clear();
+    }
+
+    std::vector<std::string> m_msgs;
+    std::vector<uint32_t> m_overloads;
+};
+
+// Message的驱动是进程级的，一个进程只能Init一个PebbleServer，所有用例共用
+class PebbleServerTest : public ::testing::Test {
+protected:
+    static void SetUpTestCase() {
+        m_server = new PebbleServer();
+        Options* options = m_server->GetOptions();
+        options->_enable_flow_control = true;
+        options->_enable_codel        = true;
+        options->_codel_target_ms     = 5;
+        options->_codel_interval_ms   = 100;
+        ASSERT_EQ(0, m_server->Init());
+
+        m_driver.reset(new FakeDriver());
+        ASSERT_EQ(0, Message::AddDriver(m_driver));
+        ASSERT_EQ(0, m_server->Attach(kFAKE_HANDLE, &m_processor));
+    }
+
+    static void TearDownTestCase() {
+        delete m_server;
+        m_server = NULL;
+        m_driver.reset();
+    }
+
+    virtual void SetUp() {
+        ASSERT_TRUE(m_server != NULL);
+        // 排队时间低于目标的消息使CoDel退出上个用例可能留下的丢弃状态
+        m_driver->Push("reset", 0);
+        m_server->Update();
+        m_processor.Clear();
+    }
+
+    virtual void TearDown() {
+        m_driver->m_pending.clear();
+    }
+
+    // 排队时间持续一个周期高于目标，使CoDel进入丢弃状态
+    void EnterDropping() {
+        m_driver->Push("warm0", 50);
+        m_server->Update();
+        usleep(105 * 1000);
+        m_driver->Push("warm1", 50);
+        m_server->Update();
+        ASSERT_EQ(2u, m_processor.m_overloads.size());
+        ASSERT_NE(0u, m_processor.m_overloads[1] & kQUEUE_DELAY_OVERLOAD);
+        m_processor.Clear();
+    }
+
+    static PebbleServer* m_server;
+    static cxx::shared_ptr<FakeDriver> m_driver;
+    static RecordProcessor m_processor;
+};
+
+PebbleServer* PebbleServerTest::m_server = NULL;
+cxx::shared_ptr<FakeDriver> PebbleServerTest::m_driver;
+RecordProcessor PebbleServerTest::m_processor;
+
+} // namespace
+
+TEST_F(PebbleServerTest, CoDelShedsOldestThenServesNewestFirst) {
+    EnterDropping();
+
+    // 积压的消息超过驱动一轮投递的数量，全部收进LIFO缓冲区
+    usleep(105 * 1000);
+    for (int i = 0; i < 10; i++) {
+        m_driver->Push(std::string(1, static_cast<char>('0' + i)), 60 - i);
+    }
+    m_server->Update();
+    ASSERT_EQ(10u, m_processor.m_msgs.size());
+
+    // 最早的消息按CoDel丢弃，其余消息从新到旧处理
+    EXPECT_EQ("0", m_processor.m_msgs[0]);
+    EXPECT_NE(0u, m_processor.m_overloads[0] & kQUEUE_DELAY_OVERLOAD);
+    for (int i = 1; i < 10; i++) {
+        EXPECT_EQ(std::string(1, static_cast<char>('0' + 10 - i)), m_processor.m_msgs[i]);
+        EXPECT_EQ(0u, m_processor.m_overloads[i] & kQUEUE_DELAY_OVERLOAD);
+    }
+
+    // 新到的消息排队时间短，但最早的消息仍超标，保持丢弃状态
+    m_processor.Clear();
+    m_driver->Push("a", 30);
+    m_driver->Push("b", 0);
+    m_server->Update();
+    ASSERT_EQ(2u, m_processor.m_msgs.size());
+    EXPECT_EQ("b", m_processor.m_msgs[0]);
+    EXPECT_EQ("a", m_processor.m_msgs[1]);
+
+    // 最早的消息排队时间回落后退出丢弃状态，之后按到达顺序处理
+    m_processor.Clear();
+    m_driver->Push("c", 0);
+    m_server->Update();
+    m_driver->Push("d", 0);
+    m_driver->Push("e", 0);
+    m_server->Update();
+    ASSERT_EQ(3u, m_processor.m_msgs.size());
+    EXPECT_EQ("d", m_processor.m_msgs[1]);
+    EXPECT_EQ("e", m_processor.m_msgs[2]);
+}
+
+TEST_F(PebbleServerTest, RemovedRouterHandleKeepsProcessorUntilDrained) {
+    FakeNaming naming;
+    Router router("test.drain");
+    ASSERT_EQ(0, router.Init(&naming));
+    RecordProcessor processor;
+    ASSERT_EQ(0, m_server->Attach(&router, &processor));
+
+    naming.SetUrls("fake://a", "fake://b");
+    ASSERT_EQ(2u, m_driver->m_connected.size());
+    int64_t removed = m_driver->m_connected[0];
+
+    // 地址移除时还有在途请求，连接保留到请求完成
+    RouteQuality::OnRequestSent(removed);
+    naming.SetUrls("fake://b");
+    EXPECT_TRUE(m_driver->m_closed.empty());
+    EXPECT_TRUE(RouteQuality::IsDraining(removed));
+
+    // 迟到的响应仍然交给processor处理
+    m_driver->Push("late", 0, removed);
+    m_server->Update();
+    ASSERT_EQ(1u, processor.m_msgs.size());
+    EXPECT_EQ("late", processor.m_msgs[0]);
+
+    // 在途请求完成后关闭连接并detach，之后的消息不再交给processor
+    RouteQuality::OnRequestDone(removed, 0, 1);
+    ASSERT_EQ(1u, m_driver->m_closed.size());
+    EXPECT_EQ(removed, m_driver->m_closed[0]);
+    m_driver->Push("closed", 0, removed);
+    m_server->Update();
+    EXPECT_EQ(1u, processor.m_msgs.size());
+
+    // 保留的地址不受影响
+    m_driver->Push("kept", 0, m_driver->m_connected[1]);
+    m_server->Update();
+    ASSERT_EQ(2u, processor.m_msgs.size());
+    EXPECT_EQ("kept", processor.m_msgs[1]);
+}
@@ -2429,6 +2429,11 @@ void t_cpp_client_generator::generate_service_client(t_service* tservice, string
       endl;
   }
 
+  f_service_h_ <<
+    indent() << "// 设置RPC自动重试策略，只能用于幂等方法，未指定方法名时对所有方法生效，@see pebble::RetryPolicy" << endl <<
+    indent() << "int SetRetryPolicy(const pebble::RetryPolicy& policy, const char* method_name = NULL);" << endl <<
+    endl;
+
   f_service_h_ << indent() << "/* IDL定义接口部分 - begin */" << endl;
   vector<t_function*> functions = tservice->get_functions();
   vector<t_function*>::const_iterator f_iter;
@@ -2561,6 +2566,30 @@ void t_cpp_client_generator::generate_service_client(t_service* tservice, string
       endl;
   }
 
+  out << "int " << scope << "SetRetryPolicy(const pebble::RetryPolicy& policy, const char* method_name) {" << endl <<
+    indent(1) << "if (method_name != NULL && m_methods.find(method_name) == m_methods.end()) {" << endl <<
+    indent(2) << "return pebble::kRPC_UNSUPPORT_FUNCTION_NAME;" << endl <<
+    indent(1) << "}" << endl <<
+    endl;
+  if (!functions.empty()) {
+    out << indent(1) << "std::string name(method_name != NULL ? method_name : \"\");" << endl;
+  }
+  for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
+    out << indent(1) << "if (name.empty() || name == \"" << (*f_iter)->get_name() << "\") {" << endl <<
+      indent(2) << "m_client->SetRetryPolicy(\"" << service_name_ << ":" << (*f_iter)->get_name() << "\", policy);" << endl <<
+      indent(1) << "}" << endl;
+  }
+  out << endl;
+  if (tservice->get_extends() != NULL) {
+    // 父服务的方法由父类按父服务名设置
+    out << indent(1) << "return " << type_name(tservice->get_extends()) << client_suffix <<
+      "::SetRetryPolicy(policy, method_name);" << endl;
+  } else {
+    out << indent(1) << "return 0;" << endl;
+  }
+  out << "}" << endl <<
+    endl;
+
   for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
     string funname = (*f_iter)->get_name();
     string argsname = tservice->get_name() + "_" + (*f_iter)->get_name() + "_pargs";
@@ -2582,7 +2611,8 @@ void t_cpp_client_generator::generate_service_client(t_service* tservice, string
 
     out << indent() <<
         "::pebble::RpcHead head;" << endl << indent() <<
-        "head.m_function_name.assign(\"" << service_name_ << ":" << funname << "\");" << endl << indent();
+        "head.m_function_name.assign(\"" << service_name_ << ":" << funname << "\");" << endl << indent() <<
+        "head.m_function_id = " << rpc_function_id(service_name_ + ":" + funname) << "u;" << endl << indent();
     if (!(*f_iter)->is_oneway()) {
         out << "head.m_message_type = pebble::dr::protocol::T_CALL;" << endl << indent();
     } else {
@@ -2647,7 +2677,8 @@ void t_cpp_client_generator::generate_service_client(t_service* tservice, string
 
       out << indent() <<
           "::pebble::RpcHead head;" << endl << indent() <<
-          "head.m_function_name.assign(\"" << service_name_ << ":" << funname << "\");" << endl << indent();
+          "head.m_function_name.assign(\"" << service_name_ << ":" << funname << "\");" << endl << indent() <<
+        "head.m_function_id = " << rpc_function_id(service_name_ + ":" + funname) << "u;" << endl << indent();
       if (!(*f_iter)->is_oneway()) {
           out << "head.m_message_type = pebble::dr::protocol::T_CALL;" << endl << indent();
       } else {
@@ -3021,7 +3052,8 @@ void ProcessorGenerator4Client::generate_register_service_function() {
 
     f_out_ <<
       indent() << "ret = m_server->AddOnRequestFunction(\"" << service_name_ <<
-      ":" << (*f_iter)->get_name() << "\", cb);" << endl;
+      ":" << (*f_iter)->get_name() << "\", " <<
+      t_generator::rpc_function_id(service_name_ + ":" + (*f_iter)->get_name()) << "u, cb);" << endl;
 
     f_out_ <<
       indent() << "if (ret != pebble::kRPC_SUCCESS) {" << endl <<
@@ -141,6 +141,9 @@ class t_cpp_generator : public t_oop_generator {
                                    string style, bool specialized=false);
   void generate_return_function  (t_service* tservice, t_function* tfunction,
                                    string style, bool specialized=false);
+  void generate_stream_client_function (std::ofstream& out, t_service* tservice,
+                                   t_function* tfunction, string scope);
+  void generate_stream_return_function (t_service* tservice, t_function* tfunction);
   void generate_function_helpers  (t_service* tservice, t_function* tfunction);
   void generate_service_async_skeleton (t_service* tservice);
 
@@ -2030,6 +2033,13 @@ void t_cpp_generator::generate_struct_reflection_info(std::ofstream& out, t_stru
 void t_cpp_generator::generate_service(t_service* tservice) {
   string svcname = tservice->get_name();
 
+  vector<t_function*> functions = tservice->get_functions();
+  for (vector<t_function*>::iterator f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
+    if ((*f_iter)->is_stream() && ((*f_iter)->is_oneway() || (*f_iter)->get_returntype()->is_void())) {
+      throw "stream function " + svcname + "." + (*f_iter)->get_name() + " must return a value and can't be oneway";
+    }
+  }
+
   // Make output files
   string f_header_h_name = get_out_dir()+program_name_+"_"+svcname+".h";
   string f_header_inh_name = get_out_dir()+program_name_+"_"+svcname+".inh";
@@ -2682,6 +2692,11 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
       endl;
   }
 
+  f_service_h_ <<
+    indent() << "// 设置RPC自动重试策略，只能用于幂等方法，未指定方法名时对所有方法生效，@see pebble::RetryPolicy" << endl <<
+    indent() << "int SetRetryPolicy(const pebble::RetryPolicy& policy, const char* method_name = NULL);" << endl <<
+    endl;
+
   f_service_h_ << indent() << "// IDL定义接口部分 - begin" << endl;
   f_service_h_ << indent() << "// IDL定义接口说明 : " << endl <<
     indent() << "// 1. 所有IDL定义的接口将生成同步和异步两个函数，函数的参数和IDL定义保持一致" << endl <<
@@ -2691,7 +2706,10 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
   vector<t_function*>::const_iterator f_iter;
   for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
     indent(f_service_h_) << function_signature_if(*f_iter, "") << ";" << endl;
-    if (!((*f_iter)->is_oneway())) {
+    if ((*f_iter)->is_stream()) {
+      // 流式方法没有并行调用接口
+      indent(f_service_h_) << function_signature_if(*f_iter, "CobCl") << ";" << endl;
+    } else if (!((*f_iter)->is_oneway())) {
       indent(f_service_h_) << function_signature_if(*f_iter, "Parallel", "Parallel") << ";" << endl;
       indent(f_service_h_) << function_signature_if(*f_iter, "CobCl") << ";" << endl;
     }
@@ -2702,6 +2720,21 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
   // 响应接收处理函数 recv_functionname & recv_functionname_sync
   f_service_h_ << endl << "private:" << endl;
   for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
+    if ((*f_iter)->is_stream()) {
+      t_type* ttype = (*f_iter)->get_returntype();
+      std::string item = (is_complex_type(ttype) ? "const " : "") + type_name(ttype)
+        + (is_complex_type(ttype) ? "&" : "") + " item";
+      f_service_h_ << indent() <<
+        "int32_t decode_" << (*f_iter)->get_name() << "_item(const uint8_t* buff, uint32_t buff_len, " <<
+        type_name(ttype) << "* item);" << endl;
+      f_service_h_ << indent() <<
+        "int32_t recv_" << (*f_iter)->get_name() << "_item(const uint8_t* buff, uint32_t buff_len, uint64_t session_id, " <<
+        "cxx::function<void(" << item << ")>& on_item, cxx::function<void(int32_t ret_code)>& on_end);" << endl;
+      f_service_h_ << indent() <<
+        "int32_t recv_" << (*f_iter)->get_name() << "_end(int32_t ret, const uint8_t* buff, uint32_t buff_len, " <<
+        "cxx::function<void(int32_t ret_code)>& on_end);" << endl;
+      continue;
+    }
     if (!(*f_iter)->is_oneway()) {
       // 参数定义
       std::string args = "int32_t ret, const uint8_t* buff, uint32_t buff_len";
@@ -2834,9 +2867,38 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
       endl;
   }
 
+  out << "int " << scope << "SetRetryPolicy(const pebble::RetryPolicy& policy, const char* method_name) {" << endl <<
+    indent(1) << "if (method_name != NULL && m_methods.find(method_name) == m_methods.end()) {" << endl <<
+    indent(2) << "return pebble::kRPC_UNSUPPORT_FUNCTION_NAME;" << endl <<
+    indent(1) << "}" << endl <<
+    endl;
+  if (!functions.empty()) {
+    out << indent(1) << "std::string name(method_name != NULL ? method_name : \"\");" << endl;
+  }
+  for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
+    out << indent(1) << "if (name.empty() || name == \"" << (*f_iter)->get_name() << "\") {" << endl <<
+      indent(2) << "m_client->SetRetryPolicy(\"" << service_name_ << ":" << (*f_iter)->get_name() << "\", policy);" << endl <<
+      indent(1) << "}" << endl;
+  }
+  out << endl;
+  if (tservice->get_extends() != NULL) {
+    // 父服务的方法由父类按父服务名设置
+    out << indent(1) << "return " << type_name(tservice->get_extends()) << client_suffix <<
+      "::SetRetryPolicy(policy, method_name);" << endl;
+  } else {
+    out << indent(1) << "return 0;" << endl;
+  }
+  out << "}" << endl <<
+    endl;
+
   for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
     string funname = (*f_iter)->get_name();
 
+    if ((*f_iter)->is_stream()) {
+      generate_stream_client_function(out, tservice, *f_iter, scope);
+      continue;
+    }
+
     // 同步接口实现
     indent(out) << function_signature_if(*f_iter, "", scope) << endl;
     scope_up(out);
@@ -2851,7 +2913,8 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
 
     out << indent() <<
         "::pebble::RpcHead head;" << endl << indent() <<
-        "head.m_function_name.assign(\"" << service_name_ << ":" << funname << "\");" << endl << indent();
+        "head.m_function_name.assign(\"" << service_name_ << ":" << funname << "\");" << endl << indent() <<
+        "head.m_function_id = " << rpc_function_id(service_name_ + ":" + funname) << "u;" << endl << indent();
     if (!(*f_iter)->is_oneway()) {
         out << "head.m_message_type = pebble::dr::protocol::T_CALL;" << endl << indent();
     } else {
@@ -2946,7 +3009,8 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
 
       out << indent() <<
           "::pebble::RpcHead head;" << endl << indent() <<
-          "head.m_function_name.assign(\"" << service_name_ << ":" << funname << "\");" << endl << indent();
+          "head.m_function_name.assign(\"" << service_name_ << ":" << funname << "\");" << endl << indent() <<
+        "head.m_function_id = " << rpc_function_id(service_name_ + ":" + funname) << "u;" << endl << indent();
       if (!(*f_iter)->is_oneway()) {
           out << "head.m_message_type = pebble::dr::protocol::T_CALL;" << endl << indent();
       } else {
@@ -3058,7 +3122,8 @@ void t_cpp_generator::generate_service_client(t_service* tservice, string style)
 
       out << indent() <<
           "::pebble::RpcHead head;" << endl << indent() <<
-          "head.m_function_name.assign(\"" << service_name_ << ":" << funname << "\");" << endl << indent();
+          "head.m_function_name.assign(\"" << service_name_ << ":" << funname << "\");" << endl << indent() <<
+        "head.m_function_id = " << rpc_function_id(service_name_ + ":" + funname) << "u;" << endl << indent();
       if (!(*f_iter)->is_oneway()) {
           out << "head.m_message_type = pebble::dr::protocol::T_CALL;" << endl << indent();
       } else {
@@ -3451,7 +3516,20 @@ void ProcessorGenerator::generate_class_definition() {
       "(const uint8_t* buff, uint32_t buff_len, " << endl << indent(1) <<
       "cxx::function<int32_t(int32_t ret, const uint8_t* buff, uint32_t buff_len)>& rsp);" << endl;
 
-    if (!(*f_iter)->is_oneway()) {
+    if ((*f_iter)->is_stream()) {
+      std::string type_const;
+      std::string type_ref;
+      if (generator_->is_complex_type((*f_iter)->get_returntype())) {
+        type_const = "const ";
+        type_ref   = "&";
+      }
+      indent(out) << "int32_t write_" << (*f_iter)->get_name() <<
+        "(uint64_t session_id" << endl << indent(1) <<
+        ", " << type_const << type_name((*f_iter)->get_returntype()) << type_ref << " item);" << endl;
+      indent(out) << "void finish_" << (*f_iter)->get_name() <<
+        "(cxx::function<int32_t(int32_t ret, const uint8_t* buff, uint32_t buff_len)>& rsp" << endl << indent(1) <<
+        ", int32_t ret_code);" << endl;
+    } else if (!(*f_iter)->is_oneway()) {
       string ret_arg = ", int32_t ret_code";
       if (!(*f_iter)->get_returntype()->is_void()) {
         std::string type_const = ", ";
@@ -3536,7 +3614,8 @@ void ProcessorGenerator::generate_register_service_function() {
 
     f_out_ <<
       indent() << "ret = m_server->AddOnRequestFunction(\"" << service_name_ <<
-      ":" << (*f_iter)->get_name() << "\", cb);" << endl;
+      ":" << (*f_iter)->get_name() << "\", " <<
+      t_generator::rpc_function_id(service_name_ + ":" + (*f_iter)->get_name()) << "u, cb);" << endl;
 
     f_out_ <<
       indent() << "if (ret != pebble::kRPC_SUCCESS) {" << endl <<
@@ -3566,7 +3645,9 @@ void ProcessorGenerator::generate_process_functions() {
   vector<t_function*>::iterator f_iter;
   for (f_iter = functions.begin(); f_iter != functions.end(); ++f_iter) {
       generator_->generate_process_function(service_, *f_iter, style_, false);
-      if (!(*f_iter)->is_oneway()) {
+      if ((*f_iter)->is_stream()) {
+        generator_->generate_stream_return_function(service_, *f_iter);
+      } else if (!(*f_iter)->is_oneway()) {
         generator_->generate_return_function(service_, *f_iter, style_, false);
       }
   }
@@ -3744,7 +3825,24 @@ void t_cpp_generator::generate_process_function(t_service* tservice,
       "}" << endl << endl;
 
   std::string cb_func;
-  if (!tfunction->is_oneway()) {
+  if (tfunction->is_stream()) {
+    std::string type_const;
+    std::string type_ref;
+    if (is_complex_type(tfunction->get_returntype())) {
+      type_const = "const ";
+      type_ref   = "&";
+    }
+    out << indent() <<
+      "cxx::function<int32_t(" << type_const << type_name(tfunction->get_returntype()) << type_ref << " item)> write =" << endl << indent(1) <<
+      "cxx::bind(&" << tservice->get_name() << "Handler::write_" << tfunction->get_name() << ", this," << endl << indent(2) <<
+      "m_server->GetStreamSessionId(), cxx::placeholders::_1);" << endl;
+    out << indent() <<
+      "cxx::function<void(int32_t ret_code)> finish =" << endl << indent(1) <<
+      "cxx::bind(&" << tservice->get_name() << "Handler::finish_" << tfunction->get_name() << ", this," << endl << indent(2) <<
+      "rsp, cxx::placeholders::_1);" << endl <<
+      endl;
+    cb_func = "write, finish";
+  } else if (!tfunction->is_oneway()) {
     if (!tfunction->get_returntype()->is_void()) {
       std::string type_const;
       std::string type_ref;
@@ -3874,6 +3972,215 @@ void t_cpp_generator::generate_return_function  (t_service* tservice, t_function
   out << endl;
 }
 
+/**
+ * Generates the client methods of a stream function: a sync method returning
+ * a coroutine iterator and an async method with per-item callbacks.
+ */
+void t_cpp_generator::generate_stream_client_function(std::ofstream& out, t_service* tservice,
+                                                      t_function* tfunction, string scope) {
+  string funname  = tfunction->get_name();
+  string argsname = tservice->get_name() + "_" + funname + "_pargs";
+  string resultname = tservice->get_name() + "_" + funname + "_presult";
+  t_type* ttype   = tfunction->get_returntype();
+  string item_type = type_name(ttype);
+  string item_arg  = (is_complex_type(ttype) ? "const " : "") + item_type
+    + (is_complex_type(ttype) ? "&" : "") + " item";
+  const vector<t_field*>& fields = tfunction->get_arglist()->get_members();
+  vector<t_field*>::const_iterator fld_iter;
+
+  // 同步和异步接口的请求编码相同，只有失败时的处理不同
+  for (int async = 0; async < 2; ++async) {
+    string fail_pre  = async ? "on_end(" : "return ";
+    string fail_post = async ? ");" : ";";
+
+    indent(out) << function_signature_if(tfunction, async ? "CobCl" : "", scope) << endl;
+    scope_up(out);
+
+    out << indent() << "::pebble::dr::protocol::TProtocol* encoder =" << endl << indent(1) <<
+      "m_client->GetCodec(pebble::PebbleRpc::kMALLOC);" << endl << indent() <<
+      "if (!encoder) {" << endl << indent(1) <<
+      fail_pre << "::pebble::kPEBBLE_RPC_UNKNOWN_CODEC_TYPE" << fail_post << endl;
+    if (async) {
+      out << indent(1) << "return;" << endl;
+    }
+    out << indent() << "}" << endl << endl;
+
+    out << indent() <<
+      "::pebble::RpcHead head;" << endl << indent() <<
+      "head.m_function_name.assign(\"" << service_name_ << ":" << funname << "\");" << endl << indent() <<
+      "head.m_function_id = " << rpc_function_id(service_name_ + ":" + funname) << "u;" << endl << indent() <<
+      "head.m_message_type = ::pebble::kRPC_STREAM_CALL;" << endl << indent() <<
+      "head.m_session_id = m_client->GenSessionId();" << endl << endl;
+
+    out << indent() << argsname << " args;" << endl;
+    for (fld_iter = fields.begin(); fld_iter != fields.end(); ++fld_iter) {
+      out <<
+        indent() << "args." << (*fld_iter)->get_name() << " = &" << (*fld_iter)->get_name() << ";" << endl;
+    }
+    out << endl;
+
+    out << indent() <<
+      "try {" << endl << indent(1) <<
+      "args.write(encoder);" << endl << indent(1) <<
+      "encoder->writeMessageEnd();" << endl << indent(1) <<
+      "encoder->getTransport()->writeEnd();" << endl << indent() <<
+      "} catch (pebble::TException ex) {" << endl << indent(1) <<
+      fail_pre << "pebble::kRPC_ENCODE_FAILED" << fail_post << endl;
+    if (async) {
+      out << indent(1) << "return;" << endl;
+    }
+    out << indent() << "}" << endl << endl;
+
+    out << indent() <<
+      "uint8_t* buff = NULL;" << endl << indent() <<
+      "uint32_t buff_len = 0;" << endl << indent() <<
+      "(static_cast<pebble::dr::transport::TMemoryBuffer*>(encoder->getTransport().get()))->" << endl << indent(1) <<
+      "getBuffer(&buff, &buff_len);" << endl <<
+      endl;
+
+    if (!async) {
+      out << indent() <<
+        "reader->SetDecoder(cxx::bind(&" << scope << "decode_" << funname << "_item, this," << endl << indent(1) <<
+        "cxx::placeholders::_1, cxx::placeholders::_2, cxx::placeholders::_3));" << endl << indent() <<
+        "return reader->Open(m_client, GetHandle(), head, buff, buff_len, m_methods[\"" << funname << "\"]);" << endl;
+    } else {
+      out << indent() <<
+        "pebble::OnRpcStream on_frame = cxx::bind(&" << scope << "recv_" << funname << "_item, this," << endl << indent(1) <<
+        "cxx::placeholders::_1, cxx::placeholders::_2, head.m_session_id, on_item, on_end);" << endl << indent() <<
+        "pebble::OnRpcResponse on_rsp = cxx::bind(&" << scope << "recv_" << funname << "_end, this," << endl << indent(1) <<
+        "cxx::placeholders::_1, cxx::placeholders::_2, cxx::placeholders::_3, on_end);" << endl << indent() <<
+        "int32_t ret = m_client->SendStreamRequest(GetHandle(), head, buff, buff_len, on_frame, on_rsp, m_methods[\"" <<
+        funname << "\"], 0);" << endl << indent() <<
+        "if (ret != pebble::kRPC_SUCCESS) {" << endl << indent(1) <<
+        "on_end(ret);" << endl << indent() <<
+        "}" << endl;
+    }
+
+    scope_down(out);
+    out << endl;
+  }
+
+  // 帧解码
+  out << indent() <<
+    "int32_t " << scope << "decode_" << funname << "_item(const uint8_t* buff, uint32_t buff_len, " <<
+    item_type << "* item)" << endl;
+  scope_up(out);
+  out << indent() <<
+    "::pebble::dr::protocol::TProtocol* decoder =" << endl << indent(1) <<
+    "m_client->GetCodec(pebble::PebbleRpc::kBORROW);" << endl << indent() <<
+    "if (!decoder) {" << endl << indent(1) <<
+    "return ::pebble::kPEBBLE_RPC_UNKNOWN_CODEC_TYPE;" << endl << indent() <<
+    "}" << endl << endl << indent() <<
+    "(static_cast<pebble::dr::transport::TMemoryBuffer*>(decoder->getTransport().get()))->" << endl << indent(1) <<
+    "resetBuffer(const_cast<uint8_t*>(buff), buff_len, ::pebble::dr::transport::TMemoryBuffer::OBSERVE);" << endl << endl;
+  out << indent() << resultname << " result;" << endl << indent() <<
+    "result.success = item;" << endl << indent() <<
+    "try {" << endl << indent(1) <<
+    "result.read(decoder);" << endl << indent(1) <<
+    "decoder->readMessageEnd();" << endl << indent(1) <<
+    "decoder->getTransport()->readEnd();" << endl << indent() <<
+    "} catch (pebble::TException ex) {" << endl << indent(1) <<
+    "return pebble::kRPC_DECODE_FAILED;" << endl << indent() <<
+    "}" << endl << endl << indent() <<
+    "if (!result.__isset.success) {" << endl << indent(1) <<
+    "return pebble::kPEBBLE_RPC_MISS_RESULT;" << endl << indent() <<
+    "}" << endl << endl << indent() <<
+    "return pebble::kRPC_SUCCESS;" << endl;
+  scope_down(out);
+  out << endl;
+
+  // 异步接口的帧回调，处理完后确认
+  out << indent() <<
+    "int32_t " << scope << "recv_" << funname << "_item(const uint8_t* buff, uint32_t buff_len, uint64_t session_id, " <<
+    "cxx::function<void(" << item_arg << ")>& on_item, cxx::function<void(int32_t ret_code)>& on_end)" << endl;
+  scope_up(out);
+  t_field itemfield(ttype, "item");
+  out << indent() << declare_field(&itemfield, true) << endl << indent() <<
+    "int32_t ret = decode_" << funname << "_item(buff, buff_len, &item);" << endl << indent() <<
+    "if (ret != pebble::kRPC_SUCCESS) {" << endl << indent(1) <<
+    "m_client->CancelRequest(session_id);" << endl << indent(1) <<
+    "on_end(ret);" << endl << indent(1) <<
+    "return ret;" << endl << indent() <<
+    "}" << endl << endl << indent() <<
+    "on_item(item);" << endl << indent() <<
+    "m_client->AckStream(session_id, 1);" << endl << indent() <<
+    "return pebble::kRPC_SUCCESS;" << endl;
+  scope_down(out);
+  out << endl;
+
+  out << indent() <<
+    "int32_t " << scope << "recv_" << funname << "_end(int32_t ret, const uint8_t* buff, uint32_t buff_len, " <<
+    "cxx::function<void(int32_t ret_code)>& on_end)" << endl;
+  scope_up(out);
+  out << indent() << "on_end(ret);" << endl << indent() <<
+    "return ret;" << endl;
+  scope_down(out);
+  out << endl;
+}
+
+/**
+ * Generates the write and finish functions of a stream function handler.
+ */
+void t_cpp_generator::generate_stream_return_function(t_service* tservice, t_function* tfunction) {
+  std::ofstream& out = f_service_cpp_;
+  string type_const;
+  string type_ref;
+  if (is_complex_type(tfunction->get_returntype())) {
+    type_const = "const ";
+    type_ref   = "&";
+  }
+
+  out <<
+    "int32_t " << tservice->get_name() << "Handler" <<
+    "::write_" << tfunction->get_name() << "(" << endl << indent(1) <<
+    "uint64_t session_id" << endl << indent(1) <<
+    ", " << type_const << type_name(tfunction->get_returntype()) << type_ref << " item)" << endl;
+  scope_up(out);
+
+  out << indent() <<
+    "::pebble::dr::protocol::TProtocol* encoder = m_server->GetCodec(pebble::PebbleRpc::kMALLOC);" << endl << indent() <<
+    "if (!encoder) {" << endl << indent(1) <<
+    "return pebble::kPEBBLE_RPC_UNKNOWN_CODEC_TYPE;" << endl << indent() <<
+    "}" << endl <<
+    endl;
+
+  out <<
+    indent() << tservice->get_name() + "_" + tfunction->get_name() << "_presult result;" << endl <<
+    indent() << "result.success = const_cast<" <<
+      type_name(tfunction->get_returntype()) << "*>(&item);" << endl <<
+    indent() << "result.__isset.success = true;" << endl;
+
+  out << endl << indent() <<
+    "try {" << endl << indent(1) <<
+    "result.write(encoder);" << endl << indent(1) <<
+    "encoder->writeMessageEnd();" << endl << indent(1) <<
+    "encoder->getTransport()->writeEnd();" << endl << indent() <<
+    "} catch (pebble::TException ex) {" << endl << indent(1) <<
+    "return pebble::kPEBBLE_RPC_ENCODE_BODY_FAILED;" << endl << indent() <<
+    "}" << endl << endl;
+
+  out << indent() <<
+    "uint8_t* buff = NULL;" << endl << indent() <<
+    "uint32_t buff_len = 0;" << endl << indent() <<
+    "(static_cast<pebble::dr::transport::TMemoryBuffer*>(encoder->getTransport().get()))->" << endl << indent(1) <<
+    "getBuffer(&buff, &buff_len);" << endl << endl << indent() <<
+    "// 窗口用完时在协程中等待调用方确认" << endl << indent() <<
+    "return m_server->SendStreamFrame(session_id, buff, buff_len);" << endl;
+
+  scope_down(out);
+  out << endl;
+
+  out <<
+    "void " << tservice->get_name() << "Handler" <<
+    "::finish_" << tfunction->get_name() << "(" << endl << indent(1) <<
+    "cxx::function<int32_t(int32_t ret, const uint8_t* buff, uint32_t buff_len)>& rsp" << endl << indent(1) <<
+    ", int32_t ret_code)" << endl;
+  scope_up(out);
+  out << indent() << "rsp(ret_code, NULL, 0);" << endl;
+  scope_down(out);
+  out << endl;
+}
+
 /**
  * Generates a skeleton file of a server
  *
@@ -4769,6 +5076,16 @@ std::string t_cpp_generator::function_signature_if(t_function* tfunction,
     }
   }
 
+  // 流式方法: 同步调用返回迭代器，异步调用逐个回调，服务端逐个写入后结束
+  if (tfunction->is_stream()) {
+    std::string item = type_const + ns_prefix + type_name(ttype) + type_ref + " item";
+    ret_sync   = "::pebble::RpcStreamReader< " + ns_prefix + type_name(ttype) + " >* reader";
+    ret_async  = "const cxx::function<void(" + item + ")>& on_item, "
+      "const cxx::function<void(int32_t ret_code)>& on_end";
+    ret_server = "cxx::function<int32_t(" + item + ")>& write, "
+      "cxx::function<void(int32_t ret_code)>& finish";
+  }
+
   // sync
   if (style == "") {
     if (!args.empty() && !ret_sync.empty()) {
@@ -250,6 +250,19 @@ class t_generator {
   }
 
  public:
+  /**
+   * Stable numeric id of a rpc function, FNV-1a hash of "Service:method".
+   * Must be kept in sync with pebble::IRpc::GenFunctionId, 0 is reserved as invalid.
+   */
+  static unsigned int rpc_function_id(const std::string& name) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < name.size(); ++i) {
+      hash ^= (unsigned char)name[i];
+      hash *= 16777619u;
+    }
+    return hash != 0 ? hash : 1;
+  }
+
   /**
    * Get the true type behind a series of typedefs.
    */
@@ -127,6 +127,12 @@ class t_function : public t_doc {
     return timeoutms;
   }
 
+  // 流式方法，服务端对一个请求返回多个响应帧，IDL中以(stream = "true")标注
+  bool is_stream() const {
+    std::map<std::string, std::string>::const_iterator it = annotations_.find("stream");
+    return annotations_.end() != it && ("true" == it->second || "1" == it->second);
+  }
+
   std::map<std::string, std::string> annotations_;
 
  private:
@@ -37,6 +37,19 @@ std::string FileNameIdentifier(const std::string& filename) {
     return result;
 }
 
+// 生成RPC函数的数字ID，算法需要和IRpc::GenFunctionId保持一致(FNV-1a)
+std::string FunctionId(const std::string& service, const std::string& method) {
+    std::string name = service + ":" + method;
+    unsigned int hash = 2166136261u;
+    for (unsigned i = 0; i < name.size(); i++) {
+        hash ^= static_cast<unsigned char>(name[i]);
+        hash *= 16777619u;
+    }
+    std::ostringstream out;
+    out << (hash != 0 ? hash : 1) << "u";
+    return out.str();
+}
+
 // 生成include信息
 void PrintIncludes(Printer* printer, const std::vector<std::string>& headers,
                    const Parameters& params) {
@@ -179,7 +192,17 @@ void PrintINHeaderClientMethod(
     } else if (method->ClientOnlyStreaming()) {
         printer->Print(*vars, "// TODO: ClientOnlyStreaming for $Method$\n");
     } else if (method->ServerOnlyStreaming()) {
-        printer->Print(*vars, "// TODO: ServerOnlyStreaming for $Method$\n");
+#ifndef __RPC_CLIENT__
+        // 同步
+        printer->Print(*vars,
+            "virtual int32_t $Method$(const $Request$& request,"
+            " ::pebble::RpcStreamReader< $Response$ >* reader) = 0;\n");
+#endif
+        // 异步
+        printer->Print(*vars,
+            "virtual void $Method$(const $Request$& request, "
+            "const cxx::function<void(const $Response$& item)>& on_item, "
+            "const cxx::function<void(int32_t ret_code)>& on_end) = 0;\n");
     } else if (method->BidiStreaming()) {
         printer->Print(*vars, "// TODO: BidiStreaming for $Method$\n");
     }
@@ -222,7 +245,19 @@ void PrintHeaderClientMethod(
         } else if (method->ClientOnlyStreaming()) {
             printer->Print(*vars, "// TODO: ClientOnlyStreaming for $Method$\n");
         } else if (method->ServerOnlyStreaming()) {
-            printer->Print(*vars, "// TODO: ServerOnlyStreaming for $Method$\n");
+#ifndef __RPC_CLIENT__
+            // 同步
+            printer->Print(*vars, "/* $Method$同步流式调用，需在协程中通过reader逐个读取响应，返回0时请求发送成功 */\n");
+            printer->Print(*vars,
+                "virtual int32_t $Method$(const $Request$& request,"
+                " ::pebble::RpcStreamReader< $Response$ >* reader);\n");
+#endif
+            // 异步
+            printer->Print(*vars, "/* $Method$异步流式调用，每收到一个响应回调on_item，结束时回调on_end，0为成功，非0失败 */\n");
+            printer->Print(*vars,
+                "virtual void $Method$(const $Request$& request, "
+                "const cxx::function<void(const $Response$& item)>& on_item, "
+                "const cxx::function<void(int32_t ret_code)>& on_end);\n");
         } else if (method->BidiStreaming()) {
             printer->Print(*vars, "// TODO: BidiStreaming for $Method$\n");
         }
@@ -242,7 +277,15 @@ void PrintHeaderClientMethod(
         } else if (method->ClientOnlyStreaming()) {
             printer->Print(*vars, "// TODO: ClientOnlyStreaming for $Method$\n");
         } else if (method->ServerOnlyStreaming()) {
-            printer->Print(*vars, "// TODO: ServerOnlyStreaming for $Method$\n");
+            printer->Print(*vars,
+                "int32_t decode_$Method$_item(const uint8_t* buff, uint32_t buff_len, $Response$* item);\n");
+            printer->Print(*vars,
+                "int32_t recv_$Method$_item(const uint8_t* buff, uint32_t buff_len, uint64_t session_id,"
+                " cxx::function<void(const $Response$& item)>& on_item,"
+                " cxx::function<void(int32_t ret_code)>& on_end);\n");
+            printer->Print(*vars,
+                "int32_t recv_$Method$_end(int32_t ret, const uint8_t* buff, uint32_t buff_len,"
+                " cxx::function<void(int32_t ret_code)>& on_end);\n");
         } else if (method->BidiStreaming()) {
             printer->Print(*vars, "// TODO: BidiStreaming for $Method$\n");
         }
@@ -274,7 +317,11 @@ void PrintHeaderServerMethod(
     } else if (method->ClientOnlyStreaming()) {
         printer->Print(*vars, "// TODO: ClientOnlyStreaming for $Method$\n");
     } else if (method->ServerOnlyStreaming()) {
-        printer->Print(*vars, "// TODO: ServerOnlyStreaming for $Method$\n");
+        printer->Print(*vars, "/* 通过write逐个发送响应，调用方窗口用完时write在协程中等待，最后必须调用finish结束 */\n");
+        printer->Print(*vars,
+            "virtual void $Method$(const $Request$& request,"
+            " cxx::function<int32_t(const $Response$& item)>& write,"
+            " cxx::function<void(int32_t ret_code)>& finish) = 0;\n");
     } else if (method->BidiStreaming()) {
         printer->Print(*vars, "// TODO: BidiStreaming for $Method$\n");
     }
@@ -298,7 +345,14 @@ void PrintINHeaderServerMethod(
     } else if (method->ClientOnlyStreaming()) {
         printer->Print(*vars, "// TODO: ClientOnlyStreaming for $Method$\n");
     } else if (method->ServerOnlyStreaming()) {
-        printer->Print(*vars, "// TODO: ServerOnlyStreaming for $Method$\n");
+        printer->Print(*vars,
+            "int32_t process_$Method$(const uint8_t* buff, uint32_t buff_len,"
+            " cxx::function<int32_t(int32_t ret, const uint8_t* buff, uint32_t buff_len)>& rsp);\n");
+        printer->Print(*vars,
+            "int32_t write_$Method$(uint64_t session_id, const $Response$& item);\n");
+        printer->Print(*vars,
+            "void finish_$Method$(cxx::function<int32_t(int32_t ret, const uint8_t* buff, uint32_t buff_len)>& rsp,"
+            " int32_t ret_code);\n");
     } else if (method->BidiStreaming()) {
         printer->Print(*vars, "// TODO: BidiStreaming for $Method$\n");
     }
@@ -422,6 +476,8 @@ void PrintHeaderService(Printer* printer, const Service* service,
 #endif
     printer->Print("/* 设置RPC请求超时时间(单位ms)，未指定方法名时对所有方法生效，指定方法名时只对指定方法生效，默认的超时时间为10s */\n");
     printer->Print("int SetTimeout(uint32_t timeout_ms, const char* method_name = NULL);\n\n");
+    printer->Print("/* 设置RPC自动重试策略，只能用于幂等方法，未指定方法名时对所有方法生效，@see pebble::RetryPolicy */\n");
+    printer->Print("int SetRetryPolicy(const pebble::RetryPolicy& policy, const char* method_name = NULL);\n\n");
 
     printer->Outdent();
 
@@ -640,9 +696,154 @@ std::string GetSourceIncludes(File* file, const Parameters& params) {
     return output;
 }
 
+// 生成一对多流式方法的客户端接口实现
+void PrintSourceClientStreamMethod(Printer* printer, const Method* method,
+                                   std::map<std::string, std::string>* vars, bool is_public) {
+    (*vars)["Method"] = method->name();
+    (*vars)["Request"] = method->input_type_name();
+    (*vars)["Response"] = method->output_type_name();
+    (*vars)["FunctionId"] = FunctionId((*vars)["Service"], method->name());
+
+    if (is_public) {
+#ifndef __RPC_CLIENT__
+        // 同步调用，请求发送后由reader在协程中逐个读取响应
+        printer->Print(*vars, "int32_t $Service$Client::$Method$("
+            "const $Request$& request, ::pebble::RpcStreamReader< $Response$ >* reader) {\n");
+        printer->Indent();
+
+        printer->Print("::pebble::RpcHead __head;\n");
+        printer->Print(*vars, "__head.m_function_name.assign(\"$Service$:$Method$\");\n");
+        printer->Print(*vars, "__head.m_function_id = $FunctionId$;\n");
+        printer->Print("__head.m_message_type = ::pebble::kRPC_STREAM_CALL;\n");
+        printer->Print("__head.m_session_id = m_imp->m_client->GenSessionId();\n\n");
+
+        printer->Print("int __size = request.ByteSize();\n");
+        printer->Print("uint8_t* __buff = m_imp->m_client->GetBuffer(__size);\n");
+        printer->Print("if (__buff == NULL) {\n");
+        printer->Indent();
+        printer->Print("return ::pebble::kPEBBLE_RPC_INSUFFICIENT_MEMORY;\n");
+        printer->Outdent();
+        printer->Print("}\n\n");
+
+        printer->Print("if (!request.SerializeToArray(__buff, __size)) {\n");
+        printer->Indent();
+        printer->Print("return ::pebble::kRPC_ENCODE_FAILED;\n");
+        printer->Outdent();
+        printer->Print("}\n\n");
+
+        printer->Print(*vars, "reader->SetDecoder(cxx::bind(&$Service$ClientImp::decode_$Method$_item, m_imp,\n");
+        printer->Print("    cxx::placeholders::_1, cxx::placeholders::_2, cxx::placeholders::_3));\n");
+        printer->Print(*vars, "return reader->Open(m_imp->m_client, m_imp->GetHandle(), __head, __buff, __size, m_imp->m_methods[\"$Method$\"]);\n");
+
+        printer->Outdent();
+        printer->Print("}\n\n");
+#endif
+        // 异步调用
+        printer->Print(*vars,
+            "void $Service$Client::$Method$(const $Request$& request, "
+            "const cxx::function<void(const $Response$& item)>& on_item, "
+            "const cxx::function<void(int32_t ret_code)>& on_end) {\n");
+        printer->Indent();
+
+        printer->Print("::pebble::RpcHead __head;\n");
+        printer->Print(*vars, "__head.m_function_name.assign(\"$Service$:$Method$\");\n");
+        printer->Print(*vars, "__head.m_function_id = $FunctionId$;\n");
+        printer->Print("__head.m_message_type = ::pebble::kRPC_STREAM_CALL;\n");
+        printer->Print("__head.m_session_id = m_imp->m_client->GenSessionId();\n\n");
+
+        printer->Print("int __size = request.ByteSize();\n");
+        printer->Print("uint8_t* __buff = m_imp->m_client->GetBuffer(__size);\n");
+        printer->Print("if (__buff == NULL) {\n");
+        printer->Indent();
+        printer->Print("on_end(::pebble::kPEBBLE_RPC_INSUFFICIENT_MEMORY);\n");
+        printer->Print("return;\n");
+        printer->Outdent();
+        printer->Print("}\n\n");
+
+        printer->Print("if (!request.SerializeToArray(__buff, __size)) {\n");
+        printer->Indent();
+        printer->Print("on_end(::pebble::kRPC_ENCODE_FAILED);\n");
+        printer->Print("return;\n");
+        printer->Outdent();
+        printer->Print("}\n\n");
+
+        printer->Print(*vars, "::pebble::OnRpcStream on_frame = cxx::bind(&$Service$ClientImp::recv_$Method$_item, m_imp,\n");
+        printer->Print("    cxx::placeholders::_1, cxx::placeholders::_2, __head.m_session_id, on_item, on_end);\n");
+        printer->Print(*vars, "::pebble::OnRpcResponse on_rsp = cxx::bind(&$Service$ClientImp::recv_$Method$_end, m_imp,\n");
+        printer->Print("    cxx::placeholders::_1, cxx::placeholders::_2, cxx::placeholders::_3, on_end);\n");
+        printer->Print(*vars, "int32_t __ret = m_imp->m_client->SendStreamRequest(m_imp->GetHandle(), __head, __buff, __size, on_frame, on_rsp, m_imp->m_methods[\"$Method$\"], 0);\n");
+        printer->Print("if (__ret != ::pebble::kRPC_SUCCESS) {\n");
+        printer->Indent();
+        printer->Print("on_end(__ret);\n");
+        printer->Outdent();
+        printer->Print("}\n");
+
+        printer->Outdent();
+        printer->Print("}\n\n");
+
+    } else {
+        // 响应帧解码
+        printer->Print(*vars,
+            "int32_t $Service$ClientImp::decode_$Method$_item(const uint8_t* buff, uint32_t buff_len,"
+            " $Response$* item) {\n");
+        printer->Indent();
+
+        printer->Print("if (!item->ParseFromArray((const void*)buff, buff_len)) {\n");
+        printer->Indent();
+        printer->Print("return ::pebble::kRPC_DECODE_FAILED;\n");
+        printer->Outdent();
+        printer->Print("}\n\n");
+        printer->Print("return ::pebble::kRPC_SUCCESS;\n");
+
+        printer->Outdent();
+        printer->Print("}\n\n");
+
+        // 异步调用响应帧处理，处理完后确认，解码失败时取消整个流
+        printer->Print(*vars,
+            "int32_t $Service$ClientImp::recv_$Method$_item(const uint8_t* buff, uint32_t buff_len, uint64_t session_id,"
+            " cxx::function<void(const $Response$& item)>& on_item,"
+            " cxx::function<void(int32_t ret_code)>& on_end) {\n");
+        printer->Indent();
+
+        printer->Print(*vars, "$Response$ __item;\n");
+        printer->Print(*vars, "int32_t __ret = decode_$Method$_item(buff, buff_len, &__item);\n");
+        printer->Print("if (__ret != ::pebble::kRPC_SUCCESS) {\n");
+        printer->Indent();
+        printer->Print("m_client->CancelRequest(session_id);\n");
+        printer->Print("on_end(__ret);\n");
+        printer->Print("return __ret;\n");
+        printer->Outdent();
+        printer->Print("}\n\n");
+
+        printer->Print("on_item(__item);\n");
+        printer->Print("m_client->AckStream(session_id, 1);\n");
+        printer->Print("return ::pebble::kRPC_SUCCESS;\n");
+
+        printer->Outdent();
+        printer->Print("}\n\n");
+
+        // 异步调用结束处理
+        printer->Print(*vars,
+            "int32_t $Service$ClientImp::recv_$Method$_end(int32_t ret, const uint8_t* buff, uint32_t buff_len,"
+            " cxx::function<void(int32_t ret_code)>& on_end) {\n");
+        printer->Indent();
+
+        printer->Print("on_end(ret);\n");
+        printer->Print("return ret;\n");
+
+        printer->Outdent();
+        printer->Print("}\n\n");
+    }
+}
+
 // 生成客户端接口实现
 void PrintSourceClientMethod(Printer* printer, const Method* method,
                              std::map<std::string, std::string>* vars, bool is_public) {
+    if (method->ServerOnlyStreaming()) {
+        PrintSourceClientStreamMethod(printer, method, vars, is_public);
+        return;
+    }
+
     if (!method->NoStreaming()) {
         printer->Print("// TODO: unsupport Streaming Method.");
         return;
@@ -651,6 +852,7 @@ void PrintSourceClientMethod(Printer* printer, const Method* method,
     (*vars)["Method"] = method->name();
     (*vars)["Request"] = method->input_type_name();
     (*vars)["Response"] = method->output_type_name();
+    (*vars)["FunctionId"] = FunctionId((*vars)["Service"], method->name());
 
     if (is_public) {
 #ifndef __RPC_CLIENT__
@@ -661,6 +863,7 @@ void PrintSourceClientMethod(Printer* printer, const Method* method,
 
         printer->Print("::pebble::RpcHead __head;\n");
         printer->Print(*vars, "__head.m_function_name.assign(\"$Service$:$Method$\");\n");
+        printer->Print(*vars, "__head.m_function_id = $FunctionId$;\n");
         printer->Print("__head.m_message_type = ::pebble::kRPC_CALL;\n");
         printer->Print("__head.m_session_id = m_imp->m_client->GenSessionId();\n\n");
 
@@ -702,6 +905,7 @@ void PrintSourceClientMethod(Printer* printer, const Method* method,
 
         printer->Print("::pebble::RpcHead __head;\n");
         printer->Print(*vars, "__head.m_function_name.assign(\"$Service$:$Method$\");\n");
+        printer->Print(*vars, "__head.m_function_id = $FunctionId$;\n");
         printer->Print("__head.m_message_type = ::pebble::kRPC_CALL;\n");
         printer->Print("__head.m_session_id = m_imp->m_client->GenSessionId();\n\n");
 
@@ -745,6 +949,7 @@ void PrintSourceClientMethod(Printer* printer, const Method* method,
 
         printer->Print("::pebble::RpcHead __head;\n");
         printer->Print(*vars, "__head.m_function_name.assign(\"$Service$:$Method$\");\n");
+        printer->Print(*vars, "__head.m_function_id = $FunctionId$;\n");
         printer->Print("__head.m_message_type = ::pebble::kRPC_CALL;\n");
         printer->Print("__head.m_session_id = m_imp->m_client->GenSessionId();\n\n");
 
@@ -873,9 +1078,79 @@ void PrintSourceClientMethod(Printer* printer, const Method* method,
     }
 }
 
+// 生成一对多流式方法的服务端接口实现
+void PrintSourceServerStreamMethod(Printer* printer, const Method* method,
+                                   std::map<std::string, std::string>* vars) {
+    (*vars)["Method"] = method->name();
+    (*vars)["Request"] = method->input_type_name();
+    (*vars)["Response"] = method->output_type_name();
+
+    printer->Print(*vars,
+        "int32_t __$Service$Skeleton::process_$Method$(const uint8_t* buff, uint32_t buff_len,"
+        " cxx::function<int32_t(int32_t ret, const uint8_t* buff, uint32_t buff_len)>& rsp) {\n");
+    printer->Indent();
+
+    printer->Print(*vars, "$Request$ __request;\n");
+    printer->Print("if (!__request.ParseFromArray((const void*)buff, buff_len)) {\n");
+    printer->Indent();
+    printer->Print("rsp(::pebble::kPEBBLE_RPC_DECODE_BODY_FAILED, NULL, 0);\n");
+    printer->Print("return ::pebble::kPEBBLE_RPC_DECODE_BODY_FAILED;\n");
+    printer->Outdent();
+    printer->Print("}\n\n");
+
+    printer->Print(*vars, "cxx::function<int32_t(const $Response$& item)> __write =\n");
+    printer->Print(*vars, "    cxx::bind(&__$Service$Skeleton::write_$Method$, this,\n");
+    printer->Print("        m_server->GetStreamSessionId(), cxx::placeholders::_1);\n");
+    printer->Print("cxx::function<void(int32_t ret_code)> __finish =\n");
+    printer->Print(*vars, "    cxx::bind(&__$Service$Skeleton::finish_$Method$, this,\n");
+    printer->Print("        rsp, cxx::placeholders::_1);\n\n");
+
+    printer->Print(*vars, "m_iface->$Method$(__request, __write, __finish);\n\n");
+    printer->Print("return ::pebble::kRPC_SUCCESS;\n");
+
+    printer->Outdent();
+    printer->Print("}\n\n");
+
+    printer->Print(*vars,
+        "int32_t __$Service$Skeleton::write_$Method$(uint64_t session_id, const $Response$& item) {\n");
+    printer->Indent();
+
+    printer->Print("int __size = item.ByteSize();\n");
+    printer->Print("uint8_t* __buff = m_server->GetBuffer(__size);\n");
+    printer->Print("if (__buff == NULL) {\n");
+    printer->Indent();
+    printer->Print("return ::pebble::kPEBBLE_RPC_INSUFFICIENT_MEMORY;\n");
+    printer->Outdent();
+    printer->Print("}\n\n");
+
+    printer->Print("if (!item.SerializeToArray(__buff, __size)) {\n");
+    printer->Indent();
+    printer->Print("return ::pebble::kPEBBLE_RPC_ENCODE_BODY_FAILED;\n");
+    printer->Outdent();
+    printer->Print("}\n\n");
+
+    printer->Print("return m_server->SendStreamFrame(session_id, __buff, __size);\n");
+
+    printer->Outdent();
+    printer->Print("}\n\n");
+
+    printer->Print(*vars,
+        "void __$Service$Skeleton::finish_$Method$(cxx::function<int32_t(int32_t ret, const uint8_t* buff, uint32_t buff_len)>& rsp,"
+        " int32_t ret_code) {\n");
+    printer->Indent();
+    printer->Print("rsp(ret_code, NULL, 0);\n");
+    printer->Outdent();
+    printer->Print("}\n\n");
+}
+
 // 生成服务端接口实现
 void PrintSourceServerMethod(Printer* printer, const Method* method,
                              std::map<std::string, std::string>* vars) {
+    if (method->ServerOnlyStreaming()) {
+        PrintSourceServerStreamMethod(printer, method, vars);
+        return;
+    }
+
     if (!method->NoStreaming()) {
         printer->Print("// TODO: unsupport Streaming Method.");
         return;
@@ -1002,6 +1277,28 @@ void PrintSourceService(Printer* printer, const Service* service,
     printer->Outdent();
     printer->Print("}\n\n");
 
+    printer->Print(*vars, "int $Service$Client::SetRetryPolicy(const pebble::RetryPolicy& policy, const char* method_name) {\n");
+    printer->Indent();
+    printer->Print("if (method_name != NULL && m_imp->m_methods.find(method_name) == m_imp->m_methods.end()) {\n");
+    printer->Indent();
+    printer->Print("return pebble::kRPC_UNSUPPORT_FUNCTION_NAME;\n");
+    printer->Outdent();
+    printer->Print("}\n\n");
+    if (service->method_count() > 0) {
+        printer->Print("std::string name(method_name != NULL ? method_name : \"\");\n");
+    }
+    for (int i = 0; i < service->method_count(); ++i) {
+        (*vars)["Method"] = service->method(i)->name();
+        printer->Print(*vars, "if (name.empty() || name == \"$Method$\") {\n");
+        printer->Indent();
+        printer->Print(*vars, "m_imp->m_client->SetRetryPolicy(\"$Service$:$Method$\", policy);\n");
+        printer->Outdent();
+        printer->Print("}\n");
+    }
+    printer->Print("\nreturn 0;\n");
+    printer->Outdent();
+    printer->Print("}\n\n");
+
     for (int i = 0; i < service->method_count(); ++i) {
         PrintSourceClientMethod(printer, service->method(i).get(), vars, true);
     }
@@ -1060,9 +1357,10 @@ void PrintSourceService(Printer* printer, const Service* service,
 
     for (int i = 0; i < service->method_count(); ++i) {
         (*vars)["Method"] = service->method(i)->name();
+        (*vars)["FunctionId"] = FunctionId((*vars)["Service"], service->method(i)->name());
         printer->Print(*vars, "cb = cxx::bind(&__$Service$Skeleton::process_$Method$, this,\n");
         printer->Print("    cxx::placeholders::_1, cxx::placeholders::_2, cxx::placeholders::_3);\n");
-        printer->Print(*vars, "ret = m_server->AddOnRequestFunction(\"$Service$:$Method$\", cb);\n");
+        printer->Print(*vars, "ret = m_server->AddOnRequestFunction(\"$Service$:$Method$\", $FunctionId$, cb);\n");
         printer->Print("if (ret != ::pebble::kRPC_SUCCESS) {\n");
         printer->Indent();
         printer->Print("return ret;\n");
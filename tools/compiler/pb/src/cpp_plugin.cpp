@@ -43,7 +43,7 @@ public:
     // PB v3 支持4种请求响应模型: 一对一、一对多、多对一、多对多
     bool NoStreaming() const { // 一对一
         // return !method_->client_streaming() && !method_->server_streaming();
-        return true; // default
+        return !ServerOnlyStreaming(); // default
     }
 
     bool ClientOnlyStreaming() const { // 多对一
@@ -53,7 +53,8 @@ public:
 
     bool ServerOnlyStreaming() const { // 一对多
         // return !method_->client_streaming() && method_->server_streaming();
-        return false; // pb 2.x unsupport
+        // pb 2.x 没有stream关键字，通过方法注释中的@stream标记
+        return GetLeadingComments().find("@stream") != std::string::npos;
     }
 
     bool BidiStreaming() const { // 多对多